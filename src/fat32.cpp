@@ -1,1643 +1,6570 @@
-#include "fat32.h"
+#include "volume.h"
 
 using namespace FAT_FS;
 
+/**
+ * Describe Status
+ * Description: Turns the result of a library call on an entry into the
+ *				message the commands print. kind names what was looked up
+ *				or made.
+ */
+const string FAT_FS::describe( Status status, const string & name, const string & kind ) {
+
+	switch ( status ) {
+
+		case STATUS_OK: return "success.";
+		case STATUS_INVALID_NAME: return kind + " name may not be empty or contain /.";
+		case STATUS_NOT_FOUND: return name + " not found.";
+		case STATUS_NOT_A_FILE: return name + " is not a file.";
+		case STATUS_NOT_A_DIRECTORY: return name + " is not a directory.";
+		case STATUS_INVALID_MODE: return "mode must be either r, w, rw, a, ra. Writable modes may end in b to buffer writes.";
+		case STATUS_ALREADY_OPEN: return name + " already open.";
+		case STATUS_BAD_HANDLE: return name + " is not an open handle.";
+		case STATUS_NOT_OPEN: return name + " not found in the open file table.";
+		case STATUS_NOT_READABLE: return name + " not open for reading.";
+		case STATUS_OUT_OF_RANGE: return "start pos is past the end of " + name + ". Note: start pos is zero-based.";
+		case STATUS_NO_SPACE: return "not enough space left for " + name + ".";
+		case STATUS_WRITES_LOST: return "not enough space left to flush " + name + ", buffered writes were lost.";
+		case STATUS_NAME_TOO_LONG: return kind + " name must be less than 256 characters.";
+		case STATUS_PATH_TOO_LONG: return "total path length must be less than 260 characters.";
+		case STATUS_RESERVED_NAME: return ". and .. cannot be used here.";
+		case STATUS_EXISTS: return kind + " " + name + " already exists.";
+		case STATUS_NOT_EMPTY: return kind + " " + name + " is not empty.";
+		case STATUS_NOT_WRITABLE: return name + " not open for writing.";
+		case STATUS_TOO_LARGE: return name + " can't grow any larger.";
+		case STATUS_NO_SUCH_JOB: return "no background delete " + name + ".";
+		case STATUS_IO_ERROR: return "I/O error on " + name + ".";
+
+		case STATUS_ILLEGAL_CHARACTER:
+
+			// Point out the first offending character
+			for ( uint32_t i = 0; i < name.length(); i++ )
+				if ( name[i] < ' ' || strchr( "\"*/:<>?\\|", name[i] ) != NULL )
+					return "illegal character (" + name.substr( i, 1 ) + ") in " + kind + " name.";
+
+			return "illegal character in " + kind + " name.";
+
+		case STATUS_TOO_MANY_WORKERS: {
+
+			stringstream message;
+			message << "at most " << IO_WORKERS_MAX << " I/O workers are allowed.";
+			return message.str();
+		}
+	}
+
+	return "unknown status.";
+}
+
 /**
  * FAT32 Public Methods
+ * Description: Each one hands its call to the volume, with the session's
+ *				state or NULL for the commands' one.
  */
 
 /**
  * FAT32 Constructor
- * Description: Initializes a FAT32 object reading in file system info as
- *				well as finding currently free clusters.
+ * Description: Mounts the image.
  */
-FAT32::FAT32( fstream & fatImage ) : fatImage( fatImage ) {
-
-	// Read BIOS Parameter Block
-	this->fatImage.seekg( 0 );
-	this->fatImage.read( reinterpret_cast<char *>( &this->bpb ), sizeof( this->bpb ) );
-
-	// Read FSInfo
-	this->fatImage.seekg( this->bpb.FSInfo * this->bpb.bytesPerSector );
-	this->fatImage.read( reinterpret_cast<char *>( &this->fsInfo ), sizeof( this->fsInfo ) );
+FAT32::FAT32( fstream & fatImage, const string & imagePath, const string & sidecarPath ) {
 
-	this->firstDataSector = this->bpb.reservedSectorCount + ( this->bpb.numFATs * this->bpb.FATSz32 );
-	this->fatLocation = this->bpb.reservedSectorCount * this->bpb.bytesPerSector;
-	this->bytesPerCluster = this->bpb.sectorsPerCluster * this->bpb.bytesPerSector;
-
-	// Read in fat
-	// Note: The extra 2 entries allocated are for the reserved clusters which the countOfClusters formula 
-	// 		 doesn't account for
-	this->countOfClusters = ( ( this->bpb.totalSectors32 - this->firstDataSector ) / this->bpb.sectorsPerCluster );
-	this->fat = new uint32_t[this->countOfClusters + 2];
-	this->fatImage.seekg( this->fatLocation );
-	this->fatImage.read( reinterpret_cast<char *>( this->fat ), ( this->countOfClusters + 2 ) *  FAT_ENTRY_SIZE );
-
-	// Find free clusters
-	// Note: We ignore the 2 reserved clusters and therefore also check the last 2
-	uint32_t entry;
-	uint32_t range = this->countOfClusters + 2;
-	for ( uint32_t i = 2; i < range; i++ )
-		if ( isFreeCluster( ( entry = getFATEntry( i ) ) ) )
-			this->freeClusters.push_back( i );
-
-	// Position ourselves in root directory
-	this->currentDirectoryFirstCluster = this->bpb.rootCluster;
-	this->currentDirectoryListing = getDirectoryListing( this->currentDirectoryFirstCluster );
+	this->volume = new Volume( fatImage, imagePath, sidecarPath );
 }
 
 /**
  * FAT32 Destructor
+ * Description: Unmounts the image, anything still buffered goes out first.
  */
 FAT32::~FAT32() {
 
-	// Cleanup
-	delete[] this->fat;
+	delete this->volume;
 }
 
 /**
- * Get Current Path
- * Description: Builds and returns a / separated path to the
- *				current directory.
+ * State of Session
+ * Description: Returns the state behind a session, starting it first if it
+ *				never was, or NULL for the commands' one.
  */
-const string FAT32::getCurrentPath() const {
+SessionState * FAT32::stateOf( Session * session ) {
 
-	string path = "/";
+	if ( session == NULL )
+		return NULL;
 
-	for ( uint32_t i = 0; i < this->currentPath.size(); i++ )
-		path += this->currentPath[i] + "/";
+	if ( !session->state )
+		startSession( *session );
 
-	return path;
+	return session->state.get();
 }
 
-/**
- * Commands
- */
-
-/**
- * FS Info
- * Description: Prints out info for the loaded FAT32 FS.
- */
-void FAT32::fsinfo() const {
+const string FAT32::getCurrentPath( const Session * session ) const {
 
-	// + used to promote type to a printable number
-	cout << "Bytes per sector: " << this->bpb.bytesPerSector
-		 << "\nSectors per cluster: " << +this->bpb.sectorsPerCluster
-		 << "\nTotal sectors: " << this->bpb.totalSectors32
-		 << "\nNumber of FATs: " << +this->bpb.numFATs
-		 << "\nSectors per FAT: " << this->bpb.FATSz32
-		 << "\nNumber of free sectors: " << this->freeClusters.size() * this->bpb.sectorsPerCluster
-		 << "\n";
+	return this->volume->getCurrentPath( session == NULL ? NULL : session->state.get() );
 }
 
 /**
- * Open File
- * Description: Attempts to open a file in the currrent directory 
- *				with r, w, or rw permissions and places it in
- *				the open file table.
+ * Is Valid Open Mode
+ * Description: Checks if a given file open mode is valid, returning its mode
+ *				bits or 0.
  */
-void FAT32::open( const string & fileName, const string & openMode ) {
+uint8_t FAT32::isValidOpenMode( const string & openMode ) const {
 
-	uint8_t mode;
+	uint8_t result = 0, buffered = 0;
+	string base = openMode;
 
-	// Validate openMode
-	if ( ( mode = isValidOpenMode( openMode ) ) == 0 ) {
+	// A trailing b asks for write-behind buffering
+	if ( base.length() > 1 && base[ base.length() - 1 ] == 'b' ) {
 
-		cout << "error: mode must be either r, w, rw.\n";
-		return;
+		base.erase( base.length() - 1 );
+		buffered = BUFFERED;
 	}
 
-	uint32_t index;
+	if ( base.compare( "r" ) == 0 )
+		result = READ;
+
+	else if ( base.compare( "w" ) == 0 )
+		result = WRITE;
 
-	// Try and find file
-	if ( findFile( fileName, index ) ) {
+	else if ( base.compare( "rw" ) == 0 )
+		result = READWRITE;
 
-		// Attempt to add file to open file table
-		if ( this->openFiles.find( this->currentDirectoryListing[index] ) == this->openFiles.end() ) {
+	else if ( base.compare( "a" ) == 0 )
+		result = WRITE|APPEND;
 
-			this->openFiles[ this->currentDirectoryListing[index] ] = mode;
-			cout << fileName << " has been opened with " << this->modeToString( mode ) << " permission.\n";
-		}
+	else if ( base.compare( "ra" ) == 0 )
+		result = READWRITE|APPEND;
 
-		// File is already open
-		else {
+	// Only writes are buffered
+	if ( buffered && !( result & WRITE ) )
+		return 0;
 
-			cout << "error: " << fileName << " already open.\n";
-			return;
-		}
-	}
+	return result | buffered;
 }
 
 /**
- * Close File
- * Description: Attempts to close a file that's in the current directory
- *				and open file table.
+ * File Open Mode to String
+ * Description: Converts an open mode to a representative string.
  */
-void FAT32::close( const string & fileName ) {
+const string FAT32::modeToString( const uint8_t & mode ) const {
 
-	uint32_t index;
+	string result = ( mode & BUFFERED ) ? "buffered " : "";
 
-	// Try and find file
-	if ( findFile( fileName, index ) ) {
+	switch ( mode & ~BUFFERED ) {
 
-		// Attempt to remove file from open file table
-		if ( this->openFiles.find( this->currentDirectoryListing[index] ) != this->openFiles.end() ) {
+		case READ: return result + "reading";
+		case WRITE: return result + "writing";
+		case READWRITE: return result + "reading and writing";
+		case WRITE|APPEND: return result + "appending";
+		case READWRITE|APPEND: return result + "reading and appending";
+	}
 
-			this->openFiles.erase( this->currentDirectoryListing[index] );
-			cout << fileName << " is now closed.\n";
-		}
+	return "invalid mode";
+}
 
-		// File isn't in the table
-		else {
+void FAT32::startSession( Session & session ) {
 
-			cout << "error: " << fileName << " not found in the open file table.\n";
-			return;
-		}
-	}
+	session.state = make_shared<SessionState>();
+	this->volume->startSession( *session.state );
+	this->volume->trackSession( session.state );
 }
 
-/**
- * Create File
- * Description: Attempts to create a file in the current directory.
- */
-void FAT32::create( const string & fileName ) {
+Status FAT32::changeDirectory( const string & directoryName, Session * session ) {
 
-	if ( !fileExists( fileName ) ) {
+	return this->volume->changeDirectory( directoryName, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-		DirectoryEntry entry;
+Status FAT32::stat( const string & entryName, EntryInfo & info, Session * session ) {
 
-		if ( makeFile( fileName, entry, false  ) ) {
+	return this->volume->stat( entryName, info, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-			addFile( entry );
+Status FAT32::list( const string & directoryName, vector<EntryInfo> & entries, Session * session ) {
 
-			this->currentDirectoryListing = getDirectoryListing( this->currentDirectoryFirstCluster );
-		}
-	}
+	return this->volume->list( directoryName, entries, this->volume->sessionOf( stateOf( session ) ) );
 }
 
-/**
- * Read File
- * Description: Attempts to read a file if it's in the open file table. Reads
- *				the file starting at startPos and reads up to numBytes.
- */
-void FAT32::read( const string & fileName, uint32_t startPos, uint32_t numBytes ) {
+Status FAT32::fileSize( const string & fileName, uint32_t & bytes, Session * session ) {
 
-	uint32_t index;
+	return this->volume->fileSize( fileName, bytes, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-	// Try and find file
-	if ( findFile( fileName, index ) ) {
+Status FAT32::openFile( const string & fileName, uint8_t mode, uint32_t & handle, Session * session ) {
 
-		DirectoryEntry file = this->currentDirectoryListing[index];
+	return this->volume->openFile( fileName, mode, handle, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-		// Check if file is already open
-		if ( this->openFiles.find( file ) != this->openFiles.end() ) {
+Status FAT32::closeFile( const string & fileName, Session * session ) {
 
-			// Check permissions
-			if ( this->openFiles[file] == READ || this->openFiles[file] == READWRITE ) {
+	return this->volume->closeFile( fileName, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-				// Read file contents
-				vector<uint32_t> clusterChain;
-				uint8_t * contents = getFileContents( formCluster( file.shortEntry ), clusterChain );
+Status FAT32::readInto( const string & fileName, uint32_t startPos, uint8_t * buffer, uint32_t length, uint32_t & bytesRead, Session * session ) {
 
-				// Validate startPos against size
-				if ( startPos >= file.shortEntry.fileSize )
-					cout << "error: start_pos (" << startPos << ") greater than or equal to file size (" 
-						<< file.shortEntry.fileSize << "). Note: start_pos is zero-based.\n";
+	return this->volume->readInto( fileName, startPos, buffer, length, bytesRead, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-				// Otherwise print file contents up to numBytes
-				else
-					for ( uint32_t i = 0; i < numBytes && startPos + i < file.shortEntry.fileSize; i++ )
-						cout << contents[ startPos + i ];
+void FAT32::fsinfo( FileSystemInfo & info ) const {
 
-				delete[] contents;
-			
-			} else {
+	this->volume->fsinfo( info );
+}
 
-				cout << "error: " << fileName << " not open for reading.\n";
-				return;
-			} 
-		}
+Status FAT32::create( const string & fileName, Session * session ) {
 
-		else {
+	vector<Status> results;
+	Status status = create( vector<string>( 1, fileName ), results, session );
 
-			cout << "error: " << fileName << " not found in the open file table.\n";
-			return;
-		}
-	}
+	return status == STATUS_OK ? results[0] : status;
 }
 
-/**
- * Write to File
- * Description: Attempts to write quotedData to a given file name at a certain
- *				starting position. Resizes file if necessary.
- */
-void FAT32::write( const string & fileName, uint32_t startPos, const string & quotedData ) {
+Status FAT32::create( const vector<string> & fileNames, vector<Status> & results, Session * session ) {
 
-	uint32_t index;
+	return this->volume->create( fileNames, results, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-	// Try and find file
-	if ( findFile( fileName, index ) ) {
+Status FAT32::read( const string & fileName, uint32_t startPos, uint32_t numBytes, const ReadOutput & output, Session * session ) {
 
-		DirectoryEntry file = this->currentDirectoryListing[index];
+	return this->volume->read( fileName, startPos, numBytes, output, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-		// Check if file is already open
-		if ( this->openFiles.find( file ) != this->openFiles.end() ) {
+Status FAT32::read( const string & fileName, uint32_t numBytes, const ReadOutput & output, Session * session ) {
 
-			// Check permissions
-			if ( this->openFiles[file] == WRITE || this->openFiles[file] == READWRITE ) {
+	return this->volume->read( fileName, numBytes, output, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-				// Get current file contents
-				vector<uint32_t> clusterChain;
-				uint8_t * contents = getFileContents( formCluster( file.shortEntry ), clusterChain );
+Status FAT32::write( const string & fileName, uint32_t startPos, const string & data, Session * session ) {
 
-				uint32_t requiredSize = startPos + quotedData.length(),
-					     currentSize = file.shortEntry.fileSize == 0 ? 0 : ( clusterChain.size() * this->bytesPerCluster );
+	return this->volume->write( fileName, startPos, data, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-			    // Check if we need to resize the file
-				if ( requiredSize > currentSize ) {
+Status FAT32::write( const string & fileName, const string & data, Session * session ) {
 
-					uint32_t clustersNeeded = ceil( static_cast<double>( requiredSize - currentSize ) / this->bytesPerCluster );
+	return this->volume->write( fileName, data, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-					// Check if we have enough free space left or if the file has reached its max size
-					if ( this->freeClusters.size() < clustersNeeded 
-							|| ( static_cast<uint64_t>( currentSize ) + ( clustersNeeded * this->bytesPerCluster ) ) > FILE_MAX_SIZE ) {
+Status FAT32::append( const string & fileName, const string & data, Session * session ) {
 
-						cout << "Not enough space left to write to file.\n";
-						return;
-					}
+	return this->volume->append( fileName, data, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-					else 
-						contents = resize( clustersNeeded, clusterChain );
-				}
+Status FAT32::rm( const string & fileName, bool safe, Session * session ) {
 
-				// Need to update file info in case of crash
-				file.shortEntry.firstClusterHI = ( clusterChain[0] >> 16 );
-				file.shortEntry.firstClusterLO = ( clusterChain[0] & 0x0000FFFF );
-				file.shortEntry.fileSize += requiredSize;
-				file.shortEntry.attributes |= ATTR_ARCHIVE;
-				this->fatImage.seekp( file.shortEntry.location );
-				this->fatImage.write( reinterpret_cast<char *>( &file.shortEntry ), DIR_ENTRY_SIZE );
-				this->fatImage.flush();
-
-				// Also update our temporary listing
-				currentDirectoryListing[index].shortEntry.fileSize += requiredSize;
-				currentDirectoryListing[index].shortEntry.firstClusterHI = ( clusterChain[0] >> 16 );
-				currentDirectoryListing[index].shortEntry.firstClusterLO = ( clusterChain[0] & 0x0000FFFF );
-
-				// Write Data
-				for ( uint32_t i = 0; i < quotedData.length(); i++ )
-				 		contents[ startPos + i ] = quotedData[i];
-
-				// Flush to disk
-				writeFileContents( contents, clusterChain );
-				this->fatImage.flush();
-
-				delete[] contents;
-			
-			} else {
+	return this->volume->rm( fileName, safe, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-				cout << "error: " << fileName << " not open for writing.\n";
-				return;
-			} 
-		}
+Status FAT32::mkdir( const string & directoryName, Session * session ) {
 
-		else {
+	vector<Status> results;
+	Status status = mkdir( vector<string>( 1, directoryName ), results, session );
 
-			cout << "error: " << fileName << " not found in the open file table.\n";
-			return;
-		}
-	}
+	return status == STATUS_OK ? results[0] : status;
 }
 
-/**
- * Remove File
- * Description: Attempts to remove a file (User Facing Function).
- */
-void FAT32::rm( const string & fileName, bool safe ) {
+Status FAT32::mkdir( const vector<string> & directoryNames, vector<Status> & results, Session * session ) {
 
-	uint32_t index;
+	return this->volume->mkdir( directoryNames, results, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-	// Try and find file
-	if ( findFile( fileName, index ) ) {
+Status FAT32::rmdir( const string & directoryName, Session * session ) {
 
-		// Remove it from the open file table if it's there
-		if ( this->openFiles.find( this->currentDirectoryListing[index] ) != this->openFiles.end() )
-			this->openFiles.erase( this->currentDirectoryListing[index] );
+	return this->volume->rmdir( directoryName, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-		DirectoryEntry file = this->currentDirectoryListing[index];
+Status FAT32::rmTree( const string & directoryName, Session * session ) {
 
-		removeEntry( file, index, safe );
-	}
+	return this->volume->rmTree( directoryName, this->volume->sessionOf( stateOf( session ) ) );
 }
 
-/**
- * Change Directory
- * Description: Attempts to change to a directory within the current directory.
- */
-void FAT32::cd( const string & directoryName ) {
+Status FAT32::du( const string & path, UsageTotals & totals, Session * session ) {
 
-	uint32_t index;
+	return this->volume->du( path, totals, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-	// Try and find directory
-	if ( findDirectory( directoryName, index ) ) {
+Status FAT32::find( const string & path, const string & pattern, const FindOutput & output, Session * session ) {
 
-		// Check special case of .. directory and root
-		if ( directoryName.compare( ".." ) == 0 && formCluster( currentDirectoryListing[index].shortEntry ) == 0 ) {
+	return this->volume->find( path, pattern, output, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-			this->currentPath.clear();
-			this->currentDirectoryFirstCluster = this->bpb.rootCluster;
-			this->currentDirectoryListing = getDirectoryListing( this->bpb.rootCluster );
+Status FAT32::prealloc( const string & fileName, uint32_t numBytes, bool keepSize, Reservation & reservation, Session * session ) {
 
-		} else {
+	return this->volume->prealloc( fileName, numBytes, keepSize, reservation, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-			// .. means we are going up a directory
-			if ( directoryName.compare( ".." ) == 0 )
-				this->currentPath.pop_back();
+Status FAT32::defrag( const string & entryName, uint32_t budget, DefragReport & report, Session * session ) {
 
-			// Don't add . to currentPath
-			else if ( directoryName.compare( "." ) != 0 )
-				this->currentPath.push_back( directoryName );
+	return this->volume->defrag( entryName, budget, report, this->volume->sessionOf( stateOf( session ) ) );
+}
 
-			this->currentDirectoryFirstCluster = formCluster( currentDirectoryListing[index].shortEntry );
-			this->currentDirectoryListing = getDirectoryListing( this->currentDirectoryFirstCluster );
-		}		
-	}
+Status FAT32::check( bool repair, CheckReport & report ) {
+
+	return this->volume->check( repair, report );
 }
 
-/**
- * List Files
- * Description: Lists all files in either the current directory or 
- *				given directory if it exists.
- */
-void FAT32::ls( const string & directoryName ) const {
+Status FAT32::sync() {
 
-	vector<DirectoryEntry> listing = currentDirectoryListing;
+	return this->volume->sync();
+}
 
-	// Check if we should list files of a given directory
-	if ( !directoryName.empty() ) {
+void FAT32::trim( bool enable ) {
 
-		uint32_t index;
+	this->volume->trim( enable );
+}
 
-		// Try and find directory
-		if ( findDirectory( directoryName, index ) )
-			listing = getDirectoryListing( formCluster( currentDirectoryListing[index].shortEntry ) );
+void FAT32::jobs( vector<JobInfo> & jobs ) {
 
-		// Directory not found
-		else
-			return;
-	}
+	this->volume->jobs( jobs );
+}
 
-	// Print directory contents
-	for ( uint32_t i = 0; i < listing.size(); i++ )
-		cout << listing[i].name << " ";
+Status FAT32::cancel( uint32_t id, JobInfo & job ) {
 
-	cout << "\n";
+	return this->volume->cancel( id, job );
 }
 
-/**
- * Make Directory
- * Description: Creates a directory (like a file) and places
- *				. and .. entries in it.
- */
-void FAT32::mkdir( const string & directoryName ) {
+Status FAT32::workers( uint32_t count ) {
 
-	// See if directory already exists
-	if ( !directoryExists( directoryName ) ) {
+	return this->volume->workers( count );
+}
 
-		DirectoryEntry entry;
+/**
+ * Volume Methods
+ */
 
-		if ( makeFile( directoryName, entry, true ) ) {
+/**
+ * Volume Constructor
+ * Description: Initializes a volume reading in file system info as
+ *				well as finding currently free clusters.
+ */
+Volume::Volume( fstream & fatImage, const string & imagePath, const string & sidecarPath ) : fatImage( fatImage ) {
+
+	// Once the boot sector, FSInfo and FAT are in, all image I/O is positional
+	// on this descriptor through the block cache
+	this->imageDescriptor = ::open( imagePath.c_str(), O_RDWR );
+	this->trimOnDelete = false;
+	this->nextJobId = 1;
+	this->stopping = false;
+	this->sidecarPath = sidecarPath;
+	this->sidecarLoaded = false;
+	this->sidecarGeneration = 0;
+	this->prefetchGeneration = 0;
+	this->promisedClusters = 0;
+	this->pool.resize( max( thread::hardware_concurrency(), static_cast<uint32_t>( 1 ) ) );
 
-			// Add directory to current directory
-			addFile( entry );
+	// Read BIOS Parameter Block
+	this->fatImage.seekg( 0 );
+	this->fatImage.read( reinterpret_cast<char *>( &this->bpb ), sizeof( this->bpb ) );
 
-			// Refresh directory
-			this->currentDirectoryListing = getDirectoryListing( this->currentDirectoryFirstCluster );
+	// Read FSInfo
+	this->fatImage.seekg( this->bpb.FSInfo * this->bpb.bytesPerSector );
+	this->fatImage.read( reinterpret_cast<char *>( &this->fsInfo ), sizeof( this->fsInfo ) );
 
-			// Get our newly added entry
-			uint32_t index;
-			findDirectory( entry.name, index );
+	this->firstDataSector = this->bpb.reservedSectorCount + ( this->bpb.numFATs * this->bpb.FATSz32 );
+	this->fatLocation = this->bpb.reservedSectorCount * this->bpb.bytesPerSector;
+	this->bytesPerCluster = this->bpb.sectorsPerCluster * this->bpb.bytesPerSector;
 
-			DirectoryEntry directory = this->currentDirectoryListing[index];
+	// Map in fat, only the pages something looks at are ever read. The
+	// mapping is private so changes reach the image through storeFAT alone,
+	// hosts that can't map the image get it read in whole
+	// Note: The extra 2 entries allocated are for the reserved clusters which the countOfClusters formula 
+	// 		 doesn't account for
+	this->countOfClusters = ( ( this->bpb.totalSectors32 - this->firstDataSector ) / this->bpb.sectorsPerCluster );
 
-			vector<uint32_t> clusterChain;
+	uint64_t fatBytes = static_cast<uint64_t>( this->countOfClusters + 2 ) * FAT_ENTRY_SIZE,
+			 pageOffset = this->fatLocation % sysconf( _SC_PAGESIZE );
 
-			// Resize this directory to 1 cluster since it's new
-			clusterChain.push_back( 0 );
-			uint8_t * contents = resize( 1, clusterChain );	
-			delete[] contents;
+	this->fatMappingLength = fatBytes + pageOffset;
+	this->fatMapping = this->imageDescriptor < 0 ? MAP_FAILED
+					 : mmap( NULL, this->fatMappingLength, PROT_READ | PROT_WRITE, MAP_PRIVATE, this->imageDescriptor, this->fatLocation - pageOffset );
 
-			// Need to update file info in case of crash
-			directory.shortEntry.firstClusterHI = ( clusterChain[0] >> 16 );
-			directory.shortEntry.firstClusterLO = ( clusterChain[0] & 0x0000FFFF );
-			this->fatImage.seekp( directory.shortEntry.location );
-			this->fatImage.write( reinterpret_cast<char *>( &directory.shortEntry ), DIR_ENTRY_SIZE );
-			this->fatImage.flush();
+	if ( this->fatMapping != MAP_FAILED )
+		this->fat = reinterpret_cast<uint32_t *>( static_cast<uint8_t *>( this->fatMapping ) + pageOffset );
 
-			// Also update our temporary listing
-			currentDirectoryListing[index].shortEntry.firstClusterHI = ( clusterChain[0] >> 16 );
-			currentDirectoryListing[index].shortEntry.firstClusterLO = ( clusterChain[0] & 0x0000FFFF );
+	else {
 
-			// Temporarily change directories for adding dot and dotdot
-			vector<DirectoryEntry> savedDirectoryListing = this->currentDirectoryListing;
-			uint32_t savedCurrentDirectoryFirstCluster = this->currentDirectoryFirstCluster;
+		this->fatMapping = NULL;
+		this->fat = new uint32_t[this->countOfClusters + 2];
+		this->fatImage.seekg( this->fatLocation );
+		this->fatImage.read( reinterpret_cast<char *>( this->fat ), fatBytes );
+	}
 
-			this->currentDirectoryFirstCluster = formCluster( directory.shortEntry );
-			this->currentDirectoryListing = getDirectoryListing( this->currentDirectoryFirstCluster );
+	this->fatStale = false;
 
-			// Setup dot directory
-			uint8_t dotName[11] = { '.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ' };
-			DirectoryEntry dot;
-			memcpy( dot.shortEntry.name, dotName, DIR_Name_LENGTH );
-			dot.shortEntry.attributes = ATTR_DIRECTORY;
-			dot.shortEntry.fileSize = 0;
-			dot.shortEntry.createdTimeTenth = directory.shortEntry.createdTimeTenth;
-			dot.shortEntry.createdTime = directory.shortEntry.createdTime;
-			dot.shortEntry.createdDate = directory.shortEntry.createdDate;
-			dot.shortEntry.lastAccessDate = directory.shortEntry.lastAccessDate;
-			dot.shortEntry.writeTime = directory.shortEntry.writeTime;
-			dot.shortEntry.writeDate = directory.shortEntry.writeDate;
-			dot.shortEntry.firstClusterLO = directory.shortEntry.firstClusterLO;
-			dot.shortEntry.firstClusterHI = directory.shortEntry.firstClusterHI;
+	// Data region goes through the block cache from here on
+	this->cache.configure( this->imageDescriptor, static_cast<uint64_t>( this->firstDataSector ) * this->bpb.bytesPerSector,
+						   this->bytesPerCluster, BLOCK_CACHE_SIZE );
 
-			// Setup dotdot directory
-			uint8_t dotdotName[11] = { '.', '.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ' };
-			DirectoryEntry dotdot;
-			memcpy( dotdot.shortEntry.name, dotdotName, DIR_Name_LENGTH );
-			dotdot.shortEntry.attributes = ATTR_DIRECTORY;
-			dotdot.shortEntry.fileSize = 0;
-			dotdot.shortEntry.createdTimeTenth = directory.shortEntry.createdTimeTenth;
-			dotdot.shortEntry.createdTime = directory.shortEntry.createdTime;
-			dotdot.shortEntry.createdDate = directory.shortEntry.createdDate;
-			dotdot.shortEntry.lastAccessDate = directory.shortEntry.lastAccessDate;
-			dotdot.shortEntry.writeTime = directory.shortEntry.writeTime;
-			dotdot.shortEntry.writeDate = directory.shortEntry.writeDate;
+	// Count free clusters, the FAT itself serves as the free map. A sidecar
+	// that still matches the image already knows the count, and then no
+	// part of the FAT needs reading yet
+	// Note: We ignore the 2 reserved clusters and therefore also check the last 2
+	uint32_t range = this->countOfClusters + 2;
 
-			// Root directory must always have cluster values of 0
-			dotdot.shortEntry.firstClusterLO = savedCurrentDirectoryFirstCluster == this->bpb.rootCluster ?
-													0 :
-													savedCurrentDirectoryFirstCluster & 0x0000FFFF;
+	if ( this->sidecarPath.empty() || !loadSidecar() ) {
 
-			dotdot.shortEntry.firstClusterHI = savedCurrentDirectoryFirstCluster == this->bpb.rootCluster ?
-													0 :
-													savedCurrentDirectoryFirstCluster >> 16;
+		this->fsInfo.freeCount = 0;
+		for ( uint32_t i = 2; i < range; i++ )
+			if ( isFreeCluster( getFATEntry( i ) ) )
+				this->fsInfo.freeCount++;
+	}
 
-			// Add files to directory
-			addFile( dot );
+	// nextFree is only a hint and may be unknown (0xFFFFFFFF) or stale
+	if ( this->fsInfo.nextFree < 2 || this->fsInfo.nextFree >= range )
+		this->fsInfo.nextFree = 2;
 
-			addFile( dotdot );
+	this->mountFreeCount = this->fsInfo.freeCount;
 
-			// Restore old directory listing
-			this->currentDirectoryFirstCluster = savedCurrentDirectoryFirstCluster;
-			this->currentDirectoryListing = savedDirectoryListing;
-		}
-	}
+	// Position ourselves in root directory
+	this->treeVersion = 0;
+	this->changingSession = &this->console;
+	startSession( this->console );
 }
 
 /**
- * Remove Directory
- * Description: Atempts to remove an empty directory from the
- *				current directory.
+ * Volume Destructor
  */
-void FAT32::rmdir( const string & directoryName ) {
+Volume::~Volume() {
 
-	// Don't let anyone remove . or .. manually
-	if ( directoryName.compare(".") == 0 || directoryName.compare("..") == 0 ) {
+	// Anything still buffered goes out, the image is written through our
+	// own descriptor so the stream may already be closed
+	sync();
 
-		cout << "error: . and .. cannot be removed.\n";
-		return;
+	// Let background deletes finish so no chain is left half reclaimed
+	waitForDeletes();
+
+	// Every helper checks stopping under its own lock
+	{
+		lock_guard<mutex> jobs( this->jobLock );
+		lock_guard<mutex> prefetches( this->prefetchLock );
+		lock_guard<mutex> flushes( this->flushLock );
+
+		this->stopping = true;
+		this->prefetchQueue.clear();
 	}
 
-	uint32_t index;
+	this->jobReady.notify_all();
+	this->prefetchReady.notify_all();
+	this->flushReady.notify_all();
 
-	if ( findDirectory( directoryName, index ) ) {
+	if ( this->reclaimThread.joinable() )
+		this->reclaimThread.join();
 
-		vector<DirectoryEntry> listing = getDirectoryListing( formCluster( this->currentDirectoryListing[index].shortEntry ) );
+	if ( this->prefetchThread.joinable() )
+		this->prefetchThread.join();
 
-		// Check if directory is empty
-		bool empty = true;
-		for ( uint32_t i = 0; i < listing.size(); i++ )	{
+	if ( this->flushThread.joinable() )
+		this->flushThread.join();
 
-			if ( listing[i].name.compare( "." ) != 0 && listing[i].name.compare( ".." ) != 0   ) {
+	// Dirty clusters land before the sidecar records the image's state, an
+	// image that refused some of them doesn't match what we hold
+	bool flushed = this->cache.flush();
 
-				empty = false;
-				break;
-			}
-		}
+	if ( this->fatStale )
+		flushed &= storeFAT( 0, 0 );
 
-		if ( empty ) 
-			removeEntry( this->currentDirectoryListing[index], index, false );
+	// Next mount can skip the scan as long as nobody touches the image
+	if ( flushed && !this->sidecarPath.empty() && this->imageDescriptor >= 0 )
+		saveSidecar();
 
-		else {
+	// Cleanup
+	if ( this->fatMapping != NULL )
+		munmap( this->fatMapping, this->fatMappingLength );
 
-			cout << "error: directory not empty.\n";
-			return;
-		}
-	}
+	else
+		delete[] this->fat;
+
+	if ( this->imageDescriptor >= 0 )
+		::close( this->imageDescriptor );
 }
 
 /**
- * Size of File
- * Description: Attempts to print the size of the file or directory given. 
+ * Session Of
+ * Description: Returns the session a call works in, the commands' own one
+ *				when it's NULL.
  */
-void FAT32::size( const string & fileName ) const {
+SessionState & Volume::sessionOf( SessionState * session ) {
 
-	uint32_t index;
-
-	// Try and find entry
-	if ( findFile( fileName, index ) )
-		cout << this->currentDirectoryListing[index].shortEntry.fileSize << " bytes.\n";
+	return session == NULL ? this->console : *session;
 }
 
 /**
- * FAT32 Private Methods
+ * Get Current Path
+ * Description: Builds and returns a / separated path to the
+ *				current directory of a session, or of the commands.
  */
+const string Volume::getCurrentPath( const SessionState * session ) const {
 
-/**
- * Add File
- * Description: Adds file to current directory.
- */
-void FAT32::addFile( DirectoryEntry & entry ) {
+	const vector<string> & names = session == NULL ? this->console.path : session->path;
+	string path = "/";
 
-	// Read file contents
-	vector<uint32_t> clusterChain;
-	uint8_t * contents = getFileContents( this->currentDirectoryFirstCluster, clusterChain );
+	for ( uint32_t i = 0; i < names.size(); i++ )
+		path += names[i] + "/";
 
-	// Look for enough free entries
-	uint32_t size = clusterChain.size() * this->bytesPerCluster,
-	         start = 0,
-		     entriesNeeded = entry.longEntries.size() + 1;
+	return path;
+}
 
-	bool blockFound = false;
+/**
+ * Library Calls
+ */
 
-	// Parse contents
-	uint32_t count = 0;
-	for ( uint32_t i = 0; i < size; i += DIR_ENTRY_SIZE ) {
+/**
+ * Start Session
+ * Description: Sets up a session in the root directory.
+ */
+void Volume::startSession( SessionState & session ) {
 
-		uint8_t ordinal = contents[i];
+	shared_lock<shared_mutex> reader( shareTree() );
 
-		// Check if not free entry
-		if ( ordinal == DIR_FREE_ENTRY ) {
+	session.path.clear();
+	session.directoryCluster = this->bpb.rootCluster;
+	session.readable = false;
+	refreshSession( session );
+}
 
-			count++;
+/**
+ * Track Session
+ * Description: Remembers a session started through the library so it can
+ *				be moved along with its directory. Forgets sessions nothing
+ *				holds anymore.
+ */
+void Volume::trackSession( const shared_ptr<SessionState> & session ) {
 
-			// Start tracking block
-			if ( i > start && count == 1 ) 
-				start = i;
+	lock_guard<mutex> lock( this->sessionLock );
 
-			// Check if we have space
-			if ( count == entriesNeeded ) {
+	for ( uint32_t i = 0; i < this->sessions.size(); )
+		if ( this->sessions[i].expired() ) {
 
-				blockFound = true;
-				break;
-			}
-        }
-        else if (ordinal == DIR_LAST_FREE_ENTRY) {
-            if (start == 0) {
-                start = i;
-            }
-            
-            count = (size - start) / DIR_ENTRY_SIZE;
-            if (count >= entriesNeeded) {
-                blockFound = true;
-                break;
-            }
-        }
-		// Contiguous block broken
-        else if ( count > 0 ) {
-
-			// Reset
-			count = 0;
-			blockFound = false;
-		}
-			
-	}
+			this->sessions[i] = this->sessions.back();
+			this->sessions.pop_back();
 
-	uint32_t currentPosition = start;
+		} else
+			i++;
 
-	// Check if we need to resize
-	if ( !blockFound ) {
+	this->sessions.push_back( session );
+}
+
+/**
+ * Change Directory
+ * Description: Moves a session into a directory within its current
+ *				directory. .. of a top level directory leads to the root.
+ */
+Status Volume::changeDirectory( const string & directoryName, SessionState & active ) {
 
-		uint32_t clustersNeeded;
-		clustersNeeded = ceil( static_cast<double>( entriesNeeded ) / ( this->bytesPerCluster / DIR_ENTRY_SIZE ) );
-		currentPosition = size;
+	shared_lock<shared_mutex> reader( shareTree() );
 
-		// Check if we have enough space in the file system
-		if ( this->freeClusters.size() < clustersNeeded 
-			|| ( size + ( clustersNeeded * this->bytesPerCluster ) ) > DIR_MAX_SIZE ) {
+	refreshSession( active );
 
-			cout << "Not enough space left to create file.\n";
-			return;
-		}
+	uint32_t index;
+	Status status = locateDirectory( active, directoryName, index );
 
-		// Otherwise resize
-		else {
+	if ( status != STATUS_OK )
+		return status;
 
-			delete[] contents;
-			contents = resize( clustersNeeded, clusterChain );
+	uint32_t cluster = formCluster( active.listing[index].shortEntry );
+	bool root = directoryName.compare( ".." ) == 0 && cluster == 0;
 
-			// Mark last contiguous free spot to newly allocated as free
-			if ( start != 0 )
-				for ( uint32_t i = start; i < size; i += DIR_ENTRY_SIZE )
-					contents[i] = DIR_FREE_ENTRY;
+	// Stay put if the new directory can't be read
+	DirectoryListing listing;
 
-			size = clusterChain.size() * this->bytesPerCluster;
-		}
-	}
+	if ( !getIndexedDirectoryListing( root ? this->bpb.rootCluster : cluster, listing ) )
+		return STATUS_IO_ERROR;
 
-	// Write new entries to contents
+	// Check special case of .. directory and root
+	if ( root ) {
 
-	// Write long entries
-	for ( uint8_t i = 0; i < entry.longEntries.size(); i++ ) {
+		active.path.clear();
+		cluster = this->bpb.rootCluster;
 
-		memcpy( contents + currentPosition, &entry.longEntries[i], sizeof( entry.longEntries[i] ) - sizeof( uint32_t ) );
-		currentPosition += DIR_ENTRY_SIZE;
-	}
+	// .. means we are going up a directory
+	} else if ( directoryName.compare( ".." ) == 0 )
+		active.path.pop_back();
 
-	// Write Short Entry
-	memcpy( contents + currentPosition, &entry.shortEntry, sizeof( entry.shortEntry ) - sizeof( uint32_t ) );
+	// Don't add . to the path
+	else if ( directoryName.compare( "." ) != 0 )
+		active.path.push_back( directoryName );
 
-	// Flush to disk
-	writeFileContents( contents, clusterChain );
-	this->fatImage.flush();
+	active.directoryCluster = cluster;
+	active.listing = listing;
 
-	delete[] contents;
+	return STATUS_OK;
 }
 
 /**
- * Append Long Name
- * Description: Appends a LongDirectoryEntry's name to a string currently
- *				being built to represent the full name.
+ * Stat Entry
+ * Description: Fills in info for a file or directory in a session's
+ *				directory.
  */
-void FAT32::appendLongName( string & current, uint16_t * name, uint32_t size ) const {
+Status Volume::stat( const string & entryName, EntryInfo & info, SessionState & active ) {
 
-	// Iterate through name
-	for ( uint32_t i = 0; i < size; i++ ) {
+	shared_lock<shared_mutex> reader( shareTree() );
 
-		// Check if current character is padding space or null terminator
-		if ( name[i] == LONG_NAME_TRAIL || name[i] == LONG_NAME_NULL )
-			break;
+	refreshSession( active );
 
-		// Otherwise add it to our string being built
-		else {
+	uint32_t index;
+	Status status = locateEntry( active, entryName, index );
 
-			char temp = *(name + i);
-			current += temp;
-		}
-	}
+	if ( status != STATUS_OK )
+		return status;
+
+	const ShortDirectoryEntry & shortEntry = active.listing[index].shortEntry;
+
+	info.name = entryName;
+	info.size = shortEntry.fileSize;
+	info.firstCluster = formCluster( shortEntry );
+	info.directory = isDirectory( shortEntry );
+
+	return STATUS_OK;
 }
 
 /**
- * Calculate Checksum
- * Description: Uses the checksum algorithm from the specification
- *				to calculate a checksum on a shortname to be placed
- *				in Long Directory entries.
+ * List Directory
+ * Description: Collects every entry of either a session's directory or a
+ *				directory within it, streamed straight off the image.
  */
-inline uint8_t FAT32::calculateChecksum( const uint8_t * shortName ) const {
+Status Volume::list( const string & directoryName, vector<EntryInfo> & entries, SessionState & active ) {
 
-	uint8_t sum = 0;
+	shared_lock<shared_mutex> reader( shareTree() );
 
-	for ( uint8_t i = 0; i < DIR_Name_LENGTH; i++ )
-		sum = ( ( sum & 1 ) ? 0x80 : 0 ) + ( sum >> 1 ) + shortName[i];
+	refreshSession( active );
 
-	return sum;
-}
+	uint32_t cluster = active.directoryCluster;
 
-/**
- * Calculate Directory Entry Location
- * Description: Calculates exact byte location of a given directory entries relative byte
- *				to the directory with the cluster chain associated with it
- */
-inline uint32_t FAT32::calculateDirectoryEntryLocation( uint32_t byte, vector<uint32_t> clusterChain ) const {
+	// Check if we should list files of a given directory
+	if ( !directoryName.empty() ) {
 
-	return ( this->getFirstDataSectorOfCluster( 
-				clusterChain[ byte / this->bytesPerCluster ] ) * this->bpb.bytesPerSector 
-		   ) + ( byte % this->bytesPerCluster );
-}
+		uint32_t index;
+		Status status = locateDirectory( active, directoryName, index );
 
-/**
- * Convert Long Name Segment
- * Description: Takes a piece of a given long name and sticks it 
- *				into one of a Long Directory's name fields.
- */
-void FAT32::convertLongNameSegment( uint16_t * nameInStruct, uint8_t length, uint8_t & charLeft, bool & nullStored,
-									 const string & name ) const {
+		if ( status != STATUS_OK )
+			return status;
 
-	for ( uint8_t i = 0; i < length; i++ ) {
+		cluster = formCluster( active.listing[index].shortEntry );
+	}
 
-		if ( charLeft != 0 )
-			nameInStruct[i] = name[ name.length() - charLeft-- ];
+	DirectoryCursor cursor;
+	openDirectory( cluster, cursor );
 
-		else if ( !nullStored ) {
+	while ( nextDirectoryEntry( cursor ) ) {
 
-			nullStored = true;
-			nameInStruct[i] = LONG_NAME_NULL;
-		}
+		EntryInfo info;
+		info.name = entryName( cursor );
+		info.size = cursor.shortEntry.fileSize;
+		info.firstCluster = formCluster( cursor.shortEntry );
+		info.directory = isDirectory( cursor.shortEntry );
 
-		else
-			nameInStruct[i] = LONG_NAME_TRAIL;
+		entries.push_back( info );
 	}
 
+	return cursor.failed ? STATUS_IO_ERROR : STATUS_OK;
 }
 
 /**
- * Convert Short Name
- * Description: Converts a ShortEntry's name to a string. Also accounts
- *				for the implied '.'.
+ * Size of File
+ * Description: Sets bytes to the size of a file in a session's directory.
  */
-const string FAT32::convertShortName( uint8_t * name ) const {
+Status Volume::fileSize( const string & fileName, uint32_t & bytes, SessionState & active ) {
 
-	string result = "";
-	bool trailFound = false;
-	bool connectionComplete = false;
+	shared_lock<shared_mutex> reader( shareTree() );
 
+	refreshSession( active );
 
-	// Iterate through name
-	for ( uint32_t i = 0; i < DIR_Name_LENGTH; i++ ) {
+	uint32_t index;
+	Status status = locateFile( active, fileName, index );
 
-		// Check if we have encountered padding
-		if ( name[i] == SHORT_NAME_SPACE_PAD ) {
+	if ( status == STATUS_OK )
+		bytes = active.listing[index].shortEntry.fileSize;
 
-			trailFound = true;
-			continue;
-		}
+	return status;
+}
 
-		// Otherwise keep appending to current
-		else {
+/**
+ * Open File
+ * Description: Attempts to open a file in a session's directory with mode
+ *				bits from isValidOpenMode and places it in the open file
+ *				table. The new handle is set on success and may be used
+ *				from any session.
+ */
+Status Volume::openFile( const string & fileName, uint8_t mode, uint32_t & handle, SessionState & active ) {
 
-			// If we found a trail and we haven't already
-			// added the implied '.', add it
-			if ( !connectionComplete && trailFound ) {
+	// Validate mode, only writes may be buffered or appended
+	if ( !( mode & READWRITE ) || ( ( mode & ( BUFFERED | APPEND ) ) && !( mode & WRITE ) ) )
+		return STATUS_INVALID_MODE;
 
-				connectionComplete = true;
-				result += '.';
-			}
+	unique_lock<shared_mutex> writer( lockTree( active ) );
 
-			char temp = *(name + i);
-			result += temp;
-		}
-	}
+	uint32_t index;
+	Status status = locateFile( active, fileName, index );
 
-	return result;
-}
+	if ( status != STATUS_OK )
+		return status;
 
-/**
- * File Exists
- * Description: Check if a file by the given name exists in the
- *				current directory.
- */
-bool FAT32::fileExists( const string & fileName ) const {
+	const ShortDirectoryEntry & shortEntry = active.listing[index].shortEntry;
 
-	// Check if directoryName is valid
-	if ( !isValidEntryName( fileName ) ) {
+	// File is already open
+	for ( uint32_t i = 0; i < this->openFileTable.size(); i++ )
+		if ( this->openFileTable[i].inUse && this->openFileTable[i].shortEntry.location == shortEntry.location )
+			return STATUS_ALREADY_OPEN;
 
-		cout << "error: file name may not contain /.\n";
-		return true;
-	}
+	// Reuse the first free slot
+	handle = 0;
+	while ( handle < this->openFileTable.size() && this->openFileTable[ handle ].inUse )
+		handle++;
 
-	// Check if directory user want is in current directory
-	for ( uint32_t i = 0; i < currentDirectoryListing.size(); i++ )
-		if ( currentDirectoryListing[i].name.compare( fileName ) == 0 ) {
+	if ( handle == this->openFileTable.size() )
+		this->openFileTable.push_back( OpenFile() );
 
-			cout << "error: file already exists.\n";
-			return true;
-		}
+	OpenFile & file = this->openFileTable[ handle ];
+	file.inUse = true;
+	file.mode = mode;
+	file.position = 0;
+	file.promisedClusters = 0;
+	loadOpenFile( file, shortEntry );
 
-	return false;
+	return STATUS_OK;
 }
 
 /**
- * Directory Exists
- * Description: Check if a directory by the given name exists in the
- *				current directory.
+ * Close File
+ * Description: Attempts to close a file given by name (in a session's
+ *				directory) or by #handle. The handle is closed even when its
+ *				buffered writes could not be flushed.
  */
-bool FAT32::directoryExists( const string & directoryName ) const {
+Status Volume::closeFile( const string & fileName, SessionState & active ) {
 
-	// Check if directoryName is valid
-	if ( !isValidEntryName( directoryName ) ) {
+	unique_lock<shared_mutex> writer( lockTree( active ) );
+	lock_guard<mutex> guard( this->fatLock );
 
-		cout << "error: directory name may not contain /.\n";
-		return true;
-	}
+	uint32_t handle;
+	Status status = locateOpenFile( active, fileName, handle );
 
-	// Check if directory user want is in current directory
-	for ( uint32_t i = 0; i < currentDirectoryListing.size(); i++ )
-		if ( currentDirectoryListing[i].name.compare( directoryName ) == 0 ) {
+	if ( status != STATUS_OK )
+		return status;
 
-			if ( currentDirectoryListing[i].shortEntry.attributes == ATTR_DIRECTORY )
-				cout << "error: directory already exists.\n";
+	status = flushFile( active, handle );
 
-			else
-				cout << "error: " << directoryName << " is a file.\n";
+	// Earlier writes the image refused are still waiting in the cache
+	if ( status == STATUS_OK && !this->cache.flush() )
+		status = STATUS_IO_ERROR;
 
-			return true;
-		}
+	this->openFileTable[ handle ].inUse = false;
+	this->openFileTable[ handle ].extents.clear();
 
-	return false;
+	return status;
 }
 
 /**
- * Find Directory
- * Description: Returns whether or not a directory is in the current directory and
- *				if it is, the passed index is set.
+ * Read Into Buffer
+ * Description: Reads up to length bytes of an open file starting at startPos
+ *				into buffer and sets bytesRead. The range is split into
+ *				chunks the pool reads straight into the buffer. Reads are
+ *				positional and leave the handle's position alone, so any
+ *				number of them may share a handle. bytesRead stops short of
+ *				the first piece that couldn't be read.
  */
-bool FAT32::findDirectory( const string & directoryName, uint32_t & index ) const {
+Status Volume::readInto( const string & fileName, uint32_t startPos, uint8_t * buffer, uint32_t length, uint32_t & bytesRead, SessionState & active ) {
 
-	// Check if directoryName is valid
-	if ( !isValidEntryName( directoryName ) ) {
+	shared_lock<shared_mutex> reader( shareTree() );
 
-		cout << "error: directory name may not contain /.\n";
-		return false;
-	}
+	bytesRead = 0;
 
-	// Check if directory user want is in current directory
-	for ( uint32_t i = 0; i < currentDirectoryListing.size(); i++ )
-		if ( currentDirectoryListing[i].name.compare( directoryName ) == 0 ) {
+	uint32_t handle;
+	Status status = shareOpenFile( reader, fileName, handle, active );
 
-			if ( isDirectory( currentDirectoryListing[i] ) )  {
+	if ( status != STATUS_OK )
+		return status;
 
-				index = i;
-				return true;
-			}
+	const OpenFile & file = this->openFileTable[ handle ];
 
-			else {
+	if ( !( file.mode & READ ) )
+		return STATUS_NOT_READABLE;
 
-				cout << "error: " << directoryName << " is not a directory.\n";
-				return false;
-			}
-			
-		}
+	if ( startPos >= file.shortEntry.fileSize )
+		return STATUS_OUT_OF_RANGE;
 
-	cout << "error: " << directoryName << " not found.\n";
-	return false;
-}
+	uint64_t endPos = min( static_cast<uint64_t>( startPos ) + length,
+						   static_cast<uint64_t>( file.shortEntry.fileSize ) );
+	uint64_t chunkSize = static_cast<uint64_t>( max( READ_BUFFER_SIZE / this->bytesPerCluster, static_cast<uint32_t>( 1 ) ) ) * this->bytesPerCluster;
 
-/**
- * Find Entry
- * Description: Returns whether or not an entry is in the current directory and
- *				if it is, the passed index is set.
- */
-bool FAT32::findEntry( const string & entryName, uint32_t & index ) const {
+	// Skip straight to the extent holding startPos using the cached extent list
+	uint32_t skip = startPos / this->bytesPerCluster;
+	uint32_t e = 0;
+	while ( e < file.extents.size() && skip >= file.extents[e].length )
+		skip -= file.extents[ e++ ].length;
 
-	// Check if entryName is valid
-	if ( !isValidEntryName( entryName ) ) {
+	// Every chunk is one batch of requests landing in the caller's buffer,
+	// pieces of a cluster at either end included
+	uint64_t position = startPos;
+	deque< vector<IORequest> > chunks;
 
-		cout << "error: entry name may not contain /.\n";
-		return false;
-	}
+	while ( position < endPos && e < file.extents.size() ) {
 
-	// Check if directory user want is in current directory
-	for ( uint32_t i = 0; i < currentDirectoryListing.size(); i++ )
-		if ( currentDirectoryListing[i].name.compare( entryName ) == 0 ) {
+		if ( chunks.empty() || ( position - startPos ) / chunkSize != ( chunks.back().back().buffer - buffer ) / chunkSize )
+			chunks.push_back( vector<IORequest>() );
 
-			index = i;
-			return true;
-		}
+		uint64_t inCluster = position % this->bytesPerCluster;
+		uint64_t chunkEnd = startPos + ( ( position - startPos ) / chunkSize + 1 ) * chunkSize;
+		uint64_t extentEnd = position - inCluster + static_cast<uint64_t>( file.extents[e].length - skip ) * this->bytesPerCluster;
+		uint64_t pieceEnd = min( min( chunkEnd, extentEnd ), endPos );
 
-	cout << "error: " << entryName << " not found.\n";
-	return false;
-}
+		IORequest request;
+		request.offset = static_cast<uint64_t>( this->getFirstDataSectorOfCluster( file.extents[e].start + skip ) ) * this->bpb.bytesPerSector + inCluster;
+		request.buffer = buffer + ( position - startPos );
+		request.length = pieceEnd - position;
+		request.write = false;
+		chunks.back().push_back( request );
 
-/**
- * Find File
- * Description: Returns whether or not a file is in the current directory and
- *				if it is, the passed index is set.
- */
-bool FAT32::findFile( const string & fileName, uint32_t & index ) const {
+		// Step over the clusters this piece finished
+		skip += ( inCluster + request.length ) / this->bytesPerCluster;
+		position = pieceEnd;
 
-	// Check if fileName is valid
-	if ( !isValidEntryName( fileName ) ) {
+		if ( skip == file.extents[e].length ) {
 
-		cout << "error: file name may not contain /.\n";
-		return false;
+			skip = 0;
+			e++;
+		}
 	}
 
-	// Check if directory user want is in current directory
-	for ( uint32_t i = 0; i < currentDirectoryListing.size(); i++ )
-		if ( currentDirectoryListing[i].name.compare( fileName ) == 0 ) {
+	uint32_t remaining = 0;
 
-			if ( isFile( currentDirectoryListing[i] ) )  {
+	for ( uint32_t i = 0; i < chunks.size(); i++ )
+		this->pool.run( bind( &BlockCache::submit, &this->cache, ref( chunks[i] ), true ), remaining );
 
-				index = i;
-				return true;
-			}
+	this->pool.wait( remaining );
 
-			else {
+	bytesRead = position - startPos;
 
-				cout << "error: " << fileName << " is not a file.\n";
-				return false;
+	// Only what comes before the first failed request counts as read
+	for ( uint32_t i = 0; i < chunks.size(); i++ )
+		for ( uint32_t j = 0; j < chunks[i].size(); j++ )
+			if ( chunks[i][j].result != static_cast<int64_t>( chunks[i][j].length ) ) {
+
+				bytesRead = ( chunks[i][j].buffer - buffer ) + max( chunks[i][j].result, static_cast<int64_t>( 0 ) );
+				return STATUS_IO_ERROR;
 			}
-			
-		}
 
-	cout << "error: " << fileName << " not found.\n";
-	return false;
+	return STATUS_OK;
 }
 
 /**
- * Form Cluster
- * Description: Concatenates the low and high order bits of a ShortDirectoryEntry
- *				to form the cluster number of that entry.
+ * Commands
  */
-inline uint32_t FAT32::formCluster( const ShortDirectoryEntry & entry ) const {
 
-	uint32_t result = 0;
-	result |= entry.firstClusterLO;
-	result |= entry.firstClusterHI << 16;
+/**
+ * FS Info
+ * Description: Fills in info for the loaded FAT32 FS along with how its
+ *				cache and I/O are doing.
+ */
+void Volume::fsinfo( FileSystemInfo & info ) const {
+
+	shared_lock<shared_mutex> reader( shareTree() );
+	lock_guard<mutex> guard( this->fatLock );
+
+	info.bytesPerSector = this->bpb.bytesPerSector;
+	info.sectorsPerCluster = this->bpb.sectorsPerCluster;
+	info.totalSectors = this->bpb.totalSectors32;
+	info.numFATs = this->bpb.numFATs;
+	info.sectorsPerFAT = this->bpb.FATSz32;
+	info.freeSectors = this->fsInfo.freeCount * this->bpb.sectorsPerCluster;
+
+	CacheStatistics statistics = this->cache.statistics();
+
+	info.cacheHits = statistics.hits;
+	info.cacheMisses = statistics.misses;
+	info.cachedClusters = statistics.blocks;
+	info.dirtyClusters = statistics.dirtyBlocks;
+	info.engine = statistics.engine;
+	info.workers = this->pool.size();
+}
 
-	return result;
+/**
+ * Create Files
+ * Description: Attempts to create several files in a session's directory
+ *				at once, writing the directory and FAT a single time. results
+ *				gets one status per name and names that fail are skipped. If
+ *				the rest don't fit none of them are made and the reason is
+ *				returned.
+ */
+Status Volume::create( const vector<string> & fileNames, vector<Status> & results, SessionState & active ) {
+
+	unique_lock<shared_mutex> writer( lockTree( active ) );
+	lock_guard<mutex> guard( this->fatLock );
+
+	return createEntries( active, fileNames, false, results );
 }
 
 /**
- * Generate Basis Name
- * Description: Generates a basis-name from a long name. Will set if a 
- *				lossy conversion was applied.
+ * Read File
+ * Description: Attempts to read a file if it's in the open file table. Reads
+ *				the file starting at startPos and reads up to numBytes. Data is
+ *				handed to output a block at a time straight from the cluster
+ *				buffer, in order, never while the tree is held. The file may be
+ *				given by name or by #handle, and the handle's position moves
+ *				past the bytes read. Shares the tree like readInto.
  */
-const string FAT32::generateBasisName( const string & longName, bool & lossyConversion ) const {
+Status Volume::read( const string & fileName, uint32_t startPos, uint32_t numBytes, const ReadOutput & output, SessionState & active ) {
 
-	string shortCopy;
-	lossyConversion = false;
+	shared_lock<shared_mutex> reader( shareTree() );
 
-	for ( uint8_t i = 0; i < longName.length(); i++ ) {
+	uint32_t handle;
+	Status status = shareOpenFile( reader, fileName, handle, active );
 
-		// Check invalid characters and covert to _
-		if ( longName[i] == '+' || longName[i] == ',' || longName[i] == ';' || longName[i] == '=' 
-			|| longName[i] == '['  || longName[i] == ']' ) {
+	if ( status != STATUS_OK )
+		return status;
 
-			lossyConversion = true;
-			shortCopy += '_';
-		}
+	return readFile( reader, handle, startPos, numBytes, output );
+}
 
-		// Skip over ' ' and possibly '.'
-		else if ( longName[i] == ' ' )
-			continue;
+/**
+ * Read File at Position
+ * Description: Reads up to numBytes from an open file's current position.
+ */
+Status Volume::read( const string & fileName, uint32_t numBytes, const ReadOutput & output, SessionState & active ) {
 
-		else if ( longName[i] == '.' && longName.find_last_of( "." ) != i )
-			continue;
+	shared_lock<shared_mutex> reader( shareTree() );
 
-		// Otherwise capitalize
-		else 
-			shortCopy += toupper( longName[i] );
-	}
+	uint32_t handle;
+	Status status = shareOpenFile( reader, fileName, handle, active );
 
-    string basisName( DIR_Name_LENGTH, SHORT_NAME_SPACE_PAD );
+	if ( status != STATUS_OK )
+		return status;
 
-    // Copy in our results
-    for ( uint8_t i = 0; i < 8 && i < shortCopy.length() && shortCopy[i] != '.'; i++ )
-    	basisName[i] = shortCopy[i];
+	uint32_t startPos;
 
-    // Try to copy in extension
-    size_t period = shortCopy.find_last_of( "." );
-    if ( period != string::npos )
-    	for( uint8_t i = 0; i < 3 && ( ( period + 1 ) + i ) < shortCopy.length(); i++ )
-			basisName[ 8 + i ] = shortCopy[ ( period + 1 ) + i ];
+	{
+		lock_guard<mutex> guard( this->handleLock );
+		startPos = this->openFileTable[ handle ].position;
+	}
 
-	return basisName;
+	return readFile( reader, handle, startPos, numBytes, output );
 }
 
 /**
- * Generate Numerical Tail
- * Description: Uses the numeric-tail algorithm to figure out
- *				what name a basis-name needs.
+ * Write to File
+ * Description: Attempts to write data to a given file name at a certain
+ *				starting position. Resizes file if necessary. The file may be
+ *				given by name or by #handle, and the handle's position moves
+ *				past the bytes written.
  */
-string FAT32::generateNumericTail( string basisName ) const {
+Status Volume::write( const string & fileName, uint32_t startPos, const string & data, SessionState & active ) {
 
-	// Need to only ever occupy up to the length of 999999
-	char nBuffer[7] = {0};
-	string primaryName = basisName.substr( 0, 8 );
-	primaryName = primaryName.substr( 0, primaryName.find( " " ) );
-	string extension = basisName.substr( 8, string::npos );
-	string finalPrimaryName;
+	unique_lock<shared_mutex> writer( lockTree( active ) );
+	lock_guard<mutex> guard( this->fatLock );
 
-	for ( uint32_t start = 1; start <= 999999; start++ ) {
+	uint32_t handle;
+	Status status = locateOpenFile( active, fileName, handle );
 
-		// sprintf allows us to easily make a digit into a string
-		sprintf( nBuffer, "%d", start );
+	if ( status != STATUS_OK )
+		return status;
 
-		// Shorten primary name if necessary
-		finalPrimaryName = primaryName.substr( 0, min( primaryName.length(), 8 - ( strlen( nBuffer ) + 1 ) ) ) + "~" + nBuffer;
-		finalPrimaryName.resize( 8, SHORT_NAME_SPACE_PAD );
+	// Append handles always write at the end
+	if ( this->openFileTable[ handle ].mode & BUFFERED )
+		return bufferFile( active, handle, startPos, data );
 
-		// Stop generating tails as soon as one works
-		if ( !shortNameExists( finalPrimaryName + extension ) )
-			break;
-	}
+	if ( this->openFileTable[ handle ].mode & APPEND )
+		return appendFile( active, handle, data );
 
-	string final = finalPrimaryName + extension;
-	final.resize( DIR_Name_LENGTH, SHORT_NAME_SPACE_PAD );
+	return writeFile( active, handle, startPos, data );
+}
 
-	return final;
+/**
+ * Write to File at Position
+ * Description: Writes data at an open file's current position.
+ */
+Status Volume::write( const string & fileName, const string & data, SessionState & active ) {
+
+	unique_lock<shared_mutex> writer( lockTree( active ) );
+	lock_guard<mutex> guard( this->fatLock );
+
+	uint32_t handle;
+	Status status = locateOpenFile( active, fileName, handle );
+
+	if ( status != STATUS_OK )
+		return status;
+
+	// Append handles always write at the end
+	if ( this->openFileTable[ handle ].mode & BUFFERED )
+		return bufferFile( active, handle, this->openFileTable[ handle ].position, data );
+
+	if ( this->openFileTable[ handle ].mode & APPEND )
+		return appendFile( active, handle, data );
+
+	return writeFile( active, handle, this->openFileTable[ handle ].position, data );
 }
 
 /**
- * Get Directory Listing
- * Description: Returns a list of DirectoryEntries for a given cluster.
- * Expects: cluster to be a valid data cluster.
+ * Append to File
+ * Description: Attempts to add data to the end of an open file, whatever
+ *				its handle's position.
  */
-vector<DirectoryEntry> FAT32::getDirectoryListing( uint32_t cluster ) const {
+Status Volume::append( const string & fileName, const string & data, SessionState & active ) {
 
-	vector<uint32_t> clusterChain;
-	uint8_t * contents = getFileContents( cluster, clusterChain );
-	uint32_t size = clusterChain.size() * this->bytesPerCluster;
-	deque<LongDirectoryEntry> longEntries;
-	vector<DirectoryEntry> result;
-	// Parse contents
-	for ( uint32_t i = 0; i < size; i += DIR_ENTRY_SIZE ) {
+	unique_lock<shared_mutex> writer( lockTree( active ) );
+	lock_guard<mutex> guard( this->fatLock );
 
-		uint8_t ordinal = contents[i];
-		uint8_t attribute =  contents[i + DIR_Attr];
+	uint32_t handle;
+	Status status = locateOpenFile( active, fileName, handle );
 
-		// Check if not free entry
-		if ( ordinal != DIR_FREE_ENTRY ) {
+	if ( status != STATUS_OK )
+		return status;
 
-			// Rest of entries ahead of this are free
-			if ( ordinal == DIR_LAST_FREE_ENTRY )
-				break;
+	if ( this->openFileTable[ handle ].mode & BUFFERED )
+		return bufferFile( active, handle, this->openFileTable[ handle ].bufferedSize, data );
 
-			// Check if this entry is a long directory
-			if ( ( attribute & ATTR_LONG_NAME_MASK ) == ATTR_LONG_NAME ) {
+	return appendFile( active, handle, data );
+}
 
-				LongDirectoryEntry tempLongEntry;
-				memcpy( &tempLongEntry, contents+i, sizeof( LongDirectoryEntry ) - sizeof( uint32_t ) );
+/**
+ * Remove File
+ * Description: Attempts to remove a file from a session's directory. The
+ *				entry is removed right away and its chain is handed to the
+ *				reclaim worker, which frees (and for safe removal, wipes) it
+ *				in the background. A crash in between leaves a lost chain
+ *				for check to collect.
+ */
+Status Volume::rm( const string & fileName, bool safe, SessionState & active ) {
 
-				// Store this location in case we ever need to remove this entry
-				tempLongEntry.location = calculateDirectoryEntryLocation( i, clusterChain );
+	unique_lock<shared_mutex> writer( lockTree( active ) );
+	lock_guard<mutex> guard( this->fatLock );
 
-				longEntries.push_front( tempLongEntry );
+	uint32_t index;
+	Status status = locateFile( active, fileName, index );
 
-			// Otherwise it's a file
-			} else {
+	if ( status != STATUS_OK )
+		return status;
 
-				string name = "";
-				uint8_t attr = attribute & ( ATTR_DIRECTORY | ATTR_VOLUME_ID );
+	// Remove it from the open file table if it's there
+	for ( uint32_t i = 0; i < this->openFileTable.size(); i++ )
+		if ( this->openFileTable[i].inUse && this->openFileTable[i].shortEntry.location == active.listing[index].shortEntry.location ) {
 
-				ShortDirectoryEntry tempShortEntry;
-				memcpy( &tempShortEntry, contents+i, sizeof( ShortDirectoryEntry ) - sizeof( uint32_t ) );
-				tempShortEntry.location = calculateDirectoryEntryLocation( i, clusterChain );
+			this->openFileTable[i].inUse = false;
+			this->openFileTable[i].extents.clear();
+			this->openFileTable[i].dirtyPages.clear();
+			releasePromise( this->openFileTable[i] );
+		}
 
-				// Build long entry name if there were any
-				if ( !longEntries.empty() )
-					for ( uint32_t i = 0; i < longEntries.size(); i++ ) {
+	DeleteJob job;
+	job.name = fileName;
+	job.safe = safe;
+	job.trim = this->trimOnDelete;
+	job.cancelled = false;
+	job.totalClusters = 0;
+	job.reclaimedClusters = 0;
 
-						appendLongName( name, longEntries[i].name1, sizeof( longEntries[i].name1 )/2 );
-						appendLongName( name, longEntries[i].name2, sizeof( longEntries[i].name2 )/2 );
-						appendLongName( name, longEntries[i].name3, sizeof( longEntries[i].name3 )/2 );
-					}
+	// Build list of clusters ( potentially remaining if we crashed ) for this file
+	uint32_t nextCluster = formCluster( active.listing[index].shortEntry );
+	vector<uint32_t> clusterChain;
 
-				else
-					name = convertShortName( tempShortEntry.name );
+	if ( nextCluster != 0 ) {
 
-				// Validate attribute
-				if ( attr == 0x00 || attr == ATTR_DIRECTORY || attr == ATTR_VOLUME_ID ) {
+		do {
+
+			clusterChain.push_back( nextCluster );
+			
+		} while ( ( nextCluster = getFATEntry( nextCluster ) ) < EOC && nextCluster != FREE_CLUSTER );
+	}
 
-					// Add new DirectoryEntry
-					DirectoryEntry tempDirectoryEntry;
-					tempDirectoryEntry.name = name;
-					tempDirectoryEntry.fullPath = this->getCurrentPath() + name;
-					tempDirectoryEntry.shortEntry = tempShortEntry;
-					tempDirectoryEntry.longEntries = longEntries;
-					result.push_back( tempDirectoryEntry );
+	vector<Extent> extents;
+	buildExtents( clusterChain, extents );
+	job.extents.assign( extents.begin(), extents.end() );
+	job.totalClusters = clusterChain.size();
 
-				} else {
+	// The entry goes right away, this also lands any writes still
+	// buffered for the chain before the worker wipes it. Clusters an entry
+	// on the image may still point at are left alone, check finds them
+	if ( !releaseEntry( active, index, safe ) )
+		return STATUS_IO_ERROR;
 
-					// Invalid entry, ignore
-				}
+	if ( job.extents.empty() )
+		return STATUS_OK;
 
-				// Reset long entries
-				longEntries.clear();
-			}
-		}
+	{
+		lock_guard<mutex> lock( this->jobLock );
+
+		job.id = this->nextJobId++;
+		this->deleteJobs.push_back( job );
+
+		if ( !this->reclaimThread.joinable() )
+			this->reclaimThread = thread( &Volume::reclaimWorker, this );
 	}
 
-	delete[] contents;
+	this->jobReady.notify_one();
 
-	return result;
+	return STATUS_OK;
 }
 
 /**
- * Get FAT Entry
- * Description: Returns the value of a FAT entry without its upper 4 bits.
+ * Make Directories
+ * Description: Creates several directories (like files) in a session's
+ *				directory at once and places . and .. entries in each,
+ *				writing the directory and FAT a single time. Results are
+ *				given as for create.
  */
-inline uint32_t FAT32::getFATEntry( uint32_t n ) const {
+Status Volume::mkdir( const vector<string> & directoryNames, vector<Status> & results, SessionState & active ) {
 
-	return this->fat[n] & FAT_ENTRY_MASK;
+	unique_lock<shared_mutex> writer( lockTree( active ) );
+	lock_guard<mutex> guard( this->fatLock );
+
+	return createEntries( active, directoryNames, true, results );
 }
 
 /**
- * Get File Contents
- * Description: Returns a buffer of the contents of a file starting at a given
- *				initial cluster. Also sets the cluster chain of this buffer. 
- *				This function will cause the program to abort if we are given 
- *				a cluster that leads to an empty chain.
+ * Remove Directory
+ * Description: Atempts to remove an empty directory from a session's
+ *				directory.
  */
-uint8_t * FAT32::getFileContents( uint32_t initialCluster, vector<uint32_t> & clusterChain ) const {
+Status Volume::rmdir( const string & directoryName, SessionState & active ) {
 
-	uint32_t nextCluster = initialCluster;
+	// Don't let anyone remove . or .. manually
+	if ( directoryName.compare(".") == 0 || directoryName.compare("..") == 0 )
+		return STATUS_RESERVED_NAME;
 
-	// Build list of clusters for this file
-	do {
+	unique_lock<shared_mutex> writer( lockTree( active ) );
+	lock_guard<mutex> guard( this->fatLock );
 
-		clusterChain.push_back( nextCluster );
+	uint32_t index;
+	Status status = locateDirectory( active, directoryName, index );
+
+	if ( status != STATUS_OK )
+		return status;
+
+	DirectoryCursor cursor;
+	openDirectory( formCluster( active.listing[index].shortEntry ), cursor );
+
+	// Check if directory is empty, . and .. never have long entries
+	while ( nextDirectoryEntry( cursor ) ) {
+
+		if ( cursor.longEntryCount > 0 || ( memcmp( cursor.shortEntry.name, ".          ", DIR_Name_LENGTH ) != 0 
+											&& memcmp( cursor.shortEntry.name, "..         ", DIR_Name_LENGTH ) != 0 ) )
+			return STATUS_NOT_EMPTY;
+	}
+
+	// What couldn't be read may not be empty
+	if ( cursor.failed )
+		return STATUS_IO_ERROR;
+
+	return removeEntry( active, index, false ) ? STATUS_OK : STATUS_IO_ERROR;
+}
+
+/**
+ * Remove Directory Tree
+ * Description: Removes a directory along with everything under it. The
+ *				tree is read once, then every chain is freed in memory and the
+ *				FAT, FSInfo and the parent's entry are written back a single
+ *				time. Nothing is freed if any directory of the tree can't be
+ *				read.
+ */
+Status Volume::rmTree( const string & directoryName, SessionState & active ) {
+
+	// Don't let anyone remove . or .. manually
+	if ( directoryName.compare(".") == 0 || directoryName.compare("..") == 0 )
+		return STATUS_RESERVED_NAME;
+
+	unique_lock<shared_mutex> writer( lockTree( active ) );
+	lock_guard<mutex> guard( this->fatLock );
+
+	uint32_t index;
+	Status status = locateDirectory( active, directoryName, index );
+
+	if ( status != STATUS_OK )
+		return status;
+
+	vector<uint32_t> pending( 1, formCluster( active.listing[index].shortEntry ) ),
+					 freed;
+	set<uint32_t> directories, directoryClusters;
+
+	// First cluster of every chain in the tree and whether it is a directory's
+	vector< pair<uint32_t, bool> > chains;
+
+	while ( !pending.empty() ) {
+
+		uint32_t directory = pending.back();
+		pending.pop_back();
+
+		// Cross-linked or looping trees are only walked once, and never into the root
+		if ( directory < 2 || directory == this->bpb.rootCluster || !directories.insert( directory ).second )
+			continue;
+
+		DirectoryCursor cursor;
+		openDirectory( directory, cursor );
+
+		while ( nextDirectoryEntry( cursor ) ) {
+
+			if ( memcmp( cursor.shortEntry.name, ".          ", DIR_Name_LENGTH ) == 0 
+					|| memcmp( cursor.shortEntry.name, "..         ", DIR_Name_LENGTH ) == 0 )
+				continue;
+
+			if ( isDirectory( cursor.shortEntry ) )
+				pending.push_back( formCluster( cursor.shortEntry ) );
+
+			else if ( isFile( cursor.shortEntry ) )
+				chains.push_back( make_pair( formCluster( cursor.shortEntry ), false ) );
+		}
+
+		if ( cursor.failed )
+			return STATUS_IO_ERROR;
+
+		chains.push_back( make_pair( directory, true ) );
+	}
+
+	for ( uint32_t i = 0; i < chains.size(); i++ ) {
+
+		uint32_t before = freed.size();
+		freeChain( chains[i].first, freed );
+
+		// Every cluster of a directory may hold entries of open files
+		if ( chains[i].second )
+			directoryClusters.insert( freed.begin() + before, freed.end() );
+	}
+
+	// Open files under the tree go away with it, buffered writes included
+	for ( uint32_t i = 0; i < this->openFileTable.size(); i++ ) {
+
+		OpenFile & file = this->openFileTable[i];
+		uint32_t cluster = ( file.shortEntry.location / this->bpb.bytesPerSector - this->firstDataSector ) / this->bpb.sectorsPerCluster + 2;
+
+		if ( file.inUse && directoryClusters.count( cluster ) > 0 ) {
+
+			file.inUse = false;
+			file.extents.clear();
+			file.dirtyPages.clear();
+			releasePromise( file );
+		}
+	}
+
+	bool written = true;
+
+	// One FAT update covering every freed cluster
+	if ( !freed.empty() ) {
+
+		sort( freed.begin(), freed.end() );
+		written = writeFAT( freed.front(), freed.back() );
+
+		if ( this->trimOnDelete ) {
+
+			vector<Extent> extents;
+			buildExtents( freed, extents );
+
+			for ( uint32_t i = 0; i < extents.size(); i++ )
+				punchExtent( extents[i].start, extents[i].length );
+		}
+	}
+
+	written &= releaseEntry( active, index, false );
+
+	return written ? STATUS_OK : STATUS_IO_ERROR;
+}
+
+/**
+ * Disk Usage
+ * Description: Totals the file sizes and allocated clusters of everything
+ *				under a directory path, walking the tree in parallel.
+ *				Returns STATUS_IO_ERROR, with the totals of what could be
+ *				read, when a directory couldn't be.
+ */
+Status Volume::du( const string & path, UsageTotals & totals, SessionState & active ) {
+
+	shared_lock<shared_mutex> reader( shareTree() );
+
+	uint32_t cluster;
+	Status status;
+
+	{
+		lock_guard<mutex> guard( this->fatLock );
+		status = resolvePath( active, path, cluster, totals.path );
+	}
+
+	if ( status != STATUS_OK )
+		return status;
+
+	WalkState state;
+	walkTree( cluster, totals.path, state );
+
+	totals.bytes = state.bytes;
+	totals.allocatedBytes = state.allocatedBytes;
+	totals.files = state.files;
+	totals.directories = state.directories;
+
+	return state.failed ? STATUS_IO_ERROR : STATUS_OK;
+}
+
+/**
+ * Find
+ * Description: Hands the path of every entry under a directory path whose
+ *				name matches a glob to output, as soon as its directory is
+ *				read. output is never called from two threads at once. Names
+ *				match case-sensitively, the same way paths are resolved.
+ *				Returns STATUS_IO_ERROR when a directory couldn't be read.
+ */
+Status Volume::find( const string & path, const string & pattern, const FindOutput & output, SessionState & active ) {
+
+	shared_lock<shared_mutex> reader( shareTree() );
+
+	uint32_t cluster;
+	string display;
+	Status status;
+
+	{
+		lock_guard<mutex> guard( this->fatLock );
+		status = resolvePath( active, path, cluster, display );
+	}
+
+	if ( status != STATUS_OK )
+		return status;
+
+	WalkState state;
+	state.pattern = pattern;
+	state.output = output;
+	walkTree( cluster, display, state );
+
+	return state.failed ? STATUS_IO_ERROR : STATUS_OK;
+}
+
+/**
+ * Preallocate File
+ * Description: Reserves enough clusters for a file to hold numBytes in as few
+ *				contiguous runs as possible, linking them into its chain with a
+ *				single FAT update. The file size is only raised to numBytes
+ *				when keepSize is false. Sets what was reserved, if anything.
+ */
+Status Volume::prealloc( const string & fileName, uint32_t numBytes, bool keepSize, Reservation & reservation, SessionState & active ) {
+
+	reservation.clusters = 0;
+	reservation.runs = 0;
+
+	unique_lock<shared_mutex> writer( lockTree( active ) );
+	lock_guard<mutex> guard( this->fatLock );
+
+	// Buffered writes must land before open files get reloaded
+	Status status = flushFiles( active );
+
+	if ( status != STATUS_OK )
+		return status;
+
+	uint32_t index;
+	status = locateFile( active, fileName, index );
+
+	if ( status != STATUS_OK )
+		return status;
+
+	ShortDirectoryEntry file = active.listing[index].shortEntry;
+	uint32_t firstCluster = formCluster( file );
+
+	vector<uint32_t> clusterChain;
+	if ( firstCluster != 0 )
+		getClusterChain( firstCluster, clusterChain );
+
+	uint64_t allocatedSize = static_cast<uint64_t>( clusterChain.size() ) * this->bytesPerCluster;
+
+	// Only new clusters get zeroed, whatever the chain already holds past the
+	// end of file would otherwise become part of it
+	uint64_t exposedEnd = keepSize ? 0 : min( static_cast<uint64_t>( numBytes ), allocatedSize );
+
+	if ( exposedEnd > file.fileSize
+			&& ( !writeChainBytes( clusterChain, file.fileSize, NULL, exposedEnd - file.fileSize ) || !this->cache.flush() ) )
+		return STATUS_IO_ERROR;
+
+	if ( numBytes > allocatedSize ) {
+
+		uint32_t clustersNeeded = ceil( static_cast<double>( numBytes - allocatedSize ) / this->bytesPerCluster );
+
+		// Check if we have enough free space left or if the file would pass its max size
+		if ( availableClusters() < clustersNeeded )
+			return STATUS_NO_SPACE;
+
+		if ( allocatedSize + ( static_cast<uint64_t>( clustersNeeded ) * this->bytesPerCluster ) > FILE_MAX_SIZE )
+			return STATUS_TOO_LARGE;
+
+		// Grow from the tail if there is one, otherwise from the rotor
+		vector<uint32_t> runs;
+		uint32_t hint = clusterChain.empty() ? this->fsInfo.nextFree : clusterChain.back() + 1;
+		findFreeRuns( clustersNeeded, hint, runs );
+
+		vector<Extent> reserved;
+		for ( uint32_t i = 0; i < runs.size(); i += 2 ) {
+
+			Extent extent;
+			extent.start = runs[i];
+			extent.length = runs[ i + 1 ];
+			reserved.push_back( extent );
+		}
+
+		// Reserved space must never expose old data, runs that can't be
+		// zeroed are never linked
+		dropPrefetched();
+
+		if ( !zeroExtents( reserved ) )
+			return STATUS_IO_ERROR;
+
+		// Link every run onto the chain
+		uint32_t previous = clusterChain.empty() ? 0 : clusterChain.back();
+		for ( uint32_t i = 0; i < runs.size(); i += 2 ) {
+
+			for ( uint32_t cluster = runs[i]; cluster < runs[i] + runs[ i + 1 ]; cluster++ ) {
+
+				if ( previous != 0 )
+					setClusterValue( previous, cluster );
+
+				clusterChain.push_back( cluster );
+				previous = cluster;
+			}
+		}
+
+		setClusterValue( previous, EOC );
+		this->fsInfo.freeCount -= clustersNeeded;
+		this->fsInfo.nextFree = ( previous + 1 >= this->countOfClusters + 2 ) ? 2 : previous + 1;
+
+		// Zeros need to be on disk before the chain that exposes them
+		if ( !writeFAT() )
+			status = STATUS_IO_ERROR;
+
+		reservation.clusters = clustersNeeded;
+		reservation.runs = runs.size() / 2;
+	}
+
+	// Need to update file info in case of crash
+	if ( !keepSize && numBytes > file.fileSize )
+		file.fileSize = numBytes;
+
+	file.firstClusterHI = ( clusterChain.empty() ? 0 : clusterChain[0] >> 16 );
+	file.firstClusterLO = ( clusterChain.empty() ? 0 : clusterChain[0] & 0x0000FFFF );
+	treeChanged();
+
+	if ( !this->cache.write( file.location, &file, DIR_ENTRY_SIZE ) || !this->cache.flush() )
+		status = STATUS_IO_ERROR;
+
+	// Also update our temporary listing and any open handle
+	active.listing.setShortEntry( index, file );
+	refreshOpenFiles();
+
+	return status;
+}
+
+/**
+ * Defragment
+ * Description: Measures fragmentation of every chain under the given entry (or
+ *				under a session's directory when entryName is empty or .) and
+ *				moves fragmented chains into contiguous free runs. Stops
+ *				moving once budget bytes have been moved (0 means no limit).
+ *				Fills in report with every fragmented chain and the totals.
+ */
+Status Volume::defrag( const string & entryName, uint32_t budget, DefragReport & report, SessionState & active ) {
+
+	report.chainsChecked = 0;
+	report.chainsFragmented = 0;
+	report.chainsMoved = 0;
+	report.chainsSkipped = 0;
+	report.bytesMoved = 0;
+	report.chains.clear();
+
+	if ( entryName.compare( ".." ) == 0 )
+		return STATUS_RESERVED_NAME;
+
+	unique_lock<shared_mutex> writer( lockTree( active ) );
+	lock_guard<mutex> guard( this->fatLock );
+
+	// Buffered writes must land before chains move
+	Status status = flushFiles( active );
+
+	if ( status != STATUS_OK )
+		return status;
+
+	DefragProgress progress = { budget, report, true, map<uint32_t, uint32_t>() };
+
+	// Whole current directory, but never the directory itself
+	if ( entryName.empty() || entryName.compare( "." ) == 0 ) {
+
+		for ( uint32_t i = 0; i < active.listing.size(); i++ )
+			if ( !active.listing.nameEquals( i, "." ) && !active.listing.nameEquals( i, ".." ) )
+				defragEntry( active.listing[i].shortEntry, getCurrentPath( &active ) + active.listing.name( i ), progress );
+
+	} else {
+
+		uint32_t index;
+
+		// Try and find entry
+		if ( ( status = locateEntry( active, entryName, index ) ) != STATUS_OK )
+			return status;
+
+		defragEntry( active.listing[index].shortEntry, getCurrentPath( &active ) + entryName, progress );
+	}
+
+	// Cluster locations may have changed underneath us
+	relocateDirectories( progress.moved );
+
+	if ( !getDirectoryListing( active.directoryCluster, active.listing ) )
+		active.readable = false;
+
+	refreshOpenFiles();
+
+	return progress.complete ? STATUS_OK : STATUS_IO_ERROR;
+}
+
+/**
+ * Check File System
+ * Description: Walks the whole tree from the root cluster with a pool of worker
+ *				threads, claiming every cluster in an ownership map to find
+ *				cross-linked chains, cycles, bad links, lost chains, files larger
+ *				than their chain, bad .. entries and a wrong FSInfo free count.
+ *				Problems that have a safe fix are repaired when repair is set.
+ *				Returns STATUS_IO_ERROR without repairing anything when part of
+ *				the tree or FSInfo couldn't be read, everything below it would
+ *				look lost.
+ */
+Status Volume::check( bool repair, CheckReport & report ) {
+
+	report.problems.clear();
+	report.chains = 0;
+	report.threads = 0;
+	report.repaired = false;
+
+	// Pending deletes would show up as lost chains
+	waitForDeletes();
+
+	unique_lock<shared_mutex> writer( lockTree( this->console ) );
+	lock_guard<mutex> guard( this->fatLock );
+
+	// Buffered writes must land before chains are checked
+	Status status = flushFiles( this->console );
+
+	if ( status != STATUS_OK )
+		return status;
+
+	// So must a FAT the image refused before, FSInfo is compared against it
+	if ( this->imageDescriptor < 0 || ( this->fatStale && !storeFAT( 0, 0 ) ) )
+		return STATUS_IO_ERROR;
+
+	uint32_t range = this->countOfClusters + 2;
+
+	CheckState state;
+	state.owners = new atomic<uint32_t>[ range ]();
+	state.nextChainId = 0;
+	state.failed = false;
+
+	CheckDirectory root;
+	root.cluster = this->bpb.rootCluster;
+	root.parentCluster = 0;
+	root.path = "/";
+
+	// Walk the tree in parallel
+	uint32_t workerCount = walkDirectories( root, bind( &Volume::checkDirectory, this, placeholders::_1, placeholders::_2, ref( state ) ) );
+
+	// Compare against what FSInfo says on disk
+	FSInfo diskInfo;
+
+	if ( state.failed || !this->cache.read( this->bpb.FSInfo * this->bpb.bytesPerSector, &diskInfo, sizeof( diskInfo ) ) ) {
+
+		delete[] state.owners;
+		return STATUS_IO_ERROR;
+	}
+
+	// Anything allocated that nobody claimed is lost
+	uint32_t lostClusters = 0, lostChains = 0;
+	vector<bool> pointedTo( range, false );
+
+	for ( uint32_t i = 2; i < range; i++ ) {
+
+		uint32_t value = getFATEntry( i );
+
+		if ( state.owners[i] == 0 && !isFreeCluster( value ) && value >= 2 && value < range )
+			pointedTo[ value ] = true;
+	}
+
+	for ( uint32_t i = 2; i < range; i++ )
+		if ( state.owners[i] == 0 && !isFreeCluster( getFATEntry( i ) ) ) {
+
+			lostClusters++;
+
+			if ( !pointedTo[i] )
+				lostChains++;
+		}
+
+	if ( lostClusters > 0 ) {
+
+		CheckProblem problem = { PROBLEM_LOST, "", lostClusters, lostChains };
+		state.problems.push_back( problem );
+	}
+
+	uint32_t freeCount = 0;
+	for ( uint32_t i = 2; i < range; i++ )
+		if ( isFreeCluster( getFATEntry( i ) ) )
+			freeCount++;
+
+	if ( diskInfo.freeCount != freeCount ) {
+
+		CheckProblem problem = { PROBLEM_FREE_COUNT, "", diskInfo.freeCount, freeCount };
+		state.problems.push_back( problem );
+	}
+
+	if ( repair && !state.problems.empty() ) {
+
+		// Cut chains off where they loop, leave the range or run into free clusters
+		for ( uint32_t i = 0; i < state.terminate.size(); i++ )
+			setClusterValue( state.terminate[i], EOC );
+
+		// Lost chains go back to the free pool
+		for ( uint32_t i = 2; i < range; i++ )
+			if ( state.owners[i] == 0 && !isFreeCluster( getFATEntry( i ) ) )
+				setClusterValue( i, FREE_CLUSTER );
+
+		this->fsInfo.freeCount = 0;
+		for ( uint32_t i = 2; i < range; i++ )
+			if ( isFreeCluster( getFATEntry( i ) ) )
+				this->fsInfo.freeCount++;
+
+		bool written = writeFAT();
+
+		// Files claim no more than their chain holds
+		for ( uint32_t i = 0; i < state.sizeFixes.size(); i++ )
+			written &= this->cache.write( state.sizeFixes[i].location, &state.sizeFixes[i], DIR_ENTRY_SIZE );
+
+		for ( uint32_t i = 0; i < state.dotdotFixes.size(); i++ )
+			written &= setDotEntryCluster( state.dotdotFixes[i].first, 1, state.dotdotFixes[i].second );
+
+		written &= this->cache.flush();
+
+		if ( !written )
+			status = STATUS_IO_ERROR;
+
+		if ( !getDirectoryListing( this->console.directoryCluster, this->console.listing ) )
+			this->console.readable = false;
+
+		refreshOpenFiles();
+
+		report.repaired = true;
+	}
+
+	report.problems.swap( state.problems );
+	report.chains = state.nextChainId;
+	report.threads = workerCount;
+
+	delete[] state.owners;
+
+	return status;
+}
+
+/**
+ * Sync
+ * Description: Flushes the buffered writes of every open file along with
+ *				any dirty cached clusters and a FAT the image refused before.
+ *				Returns STATUS_IO_ERROR when the image refused some of them,
+ *				they stay around for the next try.
+ */
+Status Volume::sync() {
+
+	unique_lock<shared_mutex> writer( lockTree( this->console ) );
+	lock_guard<mutex> guard( this->fatLock );
+
+	Status status = flushFiles( this->console );
+	bool flushed = this->cache.flush();
+
+	if ( this->fatStale )
+		flushed &= storeFAT( 0, 0 );
+
+	if ( !flushed && status == STATUS_OK )
+		status = STATUS_IO_ERROR;
+
+	return status;
+}
+
+/**
+ * Trim
+ * Description: Turns releasing the host storage of deleted files' clusters
+ *				on or off.
+ */
+void Volume::trim( bool enable ) {
+
+	unique_lock<shared_mutex> writer( lockTree( this->console ) );
+
+	this->trimOnDelete = enable;
+}
+
+/**
+ * Jobs
+ * Description: Lists the deletes still being reclaimed in the background
+ *				along with how far along each one is.
+ */
+void Volume::jobs( vector<JobInfo> & jobs ) {
+
+	lock_guard<mutex> lock( this->jobLock );
+
+	jobs.clear();
+
+	for ( deque<DeleteJob>::const_iterator itr = this->deleteJobs.begin(); itr != this->deleteJobs.end(); itr++ ) {
+
+		JobInfo job;
+		job.id = itr->id;
+		job.name = itr->name;
+		job.safe = itr->safe;
+		job.cancelled = itr->cancelled;
+		job.reclaimedClusters = itr->reclaimedClusters;
+		job.totalClusters = itr->totalClusters;
+
+		jobs.push_back( job );
+	}
+}
+
+/**
+ * Cancel
+ * Description: Stops the slow part of a background delete. The entry is
+ *				already gone, so the rest of its chain is freed at once
+ *				without being trimmed. A safe delete still wipes all of it
+ *				first, freed clusters may show up in a later file's unwritten
+ *				space. Sets how far along the job was.
+ */
+Status Volume::cancel( uint32_t id, JobInfo & job ) {
+
+	lock_guard<mutex> lock( this->jobLock );
+
+	for ( deque<DeleteJob>::iterator itr = this->deleteJobs.begin(); itr != this->deleteJobs.end(); itr++ ) {
+
+		if ( itr->id == id ) {
+
+			itr->cancelled = true;
+
+			job.id = itr->id;
+			job.name = itr->name;
+			job.safe = itr->safe;
+			job.cancelled = true;
+			job.reclaimedClusters = itr->reclaimedClusters;
+			job.totalClusters = itr->totalClusters;
+
+			return STATUS_OK;
+		}
+	}
+
+	return STATUS_NO_SUCH_JOB;
+}
+
+/**
+ * Workers
+ * Description: Sets how many threads carry out the chunks of large reads,
+ *				copies and wipes. With 0 the calling thread does it all.
+ */
+Status Volume::workers( uint32_t count ) {
+
+	if ( count > IO_WORKERS_MAX )
+		return STATUS_TOO_MANY_WORKERS;
+
+	// Library reads may be waiting on the pool
+	unique_lock<shared_mutex> writer( lockTree( this->console ) );
+
+	this->pool.resize( count );
+
+	return STATUS_OK;
+}
+
+/**
+ * Volume Private Methods
+ */
+
+/**
+ * Add Files
+ * Description: Adds files to a session's directory. Places every entry in one
+ *				pass over the directory, growing it at most once, and writes
+ *				back only the clusters that changed. Fills in the on-disk
+ *				location of every entry it placed and inserts the files into
+ *				the current listing, setting indices to where they landed.
+ *				reserved counts clusters the caller already took from the
+ *				in-memory FAT, which must reach the disk first. Returns
+ *				STATUS_NO_SPACE or STATUS_TOO_LARGE if there was no room for
+ *				them and STATUS_IO_ERROR if the directory couldn't be read, in
+ *				which case indices stays empty. Entries that were placed but
+ *				not all written also give STATUS_IO_ERROR, with indices set.
+ */
+Status Volume::addFiles( SessionState & session, vector<DirectoryEntry> & entries, vector<uint32_t> & indices, uint32_t reserved ) {
+
+	// Listings no longer match the image
+	treeChanged();
+
+	// Read file contents
+	vector<uint32_t> clusterChain;
+	uint8_t * contents = getFileContents( session.directoryCluster, clusterChain );
+
+	if ( contents == NULL )
+		return STATUS_IO_ERROR;
+
+	uint32_t size = clusterChain.size() * this->bytesPerCluster,
+			 position = 0,
+			 start = 0,
+			 count = 0;
+
+	bool tail = false,
+		 written = true;
+	vector<uint32_t> offsets;
+
+	// Look for enough free entries, each search picks up where the last one stopped
+	for ( uint32_t i = 0; i < entries.size(); i++ ) {
+
+		uint32_t entriesNeeded = entries[i].longEntries.size() + 1;
+
+		while ( !tail && count < entriesNeeded ) {
+
+			// Everything from here to the end of the directory is free, and
+			// a free block running up to the end carries on into new clusters
+			if ( position == size || contents[ position ] == DIR_LAST_FREE_ENTRY ) {
+
+				if ( count == 0 )
+					start = position;
+
+				tail = true;
+			}
+
+			// Start or grow a block
+			else if ( contents[ position ] == DIR_FREE_ENTRY ) {
+
+				if ( count++ == 0 ) 
+					start = position;
+
+				position += DIR_ENTRY_SIZE;
+			}
+
+			// Contiguous block broken
+			else {
+
+				count = 0;
+				position += DIR_ENTRY_SIZE;
+			}
+		}
+
+		offsets.push_back( start );
+		start += entriesNeeded * DIR_ENTRY_SIZE;
+
+		if ( !tail ) {
+
+			count = 0;
+			position = start;
+		}
+	}
+
+	// Check if we need to resize
+	if ( tail && start > size ) {
+
+		uint32_t clustersNeeded = ceil( static_cast<double>( start - size ) / this->bytesPerCluster );
+
+		// Check if we have enough space in the file system
+		if ( availableClusters() < clustersNeeded ) {
+
+			delete[] contents;
+			return STATUS_NO_SPACE;
+		}
+
+		if ( ( size + ( clustersNeeded * this->bytesPerCluster ) ) > DIR_MAX_SIZE ) {
+
+			delete[] contents;
+			return STATUS_TOO_LARGE;
+		}
+
+		// Otherwise resize, which also writes out any reserved clusters
+		written = resize( clustersNeeded, clusterChain );
+		session.listing.setClusterChain( clusterChain );
+
+		// New clusters are zeroed here, every one of them gets written back below
+		uint8_t * grown = new uint8_t[ clusterChain.size() * this->bytesPerCluster ];
+		memcpy( grown, contents, size );
+		memset( grown + size, 0, ( clusterChain.size() * this->bytesPerCluster ) - size );
+
+		delete[] contents;
+		contents = grown;
+
+	} else if ( reserved > 0 )
+		written = writeFAT();
+
+	// Write new entries to contents
+	for ( uint32_t i = 0; i < entries.size(); i++ ) {
+
+		DirectoryEntry & entry = entries[i];
+		uint32_t currentPosition = offsets[i];
+
+		// Write long entries
+		for ( uint8_t j = 0; j < entry.longEntries.size(); j++ ) {
+
+			memcpy( contents + currentPosition, &entry.longEntries[j], sizeof( entry.longEntries[j] ) - sizeof( uint32_t ) );
+			entry.longEntries[j].location = calculateDirectoryEntryLocation( currentPosition, clusterChain );
+			currentPosition += DIR_ENTRY_SIZE;
+		}
+
+		// Write Short Entry
+		memcpy( contents + currentPosition, &entry.shortEntry, sizeof( entry.shortEntry ) - sizeof( uint32_t ) );
+		entry.shortEntry.location = calculateDirectoryEntryLocation( currentPosition, clusterChain );
+	}
+
+	// Flush the clusters we touched to disk
+	uint32_t firstCluster = offsets.front() / this->bytesPerCluster,
+			 lastCluster = ( offsets.back() + ( entries.back().longEntries.size() + 1 ) * DIR_ENTRY_SIZE - 1 ) / this->bytesPerCluster;
+
+	vector<uint32_t> touched( clusterChain.begin() + firstCluster, clusterChain.begin() + lastCluster + 1 );
+	written &= writeFileContents( contents + firstCluster * this->bytesPerCluster, touched );
+	written &= this->cache.flush();
+
+	delete[] contents;
+
+	for ( uint32_t i = 0; i < entries.size(); i++ )
+		indices.push_back( session.listing.insert( entries[i].shortEntry, entries[i].name, 
+																 offsets[i] / DIR_ENTRY_SIZE, entries[i].longEntries.size() ) );
+
+	return written ? STATUS_OK : STATUS_IO_ERROR;
+}
+
+/**
+ * Allocate Cluster
+ * Description: Next-fit search for a free cluster starting at hint and wrapping
+ *				around the end of the FAT. Takes the cluster off the free count
+ *				and advances the FSInfo next free rotor past it.
+ * Expects: at least one free cluster to be available.
+ */
+uint32_t Volume::allocateCluster( uint32_t hint ) {
+
+	uint32_t range = this->countOfClusters + 2;
+	uint32_t cluster = ( hint < 2 || hint >= range ) ? this->fsInfo.nextFree : hint;
+
+	for ( uint32_t i = 0; i < this->countOfClusters; i++ ) {
+
+		if ( isFreeCluster( getFATEntry( cluster ) ) )
+			break;
+
+		if ( ++cluster >= range )
+			cluster = 2;
+	}
+
+	this->fsInfo.freeCount--;
+	this->fsInfo.nextFree = ( cluster + 1 >= range ) ? 2 : cluster + 1;
+
+	return cluster;
+}
+
+/**
+ * Append File Contents
+ * Description: Guts of append. Adds data to the end of an open file. The
+ *				tail comes straight from the handle's cached extents, the
+ *				slack in it is filled first and clusters are only allocated
+ *				for what spills over. The directory entry is rewritten once.
+ *				Returns STATUS_IO_ERROR, leaving the size alone, when the data
+ *				couldn't be written.
+ */
+Status Volume::appendFile( SessionState & session, uint32_t handle, const string & quotedData ) {
+
+	OpenFile & file = this->openFileTable[ handle ];
+
+	// Check permissions
+	if ( !( file.mode & WRITE ) )
+		return STATUS_NOT_WRITABLE;
+
+	if ( quotedData.empty() )
+		return STATUS_OK;
+
+	uint32_t oldSize = file.shortEntry.fileSize;
+	uint64_t requiredSize = static_cast<uint64_t>( oldSize ) + quotedData.length(),
+			 allocatedSize = 0;
+	bool written = true;
+
+	for ( uint32_t i = 0; i < file.extents.size(); i++ )
+		allocatedSize += static_cast<uint64_t>( file.extents[i].length ) * this->bytesPerCluster;
+
+	// Allocate only what spills past the tail cluster
+	if ( requiredSize > allocatedSize ) {
+
+		uint32_t clustersNeeded = ceil( static_cast<double>( requiredSize - allocatedSize ) / this->bytesPerCluster );
+
+		// Check if we have enough free space left or if the file has reached its max size
+		if ( availableClusters() < clustersNeeded )
+			return STATUS_NO_SPACE;
+
+		if ( allocatedSize + static_cast<uint64_t>( clustersNeeded ) * this->bytesPerCluster > FILE_MAX_SIZE )
+			return STATUS_TOO_LARGE;
+
+		// Grow from the tail cluster, or from nothing for an empty file
+		vector<uint32_t> tail( 1, file.extents.empty() ? 0 : file.extents.back().start + file.extents.back().length - 1 );
+		bool empty = file.extents.empty();
+
+		written = resize( clustersNeeded, tail );
+
+		vector<Extent> added;
+		buildExtents( vector<uint32_t>( tail.begin() + ( empty ? 0 : 1 ), tail.end() ), added );
+
+		for ( uint32_t i = 0; i < added.size(); i++ ) {
+
+			if ( !file.extents.empty() && file.extents.back().start + file.extents.back().length == added[i].start )
+				file.extents.back().length += added[i].length;
+
+			else
+				file.extents.push_back( added[i] );
+		}
+
+		allocatedSize += static_cast<uint64_t>( clustersNeeded ) * this->bytesPerCluster;
+	}
+
+	// Collect just the clusters the new data lands in, walking back from the tail
+	uint64_t extentOffset = 0;
+	uint32_t first = file.extents.size();
+
+	for ( uint64_t end = allocatedSize; first > 0; ) {
+
+		first--;
+		extentOffset = end - static_cast<uint64_t>( file.extents[ first ].length ) * this->bytesPerCluster;
+
+		if ( extentOffset <= oldSize )
+			break;
+
+		end = extentOffset;
+	}
+
+	vector<Extent> tailExtents( file.extents.begin() + first, file.extents.end() );
+	vector<uint32_t> clusterChain;
+	expandExtents( tailExtents, clusterChain );
+
+	// Write Data
+	bool appended = writeChainBytes( clusterChain, oldSize - extentOffset, reinterpret_cast<const uint8_t *>( quotedData.data() ), quotedData.length() );
+	appended &= this->cache.flush();
+
+	// One directory entry write covers the new size, which only grows once
+	// the data is out. New clusters are kept either way
+	file.shortEntry.firstClusterHI = ( file.extents[0].start >> 16 );
+	file.shortEntry.firstClusterLO = ( file.extents[0].start & 0x0000FFFF );
+	file.shortEntry.fileSize = appended ? requiredSize : oldSize;
+	file.shortEntry.attributes |= ATTR_ARCHIVE;
+	written &= writeDirectoryEntry( session, file.shortEntry );
+
+	file.position = file.shortEntry.fileSize;
+
+	return written && appended ? STATUS_OK : STATUS_IO_ERROR;
+}
+
+/**
+ * Append Long Name
+ * Description: Appends the UTF-16 name characters of a raw long directory
+ *				entry to units. Returns false once the name's null terminator
+ *				or padding has been reached.
+ */
+bool Volume::appendLongName( uint16_t * units, uint32_t & unitCount, const uint8_t * entry ) const {
+
+	// Byte offsets of name1, name2 and name3 characters within the entry
+	static const uint8_t offsets[ LONG_NAME_LENGTH ] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+	for ( uint32_t i = 0; i < LONG_NAME_LENGTH; i++ ) {
+
+		uint16_t character = entry[ offsets[i] ] | ( entry[ offsets[i] + 1 ] << 8 );
+
+		// Check if current character is padding space or null terminator
+		if ( character == LONG_NAME_TRAIL || character == LONG_NAME_NULL )
+			return false;
+
+		units[ unitCount++ ] = character;
+	}
+
+	return true;
+}
+
+/**
+ * Append UTF-8
+ * Description: Encodes UTF-16 units as UTF-8 onto the end of a string.
+ *				Unpaired surrogates become U+FFFD.
+ */
+void Volume::appendUTF8( string & current, const uint16_t * units, uint32_t unitCount ) const {
+
+	for ( uint32_t i = 0; i < unitCount; i++ ) {
+
+		uint32_t codePoint = units[i];
+
+		// Combine surrogate pairs
+		if ( codePoint >= 0xD800 && codePoint <= 0xDBFF && i + 1 < unitCount && units[ i + 1 ] >= 0xDC00 && units[ i + 1 ] <= 0xDFFF )
+			codePoint = 0x10000 + ( ( codePoint - 0xD800 ) << 10 ) + ( units[ ++i ] - 0xDC00 );
+
+		else if ( codePoint >= 0xD800 && codePoint <= 0xDFFF )
+			codePoint = 0xFFFD;
+
+		if ( codePoint < 0x80 )
+			current += static_cast<char>( codePoint );
+
+		else if ( codePoint < 0x800 ) {
+
+			current += static_cast<char>( 0xC0 | ( codePoint >> 6 ) );
+			current += static_cast<char>( 0x80 | ( codePoint & 0x3F ) );
+
+		} else if ( codePoint < 0x10000 ) {
+
+			current += static_cast<char>( 0xE0 | ( codePoint >> 12 ) );
+			current += static_cast<char>( 0x80 | ( ( codePoint >> 6 ) & 0x3F ) );
+			current += static_cast<char>( 0x80 | ( codePoint & 0x3F ) );
+
+		} else {
+
+			current += static_cast<char>( 0xF0 | ( codePoint >> 18 ) );
+			current += static_cast<char>( 0x80 | ( ( codePoint >> 12 ) & 0x3F ) );
+			current += static_cast<char>( 0x80 | ( ( codePoint >> 6 ) & 0x3F ) );
+			current += static_cast<char>( 0x80 | ( codePoint & 0x3F ) );
+		}
+	}
+}
+
+/**
+ * Available Clusters
+ * Description: Returns how many free clusters may still be allocated, the
+ *				ones promised to buffered handles aside.
+ */
+inline uint32_t Volume::availableClusters() const {
+
+	return this->fsInfo.freeCount > this->promisedClusters ? this->fsInfo.freeCount - this->promisedClusters : 0;
+}
+
+/**
+ * Buffer File Contents
+ * Description: Guts of write for buffered handles. Copies data into the
+ *				handle's cluster sized dirty pages instead of the image, a
+ *				page picks up what the file already holds the first time it
+ *				is touched. Everything goes out in one flush once enough is
+ *				buffered or the oldest buffered write is old enough.
+ *				Returns STATUS_IO_ERROR, having buffered only what came before
+ *				it, when a page's old contents couldn't be read.
+ */
+Status Volume::bufferFile( SessionState & session, uint32_t handle, uint32_t startPos, const string & quotedData ) {
+
+	OpenFile & file = this->openFileTable[ handle ];
+
+	// Check permissions
+	if ( !( file.mode & WRITE ) )
+		return STATUS_NOT_WRITABLE;
+
+	// Append handles always write at the end of what has been buffered so far
+	if ( file.mode & APPEND )
+		startPos = file.bufferedSize;
+
+	uint64_t requiredSize = static_cast<uint64_t>( startPos ) + quotedData.length(),
+			 allocatedSize = 0;
+
+	for ( uint32_t i = 0; i < file.extents.size(); i++ )
+		allocatedSize += static_cast<uint64_t>( file.extents[i].length ) * this->bytesPerCluster;
+
+	// Make sure the flush will have room, by setting aside what it needs
+	// beyond what the handle was already promised
+	if ( requiredSize > allocatedSize ) {
+
+		uint32_t clustersNeeded = ceil( static_cast<double>( requiredSize - allocatedSize ) / this->bytesPerCluster );
+
+		if ( allocatedSize + static_cast<uint64_t>( clustersNeeded ) * this->bytesPerCluster > FILE_MAX_SIZE )
+			return STATUS_TOO_LARGE;
+
+		if ( clustersNeeded > file.promisedClusters ) {
+
+			if ( availableClusters() < clustersNeeded - file.promisedClusters )
+				return STATUS_NO_SPACE;
+
+			this->promisedClusters += clustersNeeded - file.promisedClusters;
+			file.promisedClusters = clustersNeeded;
+		}
+	}
+
+	// Pages nobody writes to again are aged out by the flush worker
+	if ( file.dirtyPages.empty() ) {
+
+		file.dirtySince = time( NULL );
+
+		if ( !this->flushThread.joinable() )
+			this->flushThread = thread( &Volume::flushWorker, this );
+	}
+
+	bool loaded = true;
+
+	for ( uint32_t written = 0; written < quotedData.length(); ) {
+
+		uint32_t position = startPos + written,
+				 page = position / this->bytesPerCluster,
+				 offset = position % this->bytesPerCluster,
+				 amount = min( this->bytesPerCluster - offset, static_cast<uint32_t>( quotedData.length() ) - written );
+
+		map< uint32_t, vector<uint8_t> >::iterator itr = file.dirtyPages.find( page );
+
+		if ( itr == file.dirtyPages.end() ) {
+
+			vector<uint8_t> & contents = file.dirtyPages[ page ];
+			uint64_t pageStart = static_cast<uint64_t>( page ) * this->bytesPerCluster;
+
+			contents.assign( this->bytesPerCluster, 0 );
+
+			// Keep whatever the file already holds in this page. A size past
+			// the end of the chain (check reports those) holds only zeros
+			uint32_t index = page, i = 0;
+			while ( i < file.extents.size() && index >= file.extents[i].length )
+				index -= file.extents[ i++ ].length;
+
+			if ( pageStart < file.shortEntry.fileSize && i < file.extents.size() ) {
+
+				loaded = this->cache.read( static_cast<uint64_t>( this->getFirstDataSectorOfCluster( file.extents[i].start + index ) ) * this->bpb.bytesPerSector,
+										   &contents[0], min( static_cast<uint64_t>( this->bytesPerCluster ), file.shortEntry.fileSize - pageStart ) );
+			}
+
+			// A page we couldn't fill would wipe what the file holds, stop short of it
+			if ( !loaded ) {
+
+				file.dirtyPages.erase( page );
+				requiredSize = position;
+				break;
+			}
+
+			itr = file.dirtyPages.find( page );
+		}
+
+		memcpy( &itr->second[ offset ], quotedData.data() + written, amount );
+		written += amount;
+	}
+
+	file.bufferedSize = max( static_cast<uint64_t>( file.bufferedSize ), requiredSize );
+	file.position = requiredSize;
+
+	if ( !loaded )
+		return STATUS_IO_ERROR;
+
+	if ( static_cast<uint64_t>( file.dirtyPages.size() ) * this->bytesPerCluster >= WRITE_BUFFER_SIZE 
+			|| time( NULL ) - file.dirtySince >= WRITE_BUFFER_SECONDS )
+		return flushFile( session, handle );
+
+	return STATUS_OK;
+}
+
+/**
+ * Build Extents
+ * Description: Collapses a cluster chain into runs of physically
+ *				contiguous clusters.
+ */
+void Volume::buildExtents( const vector<uint32_t> & clusterChain, vector<Extent> & extents ) const {
+
+	extents.clear();
+
+	for ( uint32_t i = 0; i < clusterChain.size(); i++ ) {
+
+		// Cluster 0 stands in for an empty file's chain
+		if ( clusterChain[i] == 0 )
+			continue;
+
+		if ( !extents.empty() && extents.back().start + extents.back().length == clusterChain[i] )
+			extents.back().length++;
+
+		else {
+
+			Extent extent;
+			extent.start = clusterChain[i];
+			extent.length = 1;
+			extents.push_back( extent );
+		}
+	}
+}
+
+/**
+ * Calculate Checksum
+ * Description: Uses the checksum algorithm from the specification
+ *				to calculate a checksum on a shortname to be placed
+ *				in Long Directory entries.
+ */
+inline uint8_t Volume::calculateChecksum( const uint8_t * shortName ) const {
+
+	uint8_t sum = 0;
+
+	for ( uint8_t i = 0; i < DIR_Name_LENGTH; i++ )
+		sum = ( ( sum & 1 ) ? 0x80 : 0 ) + ( sum >> 1 ) + shortName[i];
+
+	return sum;
+}
+
+/**
+ * Checksum Boot Sectors
+ * Description: Returns a checksum of a boot sector and FSInfo, cheap enough
+ *				to tell at mount whether a sidecar was written for them.
+ */
+uint64_t Volume::checksumBootSectors( const BIOSParameterBlock & bpb, const FSInfo & fsInfo ) const {
+
+	uint64_t checksum = 0xCBF29CE484222325ULL;
+	const uint8_t * bpbBytes = reinterpret_cast<const uint8_t *>( &bpb ),
+				  * fsInfoBytes = reinterpret_cast<const uint8_t *>( &fsInfo );
+
+	for ( uint32_t i = 0; i < sizeof( bpb ); i++ )
+		checksum = ( checksum ^ bpbBytes[i] ) * 0x100000001B3ULL;
+
+	for ( uint32_t i = 0; i < sizeof( fsInfo ); i++ )
+		checksum = ( checksum ^ fsInfoBytes[i] ) * 0x100000001B3ULL;
+
+	return checksum;
+}
+
+/**
+ * Calculate Directory Entry Location
+ * Description: Calculates exact byte location of a given directory entries relative byte
+ *				to the directory with the cluster chain associated with it
+ */
+inline uint32_t Volume::calculateDirectoryEntryLocation( uint32_t byte, const vector<uint32_t> & clusterChain ) const {
+
+	return ( this->getFirstDataSectorOfCluster( 
+				clusterChain[ byte / this->bytesPerCluster ] ) * this->bpb.bytesPerSector 
+		   ) + ( byte % this->bytesPerCluster );
+}
+
+/**
+ * Chain Length
+ * Description: Counts the clusters of a chain without building it. Gives up
+ *				after as many clusters as the volume holds, so a looping
+ *				chain can't hang the caller.
+ */
+uint32_t Volume::chainLength( uint32_t firstCluster ) const {
+
+	uint32_t range = this->countOfClusters + 2,
+			 length = 0;
+
+	for ( uint32_t cluster = firstCluster; cluster >= 2 && cluster < range && length < this->countOfClusters; cluster = getFATEntry( cluster ) )
+		length++;
+
+	return length;
+}
+
+/**
+ * Chain Requests
+ * Description: Appends one request per physically contiguous run of a
+ *				cluster chain to requests, each covering its part of buffer.
+ */
+void Volume::chainRequests( const vector<uint32_t> & clusterChain, uint8_t * buffer, bool write, vector<IORequest> & requests ) const {
+
+	for ( uint32_t i = 0; i < clusterChain.size(); ) {
+
+		uint32_t run = 1;
+		while ( i + run < clusterChain.size() && clusterChain[ i + run ] == clusterChain[ i + run - 1 ] + 1 )
+			run++;
+
+		IORequest request;
+		request.offset = static_cast<uint64_t>( this->getFirstDataSectorOfCluster( clusterChain[i] ) ) * this->bpb.bytesPerSector;
+		request.buffer = buffer;
+		request.length = static_cast<uint64_t>( run ) * this->bytesPerCluster;
+		request.write = write;
+		requests.push_back( request );
+
+		buffer += request.length;
+		i += run;
+	}
+}
+
+/**
+ * Check Chain
+ * Description: Follows a chain claiming each cluster for a new owner id in the
+ *				ownership map. Stops at cross-links, cycles, out of range links
+ *				and free clusters, recording a problem and the cluster the chain
+ *				should end at. Returns false if the chain is cross-linked, in
+ *				which case its real length is unknown.
+ */
+bool Volume::checkChain( uint32_t firstCluster, const string & path, CheckState & state, vector<uint32_t> & clusterChain ) const {
+
+	uint32_t range = this->countOfClusters + 2;
+	uint32_t id = ++state.nextChainId;
+	uint32_t cluster = firstCluster, previous = 0;
+	CheckProblem problem = { PROBLEM_INVALID_LINK, path, cluster, 0 };
+
+	while ( true ) {
+
+		if ( cluster < 2 || cluster >= range ) {
+
+			problem.kind = PROBLEM_INVALID_LINK;
+			problem.value = cluster;
+			break;
+		}
+
+		uint32_t expected = 0;
+		if ( !state.owners[ cluster ].compare_exchange_strong( expected, id ) ) {
+
+			problem.kind = ( expected == id ) ? PROBLEM_LOOP : PROBLEM_CROSS_LINK;
+			problem.value = cluster;
+			break;
+		}
+
+		clusterChain.push_back( cluster );
+		previous = cluster;
+
+		uint32_t next = getFATEntry( cluster );
+
+		if ( next >= EOC )
+			return true;
+
+		if ( isFreeCluster( next ) ) {
+
+			problem.kind = PROBLEM_FREE_LINK;
+			problem.value = cluster;
+			break;
+		}
+
+		cluster = next;
+	}
+
+	bool crossLinked = problem.kind == PROBLEM_CROSS_LINK;
+
+	lock_guard<mutex> lock( state.lock );
+
+	state.problems.push_back( problem );
+
+	// Cross-links can't be cut without losing someone's data
+	if ( previous != 0 && !crossLinked )
+		state.terminate.push_back( previous );
+
+	return !crossLinked;
+}
+
+/**
+ * Check Directory
+ * Description: What check does with each directory of the walk. Reads it
+ *				with positional I/O and checks every entry, queueing
+ *				subdirectories for whichever worker is free next.
+ */
+void Volume::checkDirectory( const CheckDirectory & directory, DirectoryQueue & queue, CheckState & state ) const {
+
+	vector<uint32_t> clusterChain;
+
+	// Only parse directories that aren't shared with another chain
+	if ( checkChain( directory.cluster, directory.path, state, clusterChain ) ) {
+
+		uint8_t * contents = new uint8_t[ clusterChain.size() * this->bytesPerCluster ];
+
+		if ( !readClusters( clusterChain, contents ) ) {
+
+			delete[] contents;
+
+			lock_guard<mutex> lock( state.lock );
+			state.failed = true;
+			return;
+		}
+
+		DirectoryListing listing = parseDirectoryContents( contents, clusterChain );
+		delete[] contents;
+
+		for ( uint32_t i = 0; i < listing.size(); i++ ) {
+
+			ShortDirectoryEntry entry = listing[i].shortEntry;
+			uint32_t firstCluster = formCluster( entry );
+			string path = directory.path + listing.name( i );
+
+			if ( listing.nameEquals( i, "." ) )
+				continue;
+
+			// .. names the parent, which is 0 for the root
+			if ( listing.nameEquals( i, ".." ) ) {
+
+				uint32_t expected = directory.parentCluster == this->bpb.rootCluster ? 0 : directory.parentCluster;
+
+				if ( firstCluster != expected ) {
+
+					CheckProblem problem = { PROBLEM_DOTDOT, directory.path, firstCluster, expected };
+
+					lock_guard<mutex> lock( state.lock );
+					state.problems.push_back( problem );
+					state.dotdotFixes.push_back( make_pair( directory.cluster, directory.parentCluster ) );
+				}
+
+				continue;
+			}
+
+			if ( isDirectory( entry ) ) {
+
+				if ( firstCluster == 0 )
+					continue;
+
+				CheckDirectory child;
+				child.cluster = firstCluster;
+				child.parentCluster = directory.cluster;
+				child.path = path + "/";
+
+				queueDirectory( queue, child );
+
+			} else if ( isFile( entry ) ) {
+
+				vector<uint32_t> fileChain;
+				bool lengthKnown = true;
+
+				if ( firstCluster != 0 )
+					lengthKnown = checkChain( firstCluster, path, state, fileChain );
+
+				uint64_t chainBytes = static_cast<uint64_t>( fileChain.size() ) * this->bytesPerCluster;
+
+				// Longer chains are fine, prealloc reserves past the size
+				if ( lengthKnown && entry.fileSize > chainBytes ) {
+
+					CheckProblem problem = { PROBLEM_SIZE, path, entry.fileSize, chainBytes };
+
+					entry.fileSize = chainBytes;
+
+					lock_guard<mutex> lock( state.lock );
+					state.problems.push_back( problem );
+					state.sizeFixes.push_back( entry );
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Convert Long Name Segment
+ * Description: Takes a piece of a given long name and sticks it 
+ *				into one of a Long Directory's name fields.
+ */
+void Volume::convertLongNameSegment( uint16_t * nameInStruct, uint8_t length, uint8_t & charLeft, bool & nullStored,
+									 const string & name ) const {
+
+	for ( uint8_t i = 0; i < length; i++ ) {
+
+		if ( charLeft != 0 )
+			nameInStruct[i] = name[ name.length() - charLeft-- ];
+
+		else if ( !nullStored ) {
+
+			nullStored = true;
+			nameInStruct[i] = LONG_NAME_NULL;
+		}
+
+		else
+			nameInStruct[i] = LONG_NAME_TRAIL;
+	}
+
+}
+
+/**
+ * Convert Short Name
+ * Description: Converts a ShortEntry's name to a string. Also accounts
+ *				for the implied '.'.
+ */
+const string Volume::convertShortName( uint8_t * name ) const {
+
+	string result = "";
+	bool trailFound = false;
+	bool connectionComplete = false;
+
+
+	// Iterate through name
+	for ( uint32_t i = 0; i < DIR_Name_LENGTH; i++ ) {
+
+		// Check if we have encountered padding
+		if ( name[i] == SHORT_NAME_SPACE_PAD ) {
+
+			trailFound = true;
+			continue;
+		}
+
+		// Otherwise keep appending to current
+		else {
+
+			// If we found a trail and we haven't already
+			// added the implied '.', add it
+			if ( !connectionComplete && trailFound ) {
+
+				connectionComplete = true;
+				result += '.';
+			}
+
+			char temp = *(name + i);
+			result += temp;
+		}
+	}
+
+	return result;
+}
+
+/**
+ * Copy Clusters
+ * Description: Copies count physically contiguous clusters starting at from
+ *				over to the ones starting at to. Run by the pool. Sets copied
+ *				to whether both the read and the write worked.
+ */
+void Volume::copyClusters( uint32_t from, uint32_t to, uint32_t count, bool & copied ) {
+
+	vector<uint8_t> buffer( static_cast<uint64_t>( count ) * this->bytesPerCluster );
+
+	copied = this->cache.read( static_cast<uint64_t>( this->getFirstDataSectorOfCluster( from ) ) * this->bpb.bytesPerSector, &buffer[0], buffer.size() )
+			 && this->cache.write( static_cast<uint64_t>( this->getFirstDataSectorOfCluster( to ) ) * this->bpb.bytesPerSector, &buffer[0], buffer.size() );
+}
+
+/**
+ * Count Extents
+ * Description: Returns the number of physically contiguous runs a cluster
+ *				chain is made of.
+ */
+uint32_t Volume::countExtents( const vector<uint32_t> & clusterChain ) const {
+
+	uint32_t extents = 0;
+
+	for ( uint32_t i = 0; i < clusterChain.size(); i++ )
+		if ( i == 0 || clusterChain[i] != clusterChain[ i - 1 ] + 1 )
+			extents++;
+
+	return extents;
+}
+
+/**
+ * Create Entries
+ * Description: Guts of create and mkdir. Builds an entry for every name
+ *				that is free to use and adds them all to a session's
+ *				directory in one go, results gets why each of the others
+ *				was skipped. New directories get their cluster with . and ..
+ *				written out before anything points at it.
+ */
+Status Volume::createEntries( SessionState & session, const vector<string> & names, bool directory, vector<Status> & results ) {
+
+	// Names can't be checked against a listing we couldn't read
+	if ( !session.readable )
+		return STATUS_IO_ERROR;
+
+	// Names already taken in this directory, including the ones we are adding
+	map<string, uint8_t> existing;
+	set<string> shortNames;
+
+	for ( uint32_t i = 0; i < session.listing.size(); i++ ) {
+
+		const ShortDirectoryEntry & shortEntry = session.listing[i].shortEntry;
+
+		existing[ session.listing.name( i ) ] = shortEntry.attributes;
+		shortNames.insert( string( reinterpret_cast<const char *>( shortEntry.name ), DIR_Name_LENGTH ) );
+	}
+
+	vector<DirectoryEntry> entries;
+	results.assign( names.size(), STATUS_OK );
+
+	for ( uint32_t i = 0; i < names.size(); i++ ) {
+
+		// Check if name is valid
+		if ( !isValidEntryName( names[i] ) ) {
+
+			results[i] = STATUS_INVALID_NAME;
+			continue;
+		}
+
+		map<string, uint8_t>::const_iterator found = existing.find( names[i] );
+
+		if ( found != existing.end() ) {
+
+			results[i] = ( directory && found->second != ATTR_DIRECTORY ) ? STATUS_NOT_A_DIRECTORY : STATUS_EXISTS;
+			continue;
+		}
+
+		DirectoryEntry entry;
+
+		if ( ( results[i] = makeFile( session, names[i], entry, directory, shortNames ) ) == STATUS_OK ) {
+
+			existing[ names[i] ] = entry.shortEntry.attributes;
+			shortNames.insert( string( reinterpret_cast<const char *>( entry.shortEntry.name ), DIR_Name_LENGTH ) );
+			entries.push_back( entry );
+		}
+	}
+
+	if ( entries.empty() )
+		return STATUS_OK;
+
+	vector<uint32_t> clusters;
+
+	if ( directory ) {
+
+		if ( availableClusters() < entries.size() )
+			return STATUS_NO_SPACE;
+
+		uint8_t * contents = new uint8_t[ this->bytesPerCluster ];
+		uint32_t hint = session.directoryCluster;
+		bool written = true;
+
+		// Root directory must always have cluster values of 0
+		uint32_t parentCluster = session.directoryCluster == this->bpb.rootCluster ? 0 : session.directoryCluster;
+
+		for ( uint32_t i = 0; i < entries.size(); i++ ) {
+
+			// Reserve one cluster per directory near its parent, the FAT goes out with the listing
+			uint32_t cluster = allocateCluster( hint );
+			setClusterValue( cluster, EOC );
+			clusters.push_back( cluster );
+			hint = cluster + 1;
+
+			ShortDirectoryEntry & directoryEntry = entries[i].shortEntry;
+			directoryEntry.firstClusterHI = ( cluster >> 16 );
+			directoryEntry.firstClusterLO = ( cluster & 0x0000FFFF );
+
+			// Setup dot directory
+			uint8_t dotName[11] = { '.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ' };
+			ShortDirectoryEntry dot = directoryEntry;
+			memcpy( dot.name, dotName, DIR_Name_LENGTH );
+			dot.attributes = ATTR_DIRECTORY;
+			dot.fileSize = 0;
+
+			// Setup dotdot directory
+			uint8_t dotdotName[11] = { '.', '.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ' };
+			ShortDirectoryEntry dotdot = dot;
+			memcpy( dotdot.name, dotdotName, DIR_Name_LENGTH );
+			dotdot.firstClusterHI = ( parentCluster >> 16 );
+			dotdot.firstClusterLO = ( parentCluster & 0x0000FFFF );
+
+			// Nothing points at this cluster yet so it can go out right away
+			memset( contents, 0, this->bytesPerCluster );
+			memcpy( contents, &dot, DIR_ENTRY_SIZE );
+			memcpy( contents + DIR_ENTRY_SIZE, &dotdot, DIR_ENTRY_SIZE );
+
+			written &= this->cache.write( static_cast<uint64_t>( this->getFirstDataSectorOfCluster( cluster ) ) * this->bpb.bytesPerSector, contents, this->bytesPerCluster );
+		}
+
+		delete[] contents;
+		written &= this->cache.flush();
+
+		// Nothing may point at a cluster whose . and .. didn't make it out
+		if ( !written ) {
+
+			for ( uint32_t i = 0; i < clusters.size(); i++ ) {
+
+				setClusterValue( clusters[i], FREE_CLUSTER );
+				this->fsInfo.freeCount++;
+			}
+
+			return STATUS_IO_ERROR;
+		}
+	}
+
+	vector<uint32_t> indices;
+	Status status = addFiles( session, entries, indices, clusters.size() );
+
+	// Hand the directory clusters back if there was no room, the disk never saw
+	// them. Entries that were placed keep theirs even if writing them failed
+	if ( status != STATUS_OK && indices.empty() )
+		for ( uint32_t i = 0; i < clusters.size(); i++ ) {
+
+			setClusterValue( clusters[i], FREE_CLUSTER );
+			this->fsInfo.freeCount++;
+		}
+
+	return status;
+}
+
+/**
+ * Decode Long Name
+ * Description: Returns the UTF-8 name held by a run of raw long directory
+ *				entries given in on-disk order (last piece first).
+ */
+const string Volume::decodeLongName( const uint8_t * longEntries, uint32_t count ) const {
+
+	uint16_t units[ LONG_ENTRY_MAX * LONG_NAME_LENGTH ];
+	uint32_t unitCount = 0;
+	string name;
+
+	for ( uint32_t i = count; i-- > 0; )
+		if ( !appendLongName( units, unitCount, longEntries + i * DIR_ENTRY_SIZE ) )
+			break;
+
+	appendUTF8( name, units, unitCount );
+
+	return name;
+}
+
+/**
+ * Defragment Entry
+ * Description: Guts of defrag. Directories have their children handled first and
+ *				are then moved themselves, patching their . entry and the .. entry
+ *				of every child directory. Data is copied before any link changes,
+ *				then the new chain is linked, the directory entry repointed and the
+ *				old chain freed so a crash never leaves the entry on free clusters.
+ */
+void Volume::defragEntry( ShortDirectoryEntry entry, const string & path, DefragProgress & progress ) {
+
+	uint32_t firstCluster = formCluster( entry );
+
+	// Empty files have nothing to move
+	if ( firstCluster == 0 )
+		return;
+
+	if ( isDirectory( entry ) ) {
+
+		vector<uint32_t> directoryChain;
+		uint8_t * contents = getFileContents( firstCluster, directoryChain );
+
+		// Children we can't see can't be repointed, leave the whole directory be
+		if ( contents == NULL ) {
+
+			progress.complete = false;
+			return;
+		}
+
+		DirectoryListing listing = parseDirectoryContents( contents, directoryChain );
+		delete[] contents;
+
+		for ( uint32_t i = 0; i < listing.size(); i++ )
+			if ( !listing.nameEquals( i, "." ) && !listing.nameEquals( i, ".." ) )
+				defragEntry( listing[i].shortEntry, path + "/" + listing.name( i ), progress );
+	}
+
+	vector<uint32_t> clusterChain;
+	getClusterChain( firstCluster, clusterChain );
+
+	uint32_t extents = countExtents( clusterChain );
+	uint64_t chainBytes = static_cast<uint64_t>( clusterChain.size() ) * this->bytesPerCluster;
+
+	DefragReport & report = progress.report;
+	report.chainsChecked++;
+
+	if ( extents <= 1 )
+		return;
+
+	report.chainsFragmented++;
+
+	DefragChain chain;
+	chain.path = path;
+	chain.clusters = clusterChain.size();
+	chain.fragments = extents;
+	chain.runs = 0;
+	chain.bytesMovedSoFar = 0;
+
+	// Respect the byte budget
+	if ( progress.budget != 0 && report.bytesMoved + chainBytes > progress.budget )
+		chain.outcome = DEFRAG_OVER_BUDGET;
+
+	else if ( availableClusters() < clusterChain.size() )
+		chain.outcome = DEFRAG_NO_SPACE;
+
+	else
+		chain.outcome = DEFRAG_MOVED;
+
+	// Only move if we actually end up less fragmented
+	vector<uint32_t> runs;
+
+	if ( chain.outcome == DEFRAG_MOVED ) {
+
+		findFreeRuns( clusterChain.size(), this->fsInfo.nextFree, runs );
+
+		if ( runs.size() / 2 >= extents )
+			chain.outcome = DEFRAG_NO_LARGER_RUN;
+	}
+
+	if ( chain.outcome != DEFRAG_MOVED ) {
+
+		report.chainsSkipped++;
+		report.chains.push_back( chain );
+		return;
+	}
+
+	vector<uint32_t> newChain;
+	for ( uint32_t i = 0; i < runs.size(); i += 2 )
+		for ( uint32_t cluster = runs[i]; cluster < runs[i] + runs[ i + 1 ]; cluster++ )
+			newChain.push_back( cluster );
+
+	// Copy data first, coalescing wherever both old and new clusters are
+	// contiguous. Each run is its own chunk for the pool
+	dropPrefetched();
+
+	uint32_t clustersPerBuffer = max( READ_BUFFER_SIZE / this->bytesPerCluster, static_cast<uint32_t>( 1 ) ),
+			 remaining = 0;
+	deque<bool> copied;
+
+	for ( uint32_t i = 0; i < clusterChain.size(); ) {
+
+		uint32_t run = 1;
+		while ( run < clustersPerBuffer && i + run < clusterChain.size()
+				&& clusterChain[ i + run ] == clusterChain[ i + run - 1 ] + 1
+				&& newChain[ i + run ] == newChain[ i + run - 1 ] + 1 )
+			run++;
+
+		copied.push_back( false );
+		this->pool.run( bind( &Volume::copyClusters, this, clusterChain[i], newChain[i], run, ref( copied.back() ) ), remaining );
+
+		i += run;
+	}
+
+	this->pool.wait( remaining );
+
+	// Moved directories name their new chain in every child's .., read
+	// from the copy so children moved above are seen where they are now
+	DirectoryListing listing;
+	bool readable = count( copied.begin(), copied.end(), false ) == 0;
+
+	if ( readable && isDirectory( entry ) ) {
+
+		uint8_t * contents = getChainContents( newChain );
+		readable = contents != NULL;
+
+		if ( readable ) {
+
+			listing = parseDirectoryContents( contents, newChain );
+			delete[] contents;
+		}
+	}
+
+	// Nothing points at the new clusters yet, the chain simply stays put
+	if ( !readable ) {
+
+		chain.outcome = DEFRAG_IO_ERROR;
+		report.chainsSkipped++;
+		report.chains.push_back( chain );
+		return;
+	}
+
+	// Link the new chain while the old one is still allocated
+	for ( uint32_t i = 0; i + 1 < newChain.size(); i++ )
+		setClusterValue( newChain[i], newChain[ i + 1 ] );
+
+	setClusterValue( newChain.back(), EOC );
+	this->fsInfo.freeCount -= newChain.size();
+	this->fsInfo.nextFree = ( newChain.back() + 1 >= this->countOfClusters + 2 ) ? 2 : newChain.back() + 1;
+	bool written = writeFAT();
+
+	// Repoint the directory entry
+	entry.firstClusterHI = ( newChain[0] >> 16 );
+	entry.firstClusterLO = ( newChain[0] & 0x0000FFFF );
+	written &= this->cache.write( entry.location, &entry, DIR_ENTRY_SIZE );
+
+	// Moved directories carry their own . and are named by their children's ..
+	if ( isDirectory( entry ) ) {
+
+		written &= setDotEntryCluster( newChain[0], 0, newChain[0] );
+
+		for ( uint32_t i = 0; i < listing.size(); i++ )
+			if ( isDirectory( listing[i].shortEntry ) && !listing.nameEquals( i, "." ) && !listing.nameEquals( i, ".." )
+					&& formCluster( listing[i].shortEntry ) != 0 )
+				written &= setDotEntryCluster( formCluster( listing[i].shortEntry ), 1, newChain[0] );
+	}
+
+	written &= this->cache.flush();
+
+	// The image may still point at the old chain, it stays allocated for
+	// check to find rather than being handed out again
+	if ( !written ) {
+
+		progress.complete = false;
+		return;
+	}
+
+	// Handles and sessions inside a moved directory have to follow it
+	if ( isDirectory( entry ) )
+		for ( uint32_t i = 0; i < clusterChain.size(); i++ )
+			progress.moved[ clusterChain[i] ] = newChain[i];
+
+	// Finally release the old chain
+	for ( uint32_t i = 0; i < clusterChain.size(); i++ )
+		setClusterValue( clusterChain[i], FREE_CLUSTER );
+
+	this->fsInfo.freeCount += clusterChain.size();
+	progress.complete &= writeFAT();
+
+	report.bytesMoved += chainBytes;
+	report.chainsMoved++;
+
+	chain.runs = runs.size() / 2;
+	chain.bytesMovedSoFar = report.bytesMoved;
+	report.chains.push_back( chain );
+}
+
+/**
+ * Directory Worker
+ * Description: Body of every worker of a directory walk. Takes directories
+ *				off the shared queue and visits them until nothing is queued
+ *				and no other worker can queue more.
+ */
+void Volume::directoryWorker( DirectoryQueue & queue, const DirectoryVisitor & visit ) const {
+
+	while ( true ) {
+
+		CheckDirectory directory;
+
+		{
+			unique_lock<mutex> lock( queue.lock );
+
+			// Done once nothing is queued and nobody can queue more
+			while ( queue.pending.empty() && queue.activeWorkers > 0 )
+				queue.ready.wait( lock );
+
+			if ( queue.pending.empty() )
+				return;
+
+			directory = queue.pending.front();
+			queue.pending.pop_front();
+			queue.activeWorkers++;
+		}
+
+		visit( directory, queue );
+
+		lock_guard<mutex> lock( queue.lock );
+		queue.activeWorkers--;
+		queue.ready.notify_all();
+	}
+}
+
+/**
+ * Drop Prefetched
+ * Description: Throws away readahead still queued for the helper. Called
+ *				before file data on disk changes so the helper doesn't spend
+ *				reads on clusters that are about to be rewritten.
+ */
+void Volume::dropPrefetched() {
+
+	lock_guard<mutex> lock( this->prefetchLock );
+
+	this->prefetchGeneration++;
+	this->prefetchQueue.clear();
+}
+
+/**
+ * Entry Name
+ * Description: Returns the name of the entry a directory cursor stopped on,
+ *				decoding its long entries only now.
+ */
+const string Volume::entryName( const DirectoryCursor & cursor ) const {
+
+	if ( cursor.longEntryCount > 0 && cursor.longEntryCount <= LONG_ENTRY_MAX )
+		return decodeLongName( cursor.longEntries, cursor.longEntryCount );
+
+	uint8_t shortName[ DIR_Name_LENGTH ];
+	memcpy( shortName, cursor.shortEntry.name, DIR_Name_LENGTH );
+
+	return convertShortName( shortName );
+}
+
+/**
+ * Expand Extents
+ * Description: Turns a list of extents back into a cluster chain.
+ */
+void Volume::expandExtents( const vector<Extent> & extents, vector<uint32_t> & clusterChain ) const {
+
+	for ( uint32_t i = 0; i < extents.size(); i++ )
+		for ( uint32_t j = 0; j < extents[i].length; j++ )
+			clusterChain.push_back( extents[i].start + j );
+}
+
+/**
+ * Find Free Runs
+ * Description: Picks free clusters totalling count as (start, length) pairs.
+ *				A single run large enough is taken next-fit from hint if one
+ *				exists, otherwise the largest runs are used so the result is
+ *				as unfragmented as possible. Runs come back in disk order.
+ * Expects: at least count free clusters to be available.
+ */
+void Volume::findFreeRuns( uint32_t count, uint32_t hint, vector<uint32_t> & runs ) const {
+
+	uint32_t range = this->countOfClusters + 2;
+	vector< pair<uint32_t, uint32_t> > allRuns;
+
+	if ( hint < 2 || hint >= range )
+		hint = 2;
+
+	// Collect every free run, starting at the hint so the first fit is next-fit
+	uint32_t i = hint;
+	uint32_t scanned = 0;
+	while ( scanned < this->countOfClusters ) {
+
+		if ( isFreeCluster( getFATEntry( i ) ) ) {
+
+			// Runs don't wrap around the end of the FAT
+			uint32_t start = i, length = 0;
+			while ( scanned < this->countOfClusters && i < range && isFreeCluster( getFATEntry( i ) ) ) {
+
+				length++;
+				scanned++;
+				i++;
+			}
+
+			if ( length >= count ) {
+
+				runs.push_back( start );
+				runs.push_back( count );
+				return;
+			}
+
+			allRuns.push_back( make_pair( length, start ) );
+
+		} else {
+
+			scanned++;
+			i++;
+		}
+
+		if ( i >= range )
+			i = 2;
+	}
+
+	// No single run fits, so take the biggest ones first
+	sort( allRuns.begin(), allRuns.end(), greater< pair<uint32_t, uint32_t> >() );
+
+	vector< pair<uint32_t, uint32_t> > chosen;
+	for ( uint32_t j = 0; j < allRuns.size() && count > 0; j++ ) {
+
+		uint32_t length = min( allRuns[j].first, count );
+		chosen.push_back( make_pair( allRuns[j].second, length ) );
+		count -= length;
+	}
+
+	sort( chosen.begin(), chosen.end() );
+
+	for ( uint32_t j = 0; j < chosen.size(); j++ ) {
+
+		runs.push_back( chosen[j].first );
+		runs.push_back( chosen[j].second );
+	}
+}
+
+/**
+ * Flush File
+ * Description: Writes out a buffered handle's dirty pages. The file grows
+ *				with one resize, runs of neighbouring pages go out together,
+ *				anything skipped over past the old end of file is zeroed and
+ *				the directory entry is written once. Buffered writes that no
+ *				longer fit are dropped and STATUS_WRITES_LOST is returned,
+ *				STATUS_IO_ERROR when the image refused the write, the pages
+ *				stay buffered for another try then.
+ */
+Status Volume::flushFile( SessionState & session, uint32_t handle ) {
+
+	OpenFile & file = this->openFileTable[ handle ];
+
+	// Whatever the handle was promised is allocated below or not needed
+	releasePromise( file );
+
+	if ( file.dirtyPages.empty() )
+		return STATUS_OK;
+
+	vector<uint32_t> clusterChain;
+	expandExtents( file.extents, clusterChain );
+
+	uint64_t allocatedSize = static_cast<uint64_t>( clusterChain.size() ) * this->bytesPerCluster;
+	bool written = true;
+
+	// Check if we need to resize the file
+	if ( file.bufferedSize > allocatedSize ) {
+
+		uint32_t clustersNeeded = ceil( static_cast<double>( file.bufferedSize - allocatedSize ) / this->bytesPerCluster );
+
+		// Promised space only falls short when check counted fewer free clusters
+		if ( availableClusters() < clustersNeeded ) {
+
+			file.dirtyPages.clear();
+			file.bufferedSize = file.shortEntry.fileSize;
+			return STATUS_WRITES_LOST;
+		}
+
+		// Empty files are represented by a lone cluster 0 for resize
+		if ( clusterChain.empty() )
+			clusterChain.push_back( 0 );
+
+		written = resize( clustersNeeded, clusterChain );
+		buildExtents( clusterChain, file.extents );
+	}
+
+	uint32_t zeroedUpTo = file.shortEntry.fileSize;
+	bool stored = true;
+
+	for ( map< uint32_t, vector<uint8_t> >::iterator itr = file.dirtyPages.begin(); itr != file.dirtyPages.end(); ) {
+
+		// Gather a run of neighbouring pages
+		uint32_t firstPage = itr->first;
+		vector<uint8_t> run;
+
+		while ( itr != file.dirtyPages.end() && itr->first == firstPage + run.size() / this->bytesPerCluster ) {
+
+			run.insert( run.end(), itr->second.begin(), itr->second.end() );
+			itr++;
+		}
+
+		uint32_t runStart = firstPage * this->bytesPerCluster;
+
+		// Anything skipped over past the old end of file must read back as zeros
+		if ( runStart > zeroedUpTo )
+			stored &= writeChainBytes( clusterChain, zeroedUpTo, NULL, runStart - zeroedUpTo );
+
+		stored &= writeChainBytes( clusterChain, runStart, &run[0], run.size() );
+		zeroedUpTo = max( zeroedUpTo, static_cast<uint32_t>( runStart + run.size() ) );
+	}
+
+	if ( file.bufferedSize > zeroedUpTo )
+		stored &= writeChainBytes( clusterChain, zeroedUpTo, NULL, file.bufferedSize - zeroedUpTo );
+
+	stored &= this->cache.flush();
+
+	// One directory entry write covers every buffered write. Pages that
+	// didn't all make it out stay buffered for the next flush and the size
+	// waits for them, the new clusters are kept either way
+	file.shortEntry.firstClusterHI = ( clusterChain[0] >> 16 );
+	file.shortEntry.firstClusterLO = ( clusterChain[0] & 0x0000FFFF );
+	file.shortEntry.attributes |= ATTR_ARCHIVE;
+
+	if ( stored ) {
+
+		file.shortEntry.fileSize = file.bufferedSize;
+		file.dirtyPages.clear();
+	}
+
+	written &= writeDirectoryEntry( session, file.shortEntry );
+
+	// The cache keeps whatever the image refused, a flush with nothing
+	// left dirty is free
+	return written && stored && this->cache.flush() ? STATUS_OK : STATUS_IO_ERROR;
+}
+
+/**
+ * Flush Files
+ * Description: Writes out the buffered writes of every open file. Returns
+ *				STATUS_WRITES_LOST if any of them no longer fit, otherwise the
+ *				first failure, the rest still go out.
+ */
+Status Volume::flushFiles( SessionState & session ) {
+
+	Status status = STATUS_OK;
+
+	for ( uint32_t i = 0; i < this->openFileTable.size(); i++ )
+		if ( this->openFileTable[i].inUse ) {
+
+			Status result = flushFile( session, i );
+
+			if ( result != STATUS_OK && status != STATUS_WRITES_LOST )
+				status = result;
+		}
+
+	return status;
+}
+
+/**
+ * Flush Open File
+ * Description: Writes out an open file's buffered writes on behalf of a
+ *				reader, taking the tree for itself while it does.
+ */
+Status Volume::flushOpenFile( const string & fileName, SessionState & session ) {
+
+	unique_lock<shared_mutex> writer( lockTree( session ) );
+	lock_guard<mutex> guard( this->fatLock );
+
+	uint32_t handle;
+	Status status = locateOpenFile( session, fileName, handle );
+
+	return status == STATUS_OK ? flushFile( session, handle ) : status;
+}
+
+/**
+ * Flush Worker
+ * Description: Body of the flush thread. Once a second, writes out every
+ *				buffered handle whose oldest write is WRITE_BUFFER_SECONDS
+ *				old. A flush the image refuses keeps its pages for the next
+ *				one, close reports it.
+ */
+void Volume::flushWorker() {
+
+	unique_lock<mutex> lock( this->flushLock );
+
+	while ( !this->stopping ) {
+
+		this->flushReady.wait_for( lock, chrono::seconds( 1 ) );
+
+		if ( this->stopping )
+			break;
+
+		lock.unlock();
+
+		// Most ticks find nothing due, which only needs the tree shared
+		bool due = false;
+
+		{
+			shared_lock<shared_mutex> reader( shareTree() );
+			time_t now = time( NULL );
+
+			for ( uint32_t i = 0; i < this->openFileTable.size() && !due; i++ )
+				due = this->openFileTable[i].inUse && !this->openFileTable[i].dirtyPages.empty()
+					  && now - this->openFileTable[i].dirtySince >= WRITE_BUFFER_SECONDS;
+		}
+
+		if ( due ) {
+
+			unique_lock<shared_mutex> writer( lockTree( this->console ) );
+			lock_guard<mutex> guard( this->fatLock );
+			time_t now = time( NULL );
+
+			for ( uint32_t i = 0; i < this->openFileTable.size(); i++ )
+				if ( this->openFileTable[i].inUse && !this->openFileTable[i].dirtyPages.empty()
+						&& now - this->openFileTable[i].dirtySince >= WRITE_BUFFER_SECONDS )
+					flushFile( this->console, i );
+		}
+
+		lock.lock();
+	}
+}
+
+/**
+ * Form Cluster
+ * Description: Concatenates the low and high order bits of a ShortDirectoryEntry
+ *				to form the cluster number of that entry.
+ */
+inline uint32_t Volume::formCluster( const ShortDirectoryEntry & entry ) const {
+
+	uint32_t result = 0;
+	result |= entry.firstClusterLO;
+	result |= entry.firstClusterHI << 16;
+
+	return result;
+}
+
+/**
+ * Free Chain
+ * Description: Frees a cluster chain in the in-memory FAT only, adding each
+ *				cluster to freed. Stops at clusters that are already free so
+ *				half deleted or cross-linked chains are never freed twice.
+ */
+void Volume::freeChain( uint32_t firstCluster, vector<uint32_t> & freed ) {
+
+	uint32_t range = this->countOfClusters + 2;
+
+	for ( uint32_t cluster = firstCluster; cluster >= 2 && cluster < range && !isFreeCluster( getFATEntry( cluster ) ); ) {
+
+		uint32_t next = getFATEntry( cluster );
+
+		setClusterValue( cluster, FREE_CLUSTER );
+		this->fsInfo.freeCount++;
+		freed.push_back( cluster );
+
+		cluster = next;
+	}
+}
+
+/**
+ * Generate Basis Name
+ * Description: Generates a basis-name from a long name. Will set if a 
+ *				lossy conversion was applied.
+ */
+const string Volume::generateBasisName( const string & longName, bool & lossyConversion ) const {
+
+	string shortCopy;
+	lossyConversion = false;
+
+	for ( uint8_t i = 0; i < longName.length(); i++ ) {
+
+		// Check invalid characters and covert to _
+		if ( longName[i] == '+' || longName[i] == ',' || longName[i] == ';' || longName[i] == '=' 
+			|| longName[i] == '['  || longName[i] == ']' ) {
+
+			lossyConversion = true;
+			shortCopy += '_';
+		}
+
+		// Skip over ' ' and possibly '.'
+		else if ( longName[i] == ' ' )
+			continue;
+
+		else if ( longName[i] == '.' && longName.find_last_of( "." ) != i )
+			continue;
+
+		// Otherwise capitalize
+		else 
+			shortCopy += toupper( longName[i] );
+	}
+
+    string basisName( DIR_Name_LENGTH, SHORT_NAME_SPACE_PAD );
+
+    // Copy in our results
+    for ( uint8_t i = 0; i < 8 && i < shortCopy.length() && shortCopy[i] != '.'; i++ )
+    	basisName[i] = shortCopy[i];
+
+    // Try to copy in extension
+    size_t period = shortCopy.find_last_of( "." );
+    if ( period != string::npos )
+    	for( uint8_t i = 0; i < 3 && ( ( period + 1 ) + i ) < shortCopy.length(); i++ )
+			basisName[ 8 + i ] = shortCopy[ ( period + 1 ) + i ];
+
+	return basisName;
+}
+
+/**
+ * Generate Numerical Tail
+ * Description: Uses the numeric-tail algorithm to figure out
+ *				what name a basis-name needs.
+ */
+string Volume::generateNumericTail( string basisName, const set<string> & shortNames ) const {
+
+	// Need to only ever occupy up to the length of 999999
+	char nBuffer[7] = {0};
+	string primaryName = basisName.substr( 0, 8 );
+	primaryName = primaryName.substr( 0, primaryName.find( " " ) );
+	string extension = basisName.substr( 8, string::npos );
+	string finalPrimaryName;
+
+	for ( uint32_t start = 1; start <= 999999; start++ ) {
+
+		// sprintf allows us to easily make a digit into a string
+		sprintf( nBuffer, "%d", start );
+
+		// Shorten primary name if necessary
+		finalPrimaryName = primaryName.substr( 0, min( primaryName.length(), 8 - ( strlen( nBuffer ) + 1 ) ) ) + "~" + nBuffer;
+		finalPrimaryName.resize( 8, SHORT_NAME_SPACE_PAD );
+
+		// Stop generating tails as soon as one works
+		if ( !shortNameExists( finalPrimaryName + extension, shortNames ) )
+			break;
+	}
+
+	string final = finalPrimaryName + extension;
+	final.resize( DIR_Name_LENGTH, SHORT_NAME_SPACE_PAD );
+
+	return final;
+}
+
+/**
+ * Get Chain Contents
+ * Description: Returns a buffer of the contents of a known cluster chain,
+ *				or NULL if the chain couldn't be read.
+ * Expects: a non-empty chain.
+ */
+uint8_t * Volume::getChainContents( const vector<uint32_t> & clusterChain ) const {
+
+	uint32_t size = clusterChain.size() * this->bytesPerCluster;
+
+	uint8_t * data = new uint8_t[ size ];
+
+	if ( !readClusters( clusterChain, data ) ) {
+
+		delete[] data;
+		return NULL;
+	}
+
+	return data;
+}
+
+/**
+ * Get Cluster Chain
+ * Description: Follows the FAT from a given initial cluster and appends
+ *				every cluster of the chain to clusterChain.
+ */
+void Volume::getClusterChain( uint32_t initialCluster, vector<uint32_t> & clusterChain ) const {
+
+	uint32_t nextCluster = initialCluster;
+
+	do {
+
+		clusterChain.push_back( nextCluster );
+
+	} while ( ( nextCluster = getFATEntry( nextCluster ) ) < EOC );
+}
+
+/**
+ * Get Directory Listing
+ * Description: Sets listing to the directory starting at a given cluster.
+ *				Returns false, leaving listing alone, if it couldn't be read.
+ * Expects: cluster to be a valid data cluster.
+ */
+bool Volume::getDirectoryListing( uint32_t cluster, DirectoryListing & listing ) const {
+
+	vector<uint32_t> clusterChain;
+	uint8_t * contents = getFileContents( cluster, clusterChain );
+
+	if ( contents == NULL )
+		return false;
+
+	listing = parseDirectoryContents( contents, clusterChain );
+
+	delete[] contents;
+
+	return true;
+}
+
+/**
+ * Next Directory Entry
+ * Description: Moves a directory cursor onto the next file or directory
+ *				entry, reading the directory a cluster at a time. Long entries
+ *				in front of it are kept raw so names cost nothing until asked
+ *				for. Returns false once the directory is exhausted.
+ */
+bool Volume::nextDirectoryEntry( DirectoryCursor & cursor ) const {
+
+	// Long entries of the entry handed out last time are done with
+	cursor.longEntryCount = 0;
+
+	while ( cursor.cluster != 0 ) {
+
+		// Move on to the next cluster of the directory
+		if ( cursor.offset == this->bytesPerCluster ) {
+
+			uint32_t next = getFATEntry( cursor.cluster );
+
+			if ( next >= EOC || next < 2 || next >= this->countOfClusters + 2 ) {
+
+				cursor.cluster = 0;
+				break;
+			}
+
+			cursor.cluster = next;
+			cursor.offset = 0;
+
+			if ( !this->cache.read( static_cast<uint64_t>( this->getFirstDataSectorOfCluster( cursor.cluster ) ) * this->bpb.bytesPerSector,
+									&cursor.buffer[0], this->bytesPerCluster ) ) {
+
+				cursor.cluster = 0;
+				cursor.failed = true;
+				break;
+			}
+		}
+
+		const uint8_t * entry = &cursor.buffer[ cursor.offset ];
+		uint8_t attribute = entry[ DIR_Attr ];
+		uint32_t location = this->getFirstDataSectorOfCluster( cursor.cluster ) * this->bpb.bytesPerSector + cursor.offset;
+
+		cursor.offset += DIR_ENTRY_SIZE;
+
+		// Rest of entries ahead of this are free
+		if ( entry[0] == DIR_LAST_FREE_ENTRY ) {
+
+			cursor.cluster = 0;
+			break;
+		}
+
+		// A deleted entry breaks up any long entry run
+		if ( entry[0] == DIR_FREE_ENTRY )
+			cursor.longEntryCount = 0;
+
+		// Hold on to long entries until their short entry turns up
+		else if ( ( attribute & ATTR_LONG_NAME_MASK ) == ATTR_LONG_NAME ) {
+
+			if ( cursor.longEntryCount < LONG_ENTRY_MAX )
+				memcpy( cursor.longEntries + cursor.longEntryCount * DIR_ENTRY_SIZE, entry, DIR_ENTRY_SIZE );
+
+			cursor.longEntryCount++;
+
+		} else {
+
+			uint8_t attr = attribute & ( ATTR_DIRECTORY | ATTR_VOLUME_ID );
+
+			memcpy( &cursor.shortEntry, entry, sizeof( ShortDirectoryEntry ) - sizeof( uint32_t ) );
+			cursor.shortEntry.location = location;
+
+			// Validate attribute
+			if ( attr == 0x00 || attr == ATTR_DIRECTORY || attr == ATTR_VOLUME_ID )
+				return true;
+
+			cursor.longEntryCount = 0;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Open Directory
+ * Description: Points a directory cursor at the first entry of the
+ *				directory starting at a given cluster. A cursor that runs into
+ *				a cluster it can't read ends there with failed set.
+ */
+void Volume::openDirectory( uint32_t cluster, DirectoryCursor & cursor ) const {
+
+	// .. entries name the root as cluster 0
+	if ( cluster == 0 )
+		cluster = this->bpb.rootCluster;
+
+	cursor.cluster = cluster;
+	cursor.offset = 0;
+	cursor.longEntryCount = 0;
+	cursor.failed = false;
+	cursor.buffer.resize( this->bytesPerCluster );
+
+	if ( !this->cache.read( static_cast<uint64_t>( this->getFirstDataSectorOfCluster( cluster ) ) * this->bpb.bytesPerSector,
+							&cursor.buffer[0], this->bytesPerCluster ) ) {
+
+		cursor.cluster = 0;
+		cursor.failed = true;
+	}
+}
+
+/**
+ * Parse Directory Contents
+ * Description: Returns the listing found in a directory's raw contents. Names
+ *				go back to back into the listing's arena as UTF-8 and each
+ *				entry is only remembered as the slot range it occupies. Touches no shared
+ *				state so it is safe to call from worker threads.
+ * Expects: contents to hold every cluster of clusterChain.
+ */
+DirectoryListing Volume::parseDirectoryContents( const uint8_t * contents, const vector<uint32_t> & clusterChain ) const {
+
+	uint32_t size = clusterChain.size() * this->bytesPerCluster;
+	uint32_t firstSlot = 0, longEntryCount = 0;
+	DirectoryListing result;
+
+	result.setClusterChain( clusterChain );
+
+	// Parse contents
+	for ( uint32_t i = 0; i < size; i += DIR_ENTRY_SIZE ) {
+
+		uint8_t ordinal = contents[i];
+		uint8_t attribute =  contents[i + DIR_Attr];
+
+		// Check if not free entry
+		if ( ordinal != DIR_FREE_ENTRY ) {
+
+			// Rest of entries ahead of this are free
+			if ( ordinal == DIR_LAST_FREE_ENTRY )
+				break;
+
+			// Check if this entry is a long directory, just note where the run starts
+			if ( ( attribute & ATTR_LONG_NAME_MASK ) == ATTR_LONG_NAME ) {
+
+				if ( longEntryCount++ == 0 )
+					firstSlot = i / DIR_ENTRY_SIZE;
+
+			// Otherwise it's a file
+			} else {
+
+				uint8_t attr = attribute & ( ATTR_DIRECTORY | ATTR_VOLUME_ID );
+
+				ShortDirectoryEntry tempShortEntry;
+				string name;
+				memcpy( &tempShortEntry, contents+i, sizeof( ShortDirectoryEntry ) - sizeof( uint32_t ) );
+				tempShortEntry.location = calculateDirectoryEntryLocation( i, clusterChain );
+
+				if ( longEntryCount > 0 && longEntryCount <= LONG_ENTRY_MAX )
+					name = decodeLongName( contents + firstSlot * DIR_ENTRY_SIZE, longEntryCount );
+
+				else
+					name = convertShortName( tempShortEntry.name );
+
+				if ( longEntryCount == 0 )
+					firstSlot = i / DIR_ENTRY_SIZE;
+
+				// Validate attribute
+				if ( attr == 0x00 || attr == ATTR_DIRECTORY || attr == ATTR_VOLUME_ID )
+					result.append( tempShortEntry, name, firstSlot, longEntryCount );
+
+				// Reset long entries
+				longEntryCount = 0;
+			}
+
+		// A deleted entry breaks up any long entry run
+		} else
+			longEntryCount = 0;
+	}
+
+	return result;
+}
+
+/**
+ * Get FAT Entry
+ * Description: Returns the value of a FAT entry without its upper 4 bits.
+ */
+inline uint32_t Volume::getFATEntry( uint32_t n ) const {
+
+	return this->fat[n] & FAT_ENTRY_MASK;
+}
+
+/**
+ * Get File Contents
+ * Description: Returns a buffer of the contents of a file starting at a given
+ *				initial cluster. Also sets the cluster chain of this buffer. 
+ *				This function will cause the program to abort if we are given 
+ *				a cluster that leads to an empty chain. NULL if it can't be
+ *				read.
+ */
+uint8_t * Volume::getFileContents( uint32_t initialCluster, vector<uint32_t> & clusterChain ) const {
+
+	// Build list of clusters for this file
+	getClusterChain( initialCluster, clusterChain );
+
+	return getChainContents( clusterChain );
+}
+
+/**
+ * Get Indexed Directory Listing
+ * Description: Sets listing to a directory's listing from the sidecar index
+ *				when it holds one, otherwise reads it and keeps it for the next
+ *				sidecar. Readers sharing the tree may get here together.
+ *				Returns false, keeping nothing, if it couldn't be read.
+ */
+bool Volume::getIndexedDirectoryListing( uint32_t cluster, DirectoryListing & listing ) {
+
+	if ( this->sidecarPath.empty() )
+		return getDirectoryListing( cluster, listing );
+
+	{
+		lock_guard<mutex> guard( this->indexLock );
+
+		map<uint32_t, DirectoryListing>::iterator itr = this->directoryIndex.find( cluster );
+
+		if ( itr != this->directoryIndex.end() ) {
+
+			listing = itr->second;
+			return true;
+		}
+	}
+
+	if ( !getDirectoryListing( cluster, listing ) )
+		return false;
+
+	lock_guard<mutex> guard( this->indexLock );
+	this->directoryIndex[ cluster ] = listing;
+
+	return true;
+}
+
+/**
+ * Get First Sector of Cluster
+ * Description: Returns the first data sector of a given cluster.
+ */
+inline uint32_t Volume::getFirstDataSectorOfCluster( uint32_t n ) const {
+
+	return ( ( n - 2 ) * this->bpb.sectorsPerCluster ) + this->firstDataSector;
+}
+
+/**
+ * Is Directory
+ * Description: Checks if given entry is a directory.
+ */
+inline bool Volume::isDirectory( const ShortDirectoryEntry & entry ) const {
+
+	return ( entry.attributes & ( ATTR_DIRECTORY | ATTR_VOLUME_ID ) ) == ATTR_DIRECTORY;
+}
+
+/**
+ * Is File
+ * Description: Checks if given entry is a file.
+ */
+inline bool Volume::isFile( const ShortDirectoryEntry & entry ) const {
+
+	return ( entry.attributes & ( ATTR_DIRECTORY | ATTR_VOLUME_ID ) ) == 0x00;
+}
+
+/**
+ * Is Free Cluster
+ * Description: Checks if given cluster's value represents that it's free.
+ */
+inline bool Volume::isFreeCluster( uint32_t value ) const {
+
+	return ( value == FREE_CLUSTER );
+}
+
+/**
+ * Is Valid Entry Name
+ * Description: Checks if a given entry name is valid. Library callers can
+ *				pass empty names, which fmod never does.
+ */
+inline bool Volume::isValidEntryName( const string & entryName ) const {
+
+	return !entryName.empty() && entryName.find( "/" ) == string::npos;	
+}
+
+/**
+ * Load Sidecar
+ * Description: Reads the free count, next free hint and directory index from
+ *				the sidecar. Only trusted when it was written against this
+ *				exact image: same size and modification time, and the boot
+ *				sector and FSInfo as read still matching its checksum. None
+ *				of it touches the FAT. Returns false, leaving nothing loaded,
+ *				otherwise.
+ */
+bool Volume::loadSidecar() {
+
+	ifstream sidecar( this->sidecarPath.c_str(), ios::in | ios::binary );
+
+	if ( !sidecar.is_open() )
+		return false;
+
+	SidecarHeader header;
+	sidecar.read( reinterpret_cast<char *>( &header ), sizeof( header ) );
+
+	struct stat info;
+
+	if ( !sidecar || memcmp( header.magic, "FAT32IDX", sizeof( header.magic ) ) != 0 || header.version != SIDECAR_VERSION
+			|| header.countOfClusters != this->countOfClusters || fstat( this->imageDescriptor, &info ) != 0
+			|| header.imageSize != static_cast<uint64_t>( info.st_size ) || header.modifiedSeconds != info.st_mtim.tv_sec
+			|| header.modifiedNanoseconds != info.st_mtim.tv_nsec || header.checksum != checksumBootSectors( this->bpb, this->fsInfo ) )
+		return false;
+
+	map<uint32_t, DirectoryListing> index;
+
+	for ( uint32_t i = 0; i < header.directoryCount; i++ ) {
+
+		uint32_t cluster, chainLength, namesLength, recordCount;
+
+		sidecar.read( reinterpret_cast<char *>( &cluster ), sizeof( cluster ) );
+		sidecar.read( reinterpret_cast<char *>( &chainLength ), sizeof( chainLength ) );
+
+		if ( !sidecar || chainLength > this->countOfClusters )
+			return false;
+
+		vector<uint32_t> clusterChain( chainLength );
+		sidecar.read( reinterpret_cast<char *>( clusterChain.data() ), chainLength * sizeof( uint32_t ) );
+		sidecar.read( reinterpret_cast<char *>( &namesLength ), sizeof( namesLength ) );
+
+		if ( !sidecar || namesLength > chainLength * this->bytesPerCluster * 4 )
+			return false;
+
+		string names( namesLength, '\0' );
+		sidecar.read( &names[0], namesLength );
+		sidecar.read( reinterpret_cast<char *>( &recordCount ), sizeof( recordCount ) );
+
+		if ( !sidecar || recordCount > chainLength * this->bytesPerCluster / DIR_ENTRY_SIZE )
+			return false;
+
+		DirectoryListing listing;
+		listing.setClusterChain( clusterChain );
+
+		for ( uint32_t j = 0; j < recordCount; j++ ) {
+
+			DirectoryRecord record;
+			sidecar.read( reinterpret_cast<char *>( &record ), sizeof( record ) );
+
+			if ( !sidecar || static_cast<uint64_t>( record.nameOffset ) + record.nameLength > names.size() )
+				return false;
+
+			listing.append( record.shortEntry, names.substr( record.nameOffset, record.nameLength ), record.firstSlot, record.longEntryCount );
+		}
+
+		index[ cluster ] = listing;
+	}
+
+	this->fsInfo.freeCount = header.freeCount;
+	this->fsInfo.nextFree = header.nextFree;
+	this->directoryIndex.swap( index );
+	this->sidecarLoaded = true;
+	this->sidecarGeneration = header.generation;
+
+	return true;
+}
+
+/**
+ * Load Open File
+ * Description: Fills an open file table slot's cached entry and extent list
+ *				from a directory entry.
+ */
+void Volume::loadOpenFile( OpenFile & file, const ShortDirectoryEntry & shortEntry ) const {
+
+	file.shortEntry = shortEntry;
+	file.extents.clear();
+	file.dirtyPages.clear();
+	file.bufferedSize = shortEntry.fileSize;
+	file.lastReadEnd = 0;
+	file.readaheadEnd = 0;
+	file.readaheadWindow = 0;
+	file.readaheadGeneration = 0;
+
+	if ( formCluster( shortEntry ) != 0 ) {
+
+		vector<uint32_t> clusterChain;
+		getClusterChain( formCluster( shortEntry ), clusterChain );
+		buildExtents( clusterChain, file.extents );
+	}
+}
+
+/**
+ * Locate Directory
+ * Description: Looks up a directory in a session's directory, setting index
+ *				if it's there.
+ */
+Status Volume::locateDirectory( const SessionState & session, const string & directoryName, uint32_t & index ) const {
+
+	Status status = locateEntry( session, directoryName, index );
+
+	if ( status == STATUS_OK && !isDirectory( session.listing[index].shortEntry ) )
+		return STATUS_NOT_A_DIRECTORY;
+
+	return status;
+}
+
+/**
+ * Locate Entry
+ * Description: Looks up a file or directory in a session's directory,
+ *				setting index if it's there.
+ */
+Status Volume::locateEntry( const SessionState & session, const string & entryName, uint32_t & index ) const {
+
+	// Check if entryName is valid
+	if ( !isValidEntryName( entryName ) )
+		return STATUS_INVALID_NAME;
+
+	if ( !session.readable )
+		return STATUS_IO_ERROR;
+
+	for ( uint32_t i = 0; i < session.listing.size(); i++ )
+		if ( session.listing.nameEquals( i, entryName ) ) {
+
+			index = i;
+			return STATUS_OK;
+		}
+
+	return STATUS_NOT_FOUND;
+}
+
+/**
+ * Locate File
+ * Description: Looks up a file in a session's directory, setting index if
+ *				it's there.
+ */
+Status Volume::locateFile( const SessionState & session, const string & fileName, uint32_t & index ) const {
+
+	Status status = locateEntry( session, fileName, index );
+
+	if ( status == STATUS_OK && !isFile( session.listing[index].shortEntry ) )
+		return STATUS_NOT_A_FILE;
+
+	return status;
+}
+
+/**
+ * Locate Open File
+ * Description: Looks up an open file by #handle or by the name of a file in
+ *				a session's directory, setting handle if it's open.
+ */
+Status Volume::locateOpenFile( const SessionState & session, const string & fileName, uint32_t & handle ) const {
+
+	// Handles skip the directory lookup entirely
+	if ( fileName.length() > 1 && fileName[0] == '#' && fileName.find_first_not_of( "0123456789", 1 ) == string::npos ) {
+
+		handle = strtoul( fileName.c_str() + 1, NULL, 10 );
+
+		if ( handle < this->openFileTable.size() && this->openFileTable[ handle ].inUse )
+			return STATUS_OK;
+
+		return STATUS_BAD_HANDLE;
+	}
+
+	uint32_t index;
+	Status status = locateFile( session, fileName, index );
+
+	if ( status != STATUS_OK )
+		return status;
+
+	for ( uint32_t i = 0; i < this->openFileTable.size(); i++ )
+		if ( this->openFileTable[i].inUse && this->openFileTable[i].shortEntry.location == session.listing[index].shortEntry.location ) {
+
+			handle = i;
+			return STATUS_OK;
+		}
+
+	return STATUS_NOT_OPEN;
+}
+
+/**
+ * Lock Tree
+ * Description: Takes the tree for a change once every reader is out. New
+ *				readers wait at the gate in the meantime. The session making
+ *				the change is brought up to date first and then keeps its own
+ *				listing current, treeChanged sends every other one to reread
+ *				its listing.
+ */
+unique_lock<shared_mutex> Volume::lockTree( SessionState & session ) {
+
+	lock_guard<mutex> gate( this->treeGate );
+	unique_lock<shared_mutex> writer( this->treeLock );
+
+	refreshSession( session );
+	this->changingSession = &session;
+
+	return writer;
+}
+
+/**
+ * Make File
+ * Description: Attempts to generate a DirectoryEntry for a given name
+ *				Always makes a long name for simplicity purposes.
+ *				Uses basis-name and numeric-tail generation for the file's
+ *				Short Name Entry.
+ */
+Status Volume::makeFile( const SessionState & session, const string & fileName, DirectoryEntry & entry, bool directory, const set<string> & shortNames ) const {
+
+	// Don't let anyone make . or .. from here
+	if ( fileName.compare(".") == 0 || fileName.compare("..") == 0 )
+		return STATUS_RESERVED_NAME;
+
+	string copy = fileName;
+	deque<LongDirectoryEntry> longEntries;
+
+	// Ignore trailing periods
+	size_t trailing = copy.find_last_not_of( "." );
+	if ( trailing != string::npos)
+		copy.erase( trailing + 1 );
+
+	// File name can be at max 255 characters
+	if ( copy.length() <= 255 ) {
+
+		// Total path length can be at max 260 characters
+		if ( ( getCurrentPath( &session ).length() + copy.length() ) <= 260 ) {
+
+			// Validate fileName against invaid bytes
+			for ( unsigned int i = 0; i < copy.length(); i++ )
+				if ( copy[i] < ' ' || copy[i] == '"' || copy[i] == '*' || copy[i] == '/' 
+					|| copy[i] == ':' || copy[i] == '<'  || copy[i] == '>' || copy[i] == '?' 
+					||  copy[i] == '\\'|| copy[i] == '|' )
+					return STATUS_ILLEGAL_CHARACTER;
+
+			// Get our basis name
+			bool lossyConversion = false;
+			string basisName = generateBasisName( copy, lossyConversion );
+
+			// Check if we even need to do the numeric-tail algorithm
+			if ( lossyConversion || copy.length() > DIR_Name_LENGTH || shortNameExists( basisName, shortNames ) )
+				basisName = generateNumericTail( basisName, shortNames );
+
+			// Setup Short Directory Entry
+			ShortDirectoryEntry shortEntry;
+
+			// Copy in basis name
+			for ( uint8_t i = 0; i < DIR_Name_LENGTH; i++ )
+				shortEntry.name[i] = basisName[i];
+
+			uint8_t checksum = calculateChecksum( shortEntry.name );
+
+			shortEntry.attributes = directory ? ATTR_DIRECTORY : ATTR_ARCHIVE;
+			shortEntry.NTReserved = 0x00;
+			shortEntry.firstClusterHI = 0x0000;
+			shortEntry.firstClusterLO = 0x0000;
+			shortEntry.fileSize = 0x00000000;
+
+			// MS-DOS epoch is 01/01/1980
+			timeval timeOfDay;
+			gettimeofday( &timeOfDay, NULL );
+			time_t timeNow = (time_t) timeOfDay.tv_sec;
+			struct tm * tmNow = localtime( &timeNow );
+
+			shortEntry.createdTimeTenth = ( ( timeOfDay.tv_usec / 1000 ) % 1000 ) / 5;
+
+			// 0-4: Day of Month, 5-8: Month of Year, 9-15: Years since 1980
+			uint16_t date = ( tmNow->tm_mday & 0x0000001F )
+						| ( ( ( tmNow->tm_mon + 1 ) & 0x0000000F ) << 5 )
+						| ( ( ( tmNow->tm_year - 80 ) & 0x000000EF ) << 9 );
+
+			// 0-4: Seconds, 5-10: Minutes, 11-15: Hours
+			uint16_t time = ( ( tmNow->tm_sec / 2 ) & 0x0000001F )
+						| ( ( tmNow->tm_min & 0x0000002F ) << 5 )
+						| ( ( tmNow->tm_hour & 0x0000001F ) << 11 );
+
+			shortEntry.writeDate = shortEntry.lastAccessDate = shortEntry.createdDate = date;
+			shortEntry.writeTime = shortEntry.createdTime = time;
+
+			// Calculate number of Long Directory Entries needed
+			uint8_t range = ceil( copy.length() / static_cast<double>( LONG_NAME_LENGTH ) );
+			uint8_t charLeft = copy.length();
+			bool nullStored = false;
+
+			// Form long entry chain
+			for ( uint8_t i = 1; i <= range; i++ ) {
+
+				LongDirectoryEntry entry;
+
+				entry.ordinal = ( i == range ) ? LAST_LONG_ENTRY | i : i;
+				entry.attributes = ATTR_LONG_NAME;
+				entry.type = 0;
+				entry.checksum = checksum;
+				entry.firstClusterLO = 0;
+
+				convertLongNameSegment( entry.name1, sizeof( entry.name1 ) / 2, charLeft, nullStored, copy );
+				convertLongNameSegment( entry.name2, sizeof( entry.name2 ) / 2, charLeft, nullStored, copy );
+				convertLongNameSegment( entry.name3, sizeof( entry.name3 ) / 2, charLeft, nullStored, copy );
+
+				longEntries.push_front( entry );
+			}
+
+			entry.name = copy;
+			entry.shortEntry = shortEntry;
+			entry.longEntries = longEntries;
+
+			return STATUS_OK;
+
+		} else
+			return STATUS_PATH_TOO_LONG;
+
+	} else
+		return STATUS_NAME_TOO_LONG;
+}
+
+/**
+ * Prefetch Worker
+ * Description: Readahead helper thread. Loads queued cluster runs into the
+ *				block cache, skipping requests of a generation that has since
+ *				been dropped.
+ */
+void Volume::prefetchWorker() {
+
+	unique_lock<mutex> lock( this->prefetchLock );
+
+	while ( true ) {
+
+		while ( this->prefetchQueue.empty() && !this->stopping )
+			this->prefetchReady.wait( lock );
+
+		if ( this->prefetchQueue.empty() )
+			break;
+
+		PrefetchRequest request = this->prefetchQueue.front();
+		this->prefetchQueue.pop_front();
+
+		if ( request.generation != this->prefetchGeneration )
+			continue;
+
+		lock.unlock();
+
+		// Nothing waits on readahead, a run that can't be read just isn't
+		// cached and the demand read reports it
+		this->cache.load( static_cast<uint64_t>( this->getFirstDataSectorOfCluster( request.start ) ) * this->bpb.bytesPerSector,
+						  static_cast<uint64_t>( request.length ) * this->bytesPerCluster );
+
+		lock.lock();
+	}
+}
+
+/**
+ * Punch Extent
+ * Description: Asks the host to release the storage behind count physically
+ *				contiguous clusters starting at firstCluster. The range reads
+ *				back as zeros afterwards. Hosts that can't punch holes simply
+ *				keep the storage. Cached copies of the range are dropped.
+ */
+void Volume::punchExtent( uint32_t firstCluster, uint32_t count ) const {
+
+	this->cache.punch( static_cast<uint64_t>( this->getFirstDataSectorOfCluster( firstCluster ) ) * this->bpb.bytesPerSector,
+					   static_cast<uint64_t>( count ) * this->bytesPerCluster );
+}
+
+/**
+ * Read Clusters
+ * Description: Reads every cluster of a chain into contents through the
+ *				block cache, one request per contiguous run, all submitted
+ *				as a single batch. Safe to call from worker threads. Returns
+ *				whether all of it could be read.
+ */
+bool Volume::readClusters( const vector<uint32_t> & clusterChain, uint8_t * contents ) const {
+
+	vector<IORequest> requests;
+	chainRequests( clusterChain, contents, false, requests );
+
+	return this->cache.submit( requests );
+}
+
+/**
+ * Read File Contents
+ * Description: Guts of read. Streams up to numBytes of an open file starting
+ *				at startPos using the slot's cached extents. The pool reads a
+ *				window of chunks at a time and the window is handed to output
+ *				in order with the tree let go, so a slow output never holds up
+ *				a change. Picking the tree back up the read follows the file's
+ *				current extents and size, and ends if the handle was closed.
+ *				Moves the handle's position past the bytes read. Stops at the
+ *				first chunk that can't be read, leaving the position alone.
+ * Expects: reader to hold the tree and the handle's buffered writes to be
+ *			on the image.
+ */
+Status Volume::readFile( shared_lock<shared_mutex> & reader, uint32_t handle, uint32_t startPos, uint32_t numBytes, const ReadOutput & output ) {
+
+	OpenFile & opened = this->openFileTable[ handle ];
+
+	// Check permissions
+	if ( !( opened.mode & READ ) )
+		return STATUS_NOT_READABLE;
+
+	// Validate startPos against size
+	if ( startPos >= opened.shortEntry.fileSize )
+		return STATUS_OUT_OF_RANGE;
+
+	uint64_t endPos = min( static_cast<uint64_t>( startPos ) + numBytes, 
+						   static_cast<uint64_t>( opened.shortEntry.fileSize ) );
+
+	// Chunks hold a whole number of clusters, at least one
+	uint32_t clustersPerBuffer = max( READ_BUFFER_SIZE / this->bytesPerCluster, static_cast<uint32_t>( 1 ) );
+
+	{
+		lock_guard<mutex> guard( this->handleLock );
+
+		// Reads picking up where the last one stopped grow the readahead window,
+		// anything else turns readahead off until reads are sequential again
+		if ( startPos != opened.lastReadEnd )
+			opened.readaheadWindow = 0;
+
+		else
+			opened.readaheadWindow = opened.readaheadWindow == 0 ? READAHEAD_MIN : min( opened.readaheadWindow * 2, READAHEAD_MAX );
+
+		// Dropping the queue took whatever was queued for this file with it
+		if ( opened.readaheadGeneration != this->prefetchGeneration ) {
+
+			opened.readaheadEnd = 0;
+			opened.readaheadGeneration = this->prefetchGeneration;
+		}
+	}
+
+	// The pool reads a couple of chunks per worker at a time
+	uint32_t window = max( this->pool.size() * 2, static_cast<uint32_t>( 1 ) ),
+			 location = opened.shortEntry.location;
+	uint64_t position = static_cast<uint64_t>( startPos / this->bytesPerCluster ) * this->bytesPerCluster;
+	vector<ReadChunk> chunks( window );
+
+	while ( position < endPos ) {
+
+		// Opening another file may have moved the table
+		OpenFile & file = this->openFileTable[ handle ];
+
+		if ( !file.inUse || file.shortEntry.location != location )
+			return STATUS_BAD_HANDLE;
+
+		endPos = min( endPos, static_cast<uint64_t>( file.shortEntry.fileSize ) );
+
+		// Skip straight to the extent holding position using the cached extent list
+		uint32_t skip = position / this->bytesPerCluster;
+		uint32_t e = 0;
+		while ( e < file.extents.size() && skip >= file.extents[e].length )
+			skip -= file.extents[ e++ ].length;
+
+		uint32_t count = 0,
+				 remaining = 0;
+
+		while ( count < window && position < endPos && e < file.extents.size() ) {
+
+			ReadChunk & chunk = chunks[ count++ ];
+			chunk.start = position;
+			chunk.requests.clear();
+			chunk.data.resize( static_cast<uint64_t>( clustersPerBuffer ) * this->bytesPerCluster );
+
+			// Fill the chunk from as many extents as the range allows, every
+			// piece goes out in the same batch
+			uint64_t clustersLeft = ( endPos - position + this->bytesPerCluster - 1 ) / this->bytesPerCluster;
+			uint32_t filled = 0;
+
+			while ( filled < clustersPerBuffer && filled < clustersLeft && e < file.extents.size() ) {
+
+				uint32_t run = static_cast<uint32_t>( min( static_cast<uint64_t>( min( clustersPerBuffer - filled, file.extents[e].length - skip ) ), 
+														   clustersLeft - filled ) );
+
+				IORequest request;
+				request.offset = static_cast<uint64_t>( this->getFirstDataSectorOfCluster( file.extents[e].start + skip ) ) * this->bpb.bytesPerSector;
+				request.buffer = &chunk.data[ static_cast<uint64_t>( filled ) * this->bytesPerCluster ];
+				request.length = static_cast<uint64_t>( run ) * this->bytesPerCluster;
+				request.write = false;
+				chunk.requests.push_back( request );
+
+				filled += run;
+				skip += run;
+
+				if ( skip == file.extents[e].length ) {
+
+					skip = 0;
+					e++;
+				}
+			}
+
+			chunk.end = position + static_cast<uint64_t>( filled ) * this->bytesPerCluster;
+			position = chunk.end;
+
+			// Keep the helper a window ahead of this chunk
+			{
+				lock_guard<mutex> guard( this->handleLock );
+
+				if ( file.readaheadWindow > 0 && chunk.end + file.readaheadWindow > file.readaheadEnd ) {
+
+					queueReadahead( file, max( file.readaheadEnd, chunk.end ), chunk.end + file.readaheadWindow );
+					file.readaheadEnd = chunk.end + file.readaheadWindow;
+				}
+			}
+
+			this->pool.run( bind( &BlockCache::submit, &this->cache, ref( chunk.requests ), true ), remaining );
+		}
+
+		// A chain shorter than the file claims ends the read here
+		if ( count == 0 )
+			break;
+
+		this->pool.wait( remaining );
+
+		// Only chunks before the first one that couldn't be read go out
+		uint32_t good = 0;
+		bool failed = false;
+
+		for ( ; good < count && !failed; good++ )
+			for ( uint32_t i = 0; i < chunks[ good ].requests.size(); i++ )
+				if ( chunks[ good ].requests[i].result != static_cast<int64_t>( chunks[ good ].requests[i].length ) )
+					failed = true;
+
+		if ( failed )
+			good--;
+
+		reader.unlock();
+
+		for ( uint32_t i = 0; i < good; i++ ) {
+
+			uint32_t from = startPos > chunks[i].start ? startPos - chunks[i].start : 0;
+			uint32_t to = ( min( chunks[i].end, endPos ) - chunks[i].start );
+
+			output( &chunks[i].data[ from ], to - from );
+		}
+
+		if ( failed )
+			return STATUS_IO_ERROR;
+
+		reader = shareTree();
+	}
+
+	lock_guard<mutex> guard( this->handleLock );
+
+	// The handle may have been closed while the last window went out
+	OpenFile & file = this->openFileTable[ handle ];
+
+	if ( !file.inUse || file.shortEntry.location != location )
+		return STATUS_BAD_HANDLE;
+
+	file.position = endPos;
+	file.lastReadEnd = endPos;
+
+	return STATUS_OK;
+}
+
+/**
+ * Refresh Open Files
+ * Description: Reloads every open file's cached entry and extents from disk,
+ *				for use after chains may have moved or changed.
+ */
+void Volume::refreshOpenFiles() {
+
+	for ( uint32_t i = 0; i < this->openFileTable.size(); i++ ) {
+
+		if ( !this->openFileTable[i].inUse )
+			continue;
+
+		ShortDirectoryEntry shortEntry;
+		uint32_t location = this->openFileTable[i].shortEntry.location;
+
+		// A handle whose entry can't be read keeps what it had
+		if ( !this->cache.read( location, &shortEntry, DIR_ENTRY_SIZE ) )
+			continue;
+
+		shortEntry.location = location;
+
+		loadOpenFile( this->openFileTable[i], shortEntry );
+	}
+}
+
+/**
+ * Refresh Session
+ * Description: Rereads a session's directory listing if the tree changed
+ *				since it was read or the last read failed.
+ * Expects: the tree lock to be held, shared or not.
+ */
+void Volume::refreshSession( SessionState & session ) {
+
+	if ( session.readable && session.version == this->treeVersion )
+		return;
+
+	session.readable = getIndexedDirectoryListing( session.directoryCluster, session.listing );
+	session.version = this->treeVersion;
+}
+
+/**
+ * Relocate Directories
+ * Description: Points open handles whose entry sits in a directory defrag
+ *				moved, and sessions working in one, at its new chain. moved
+ *				maps each old cluster to the one that took its place.
+ * Expects: the tree to be held alone through lockTree.
+ */
+void Volume::relocateDirectories( const map<uint32_t, uint32_t> & moved ) {
+
+	if ( moved.empty() )
+		return;
+
+	uint32_t firstDataByte = this->firstDataSector * this->bpb.bytesPerSector;
+
+	// Entries keep their offset within the cluster replacing theirs
+	for ( uint32_t i = 0; i < this->openFileTable.size(); i++ ) {
+
+		ShortDirectoryEntry & shortEntry = this->openFileTable[i].shortEntry;
+
+		if ( !this->openFileTable[i].inUse || shortEntry.location < firstDataByte )
+			continue;
+
+		uint32_t offset = shortEntry.location - firstDataByte;
+		map<uint32_t, uint32_t>::const_iterator to = moved.find( offset / this->bytesPerCluster + 2 );
+
+		if ( to != moved.end() )
+			shortEntry.location = this->getFirstDataSectorOfCluster( to->second ) * this->bpb.bytesPerSector + offset % this->bytesPerCluster;
+	}
+
+	// Sessions are kept alive while they're moved
+	vector< shared_ptr<SessionState> > held;
+	vector<SessionState *> sessions( 1, &this->console );
+	lock_guard<mutex> lock( this->sessionLock );
+
+	for ( uint32_t i = 0; i < this->sessions.size(); i++ )
+		if ( shared_ptr<SessionState> session = this->sessions[i].lock() ) {
+
+			held.push_back( session );
+			sessions.push_back( session.get() );
+		}
+
+	// The listing is reread from the new chain on the session's next call
+	for ( uint32_t i = 0; i < sessions.size(); i++ ) {
+
+		map<uint32_t, uint32_t>::const_iterator to = moved.find( sessions[i]->directoryCluster );
+
+		if ( to != moved.end() ) {
+
+			sessions[i]->directoryCluster = to->second;
+			sessions[i]->readable = false;
+		}
+	}
+}
+
+/**
+ * Queue Directory
+ * Description: Adds a directory for the next free worker of a walk.
+ */
+void Volume::queueDirectory( DirectoryQueue & queue, const CheckDirectory & directory ) const {
+
+	lock_guard<mutex> lock( queue.lock );
+
+	queue.pending.push_back( directory );
+	queue.ready.notify_one();
+}
+
+/**
+ * Queue Readahead
+ * Description: Follows an open file's cached chain over the byte range
+ *				[from, to) and queues every physically contiguous piece of it
+ *				for the prefetch helper, a read buffer at a time. The host is
+ *				told about each piece right away so its own readahead starts
+ *				even before the helper gets to it.
+ */
+void Volume::queueReadahead( OpenFile & file, uint64_t from, uint64_t to ) {
+
+	uint32_t clustersPerBuffer = max( READ_BUFFER_SIZE / this->bytesPerCluster, static_cast<uint32_t>( 1 ) );
+	uint64_t first = from / this->bytesPerCluster,
+			 last = ( to + this->bytesPerCluster - 1 ) / this->bytesPerCluster;
+	uint64_t index = 0;
+
+	lock_guard<mutex> lock( this->prefetchLock );
+
+	for ( uint32_t e = 0; e < file.extents.size() && index < last; e++ ) {
+
+		uint64_t extentEnd = index + file.extents[e].length;
+
+		// Piece of this extent inside the range
+		for ( uint64_t i = max( index, first ); i < min( extentEnd, last ); ) {
+
+			PrefetchRequest request;
+			request.generation = this->prefetchGeneration;
+			request.start = file.extents[e].start + static_cast<uint32_t>( i - index );
+			request.length = static_cast<uint32_t>( min( static_cast<uint64_t>( clustersPerBuffer ), min( extentEnd, last ) - i ) );
+
+			posix_fadvise( this->imageDescriptor, static_cast<off_t>( this->getFirstDataSectorOfCluster( request.start ) ) * this->bpb.bytesPerSector,
+						   static_cast<off_t>( request.length ) * this->bytesPerCluster, POSIX_FADV_WILLNEED );
+
+			this->prefetchQueue.push_back( request );
+			i += request.length;
+		}
+
+		index = extentEnd;
+	}
+
+	if ( !this->prefetchThread.joinable() )
+		this->prefetchThread = thread( &Volume::prefetchWorker, this );
+
+	this->prefetchReady.notify_one();
+}
+
+/**
+ * Reclaim Worker
+ * Description: Background thread body for rm. Takes the oldest delete and
+ *				reclaims its chain a slice at a time: the slice is wiped or
+ *				trimmed when asked for, then freed in memory and written out
+ *				to every FAT. Only the slice's own FAT sectors are written, so
+ *				commands waiting on the FAT never wait long.
+ */
+void Volume::reclaimWorker() {
+
+	unique_lock<mutex> lock( this->jobLock );
+
+	while ( true ) {
+
+		while ( this->deleteJobs.empty() && !this->stopping )
+			this->jobReady.wait( lock );
+
+		if ( this->deleteJobs.empty() )
+			break;
+
+		// Only this thread pops, so the front stays put while unlocked
+		DeleteJob & job = this->deleteJobs.front();
+
+		// Cancelled jobs are freed in one go
+		vector<Extent> slice;
+		uint32_t count = 0;
+
+		while ( !job.extents.empty() && ( job.cancelled || count < RECLAIM_SLICE ) ) {
+
+			Extent & extent = job.extents.front();
+			Extent piece;
+			piece.start = extent.start;
+			piece.length = job.cancelled ? extent.length : min( extent.length, RECLAIM_SLICE - count );
+
+			slice.push_back( piece );
+			count += piece.length;
+
+			extent.start += piece.length;
+			extent.length -= piece.length;
+
+			if ( extent.length == 0 )
+				job.extents.pop_front();
+		}
+
+		// Cancelling never skips a wipe, whatever is freed unwiped can
+		// come back through a later file
+		bool wipe = job.safe,
+			 trim = job.trim && !job.cancelled;
+
+		lock.unlock();
+
+		// The chain is unreachable, so its clusters are ours until freed
+		bool wiped = !wipe || zeroExtents( slice );
+
+		for ( uint32_t i = 0; i < slice.size() && trim; i++ )
+			punchExtent( slice[i].start, slice[i].length );
+
+		// A slice that couldn't be wiped still holds the old data, it stays
+		// allocated and check reports it as lost. A FAT sector the image
+		// refused is put right by the next full FAT write
+		if ( wiped ) {
+
+			lock_guard<mutex> guard( this->fatLock );
+
+			for ( uint32_t i = 0; i < slice.size(); i++ ) {
+
+				for ( uint32_t j = 0; j < slice[i].length; j++ )
+					setClusterValue( slice[i].start + j, FREE_CLUSTER );
+
+				this->fsInfo.freeCount += slice[i].length;
+				storeFAT( slice[i].start, slice[i].start + slice[i].length - 1 );
+			}
+		}
+
+		lock.lock();
+
+		job.reclaimedClusters += count;
+
+		if ( job.extents.empty() ) {
+
+			this->deleteJobs.pop_front();
+
+			if ( this->deleteJobs.empty() )
+				this->jobsDone.notify_all();
+		}
+	}
+}
+
+/**
+ * Release Entry
+ * Description: Frees the directory slots of an entry in a session's
+ *				directory and drops it from the listing. Safe removal wipes
+ *				every slot completely. Returns whether the slots reached the
+ *				image.
+ */
+bool Volume::releaseEntry( SessionState & session, uint32_t index, bool safe ) {
+
+	// Listings no longer match the image
+	treeChanged();
+
+	uint8_t freed[ DIR_ENTRY_SIZE ] = { DIR_FREE_ENTRY };
+	uint32_t length = safe ? DIR_ENTRY_SIZE : 1;
+	const DirectoryRecord & record = session.listing[index];
+	bool written = true;
+
+	for ( uint32_t i = 0; i < record.longEntryCount; i++ ) {
+
+		written &= this->cache.write( calculateDirectoryEntryLocation( ( record.firstSlot + i ) * DIR_ENTRY_SIZE, session.listing.getClusterChain() ),
+									  freed, length );
+	}
+
+	// Check if this is the last entry in a directory
+	freed[0] = ( index + 1 == session.listing.size() ) ? DIR_LAST_FREE_ENTRY : DIR_FREE_ENTRY; 
+	written &= this->cache.write( record.shortEntry.location, freed, length );
+
+	// Don't let OS wait to flush
+	written &= this->cache.flush();
+
+	session.listing.erase( index );
+
+	return written;
+}
+
+/**
+ * Release Promise
+ * Description: Gives back the free clusters set aside for a handle's
+ *				buffered writes.
+ */
+void Volume::releasePromise( OpenFile & file ) {
+
+	this->promisedClusters -= file.promisedClusters;
+	file.promisedClusters = 0;
+}
+
+/**
+ * Remove Entry
+ * Description: Guts of rmdir. Removes an entry from the
+ *              the file system and updates all necessary records.
+ *				Actually marks a file as free but doesn't zero out unless
+ *				safe is set to true. Returns whether every write reached the
+ *				image, nothing is removed when the contents can't be zeroed.
+ */
+bool Volume::removeEntry( SessionState & session, uint32_t index, bool safe ) {
+
+	ShortDirectoryEntry entry = session.listing[index].shortEntry;
+	vector<uint32_t> clusterChain;
+
+	// Check if we need to zero out file contents
+	if ( safe && formCluster( entry ) != 0 && !zeroOutFileContents( formCluster( entry ) ) )
+		return false;
+
+	uint32_t nextCluster = formCluster( entry );
+
+	// Build list of clusters ( potentially remaining if we crashed ) for this file
+	do {
+
+		clusterChain.push_back( nextCluster );
+
+	// We must also check if the nextCluster is free because we may have crashed while deleting this
+	} while ( ( nextCluster = getFATEntry( nextCluster ) ) < EOC && nextCluster != FREE_CLUSTER );	
+
+	for ( vector<uint32_t>::reverse_iterator itr = clusterChain.rbegin(); itr != clusterChain.rend(); itr++ ) {
+
+		// Skip free clusters
+		if ( *itr != 0 ) {
+
+			setClusterValue( *itr, FREE_CLUSTER );
+			this->fsInfo.freeCount++;
+		}
+	}
+
+	// Update all FATs and FSInfo, this gets out to the disk first
+	bool written = writeFAT();
+
+	// Give the freed clusters back to the host, empty files own none
+	if ( this->trimOnDelete && clusterChain[0] != 0 ) {
+
+		vector<Extent> extents;
+		buildExtents( clusterChain, extents );
+
+		for ( uint32_t i = 0; i < extents.size(); i++ )
+			punchExtent( extents[i].start, extents[i].length );
+	}
+
+	return releaseEntry( session, index, safe ) && written;
+}
+
+/**
+ * Resolve Path
+ * Description: Finds the directory a / separated path names, starting at
+ *				the root for absolute paths and at a session's directory
+ *				otherwise. Sets cluster to its first cluster and display to
+ *				its full path.
+ */
+Status Volume::resolvePath( const SessionState & session, const string & path, uint32_t & cluster, string & display ) const {
+
+	vector<string> components;
+
+	if ( !path.empty() && path[0] == '/' )
+		cluster = this->bpb.rootCluster;
+
+	else {
+
+		cluster = session.directoryCluster;
+		components = session.path;
+	}
+
+	stringstream stream( path );
+	string component;
+
+	while ( getline( stream, component, '/' ) ) {
+
+		if ( component.empty() || component.compare( "." ) == 0 )
+			continue;
+
+		// Going up from the root stays there
+		if ( component.compare( ".." ) == 0 && cluster == this->bpb.rootCluster )
+			continue;
+
+		DirectoryCursor cursor;
+		openDirectory( cluster, cursor );
+
+		bool found = false;
+		while ( nextDirectoryEntry( cursor ) ) {
+
+			if ( entryName( cursor ).compare( component ) != 0 )
+				continue;
+
+			if ( !isDirectory( cursor.shortEntry ) )
+				return STATUS_NOT_A_DIRECTORY;
+
+			// .. entries name the root as cluster 0
+			cluster = formCluster( cursor.shortEntry ) == 0 ? this->bpb.rootCluster : formCluster( cursor.shortEntry );
+			found = true;
+			break;
+		}
+
+		if ( !found )
+			return cursor.failed ? STATUS_IO_ERROR : STATUS_NOT_FOUND;
+
+		if ( component.compare( ".." ) == 0 ) {
+
+			if ( !components.empty() )
+				components.pop_back();
+		}
+
+		else
+			components.push_back( component );
+	}
+
+	display = "/";
+
+	for ( uint32_t i = 0; i < components.size(); i++ )
+		display += components[i] + "/";
+
+	return STATUS_OK;
+}
+
+/**
+ * Resize File
+ * Description: Resizes a file (cluster chain) by a given amount. Updates
+ *				the fat image as well. New clusters are placed right after the
+ *				chain's tail when possible, an empty chain starts at hint
+ *				(or the FSInfo next free rotor when hint is 0). The data in
+ *				the new clusters is left untouched, callers that need it
+ *				zeroed do that themselves. Returns whether the FAT update
+ *				reached the image.
+ */
+bool Volume::resize( uint32_t amount, vector<uint32_t> & clusterChain, uint32_t hint ) {
+
+	uint32_t firstChanged = clusterChain.back(), lastChanged = clusterChain.back();
+
+	// Sepcial Case: Check if we are reszing an empty file
+	if ( clusterChain[0] == 0 ) {
+
+		// Reserve next free cluster and update linked list
+		uint32_t nextCluster = allocateCluster( hint == 0 ? this->fsInfo.nextFree : hint );
+		setClusterValue( nextCluster, EOC );
+
+		// Update chain
+		clusterChain.pop_back();
+		clusterChain.push_back( nextCluster );
+		firstChanged = lastChanged = nextCluster;
+
+		// Done with one cluster
+		amount--;
+	}
+
+	for ( uint32_t i = 0; i < amount; i++ ) {
+
+		uint32_t currentCluster = clusterChain.back();
+		uint32_t nextCluster = allocateCluster( currentCluster + 1 );
+
+		// Reserve next free cluster and update linked list
+		setClusterValue( currentCluster, nextCluster );
+		setClusterValue( nextCluster, EOC );
+
+		// Update chain
+		clusterChain.push_back( nextCluster );
+		firstChanged = min( firstChanged, nextCluster );
+		lastChanged = max( lastChanged, nextCluster );
+	}
+
+	// Update the changed part of all FATs and FSInfo
+	return writeFAT( firstChanged, lastChanged );
+}
+
+/**
+ * Set Dot Entry Cluster
+ * Description: Points the . (slot 0) or .. (slot 1) entry at the start of a
+ *				directory's first cluster to a new cluster. Returns false if
+ *				the entry couldn't be read or written.
+ */
+bool Volume::setDotEntryCluster( uint32_t directoryCluster, uint32_t slot, uint32_t cluster ) {
+
+	// Listings no longer match the image
+	treeChanged();
+
+	ShortDirectoryEntry dotEntry;
+	uint64_t location = static_cast<uint64_t>( this->getFirstDataSectorOfCluster( directoryCluster ) ) * this->bpb.bytesPerSector 
+						+ slot * DIR_ENTRY_SIZE;
+
+	if ( !this->cache.read( location, &dotEntry, DIR_ENTRY_SIZE ) )
+		return false;
+
+	// Only ever touch an actual dot entry
+	if ( dotEntry.name[0] != '.' || dotEntry.name[ slot ] != '.' )
+		return true;
+
+	// Root directory must always have cluster values of 0
+	if ( cluster == this->bpb.rootCluster )
+		cluster = 0;
+
+	dotEntry.firstClusterHI = ( cluster >> 16 );
+	dotEntry.firstClusterLO = ( cluster & 0x0000FFFF );
+
+	return this->cache.write( location, &dotEntry, DIR_ENTRY_SIZE );
+}
+
+/**
+ * Share Tree
+ * Description: Takes the tree for reading, behind any writer already
+ *				waiting for it.
+ */
+shared_lock<shared_mutex> Volume::shareTree() const {
+
+	lock_guard<mutex> gate( this->treeGate );
+
+	return shared_lock<shared_mutex>( this->treeLock );
+}
+
+/**
+ * Share Open File
+ * Description: Looks up an open file for a reader sharing the tree through
+ *				reader, setting handle. Buffered writes have to reach the
+ *				image first, which takes the tree alone for a moment.
+ */
+Status Volume::shareOpenFile( shared_lock<shared_mutex> & reader, const string & fileName, uint32_t & handle, SessionState & active ) {
+
+	refreshSession( active );
+
+	Status status = locateOpenFile( active, fileName, handle );
+
+	if ( status == STATUS_OK && !this->openFileTable[ handle ].dirtyPages.empty() ) {
+
+		reader.unlock();
+
+		if ( ( status = flushOpenFile( fileName, active ) ) != STATUS_OK )
+			return status;
+
+		reader = shareTree();
+		refreshSession( active );
+		status = locateOpenFile( active, fileName, handle );
+	}
+
+	return status;
+}
+
+/**
+ * Short Name Exists
+ * Description: Checks if a short name is already taken in the current
+ *				directory, given the set of its short names.
+ */
+inline bool Volume::shortNameExists( string name, const set<string> & shortNames ) const {
+
+	name.resize( DIR_Name_LENGTH, SHORT_NAME_SPACE_PAD );
+
+	return shortNames.count( name ) > 0;
+}
+
+
+/**
+ * Store FAT Range
+ * Description: Writes FAT entries first through last out to every FAT copy,
+ *				along with FSInfo. Safe to call from the reclaim worker while
+ *				the FAT lock is held. Returns whether the image took all of it,
+ *				the whole FAT is written next time if not.
+ */
+bool Volume::storeFAT( uint32_t first, uint32_t last ) {
+
+	if ( this->fatStale ) {
+
+		first = 0;
+		last = this->countOfClusters + 1;
+	}
+
+	bool written = true;
+
+	for ( uint8_t i = 0; i < this->bpb.numFATs; i++ ) {
+
+		uint64_t fatLocation = static_cast<uint64_t>( this->bpb.reservedSectorCount + i * this->bpb.FATSz32 ) * this->bpb.bytesPerSector;
+		written &= this->cache.write( fatLocation + first * FAT_ENTRY_SIZE, this->fat + first, ( last - first + 1 ) * FAT_ENTRY_SIZE );
+	}
+
+	written &= this->cache.write( this->bpb.FSInfo * this->bpb.bytesPerSector, &this->fsInfo, sizeof( this->fsInfo ) );
+	this->fatStale = !written;
+
+	return written;
+}
+/**
+ * Save Sidecar
+ * Description: Writes the free count, next free hint and every indexed
+ *				directory listing (always including the root and current
+ *				directory) out next to the image, along with the image's size,
+ *				modification time and a checksum of its boot sector and
+ *				FSInfo. Skipped when the sidecar loaded at mount still holds.
+ *				Written to a temporary file first so a crash never leaves half
+ *				a sidecar behind.
+ * Expects: every write to the image to have landed.
+ */
+void Volume::saveSidecar() {
+
+	// Versions start over at every mount, so the one loaded still holds
+	if ( this->sidecarLoaded && this->treeVersion == 0 && this->fsInfo.freeCount == this->mountFreeCount )
+		return;
+
+	if ( this->console.readable )
+		this->directoryIndex[ this->console.directoryCluster ] = this->console.listing;
+
+	if ( this->directoryIndex.count( this->bpb.rootCluster ) == 0 ) {
+
+		vector<uint32_t> clusterChain;
+		getClusterChain( this->bpb.rootCluster, clusterChain );
+
+		uint8_t * contents = new uint8_t[ clusterChain.size() * this->bytesPerCluster ];
+
+		// No sidecar beats one missing the root
+		if ( !readClusters( clusterChain, contents ) ) {
+
+			delete[] contents;
+			return;
+		}
+
+		this->directoryIndex[ this->bpb.rootCluster ] = parseDirectoryContents( contents, clusterChain );
+		delete[] contents;
+	}
+
+	// The next mount checks the boot sector and FSInfo as they are on disk,
+	// which may hold a stale count
+	BIOSParameterBlock bpb;
+	FSInfo fsInfo;
+	struct stat info;
+
+	if ( !this->cache.read( 0, &bpb, sizeof( bpb ) ) || !this->cache.read( this->bpb.FSInfo * this->bpb.bytesPerSector, &fsInfo, sizeof( fsInfo ) )
+			|| fstat( this->imageDescriptor, &info ) != 0 )
+		return;
+
+	SidecarHeader header;
+	memcpy( header.magic, "FAT32IDX", sizeof( header.magic ) );
+	header.version = SIDECAR_VERSION;
+	header.countOfClusters = this->countOfClusters;
+	header.imageSize = info.st_size;
+	header.modifiedSeconds = info.st_mtim.tv_sec;
+	header.modifiedNanoseconds = info.st_mtim.tv_nsec;
+	header.checksum = checksumBootSectors( bpb, fsInfo );
+	header.generation = this->sidecarGeneration + 1;
+	header.freeCount = this->fsInfo.freeCount;
+	header.nextFree = this->fsInfo.nextFree;
+	header.directoryCount = this->directoryIndex.size();
+
+	string temporaryPath = this->sidecarPath + ".tmp";
+	ofstream sidecar( temporaryPath.c_str(), ios::out | ios::binary | ios::trunc );
+
+	if ( !sidecar.is_open() )
+		return;
+
+	sidecar.write( reinterpret_cast<char *>( &header ), sizeof( header ) );
+
+	for ( map<uint32_t, DirectoryListing>::const_iterator itr = this->directoryIndex.begin(); itr != this->directoryIndex.end(); itr++ ) {
+
+		const DirectoryListing & listing = itr->second;
+		const vector<uint32_t> & clusterChain = listing.getClusterChain();
+
+		// Names are packed back to back and records point into them
+		string names;
+		vector<DirectoryRecord> records;
+
+		for ( uint32_t i = 0; i < listing.size(); i++ ) {
+
+			DirectoryRecord record = listing[i];
+			string name = listing.name( i );
+
+			record.nameOffset = names.size();
+			record.nameLength = name.size();
+			names += name;
+			records.push_back( record );
+		}
+
+		uint32_t cluster = itr->first,
+				 chainLength = clusterChain.size(),
+				 namesLength = names.size(),
+				 recordCount = records.size();
+
+		sidecar.write( reinterpret_cast<char *>( &cluster ), sizeof( cluster ) );
+		sidecar.write( reinterpret_cast<char *>( &chainLength ), sizeof( chainLength ) );
+		sidecar.write( reinterpret_cast<const char *>( clusterChain.data() ), chainLength * sizeof( uint32_t ) );
+		sidecar.write( reinterpret_cast<char *>( &namesLength ), sizeof( namesLength ) );
+		sidecar.write( names.data(), namesLength );
+		sidecar.write( reinterpret_cast<char *>( &recordCount ), sizeof( recordCount ) );
+		sidecar.write( reinterpret_cast<const char *>( records.data() ), recordCount * sizeof( DirectoryRecord ) );
+	}
+
+	sidecar.close();
+
+	if ( sidecar )
+		rename( temporaryPath.c_str(), this->sidecarPath.c_str() );
+
+	else
+		remove( temporaryPath.c_str() );
+}
+
+/**
+ * Set Cluster Value
+ * Description: Sets a cluster entry to a given value.
+ */
+inline void Volume::setClusterValue( uint32_t n, uint32_t newValue ) {
+
+	// Make sure we don't overwrite upper 4 bits
+	newValue &= FAT_ENTRY_MASK;
+
+	// Reset entry preserving upper 4 bits
+	this->fat[n] &= ~FAT_ENTRY_MASK;
+
+	// Set new value
+	this->fat[n] |= newValue;
+}
+
+/**
+ * Tree Changed
+ * Description: Records a change to the tree. Indexed listings are dropped
+ *				and every session but the one making the change rereads its
+ *				listing.
+ * Expects: the tree to be held alone through lockTree.
+ */
+void Volume::treeChanged() {
+
+	this->directoryIndex.clear();
+	this->treeVersion++;
+	this->changingSession->version = this->treeVersion;
+}
+
+/**
+ * Wait for Deletes
+ * Description: Blocks until the reclaim worker has freed every chain
+ *				handed to it.
+ */
+void Volume::waitForDeletes() {
+
+	unique_lock<mutex> lock( this->jobLock );
+
+	while ( !this->deleteJobs.empty() )
+		this->jobsDone.wait( lock );
+}
+
+/**
+ * Walk Directories
+ * Description: Hands root and every directory queued after it to visit,
+ *				with one worker per I/O pool thread (or just the caller when
+ *				the pool has none). visit queues subdirectories itself.
+ *				Returns how many workers took part.
+ */
+uint32_t Volume::walkDirectories( const CheckDirectory & root, const DirectoryVisitor & visit ) const {
+
+	DirectoryQueue queue;
+	queue.activeWorkers = 0;
+	queue.pending.push_back( root );
+
+	uint32_t workerCount = max( this->pool.size(), static_cast<uint32_t>( 1 ) ),
+			 remaining = 0;
+
+	for ( uint32_t i = 0; i < workerCount; i++ )
+		this->pool.run( bind( &Volume::directoryWorker, this, ref( queue ), cref( visit ) ), remaining );
+
+	this->pool.wait( remaining );
+
+	return workerCount;
+}
+
+/**
+ * Walk Directory
+ * Description: What du and find do with each directory of the walk. The
+ *				FAT is only held while chains are looked up, the directory
+ *				itself is read without it. Matches are handed out once per
+ *				directory so lines never interleave.
+ */
+void Volume::walkDirectory( const CheckDirectory & directory, DirectoryQueue & queue, WalkState & state ) const {
+
+	{
+		lock_guard<mutex> lock( state.lock );
+
+		// Cross-linked or looping trees are only walked once
+		if ( !state.visited.insert( directory.cluster ).second )
+			return;
+	}
+
+	vector<uint32_t> clusterChain;
+	uint32_t range = this->countOfClusters + 2;
+
+	// Bounded like chainLength, du and find may run on damaged trees
+	{
+		lock_guard<mutex> guard( this->fatLock );
+
+		for ( uint32_t cluster = directory.cluster; cluster >= 2 && cluster < range && clusterChain.size() < this->countOfClusters; cluster = getFATEntry( cluster ) )
+			clusterChain.push_back( cluster );
+	}
+
+	uint8_t * contents = getChainContents( clusterChain );
+
+	if ( contents == NULL ) {
+
+		lock_guard<mutex> lock( state.lock );
+		state.failed = true;
+		return;
+	}
+
+	DirectoryListing listing = parseDirectoryContents( contents, clusterChain );
+	delete[] contents;
+
+	uint64_t bytes = 0, allocatedBytes = 0;
+	uint32_t files = 0, directories = 0;
+	vector<string> matches;
+	vector<uint32_t> chains;
+
+	for ( uint32_t i = 0; i < listing.size(); i++ ) {
+
+		const ShortDirectoryEntry & entry = listing[i].shortEntry;
+
+		if ( listing.nameEquals( i, "." ) || listing.nameEquals( i, ".." ) )
+			continue;
+
+		string name = listing.name( i );
+		uint32_t firstCluster = formCluster( entry );
+
+		if ( isDirectory( entry ) ) {
+
+			directories++;
+
+			if ( firstCluster >= 2 ) {
+
+				CheckDirectory child;
+				child.cluster = firstCluster;
+				child.parentCluster = directory.cluster;
+				child.path = directory.path + name + "/";
+
+				queueDirectory( queue, child );
+			}
+
+		} else if ( isFile( entry ) ) {
+
+			files++;
+			bytes += entry.fileSize;
+
+		} else
+			continue;
+
+		chains.push_back( firstCluster );
+
+		// Names match exactly, like every other lookup
+		if ( !state.pattern.empty() && fnmatch( state.pattern.c_str(), name.c_str(), 0 ) == 0 )
+			matches.push_back( directory.path + name + ( isDirectory( entry ) ? "/" : "" ) );
+	}
+
+	{
+		lock_guard<mutex> guard( this->fatLock );
+
+		for ( uint32_t i = 0; i < chains.size(); i++ )
+			allocatedBytes += static_cast<uint64_t>( chainLength( chains[i] ) ) * this->bytesPerCluster;
+	}
+
+	lock_guard<mutex> lock( state.lock );
+
+	for ( uint32_t i = 0; i < matches.size(); i++ )
+		state.output( matches[i] );
+
+	state.bytes += bytes;
+	state.allocatedBytes += allocatedBytes;
+	state.files += files;
+	state.directories += directories;
+}
+
+/**
+ * Walk Tree
+ * Description: Walks everything under the directory at cluster in
+ *				parallel, filling in state's totals as it goes.
+ */
+void Volume::walkTree( uint32_t cluster, const string & path, WalkState & state ) const {
+
+	state.bytes = 0;
+	state.files = 0;
+	state.directories = 0;
+	state.failed = false;
+
+	{
+		lock_guard<mutex> guard( this->fatLock );
+		state.allocatedBytes = static_cast<uint64_t>( chainLength( cluster ) ) * this->bytesPerCluster;
+	}
+
+	CheckDirectory top;
+	top.cluster = cluster;
+	top.parentCluster = 0;
+	top.path = path;
+
+	walkDirectories( top, bind( &Volume::walkDirectory, this, placeholders::_1, placeholders::_2, ref( state ) ) );
+}
+
+/**
+ * Write Chain Bytes
+ * Description: Writes length bytes of data at a byte offset within a cluster
+ *				chain, one write per contiguous run of clusters, all handed
+ *				to the cache as one batch. A NULL data writes zeros instead.
+ *				Returns whether the cache or the image took all of it.
+ */
+bool Volume::writeChainBytes( const vector<uint32_t> & clusterChain, uint32_t offset, const uint8_t * data, uint32_t length ) {
+
+	dropPrefetched();
+
+	vector<uint8_t> zeros;
+	vector<IORequest> requests;
+
+	if ( data == NULL )
+		zeros.assign( min( length, READ_BUFFER_SIZE ), 0 );
+
+	uint32_t i = offset / this->bytesPerCluster,
+			 clusterOffset = offset % this->bytesPerCluster;
+
+	while ( length > 0 ) {
+
+		// Stretch the write over clusters that follow each other on disk
+		uint32_t run = 1;
+		while ( i + run < clusterChain.size() && clusterChain[ i + run ] == clusterChain[ i + run - 1 ] + 1 
+				&& static_cast<uint64_t>( run ) * this->bytesPerCluster - clusterOffset < length )
+			run++;
+
+		uint32_t amount = static_cast<uint32_t>( min( static_cast<uint64_t>( run ) * this->bytesPerCluster - clusterOffset, static_cast<uint64_t>( length ) ) );
+
+		IORequest request;
+		request.offset = static_cast<uint64_t>( this->getFirstDataSectorOfCluster( clusterChain[i] ) ) * this->bpb.bytesPerSector + clusterOffset;
+		request.write = true;
+
+		if ( data != NULL ) {
+
+			request.buffer = const_cast<uint8_t *>( data );
+			request.length = amount;
+			requests.push_back( request );
+			data += amount;
+
+		} else
+			for ( uint32_t written = 0; written < amount; written += request.length ) {
+
+				request.buffer = &zeros[0];
+				request.length = min( amount - written, static_cast<uint32_t>( zeros.size() ) );
+				requests.push_back( request );
+				request.offset += request.length;
+			}
+
+		length -= amount;
+		i += run;
+		clusterOffset = 0;
+	}
+
+	return this->cache.submit( requests );
+}
+
+/**
+ * Write Directory Entry
+ * Description: Writes a short entry back to its location on disk and keeps
+ *				a session's listing in step if it lives there. Returns whether
+ *				it reached the image.
+ */
+bool Volume::writeDirectoryEntry( SessionState & session, const ShortDirectoryEntry & shortEntry ) {
+
+	// Listings no longer match the image
+	treeChanged();
+
+	bool written = this->cache.write( shortEntry.location, &shortEntry, DIR_ENTRY_SIZE );
+	written &= this->cache.flush();
+
+	for ( uint32_t i = 0; i < session.listing.size(); i++ )
+		if ( session.listing[i].shortEntry.location == shortEntry.location ) {
+
+			session.listing.setShortEntry( i, shortEntry );
+			break;
+		}
+
+	return written;
+}
+
+/**
+ * Write FAT
+ * Description: Writes the in-memory FAT out to every FAT copy along
+ *				with FSInfo.
+ */
+bool Volume::writeFAT() {
+
+	return writeFAT( 0, this->countOfClusters + 1 );
+}
+
+/**
+ * Write FAT Range
+ * Description: Writes FAT entries first through last out to every FAT copy,
+ *				along with FSInfo. Dirty cached clusters land first, so the
+ *				FAT never points at data that isn't there yet. Returns whether
+ *				all of it reached the image.
+ */
+bool Volume::writeFAT( uint32_t first, uint32_t last ) {
+
+	// Chains changed, a reused cluster may now hold a different directory
+	treeChanged();
+
+	bool flushed = this->cache.flush();
+
+	return storeFAT( first, last ) && flushed;
+}
+
+/**
+ * Write File
+ * Description: Guts of write. Writes quotedData into an open file at
+ *				startPos using the slot's cached extents and entry. Moves
+ *				the handle's position past the bytes written.
+ */
+Status Volume::writeFile( SessionState & session, uint32_t handle, uint32_t startPos, const string & quotedData ) {
+
+	OpenFile & file = this->openFileTable[ handle ];
+
+	// Check permissions
+	if ( !( file.mode & WRITE ) )
+		return STATUS_NOT_WRITABLE;
+
+	// Get current file contents from the cached chain
+	vector<uint32_t> clusterChain;
+	expandExtents( file.extents, clusterChain );
+
+	// Empty files are represented by a lone cluster 0 for resize
+	if ( clusterChain.empty() )
+		clusterChain.push_back( 0 );
+
+	// Space reserved by prealloc counts as allocated even while fileSize is 0
+	uint32_t requiredSize = startPos + quotedData.length(),
+			 currentSize = file.extents.empty() ? 0 : ( clusterChain.size() * this->bytesPerCluster ),
+			 oldSize = file.shortEntry.fileSize;
+	bool written = true;
+
+	// Check if we need to resize the file
+	if ( requiredSize > currentSize ) {
+
+		uint32_t clustersNeeded = ceil( static_cast<double>( requiredSize - currentSize ) / this->bytesPerCluster );
+
+		// Check if we have enough free space left or if the file has reached its max size
+		if ( availableClusters() < clustersNeeded )
+			return STATUS_NO_SPACE;
+
+		if ( ( static_cast<uint64_t>( currentSize ) + ( clustersNeeded * this->bytesPerCluster ) ) > FILE_MAX_SIZE )
+			return STATUS_TOO_LARGE;
+
+		written = resize( clustersNeeded, clusterChain );
+		buildExtents( clusterChain, file.extents );
+
+	// Nothing was asked to be written into an empty file
+	} else if ( file.extents.empty() )
+		return STATUS_OK;
+
+	// Need to update file info in case of crash
+	file.shortEntry.firstClusterHI = ( clusterChain[0] >> 16 );
+	file.shortEntry.firstClusterLO = ( clusterChain[0] & 0x0000FFFF );
+	file.shortEntry.fileSize = max( file.shortEntry.fileSize, requiredSize );
+	file.shortEntry.attributes |= ATTR_ARCHIVE;
+	written &= writeDirectoryEntry( session, file.shortEntry );
+
+	// Anything skipped over past the old end of file must read back as zeros
+	bool stored = true;
+	if ( startPos > oldSize )
+		stored = writeChainBytes( clusterChain, oldSize, NULL, startPos - oldSize );
+
+	// Write Data
+	stored &= writeChainBytes( clusterChain, startPos, reinterpret_cast<const uint8_t *>( quotedData.data() ), quotedData.length() );
+
+	// Flush to disk, whatever the image refuses stays cached for the next try
+	written &= this->cache.flush();
+
+	// Don't let the file claim data that never made it out
+	if ( !stored && file.shortEntry.fileSize != oldSize ) {
+
+		file.shortEntry.fileSize = oldSize;
+		writeDirectoryEntry( session, file.shortEntry );
+	}
+
+	file.position = requiredSize;
+
+	return written && stored ? STATUS_OK : STATUS_IO_ERROR;
+}
+
+/**
+ * Write File Contentss
+ * Description: Writes the given file contents to a specified
+ *				cluster chain, every contiguous run in one batch. Returns
+ *				whether all of it was written.
+ * Expects: clusterChain to correspond to contents.
+ */
+bool Volume::writeFileContents( const uint8_t * contents, const vector<uint32_t> & clusterChain ) {
+
+	dropPrefetched();
+
+	vector<IORequest> requests;
+	chainRequests( clusterChain, const_cast<uint8_t *>( contents ), true, requests );
+
+	return this->cache.submit( requests );
+}
+
+/**
+ * Zero Extent
+ * Description: Zeros count physically contiguous clusters starting at
+ *				firstCluster. Lets the host zero the range when it can and
+ *				falls back to large positional writes. Cached copies of the
+ *				range, dirty or not, are dropped. Sets zeroed to whether it
+ *				worked.
+ */
+void Volume::zeroExtent( uint32_t firstCluster, uint32_t count, bool & zeroed ) const {
+
+	zeroed = this->cache.zero( static_cast<uint64_t>( this->getFirstDataSectorOfCluster( firstCluster ) ) * this->bpb.bytesPerSector,
+							   static_cast<uint64_t>( count ) * this->bytesPerCluster );
+}
+
+/**
+ * Zero Extents
+ * Description: Zeros every extent in the list. Extents are split into about
+ *				one piece per I/O worker, never less than a read buffer, and
+ *				the pieces are zeroed by the pool. Returns whether every piece
+ *				was zeroed.
+ */
+bool Volume::zeroExtents( const vector<Extent> & extents ) const {
+
+	uint64_t total = 0;
+	for ( uint32_t i = 0; i < extents.size(); i++ )
+		total += extents[i].length;
+
+	uint32_t clustersPerBuffer = max( READ_BUFFER_SIZE / this->bytesPerCluster, static_cast<uint32_t>( 1 ) ),
+			 workerCount = max( this->pool.size(), static_cast<uint32_t>( 1 ) ),
+			 pieceSize = static_cast<uint32_t>( max( static_cast<uint64_t>( clustersPerBuffer ), ( total + workerCount - 1 ) / workerCount ) ),
+			 remaining = 0;
+
+	// One flag per piece, a deque keeps them in place as it grows
+	deque<bool> zeroed;
+
+	for ( uint32_t i = 0; i < extents.size(); i++ )
+		for ( uint32_t done = 0; done < extents[i].length; done += pieceSize ) {
+
+			zeroed.push_back( false );
+			this->pool.run( bind( &Volume::zeroExtent, this, extents[i].start + done, min( pieceSize, extents[i].length - done ), ref( zeroed.back() ) ), remaining );
+		}
+
+	this->pool.wait( remaining );
+
+	return count( zeroed.begin(), zeroed.end(), false ) == 0;
+}
+
+/**
+ * Zero Out File Contents
+ * Description: Zeros out a file for safety purposes, with the pool
+ *				working on its extents. Returns whether all of it was zeroed.
+ */
+bool Volume::zeroOutFileContents( uint32_t initialCluster ) const {
+
+	vector<uint32_t> clusterChain;
+	vector<Extent> extents;
+
+	// Build list of clusters for this file
+	getClusterChain( initialCluster, clusterChain );
+	buildExtents( clusterChain, extents );
 
-	} while ( ( nextCluster = getFATEntry( nextCluster ) ) < EOC );
+	return zeroExtents( extents );
+}
 
-	uint32_t size = clusterChain.size() * this->bytesPerCluster;
+/**
+ * Block Cache Methods
+ */
+
+/**
+ * Block Cache Constructor
+ * Description: Starts off empty, configure has to be called before use.
+ */
+BlockCache::BlockCache() {
+
+	this->descriptor = -1;
+	this->engine = NULL;
+	this->dataOffset = 0;
+	this->blockSize = 0;
+	this->capacity = 0;
+	this->recentCapacity = 0;
+	this->sequence = 0;
+	this->writesInFlight = 0;
+	this->hits = 0;
+	this->misses = 0;
+	this->writeBacks = 0;
+}
+
+/**
+ * Block Cache Destructor
+ * Description: Lets go of the I/O engine. Dirty blocks are expected to
+ *				have been flushed.
+ */
+BlockCache::~BlockCache() {
+
+	delete this->engine;
+}
+
+/**
+ * Bypass
+ * Description: Zeros or punches a whole number of blocks on the image with
+ *				fallocate. Cached copies are dropped, dirty or not, since the
+ *				range is about to read back as zeros. Zeroing falls back to
+ *				large positional writes when the host can't do it. Returns
+ *				false if those writes failed, a host that can't punch holes
+ *				simply keeps the storage.
+ * Expects: guard to hold the lock, it is let go while the image is touched.
+ */
+bool BlockCache::bypass( unique_lock<mutex> & guard, uint64_t offset, uint64_t length, int mode ) {
+
+	uint64_t first = ( offset - this->dataOffset ) / this->blockSize,
+			 last = ( offset + length - this->dataOffset ) / this->blockSize;
+
+	map<uint64_t, CacheBlock>::iterator itr = this->blocks.lower_bound( first );
+
+	while ( itr != this->blocks.end() && itr->first < last ) {
+
+		uint64_t block = ( itr++ )->first;
+		remove( block );
+	}
+
+	this->sequence++;
+	this->writesInFlight++;
+	guard.unlock();
+
+	bool done = true;
+
+	if ( fallocate( this->descriptor, mode, offset, length ) != 0 && mode == FALLOC_FL_ZERO_RANGE ) {
+
+		uint32_t bufferSize = static_cast<uint32_t>( min( length, static_cast<uint64_t>( READ_BUFFER_SIZE ) ) );
+		vector<uint8_t> zeros( bufferSize, 0 );
+		vector<IORequest> requests;
+
+		// Every write of the batch can share the same zeros
+		for ( uint64_t done = 0; done < length; done += bufferSize ) {
+
+			IORequest request;
+			request.offset = offset + done;
+			request.buffer = &zeros[0];
+			request.length = min( length - done, static_cast<uint64_t>( bufferSize ) );
+			request.write = true;
+			requests.push_back( request );
+		}
+
+		this->engine->submit( requests );
+
+		for ( uint32_t i = 0; i < requests.size(); i++ )
+			done &= requests[i].result == static_cast<int64_t>( requests[i].length );
+	}
+
+	guard.lock();
+	this->writesInFlight--;
+	this->sequence++;
+
+	return done;
+}
+
+/**
+ * Configure
+ * Description: Points the cache at an image whose data region starts at
+ *				dataOffset and sizes it to hold size bytes of blocks. A
+ *				quarter of it goes to the queue of recent blocks.
+ */
+void BlockCache::configure( int descriptor, uint64_t dataOffset, uint32_t blockSize, uint64_t size ) {
+
+	lock_guard<mutex> guard( this->lock );
+
+	delete this->engine;
+
+	this->descriptor = descriptor;
+	this->engine = IOEngine::create( descriptor );
+	this->dataOffset = dataOffset;
+	this->blockSize = blockSize;
+	this->capacity = static_cast<uint32_t>( max( size / blockSize, static_cast<uint64_t>( 4 ) ) );
+	this->recentCapacity = this->capacity / 4;
+}
+
+/**
+ * Evict
+ * Description: Makes room for one block. The recent queue gives up its
+ *				oldest block while it is over its share and remembers it as a
+ *				ghost, otherwise the least recently used frequent block goes.
+ *				Dirty blocks are written back first, one the image refuses
+ *				stays cached and dirty. Returns whether a block went.
+ */
+bool BlockCache::evict() {
+
+	bool recent = this->recentQueue.size() > this->recentCapacity || this->frequentQueue.empty();
+	uint64_t block = recent ? this->recentQueue.back() : this->frequentQueue.back();
+
+	map<uint64_t, CacheBlock>::iterator itr = this->blocks.find( block );
+
+	if ( itr->second.dirty ) {
+
+		vector<IORequest> requests( 1 );
+		requests[0].offset = this->dataOffset + block * this->blockSize;
+		requests[0].buffer = &itr->second.data[0];
+		requests[0].length = this->blockSize;
+		requests[0].write = true;
+
+		this->engine->submit( requests );
+
+		// A miss that read the image before this landed must not keep it
+		this->sequence++;
+
+		if ( requests[0].result != static_cast<int64_t>( this->blockSize ) )
+			return false;
+
+		this->writeBacks++;
+	}
+
+	remove( block );
+
+	if ( !recent )
+		return true;
+
+	this->ghostQueue.push_front( block );
+	this->ghosts[ block ] = this->ghostQueue.begin();
+
+	if ( this->ghostQueue.size() > this->capacity / 2 ) {
+
+		this->ghosts.erase( this->ghostQueue.back() );
+		this->ghostQueue.pop_back();
+	}
+
+	return true;
+}
+
+/**
+ * Flush
+ * Description: Writes every dirty block back to the image in one batch.
+ *				The lock is held throughout so no block moves while the
+ *				engine reads from it. Blocks the image didn't take stay dirty
+ *				for the next flush. Returns whether every block was written.
+ */
+bool BlockCache::flush() {
+
+	lock_guard<mutex> guard( this->lock );
+
+	if ( this->dirtyBlocks.empty() )
+		return true;
+
+	vector<IORequest> requests;
+	vector<uint64_t> written;
+
+	for ( set<uint64_t>::iterator itr = this->dirtyBlocks.begin(); itr != this->dirtyBlocks.end(); itr++ ) {
+
+		IORequest request;
+		request.offset = this->dataOffset + *itr * this->blockSize;
+		request.buffer = &this->blocks[ *itr ].data[0];
+		request.length = this->blockSize;
+		request.write = true;
+		requests.push_back( request );
+	}
+
+	this->engine->submit( requests );
+
+	for ( uint32_t i = 0; i < requests.size(); i++ )
+		if ( requests[i].result == static_cast<int64_t>( requests[i].length ) )
+			written.push_back( ( requests[i].offset - this->dataOffset ) / this->blockSize );
+
+	for ( uint32_t i = 0; i < written.size(); i++ ) {
+
+		this->blocks[ written[i] ].dirty = false;
+		this->dirtyBlocks.erase( written[i] );
+	}
+
+	this->writeBacks += written.size();
+	this->sequence++;
+
+	return written.size() == requests.size();
+}
+
+/**
+ * Insert
+ * Description: Adds a clean copy of a block that was just read. Blocks that
+ *				are still remembered as ghosts go straight to the frequent
+ *				queue. The cache runs over its capacity for as long as the
+ *				image refuses to take a dirty block back.
+ * Expects: the lock to be held and block not to be cached.
+ */
+void BlockCache::insert( uint64_t block, const uint8_t * data ) {
+
+	while ( this->blocks.size() >= this->capacity )
+		if ( !evict() )
+			break;
+
+	map<uint64_t, list<uint64_t>::iterator>::iterator ghost = this->ghosts.find( block );
+	bool frequent = ghost != this->ghosts.end();
+
+	if ( frequent ) {
+
+		this->ghostQueue.erase( ghost->second );
+		this->ghosts.erase( ghost );
+	}
+
+	list<uint64_t> & queue = frequent ? this->frequentQueue : this->recentQueue;
+	queue.push_front( block );
+
+	CacheBlock & entry = this->blocks[ block ];
+	entry.dirty = false;
+	entry.frequent = frequent;
+	entry.position = queue.begin();
+	entry.data.assign( data, data + this->blockSize );
+}
+
+/**
+ * Load
+ * Description: Reads whatever part of the range isn't cached yet into the
+ *				cache without counting it as a hit or miss. Used for
+ *				readahead. Returns whether it could all be read.
+ */
+bool BlockCache::load( uint64_t offset, uint64_t length ) {
+
+	vector<uint8_t> scratch( length );
+	vector<IORequest> requests( 1 );
+
+	requests[0].offset = offset;
+	requests[0].buffer = &scratch[0];
+	requests[0].length = length;
+	requests[0].write = false;
+
+	return submit( requests, false );
+}
+
+/**
+ * Lookup
+ * Description: Returns the cached copy of a block or NULL. Frequent blocks
+ *				move to the front of their queue, recent ones keep their
+ *				place.
+ * Expects: the lock to be held.
+ */
+CacheBlock * BlockCache::lookup( uint64_t block ) {
+
+	map<uint64_t, CacheBlock>::iterator itr = this->blocks.find( block );
+
+	if ( itr == this->blocks.end() )
+		return NULL;
+
+	if ( itr->second.frequent )
+		this->frequentQueue.splice( this->frequentQueue.begin(), this->frequentQueue, itr->second.position );
+
+	return &itr->second;
+}
+
+/**
+ * Punch
+ * Description: Releases the host storage behind a whole number of blocks,
+ *				hosts that can't punch holes simply keep it.
+ */
+void BlockCache::punch( uint64_t offset, uint64_t length ) {
+
+	unique_lock<mutex> guard( this->lock );
+
+	bypass( guard, offset, length, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE );
+}
+
+/**
+ * Read
+ * Description: Reads length bytes of the image at offset into buffer.
+ *				Returns whether all of them could be read.
+ */
+bool BlockCache::read( uint64_t offset, void * buffer, uint64_t length ) {
+
+	vector<IORequest> requests( 1 );
+
+	requests[0].offset = offset;
+	requests[0].buffer = reinterpret_cast<uint8_t *>( buffer );
+	requests[0].length = length;
+	requests[0].write = false;
+
+	return submit( requests );
+}
+
+/**
+ * Remove
+ * Description: Drops a block from the cache without writing it back.
+ * Expects: the lock to be held and block to be cached.
+ */
+void BlockCache::remove( uint64_t block ) {
+
+	map<uint64_t, CacheBlock>::iterator itr = this->blocks.find( block );
+
+	( itr->second.frequent ? this->frequentQueue : this->recentQueue ).erase( itr->second.position );
+	this->dirtyBlocks.erase( block );
+	this->blocks.erase( itr );
+}
+
+/**
+ * Statistics
+ * Description: Returns the cache's counters and current occupancy.
+ */
+CacheStatistics BlockCache::statistics() {
+
+	lock_guard<mutex> guard( this->lock );
+
+	CacheStatistics result;
+	result.hits = this->hits;
+	result.misses = this->misses;
+	result.writeBacks = this->writeBacks;
+	result.blocks = this->blocks.size();
+	result.dirtyBlocks = this->dirtyBlocks.size();
+	result.engine = this->engine == NULL ? "none" : this->engine->name();
+
+	return result;
+}
+
+/**
+ * Submit
+ * Description: Carries out a batch of reads and writes. Cached blocks are
+ *				served or updated right away, while every run of missing
+ *				blocks read and every run of uncached blocks written is
+ *				handed to the engine as one batch with the lock let go. What
+ *				the misses read is only kept if no write went around the
+ *				cache in the meantime. Offsets in front of the data region
+ *				go straight to the engine. Demand reads count towards the
+ *				hit and miss counters, readahead doesn't. Sets each request's
+ *				result to its length or a negative errno and returns whether
+ *				every request was carried out in full.
+ * Expects: requests of one batch not to overlap.
+ */
+bool BlockCache::submit( vector<IORequest> & requests, bool demand ) {
+
+	deque<CacheMiss> missing;
+	vector<IORequest> batch;
+	vector<uint32_t> owners;
+	bool writing = false;
+
+	unique_lock<mutex> guard( this->lock );
+
+	for ( uint32_t i = 0; i < requests.size(); i++ ) {
+
+		uint64_t offset = requests[i].offset,
+				 length = requests[i].length;
+		uint8_t * buffer = requests[i].buffer;
+
+		requests[i].result = length;
+
+		// Reserved sectors and FATs aren't cached
+		if ( offset < this->dataOffset ) {
+
+			batch.push_back( requests[i] );
+			owners.push_back( i );
+			writing |= requests[i].write;
+			continue;
+		}
+
+		while ( length > 0 ) {
+
+			uint64_t block = ( offset - this->dataOffset ) / this->blockSize,
+					 within = ( offset - this->dataOffset ) % this->blockSize,
+					 amount = min( length, this->blockSize - within );
+
+			CacheBlock * entry = lookup( block );
+
+			if ( entry != NULL ) {
+
+				if ( requests[i].write ) {
+
+					memcpy( &entry->data[ within ], buffer, amount );
+
+					if ( !entry->dirty ) {
+
+						entry->dirty = true;
+						this->dirtyBlocks.insert( block );
+					}
+
+				} else {
+
+					if ( demand )
+						this->hits++;
+
+					memcpy( buffer, &entry->data[ within ], amount );
+				}
+
+			} else {
+
+				// Stretch over every block the request still covers that isn't cached either
+				uint64_t count = 1;
+				while ( count * this->blockSize < within + length && this->blocks.count( block + count ) == 0 )
+					count++;
+
+				amount = min( length, count * this->blockSize - within );
+
+				IORequest piece;
+				piece.write = requests[i].write;
+
+				if ( piece.write ) {
+
+					piece.offset = offset;
+					piece.buffer = buffer;
+					piece.length = amount;
+					writing = true;
+
+				} else {
+
+					if ( demand )
+						this->misses += count;
+
+					missing.push_back( CacheMiss() );
+					CacheMiss & run = missing.back();
+					run.block = block;
+					run.count = count;
+					run.within = within;
+					run.destination = buffer;
+					run.length = amount;
+					run.data.resize( count * this->blockSize );
+
+					piece.offset = this->dataOffset + block * this->blockSize;
+					piece.buffer = &run.data[0];
+					piece.length = run.data.size();
+				}
+
+				batch.push_back( piece );
+				owners.push_back( i );
+			}
+
+			buffer += amount;
+			offset += amount;
+			length -= amount;
+		}
+	}
+
+	if ( batch.empty() )
+		return true;
+
+	if ( writing ) {
+
+		this->sequence++;
+		this->writesInFlight++;
+	}
+
+	uint64_t observed = this->sequence;
+	bool quiet = this->writesInFlight == 0;
+
+	guard.unlock();
+	this->engine->submit( batch );
+	guard.lock();
+
+	bool current = quiet && observed == this->sequence;
+
+	if ( writing ) {
+
+		this->writesInFlight--;
+		this->sequence++;
+	}
+
+	uint32_t runIndex = 0;
+	bool succeeded = true;
+
+	for ( uint32_t i = 0; i < batch.size(); i++ ) {
+
+		bool complete = batch[i].result == static_cast<int64_t>( batch[i].length );
+
+		// A failed piece fails the request it came from
+		if ( !complete ) {
+
+			requests[ owners[i] ].result = batch[i].result < 0 ? batch[i].result : -EIO;
+			succeeded = false;
+		}
+
+		if ( batch[i].write || batch[i].offset < this->dataOffset )
+			continue;
+
+		CacheMiss & run = missing[ runIndex++ ];
+
+		for ( uint64_t j = 0; j < run.count; j++ ) {
+
+			CacheBlock * entry;
+
+			// Anything cached meanwhile is at least as new as what we read
+			if ( ( entry = lookup( run.block + j ) ) != NULL )
+				memcpy( &run.data[ j * this->blockSize ], &entry->data[0], this->blockSize );
+
+			else if ( current && complete )
+				insert( run.block + j, &run.data[ j * this->blockSize ] );
+		}
+
+		memcpy( run.destination, &run.data[ run.within ], run.length );
+	}
+
+	return succeeded;
+}
+
+/**
+ * Write
+ * Description: Writes length bytes of data to the image at offset. Cached
+ *				blocks take the write and become dirty, every run of blocks
+ *				that isn't cached is written straight through. Returns
+ *				whether the image took what was written through.
+ */
+bool BlockCache::write( uint64_t offset, const void * data, uint64_t length ) {
+
+	vector<IORequest> requests( 1 );
+
+	requests[0].offset = offset;
+	requests[0].buffer = const_cast<uint8_t *>( reinterpret_cast<const uint8_t *>( data ) );
+	requests[0].length = length;
+	requests[0].write = true;
+
+	return submit( requests );
+}
+
+/**
+ * Zero
+ * Description: Zeros a whole number of blocks on the image, letting the host
+ *				do it when it can. Returns whether the range was zeroed.
+ */
+bool BlockCache::zero( uint64_t offset, uint64_t length ) {
+
+	unique_lock<mutex> guard( this->lock );
+
+	return bypass( guard, offset, length, FALLOC_FL_ZERO_RANGE );
+}
+
+/**
+ * Directory Listing Methods
+ */
+
+/**
+ * Directory Listing Constructor
+ * Description: Starts off with an empty snapshot of its own.
+ */
+DirectoryListing::DirectoryListing() : snapshot( make_shared<DirectoryListingData>() ) {}
+
+/**
+ * Append
+ * Description: Adds an entry to the end of the listing, copying its name
+ *				into the arena.
+ */
+void DirectoryListing::append( const ShortDirectoryEntry & shortEntry, const string & name, uint32_t firstSlot, uint8_t longEntryCount ) {
+
+	DirectoryRecord record;
+
+	record.shortEntry = shortEntry;
+	record.nameOffset = this->snapshot->names.size();
+	record.nameLength = name.size();
+	record.firstSlot = firstSlot;
+	record.longEntryCount = longEntryCount;
+
+	detach();
+	this->snapshot->names.append( name );
+	this->snapshot->records.push_back( record );
+}
+
+/**
+ * Clear
+ * Description: Empties the listing.
+ */
+void DirectoryListing::clear() {
+
+	this->snapshot = make_shared<DirectoryListingData>();
+}
+
+/**
+ * Detach
+ * Description: Gives this listing a private copy of its snapshot before it
+ *				is changed, if anyone else still holds the current one.
+ */
+void DirectoryListing::detach() {
+
+	if ( this->snapshot.use_count() > 1 )
+		this->snapshot = make_shared<DirectoryListingData>( *this->snapshot );
+}
+
+/**
+ * Erase
+ * Description: Drops an entry from the listing. Its name stays in the arena
+ *				until the listing is rebuilt.
+ */
+void DirectoryListing::erase( uint32_t index ) {
+
+	detach();
+	this->snapshot->records.erase( this->snapshot->records.begin() + index );
+}
+
+/**
+ * Get Cluster Chain
+ * Description: Returns the clusters the listed directory occupies.
+ */
+const vector<uint32_t> & DirectoryListing::getClusterChain() const {
+
+	return this->snapshot->clusterChain;
+}
+
+/**
+ * Insert
+ * Description: Adds an entry in slot order and returns its index.
+ */
+uint32_t DirectoryListing::insert( const ShortDirectoryEntry & shortEntry, const string & name, uint32_t firstSlot, uint8_t longEntryCount ) {
 
-	uint8_t * data = NULL;
+	vector<DirectoryRecord> & records = this->snapshot->records;
+	uint32_t index = records.size();
 
-	// Only allocate a buffer if we were able to make a chain
-	if ( size > 0 ) {
+	// Most entries land at the end, otherwise binary search for the first later slot
+	if ( index > 0 && records[ index - 1 ].firstSlot > firstSlot ) {
 
-		data = new uint8_t[ size ];
-		uint8_t * temp = data;
+		uint32_t low = 0;
 
-		// Read in data
-		for ( uint32_t i = 0; i < clusterChain.size(); i++ ) {
+		while ( low < index ) {
 
-			this->fatImage.seekg( this->getFirstDataSectorOfCluster( clusterChain[i] ) * this->bpb.bytesPerSector  );
+			uint32_t middle = ( low + index ) / 2;
 
-			for ( uint32_t j = 0; j < this->bpb.sectorsPerCluster ; j++ ) {
+			if ( records[ middle ].firstSlot > firstSlot )
+				index = middle;
 
-				this->fatImage.read( reinterpret_cast<char *>( temp ), this->bpb.bytesPerSector  );
-				temp += this->bpb.bytesPerSector ;
-			}
+			else
+				low = middle + 1;
 		}
 	}
 
-	if ( data == NULL ) {
+	append( shortEntry, name, firstSlot, longEntryCount );
 
-		cout << "Failed to get file contents. Aborting.";
-		exit( EXIT_SUCCESS );
-	}
+	// append may have cloned the snapshot
+	vector<DirectoryRecord> & updated = this->snapshot->records;
+	rotate( updated.begin() + index, updated.end() - 1, updated.end() );
 
-	return data;
+	return index;
 }
 
 /**
- * Get First Sector of Cluster
- * Description: Returns the first data sector of a given cluster.
+ * Name
+ * Description: Returns a copy of an entry's name.
  */
-inline uint32_t FAT32::getFirstDataSectorOfCluster( uint32_t n ) const {
+const string DirectoryListing::name( uint32_t index ) const {
 
-	return ( ( n - 2 ) * this->bpb.sectorsPerCluster ) + this->firstDataSector;
+	const DirectoryRecord & record = this->snapshot->records[index];
+
+	return this->snapshot->names.substr( record.nameOffset, record.nameLength );
 }
 
 /**
- * Is Directory
- * Description: Checks if given entry is a directory.
+ * Name Equals
+ * Description: Compares an entry's name against another without copying it
+ *				out of the arena.
  */
-inline bool FAT32::isDirectory( const DirectoryEntry & entry ) const {
+bool DirectoryListing::nameEquals( uint32_t index, const string & name ) const {
 
-	return ( entry.shortEntry.attributes & ( ATTR_DIRECTORY | ATTR_VOLUME_ID ) ) == ATTR_DIRECTORY;
+	const DirectoryRecord & record = this->snapshot->records[index];
+
+	return record.nameLength == name.size() && this->snapshot->names.compare( record.nameOffset, record.nameLength, name ) == 0;
 }
 
 /**
- * Is File
- * Description: Checks if given entry is a file.
+ * Set Cluster Chain
+ * Description: Remembers the clusters the listed directory occupies.
  */
-inline bool FAT32::isFile( const DirectoryEntry & entry ) const {
+void DirectoryListing::setClusterChain( const vector<uint32_t> & clusterChain ) {
 
-	return ( entry.shortEntry.attributes & ( ATTR_DIRECTORY | ATTR_VOLUME_ID ) ) == 0x00;
+	detach();
+	this->snapshot->clusterChain = clusterChain;
 }
 
 /**
- * Is Free Cluster
- * Description: Checks if given cluster's value represents that it's free.
+ * Set Short Entry
+ * Description: Replaces an entry's short entry. Leaves the snapshot shared
+ *				when nothing actually changes.
  */
-inline bool FAT32::isFreeCluster( uint32_t value ) const {
+void DirectoryListing::setShortEntry( uint32_t index, const ShortDirectoryEntry & shortEntry ) {
 
-	return ( value == FREE_CLUSTER );
+	if ( memcmp( &this->snapshot->records[index].shortEntry, &shortEntry, sizeof( ShortDirectoryEntry ) ) == 0 )
+		return;
+
+	detach();
+	this->snapshot->records[index].shortEntry = shortEntry;
 }
 
 /**
- * Is Valid Entry Name
- * Description: Checks if a given entry name is valid.
+ * Size
+ * Description: Returns the number of entries in the listing.
  */
-inline bool FAT32::isValidEntryName( const string & entryName ) const {
+uint32_t DirectoryListing::size() const {
+
+	return this->snapshot->records.size();
+}
+
+const DirectoryRecord & DirectoryListing::operator[]( uint32_t index ) const {
 
-	return entryName.find( "/" ) == string::npos;	
+	return this->snapshot->records[index];
 }
 
 /**
- * Is Valid Open Mode
- * Description: Checks if a given file open mode is valid.
+ * I/O Engine Methods
+ */
+
+/**
+ * I/O Engine Destructor
  */
-inline uint8_t FAT32::isValidOpenMode( const string & openMode ) const {
+IOEngine::~IOEngine() {}
 
-	uint8_t result = 0;
+/**
+ * Create
+ * Description: Returns the best engine the host supports for a descriptor,
+ *				io_uring when it can be set up and plain positional I/O
+ *				otherwise.
+ */
+IOEngine * IOEngine::create( int descriptor ) {
 
-	if ( openMode.compare( "r" ) == 0 )
-		result = READ;
+#ifdef HAVE_IO_URING
+	UringEngine * engine = new UringEngine( descriptor );
 
-	else if ( openMode.compare( "w" ) == 0 )
-		result = WRITE;
+	if ( engine->isReady() )
+		return engine;
 
-	else if ( openMode.compare( "rw" ) == 0 )
-		result = READWRITE;
+	delete engine;
+#endif
 
-	return result;
+	return new SyncEngine( descriptor );
 }
 
 /**
- * Make File
- * Description: Attempts to generate a DirectoryEntry for a given name
- *				Always makes a long name for simplicity purposes.
- *				Uses basis-name and numeric-tail generation for the file's
- *				Short Name Entry.
+ * Sync Engine Constructor
  */
-bool FAT32::makeFile( const string & fileName, DirectoryEntry & entry, bool directory ) const {
-
-	// Don't let anyone make . or .. from here
-	if ( fileName.compare(".") == 0 || fileName.compare("..") == 0 ) {
+SyncEngine::SyncEngine( int descriptor ) : descriptor( descriptor ) {}
 
-		cout << "error: . and .. cannot be created.\n";
-		return false;
-	}
+/**
+ * Complete
+ * Description: Carries out one request with pread or pwrite, picking up
+ *				after partial transfers until it is done or the image ends.
+ */
+void SyncEngine::complete( int descriptor, IORequest & request ) {
 
-	string copy = fileName;
-	deque<LongDirectoryEntry> longEntries;
+	uint64_t done = 0;
 
-	// Ignore trailing periods
-	size_t trailing = copy.find_last_not_of( "." );
-	if ( trailing != string::npos)
-		copy.erase( trailing + 1 );
+	while ( done < request.length ) {
 
-	// File name can be at max 255 characters
-	if ( copy.length() <= 255 ) {
+		ssize_t transferred = request.write ? pwrite( descriptor, request.buffer + done, request.length - done, request.offset + done )
+											: pread( descriptor, request.buffer + done, request.length - done, request.offset + done );
 
-		// Total path length can be at max 260 characters
-		if ( ( getCurrentPath().length() + copy.length() ) <= 260 ) {
+		if ( transferred < 0 ) {
 
-			// Validate fileName against invaid bytes
-			for ( unsigned int i = 0; i < copy.length(); i++ )
-				if ( copy[i] < ' ' || copy[i] == '"' || copy[i] == '*' || copy[i] == '/' 
-					|| copy[i] == ':' || copy[i] == '<'  || copy[i] == '>' || copy[i] == '?' 
-					||  copy[i] == '\\'|| copy[i] == '|' ) {
+			if ( errno == EINTR )
+				continue;
 
-					cout << "error: illegal character (" << copy[i] << ") in file name.\n";
-					return false;
-				}
+			request.result = -errno;
+			return;
+		}
 
-			// Get our basis name
-			bool lossyConversion = false;
-			string basisName = generateBasisName( copy, lossyConversion );
+		if ( transferred == 0 )
+			break;
 
-			// Check if we even need to do the numeric-tail algorithm
-			if ( lossyConversion || copy.length() > DIR_Name_LENGTH || shortNameExists( basisName ) )
-				basisName = generateNumericTail( basisName );
+		done += transferred;
+	}
 
-			// Setup Short Directory Entry
-			ShortDirectoryEntry shortEntry;
+	request.result = done;
+}
 
-			// Copy in basis name
-			for ( uint8_t i = 0; i < DIR_Name_LENGTH; i++ )
-				shortEntry.name[i] = basisName[i];
+/**
+ * Name
+ */
+const char * SyncEngine::name() const {
 
-			uint8_t checksum = calculateChecksum( shortEntry.name );
+	return "sync";
+}
 
-			shortEntry.attributes = directory ? ATTR_DIRECTORY : ATTR_ARCHIVE;
-			shortEntry.NTReserved = 0x00;
-			shortEntry.firstClusterHI = 0x0000;
-			shortEntry.firstClusterLO = 0x0000;
-			shortEntry.fileSize = 0x00000000;
+/**
+ * Submit
+ * Description: Carries out every request in order.
+ */
+void SyncEngine::submit( vector<IORequest> & requests ) {
 
-			// MS-DOS epoch is 01/01/1980
-			timeval timeOfDay;
-			gettimeofday( &timeOfDay, NULL );
-			time_t timeNow = (time_t) timeOfDay.tv_sec;
-			struct tm * tmNow = localtime( &timeNow );
+	for ( uint32_t i = 0; i < requests.size(); i++ )
+		complete( this->descriptor, requests[i] );
+}
 
-			shortEntry.createdTimeTenth = ( ( timeOfDay.tv_usec / 1000 ) % 1000 ) / 5;
+#ifdef HAVE_IO_URING
 
-			// 0-4: Day of Month, 5-8: Month of Year, 9-15: Years since 1980
-			uint16_t date = ( tmNow->tm_mday & 0x0000001F )
-						| ( ( ( tmNow->tm_mon + 1 ) & 0x0000000F ) << 5 )
-						| ( ( ( tmNow->tm_year - 80 ) & 0x000000EF ) << 9 );
+/**
+ * Uring Engine Constructor
+ * Description: Sets up a ring of IO_QUEUE_DEPTH entries with the raw system
+ *				calls and maps its queues. isReady tells whether that worked.
+ */
+UringEngine::UringEngine( int descriptor ) {
 
-			// 0-4: Seconds, 5-10: Minutes, 11-15: Hours
-			uint16_t time = ( ( tmNow->tm_sec / 2 ) & 0x0000001F )
-						| ( ( tmNow->tm_min & 0x0000002F ) << 5 )
-						| ( ( tmNow->tm_hour & 0x0000001F ) << 11 );
+	this->descriptor = descriptor;
+	this->working = false;
+	this->submissionRing = MAP_FAILED;
+	this->completionRing = MAP_FAILED;
+	this->entries = reinterpret_cast<io_uring_sqe *>( MAP_FAILED );
 
-			shortEntry.writeDate = shortEntry.lastAccessDate = shortEntry.createdDate = date;
-			shortEntry.writeTime = shortEntry.createdTime = time;
+	io_uring_params params;
+	memset( &params, 0, sizeof( params ) );
 
-			// Calculate number of Long Directory Entries needed
-			uint8_t range = ceil( copy.length() / static_cast<double>( LONG_NAME_LENGTH ) );
-			uint8_t charLeft = copy.length();
-			bool nullStored = false;
+	if ( ( this->ring = syscall( __NR_io_uring_setup, IO_QUEUE_DEPTH, &params ) ) < 0 )
+		return;
 
-			// Form long entry chain
-			for ( uint8_t i = 1; i <= range; i++ ) {
+	this->submissionRingSize = params.sq_off.array + params.sq_entries * sizeof( uint32_t );
+	this->completionRingSize = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
 
-				LongDirectoryEntry entry;
+	// Newer kernels map both queues with one call
+	bool single = ( params.features & IORING_FEAT_SINGLE_MMAP ) != 0;
 
-				entry.ordinal = ( i == range ) ? LAST_LONG_ENTRY | i : i;
-				entry.attributes = ATTR_LONG_NAME;
-				entry.type = 0;
-				entry.checksum = checksum;
-				entry.firstClusterLO = 0;
+	if ( single )
+		this->submissionRingSize = this->completionRingSize = max( this->submissionRingSize, this->completionRingSize );
 
-				convertLongNameSegment( entry.name1, sizeof( entry.name1 ) / 2, charLeft, nullStored, copy );
-				convertLongNameSegment( entry.name2, sizeof( entry.name2 ) / 2, charLeft, nullStored, copy );
-				convertLongNameSegment( entry.name3, sizeof( entry.name3 ) / 2, charLeft, nullStored, copy );
+	this->submissionRing = mmap( NULL, this->submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring, IORING_OFF_SQ_RING );
 
-				longEntries.push_front( entry );
-			}
+	if ( this->submissionRing == MAP_FAILED )
+		return;
 
-			entry.name = copy;
-			entry.shortEntry = shortEntry;
-			entry.longEntries = longEntries;
+	this->completionRing = single ? this->submissionRing
+								  : mmap( NULL, this->completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring, IORING_OFF_CQ_RING );
 
-			return true;
+	if ( this->completionRing == MAP_FAILED )
+		return;
 
-		} else {
+	this->entriesSize = params.sq_entries * sizeof( io_uring_sqe );
+	this->entries = reinterpret_cast<io_uring_sqe *>( mmap( NULL, this->entriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+															 this->ring, IORING_OFF_SQES ) );
 
-			cout << "error: total path length must be less than 260 characters.\n";
-			return false;
+	if ( this->entries == MAP_FAILED )
+		return;
 
-		} 
+	uint8_t * submission = reinterpret_cast<uint8_t *>( this->submissionRing ),
+			* completion = reinterpret_cast<uint8_t *>( this->completionRing );
 
-	} else {
+	this->submissionHead = reinterpret_cast<uint32_t *>( submission + params.sq_off.head );
+	this->submissionTail = reinterpret_cast<uint32_t *>( submission + params.sq_off.tail );
+	this->submissionMask = reinterpret_cast<uint32_t *>( submission + params.sq_off.ring_mask );
+	this->submissionArray = reinterpret_cast<uint32_t *>( submission + params.sq_off.array );
+	this->completionHead = reinterpret_cast<uint32_t *>( completion + params.cq_off.head );
+	this->completionTail = reinterpret_cast<uint32_t *>( completion + params.cq_off.tail );
+	this->completionMask = reinterpret_cast<uint32_t *>( completion + params.cq_off.ring_mask );
+	this->completions = reinterpret_cast<io_uring_cqe *>( completion + params.cq_off.cqes );
 
-		cout << "error: file name must be less than 256 characters.\n";
-		return false;
-	}
+	this->working = true;
 }
 
 /**
- * File Open Mode to String
- * Description: Converts an open mode to a representative string.
+ * Uring Engine Destructor
  */
-inline const string FAT32::modeToString( const uint8_t & mode ) const {
+UringEngine::~UringEngine() {
 
-	switch ( mode ) {
+	if ( this->entries != MAP_FAILED )
+		munmap( this->entries, this->entriesSize );
 
-		case READ: return "reading";
-		case WRITE: return "writing";
-		case READWRITE: return "reading and writing";
-	}
+	if ( this->completionRing != MAP_FAILED && this->completionRing != this->submissionRing )
+		munmap( this->completionRing, this->completionRingSize );
 
-	return "invalid mode";
+	if ( this->submissionRing != MAP_FAILED )
+		munmap( this->submissionRing, this->submissionRingSize );
+
+	if ( this->ring >= 0 )
+		::close( this->ring );
 }
 
 /**
- * Remove Entry
- * Description: Guts of rm and rmdir. Removes an entry from the
- *              the file system and updates all necessary records.
- *				Actually marks a file as free but doesn't zero out unless
- *				safe is set to true.
+ * Is Ready
+ * Description: Tells whether the ring was set up.
  */
-void FAT32::removeEntry( DirectoryEntry & entry, uint32_t index, bool safe ) {
-
-	vector<uint32_t> clusterChain;
-
-	// Check if we need to zero out file contents
-	if ( safe )
-		zeroOutFileContents( formCluster( entry.shortEntry ) );
-
-	uint32_t nextCluster = formCluster( entry.shortEntry );
+bool UringEngine::isReady() const {
 
-	// Build list of clusters ( potentially remaining if we crashed ) for this file
-	do {
+	return this->working;
+}
 
-		clusterChain.push_back( nextCluster );
+/**
+ * Name
+ */
+const char * UringEngine::name() const {
 
-	// We must also check if the nextCluster is free because we may have crashed while deleting this
-	} while ( ( nextCluster = getFATEntry( nextCluster ) ) < EOC && nextCluster != FREE_CLUSTER );	
+	return "io_uring";
+}
 
-	for ( vector<uint32_t>::reverse_iterator itr = clusterChain.rbegin(); itr != clusterChain.rend(); itr++ ) {
+/**
+ * Submit
+ * Description: Fills the submission queue with as much of the batch as it
+ *				holds, submits and waits for all of it with one system call
+ *				and reaps every completion before moving on. Partial
+ *				transfers and anything the ring couldn't do are finished with
+ *				positional I/O. A ring the kernel refuses is given up on, but
+ *				only once whatever it already took has completed.
+ */
+void UringEngine::submit( vector<IORequest> & requests ) {
 
-		// Skip free clusters
-		if ( *itr != 0 ) {
+	unique_lock<mutex> guard( this->lock, defer_lock );
 
-			setClusterValue( *itr, FREE_CLUSTER );
-			this->freeClusters.push_back( *itr );
-			this->fsInfo.freeCount = this->freeClusters.size();
-		}
-	}
+	// Lone requests gain nothing from the ring, and nobody waits for it
+	if ( requests.size() < 2 || !this->working || !guard.try_lock() ) {
 
-	// Update all FATs
-	for ( uint8_t i = 0; i < this->bpb.numFATs; i++ ) {
+		for ( uint32_t i = 0; i < requests.size(); i++ )
+			SyncEngine::complete( this->descriptor, requests[i] );
 
-		uint32_t fatLocation = this->bpb.reservedSectorCount * this->bpb.bytesPerSector + ( i * this->bpb.FATSz32 * this->bpb.bytesPerSector );
-		this->fatImage.seekp( fatLocation );
-		this->fatImage.write( reinterpret_cast<char *>( this->fat ), ( this->countOfClusters + 2 ) *  FAT_ENTRY_SIZE );
+		return;
 	}
 
-	// Update FSInfo
-	this->fatImage.seekp( this->bpb.FSInfo * this->bpb.bytesPerSector );
-	this->fatImage.write( reinterpret_cast<char *>( &this->fsInfo ), sizeof( this->fsInfo ) );
-
-	// Make sure this gets out to the disk first
-	this->fatImage.flush();
+	uint32_t depth = *this->submissionMask + 1;
 
-	// Delete directory entry
-	for ( uint32_t i = 0; i < entry.longEntries.size(); i++ ) {
+	for ( uint32_t i = 0; i < requests.size(); i++ )
+		requests[i].result = -ECANCELED;
 
-		if ( safe )
-			memset( &entry.longEntries[i], 0, sizeof( entry.longEntries[i] ) - sizeof( entry.longEntries[i].location ) );
+	for ( uint32_t next = 0; next < requests.size() && this->working; ) {
 
-		entry.longEntries[i].ordinal = DIR_FREE_ENTRY;
-		this->fatImage.seekp( entry.longEntries[i].location );
-		this->fatImage.write( reinterpret_cast<char *>( &entry.longEntries[i] ), DIR_ENTRY_SIZE );
-	}
+		uint32_t count = min( depth, static_cast<uint32_t>( requests.size() - next ) ),
+				 first = *this->submissionTail,
+				 tail = first;
 
-	// Check if this is the last entry in a directory
-	if ( safe )
-			memset( &entry.shortEntry, 0, sizeof( entry.shortEntry ) - sizeof( entry.shortEntry.location ) );
-	entry.shortEntry.name[0] = ( index + 1 == this->currentDirectoryListing.size() ) ? DIR_LAST_FREE_ENTRY : DIR_FREE_ENTRY; 
-	this->fatImage.seekp( entry.shortEntry.location );
-	this->fatImage.write( reinterpret_cast<char *>( &entry.shortEntry ), DIR_ENTRY_SIZE );
+		for ( uint32_t i = next; i < next + count; i++ ) {
 
-	// Don't let OS wait to flush
-	this->fatImage.flush();
+			uint32_t index = tail++ & *this->submissionMask;
+			io_uring_sqe & entry = this->entries[ index ];
 
-	this->currentDirectoryListing.erase( this->currentDirectoryListing.begin() + index );
-}
+			memset( &entry, 0, sizeof( entry ) );
+			entry.opcode = requests[i].write ? IORING_OP_WRITE : IORING_OP_READ;
+			entry.fd = this->descriptor;
+			entry.off = requests[i].offset;
+			entry.addr = reinterpret_cast<uint64_t>( requests[i].buffer );
+			entry.len = static_cast<uint32_t>( min( requests[i].length, static_cast<uint64_t>( 0x7FFFF000 ) ) );
+			entry.user_data = i;
 
-/**
- * Resize File
- * Description: Resizes a file (cluster chain) by a given amount. Updates
- *				the fat image as well.
- */
-uint8_t * FAT32::resize( uint32_t amount, vector<uint32_t> & clusterChain ) {
+			this->submissionArray[ index ] = index;
+		}
 
-	uint32_t savedAmount = amount;
+		// Kernel may only see the entries once they are all written
+		__atomic_store_n( this->submissionTail, tail, __ATOMIC_RELEASE );
 
-	// Sepcial Case: Check if we are reszing an empty file
-	if ( clusterChain[0] == 0 ) {
+		uint32_t submitted = 0,
+				 reaped = 0,
+				 expected = count;
+		bool refused = false;
 
-		// Reserve next free cluster and update linked list
-		uint32_t nextCluster = this->freeClusters.front();
-		setClusterValue( nextCluster, EOC );
-		this->freeClusters.erase( this->freeClusters.begin() );
-		this->fsInfo.freeCount = this->freeClusters.size();
+		while ( reaped < expected ) {
 
-		// Update chain
-		clusterChain.pop_back();
-		clusterChain.push_back( nextCluster );
+			int entered = syscall( __NR_io_uring_enter, this->ring, refused ? 0 : count - submitted, expected - reaped, IORING_ENTER_GETEVENTS, NULL, 0 );
 
-		// Done with one cluster
-		amount--;
-	}
+			if ( entered < 0 && errno != EINTR ) {
 
-	for ( uint32_t i = 0; i < amount; i++ ) {
+				this->working = false;
 
-		uint32_t currentCluster = clusterChain.back();
-		uint32_t nextCluster = this->freeClusters.front();
+				// The kernel still writes into the buffers of whatever it
+				// took, positional I/O must not touch them before it's done
+				if ( !refused ) {
 
-		// Reserve next free cluster and update linked list
-		setClusterValue( currentCluster, nextCluster );
-		setClusterValue( nextCluster, EOC );
-		this->freeClusters.erase( this->freeClusters.begin() );
-		this->fsInfo.freeCount = this->freeClusters.size();
+					refused = true;
+					expected = __atomic_load_n( this->submissionHead, __ATOMIC_ACQUIRE ) - first;
 
-		// Update chain
-		clusterChain.pop_back();
-		clusterChain.push_back( currentCluster );
-		clusterChain.push_back( nextCluster );
-	}
+				} else
+					this_thread::yield();
 
-	// Update all FATs
-	for ( uint8_t i = 0; i < this->bpb.numFATs; i++ ) {
+			} else if ( entered > 0 )
+				submitted += entered;
 
-		uint32_t fatLocation = this->bpb.reservedSectorCount * this->bpb.bytesPerSector + ( i * this->bpb.FATSz32 * this->bpb.bytesPerSector );
-		this->fatImage.seekp( fatLocation );
-		this->fatImage.write( reinterpret_cast<char *>( this->fat ), ( this->countOfClusters + 2 ) *  FAT_ENTRY_SIZE );
-	}
+			uint32_t head = *this->completionHead,
+					 completionTail = __atomic_load_n( this->completionTail, __ATOMIC_ACQUIRE );
 
-	// Update FSInfo
-	this->fatImage.seekp( this->bpb.FSInfo * this->bpb.bytesPerSector );
-	this->fatImage.write( reinterpret_cast<char *>( &this->fsInfo ), sizeof( this->fsInfo ) );
+			for ( ; head != completionTail; head++, reaped++ ) {
 
-	uint32_t size = clusterChain.size() * this->bytesPerCluster;
+				const io_uring_cqe & completion = this->completions[ head & *this->completionMask ];
+				requests[ completion.user_data ].result = completion.res;
 
-	uint8_t * data = NULL;
+				// Kernels without these opcodes get positional I/O from now on
+				if ( completion.res == -EINVAL )
+					this->working = false;
+			}
 
-	// Only allocate a buffer if we were able to make a chain
-	if ( size > 0 ) {
+			__atomic_store_n( this->completionHead, head, __ATOMIC_RELEASE );
+		}
 
-		// Zero out old file contents
-		zeroOutFileContents( clusterChain[ clusterChain.size() - savedAmount ] );
-		this->fatImage.flush();
+		next += count;
+	}
 
-		data = new uint8_t[ size ];
-		uint8_t * temp = data;
+	for ( uint32_t i = 0; i < requests.size(); i++ ) {
 
-		// Read in data
-		for ( uint32_t i = 0; i < clusterChain.size(); i++ ) {
+		if ( requests[i].result == static_cast<int64_t>( requests[i].length ) )
+			continue;
 
-			this->fatImage.seekg( this->getFirstDataSectorOfCluster( clusterChain[i] ) * this->bpb.bytesPerSector  );
+		uint64_t done = requests[i].result > 0 ? requests[i].result : 0;
 
-			for ( uint32_t j = 0; j < this->bpb.sectorsPerCluster ; j++ ) {
+		IORequest rest = requests[i];
+		rest.offset += done;
+		rest.buffer += done;
+		rest.length -= done;
 
-				this->fatImage.read( reinterpret_cast<char *>( temp ), this->bpb.bytesPerSector  );
-				temp += this->bpb.bytesPerSector ;
-			}
-		}
+		SyncEngine::complete( this->descriptor, rest );
+		requests[i].result = rest.result < 0 ? rest.result : static_cast<int64_t>( done + rest.result );
 	}
+}
 
-	if ( data == NULL ) {
+#endif
 
-		cout << "Failed to get file contents. Aborting.";
-		exit( EXIT_SUCCESS );
-	}
+/**
+ * I/O Pool Methods
+ */
 
-	return data;
+/**
+ * I/O Pool Constructor
+ * Description: Starts off without threads, resize starts them.
+ */
+IOPool::IOPool() {
+
+	this->stopping = false;
 }
 
 /**
- * Short Name Exists
- * Description: Checks if a short name exists in the current directory.
+ * I/O Pool Destructor
+ * Description: Lets every thread finish what is queued and joins it.
  */
-inline bool FAT32::shortNameExists( string name ) const {
+IOPool::~IOPool() {
 
-	for ( uint32_t i = 0; i < currentDirectoryListing.size(); i++ )
-		if ( strncmp( reinterpret_cast<const char *>( currentDirectoryListing[i].shortEntry.name ), name.c_str(), DIR_Name_LENGTH ) == 0 )
-			return true;
-	
-	return false;
+	resize( 0 );
 }
 
 /**
- * Set Cluster Value
- * Description: Sets a cluster entry to a given value.
+ * Resize
+ * Description: Replaces the pool's threads with count new ones. The old
+ *				threads finish everything already queued before they stop,
+ *				and anything run meanwhile is done by its caller.
  */
-inline void FAT32::setClusterValue( uint32_t n, uint32_t newValue ) {
+void IOPool::resize( uint32_t count ) {
 
-	// Make sure we don't overwrite upper 4 bits
-	newValue &= FAT_ENTRY_MASK;
+	vector<thread> retired;
 
-	// Reset entry preserving upper 4 bits
-	this->fat[n] &= ~FAT_ENTRY_MASK;
+	{
+		lock_guard<mutex> guard( this->lock );
 
-	// Set new value
-	this->fat[n] |= newValue;
-}
+		this->stopping = true;
+		retired.swap( this->workers );
+	}
 
-/**
- * Write File Contentss
- * Description: Writes the given file contents to a specified
- *				cluster chain.
- * Expects: clusterChain to correspond to contents.
- */
-void FAT32::writeFileContents( const uint8_t * contents, const vector<uint32_t> & clusterChain ) {
+	this->ready.notify_all();
 
-	// Read in data
-	for ( uint32_t i = 0; i < clusterChain.size(); i++ ) {
+	for ( uint32_t i = 0; i < retired.size(); i++ )
+		retired[i].join();
 
-		this->fatImage.seekp( this->getFirstDataSectorOfCluster( clusterChain[i] ) * this->bpb.bytesPerSector  );
+	lock_guard<mutex> guard( this->lock );
 
-		for ( uint32_t j = 0; j < this->bpb.sectorsPerCluster ; j++ ) {
+	this->stopping = false;
 
-			this->fatImage.write( reinterpret_cast<const char *>( contents ), this->bpb.bytesPerSector  );
-			contents += this->bpb.bytesPerSector ;
-		}
-	}
+	for ( uint32_t i = 0; i < count; i++ )
+		this->workers.push_back( thread( &IOPool::work, this ) );
 }
 
 /**
- * Zero Out File Contents
- * Description: Zeros out a file for safety purposes.
+ * Run
+ * Description: Queues one chunk of work, counted in remaining until it is
+ *				done. Runs it right away on the caller when there are no
+ *				threads.
  */
-void FAT32::zeroOutFileContents( uint32_t initialCluster ) const {
-
-	vector<uint32_t> clusterChain;
-	uint32_t nextCluster = initialCluster;
+void IOPool::run( const function<void()> & work, uint32_t & remaining ) {
 
-	// Build list of clusters for this file
-	do {
+	unique_lock<mutex> guard( this->lock );
 
-		clusterChain.push_back( nextCluster );
+	if ( this->workers.empty() ) {
 
-	} while ( ( nextCluster = getFATEntry( nextCluster ) ) < EOC );
+		guard.unlock();
+		work();
+		return;
+	}
 
-	char * zeros = new char[this->bpb.bytesPerSector];
-	memset( zeros, 0, this->bpb.bytesPerSector );
+	PoolTask task;
+	task.work = work;
+	task.remaining = &remaining;
 
-	// Write out zeros
-	for ( uint32_t i = 0; i < clusterChain.size(); i++ ) {
+	remaining++;
+	this->tasks.push_back( task );
+	this->ready.notify_one();
+}
 
-		this->fatImage.seekp( this->getFirstDataSectorOfCluster( clusterChain[i] ) * this->bpb.bytesPerSector  );
+/**
+ * Size
+ * Description: Returns how many threads the pool has.
+ */
+uint32_t IOPool::size() {
 
-		for ( uint32_t j = 0; j < this->bpb.sectorsPerCluster ; j++ ) 
-			this->fatImage.write( zeros, this->bpb.bytesPerSector );
-	}
+	lock_guard<mutex> guard( this->lock );
 
-	delete[] zeros;
+	return this->workers.size();
 }
 
 /**
- * FAT_FS Functions
+ * Wait
+ * Description: Blocks until every chunk counted in remaining is done.
  */
+void IOPool::wait( uint32_t & remaining ) {
+
+	unique_lock<mutex> guard( this->lock );
+
+	while ( remaining > 0 )
+		this->finished.wait( guard );
+}
 
 /**
- * Less Than Operator for DirectoryEntry
- * Description: Used for std::map. A DirectoryEntry is considered less than
- *				another if its full path is less than the others.
+ * Work
+ * Description: Thread body. Runs queued chunks until the pool stops and
+ *				nothing is left in the queue.
  */
-bool FAT_FS::operator< ( const DirectoryEntry & left, const DirectoryEntry & right ) {
+void IOPool::work() {
 
-	return operator<( left.fullPath, right.fullPath );
+	unique_lock<mutex> guard( this->lock );
+
+	while ( true ) {
+
+		while ( this->tasks.empty() && !this->stopping )
+			this->ready.wait( guard );
+
+		if ( this->tasks.empty() )
+			break;
+
+		PoolTask task = this->tasks.front();
+		this->tasks.pop_front();
+
+		guard.unlock();
+		task.work();
+		guard.lock();
+
+		( *task.remaining )--;
+		this->finished.notify_all();
+	}
 }
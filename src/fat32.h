@@ -1,228 +1,259 @@
 #pragma once
 
-#include <cctype>
-#include <cmath>
-#include <cstdio>
-#include <cstdlib>
-#include <cstring>
-#include <ctime>
-#include <deque>
 #include <fstream>
-#include <iostream>
-#include <map>
+#include <functional>
+#include <memory>
 #include <stdint.h>
 #include <string>
-#include <sys/time.h>
 #include <vector>
 
-#include <iomanip>
-
 using namespace std;
 
 namespace FAT_FS {
 
-// FAT Markers/Constants
-const uint8_t ATTR_READ_ONLY = 0x01,
-			  ATTR_HIDDEN = 0x02,
-			  ATTR_SYSTEM = 0x04,
-			  ATTR_VOLUME_ID = 0x08,
-			  ATTR_DIRECTORY = 0x10,
-			  ATTR_ARCHIVE = 0x20,
-			  ATTR_LONG_NAME = ATTR_READ_ONLY | ATTR_HIDDEN | ATTR_SYSTEM | ATTR_VOLUME_ID,
-			  ATTR_LONG_NAME_MASK = ATTR_READ_ONLY | ATTR_HIDDEN | ATTR_SYSTEM | ATTR_VOLUME_ID | ATTR_DIRECTORY | ATTR_ARCHIVE,
-			  LAST_LONG_ENTRY = 0x40,
-			  SHORT_NAME_SPACE_PAD = 0x20,
-			  DIR_FREE_ENTRY = 0xE5,
-			  DIR_LAST_FREE_ENTRY = 0x00,
-			  LONG_NAME_LENGTH = 0x0D;
-
-const uint16_t LONG_NAME_TRAIL = 0xFFFF,
-			   LONG_NAME_NULL = 0x0000;
-
-const uint32_t FAT_ENTRY_SIZE = 0x04,
-			   FAT_ENTRY_MASK = 0x0FFFFFFF,
-			   FREE_CLUSTER = 0x00000000,
-			   EOC = 0x0FFFFFF8,
-			   DIR_ENTRY_SIZE = 0x20,
-			   DIR_Attr = 0x0B,
-			   DIR_Name_LENGTH = 0x0B,
-			   DIR_MAX_SIZE = 0x200000,
-			   FILE_MAX_SIZE = 0xFFFFFFFF;  	
-
 // Open Mode Constants
 const uint8_t READ = 0x01,
 			  WRITE = 0x02,
-			  READWRITE = READ|WRITE;
+			  READWRITE = READ|WRITE,
+			  APPEND = 0x04,
+			  BUFFERED = 0x08;
+
+// Results of the library calls, describe turns one into a message
+enum Status {
+
+	STATUS_OK = 0,
+	STATUS_INVALID_NAME,
+	STATUS_NOT_FOUND,
+	STATUS_NOT_A_FILE,
+	STATUS_NOT_A_DIRECTORY,
+	STATUS_INVALID_MODE,
+	STATUS_ALREADY_OPEN,
+	STATUS_BAD_HANDLE,
+	STATUS_NOT_OPEN,
+	STATUS_NOT_READABLE,
+	STATUS_OUT_OF_RANGE,
+	STATUS_NO_SPACE,
+	STATUS_WRITES_LOST,
+	STATUS_ILLEGAL_CHARACTER,
+	STATUS_NAME_TOO_LONG,
+	STATUS_PATH_TOO_LONG,
+	STATUS_RESERVED_NAME,
+	STATUS_EXISTS,
+	STATUS_NOT_EMPTY,
+	STATUS_NOT_WRITABLE,
+	STATUS_TOO_LARGE,
+	STATUS_NO_SUCH_JOB,
+	STATUS_TOO_MANY_WORKERS,
+	STATUS_IO_ERROR
+};
+
+const string describe( Status status, const string & name, const string & kind = "file" );
 
 /**
- * FAT Data Structures
+ * Library Data Structures
  */
 
-typedef struct BIOSParameterBlock {
+typedef struct EntryInfo {
+
+	string name;
+	uint32_t size;
+	uint32_t firstCluster;
+	bool directory;
+
+} EntryInfo;
+
+typedef struct FileSystemInfo {
 
-	uint8_t jmpBoot[3];
-	uint8_t OEMName[8];
 	uint16_t bytesPerSector;
 	uint8_t sectorsPerCluster;
-	uint16_t reservedSectorCount;
+	uint32_t totalSectors;
 	uint8_t numFATs;
-	uint16_t rootEntryCount;
-	uint16_t totalSectors16;
-	uint8_t media;
-	uint16_t FATSz16;
-	uint16_t sectorsPerTrack;
-	uint16_t numHeads;
-	uint32_t hiddenSectors;
-	uint32_t totalSectors32;
-	uint32_t FATSz32;
-	uint16_t extraFlags;
-	uint16_t FSVersion;
-	uint32_t rootCluster;
-	uint16_t FSInfo;
-	uint16_t backupBootSector;
-	uint8_t reserved[12];
-	uint8_t driveNumber;
-	uint8_t reserved1;
-	uint8_t bootSignature;
-	uint32_t volumeID;
-	uint8_t volumeLabel[11];
-	uint8_t fileSystemType[8];
-
-} __attribute__((packed)) BIOSParameterBlock;
-
-typedef struct FSInfo {
-
-	uint32_t leadSignature;
-	uint32_t reserved1[120];
-	uint32_t structSignature;
-	uint32_t freeCount;
-	uint32_t nextFree;
-	uint32_t reserved2[3];
-	uint32_t trailingSignature;
-
-} __attribute__((packed)) FSInfo;
-
-typedef struct ShortDirectoryEntry {
-
-	uint8_t name[11];
-	uint8_t attributes;
-	uint8_t NTReserved;
-	uint8_t createdTimeTenth;
-	uint16_t createdTime;
-	uint16_t createdDate;
-	uint16_t lastAccessDate;
-	uint16_t firstClusterHI;
-	uint16_t writeTime;
-	uint16_t writeDate;
-	uint16_t firstClusterLO;
-	uint32_t fileSize;
-	uint32_t location;
-
-} __attribute__((packed)) ShortDirectoryEntry;
-
-typedef struct LongDirectoryEntry {
-
-	uint8_t ordinal;
-	uint16_t name1[5];
-	uint8_t attributes;
-	uint8_t type;
-	uint8_t checksum;
-	uint16_t name2[6];
-	uint16_t firstClusterLO;
-	uint16_t name3[2];
-	uint32_t location;
-
-} __attribute__((packed)) LongDirectoryEntry;
-
-typedef struct DirectoryEntry {
+	uint32_t sectorsPerFAT;
+	uint32_t freeSectors;
+
+	// Block cache and I/O
+	uint64_t cacheHits;
+	uint64_t cacheMisses;
+	uint32_t cachedClusters;
+	uint32_t dirtyClusters;
+	string engine;
+	uint32_t workers;
+
+} FileSystemInfo;
+
+typedef struct Reservation {
+
+	uint32_t clusters;
+	uint32_t runs;
+
+} Reservation;
+
+// What defrag did with a fragmented chain
+enum DefragOutcome {
+
+	DEFRAG_MOVED,
+	DEFRAG_OVER_BUDGET,
+	DEFRAG_NO_SPACE,
+	DEFRAG_NO_LARGER_RUN,
+	DEFRAG_IO_ERROR
+};
+
+typedef struct DefragChain {
+
+	string path;
+	uint32_t clusters;
+	uint32_t fragments;
+	DefragOutcome outcome;
+
+	// Only set for moved chains
+	uint32_t runs;
+	uint64_t bytesMovedSoFar;
+
+} DefragChain;
+
+typedef struct DefragReport {
+
+	uint32_t chainsChecked;
+	uint32_t chainsFragmented;
+	uint32_t chainsMoved;
+	uint32_t chainsSkipped;
+	uint64_t bytesMoved;
+	vector<DefragChain> chains;
 
+} DefragReport;
+
+// Kinds of problems check finds, value and other depend on the kind
+enum ProblemKind {
+
+	PROBLEM_INVALID_LINK,	// value: the out of range cluster linked to
+	PROBLEM_LOOP,			// value: the cluster the chain loops back to
+	PROBLEM_CROSS_LINK,		// value: the cluster shared with another chain
+	PROBLEM_FREE_LINK,		// value: the last cluster before the free one
+	PROBLEM_DOTDOT,			// value: the cluster .. points to, other: the right one
+	PROBLEM_SIZE,			// value: the file size, other: bytes in its chain
+	PROBLEM_LOST,			// value: lost clusters, other: chains they make up
+	PROBLEM_FREE_COUNT		// value: the FSInfo free count, other: the real one
+};
+
+typedef struct CheckProblem {
+
+	ProblemKind kind;
+	string path;
+	uint64_t value;
+	uint64_t other;
+
+} CheckProblem;
+
+typedef struct CheckReport {
+
+	vector<CheckProblem> problems;
+	uint32_t chains;
+	uint32_t threads;
+	bool repaired;
+
+} CheckReport;
+
+typedef struct UsageTotals {
+
+	string path;
+	uint64_t bytes;
+	uint64_t allocatedBytes;
+	uint32_t files;
+	uint32_t directories;
+
+} UsageTotals;
+
+typedef struct JobInfo {
+
+	uint32_t id;
 	string name;
-	string fullPath;
-	ShortDirectoryEntry shortEntry;
-	deque<LongDirectoryEntry> longEntries;
+	bool safe;
+	bool cancelled;
+	uint32_t reclaimedClusters;
+	uint32_t totalClusters;
+
+} JobInfo;
+
+// Where read sends file data, in order, and find sends matching paths
+typedef function<void( const uint8_t * data, uint32_t length )> ReadOutput;
+typedef function<void( const string & path )> FindOutput;
+
+// Working directory state, only the library looks inside
+struct SessionState;
 
-} DirectoryEntry;
+// A working directory, used by one thread at a time. Copies share it
+typedef struct Session {
 
-bool operator< ( const DirectoryEntry & left, const DirectoryEntry & right );
+	shared_ptr<SessionState> state;
+
+} Session;
+
+class Volume;
 
 /**
  * FAT File System
  * Description: Representation of a FAT File System that can be operated on.
+ *				Everything it is made of lives behind volume.
  */
 class FAT32 {
 
 private:
 
-	BIOSParameterBlock bpb;
-	FSInfo fsInfo;
-	uint32_t bytesPerCluster,
-			 firstDataSector,
-			 fatLocation,
-			 countOfClusters,
-			 * fat,
-			 currentDirectoryFirstCluster;
-
-	fstream & fatImage;
-	vector<string> currentPath;
-	vector<uint32_t> freeClusters;
-	vector<DirectoryEntry> currentDirectoryListing;
-	map<DirectoryEntry, uint8_t> openFiles;
-	
-	void addFile( DirectoryEntry & entry );
-	void appendLongName( string & current, uint16_t * name, uint32_t size ) const;
-	inline uint32_t calculateDirectoryEntryLocation( uint32_t byte, vector<uint32_t> clusterChain ) const;
-	inline uint8_t calculateChecksum( const uint8_t * shortName ) const;
-	void convertLongNameSegment( uint16_t * nameInStruct, uint8_t length, uint8_t & charLeft, bool & nullStored, const string & name ) const;
-	const string convertShortName( uint8_t * name ) const;
-	bool directoryExists( const string & directoryName ) const;
-	bool fileExists( const string & fileName ) const;
-	bool findDirectory( const string & directoryName, uint32_t & index ) const;
-	bool findEntry( const string & entryName, uint32_t & index ) const;
-	bool findFile( const string & fileName, uint32_t & index ) const;
-	inline uint32_t formCluster( const ShortDirectoryEntry & entry ) const;
-	const string generateBasisName( const string & longName, bool & lossyConversion ) const;
-	string generateNumericTail( string basisName ) const;
-	vector<DirectoryEntry> getDirectoryListing( uint32_t cluster ) const;
-	inline uint32_t getFATEntry( uint32_t n ) const;
-	uint8_t * getFileContents( uint32_t initialCluster, vector<uint32_t> & clusterChain ) const;
-	inline uint32_t getFirstDataSectorOfCluster( uint32_t n ) const;
-	inline bool isDirectory( const DirectoryEntry & entry ) const;
-	inline bool isFile( const DirectoryEntry & entry ) const;
-	inline bool isFreeCluster( uint32_t value ) const;
-	inline bool isValidEntryName( const string & entryName ) const;
-	inline uint8_t isValidOpenMode( const string & openMode ) const;
-	bool makeFile( const string & fileName, DirectoryEntry & entry, bool directory ) const;
-	inline const string modeToString( const uint8_t & mode ) const;
-	void removeEntry( DirectoryEntry & entry, uint32_t index, bool safe );
-	uint8_t * resize( uint32_t amount, vector<uint32_t> & clusterChain );
-	inline void setClusterValue( uint32_t n, uint32_t newValue );
-	inline bool shortNameExists( string name ) const;
-	void writeFileContents( const uint8_t * contents, const vector<uint32_t> & clusterChain );
-	void zeroOutFileContents( uint32_t initialCluster ) const;
+	Volume * volume;
+
+	SessionState * stateOf( Session * session );
 
 public:
 
-	FAT32( fstream & fatImage );
+	FAT32( fstream & fatImage, const string & imagePath, const string & sidecarPath = "" );
+	FAT32( const FAT32 & ) = delete;
 	~FAT32();
 
-	const string getCurrentPath() const;
+	FAT32 & operator=( const FAT32 & ) = delete;
+
+	const string getCurrentPath( const Session * session = NULL ) const;
+	uint8_t isValidOpenMode( const string & openMode ) const;
+	const string modeToString( const uint8_t & mode ) const;
 
 	/**
-	 * Commands
+	 * Library calls, these never print and report through their result. Names
+	 * are looked up in the given session's directory, or the commands' one
+	 * when it's NULL. Sessions that were never started start in the root.
+	 * Calls on different sessions may run on any number of threads at once.
 	 */
-	 
-	void fsinfo() const;
-	void open( const string & fileName, const string & openMode  );
-	void close( const string & fileName );
-	void create( const string & fileName );
-	void read( const string & fileName, uint32_t startPos, uint32_t numBytes );
-	void write( const string & fileName, uint32_t startPos, const string & quotedData );
-	void rm( const string & fileName, bool safe = false );
-	void cd( const string & directory );
-	void ls( const string & directory ) const;
-	void mkdir( const string & directoryName );
-	void rmdir( const string & directoryName );
-	void size( const string & fileName ) const;
+
+	void startSession( Session & session );
+	Status changeDirectory( const string & directoryName, Session * session = NULL );
+	Status stat( const string & entryName, EntryInfo & info, Session * session = NULL );
+	Status list( const string & directoryName, vector<EntryInfo> & entries, Session * session = NULL );
+	Status fileSize( const string & fileName, uint32_t & bytes, Session * session = NULL );
+	Status openFile( const string & fileName, uint8_t mode, uint32_t & handle, Session * session = NULL );
+	Status closeFile( const string & fileName, Session * session = NULL );
+	Status readInto( const string & fileName, uint32_t startPos, uint8_t * buffer, uint32_t length, uint32_t & bytesRead, Session * session = NULL );
+
+	void fsinfo( FileSystemInfo & info ) const;
+	Status create( const string & fileName, Session * session = NULL );
+	Status create( const vector<string> & fileNames, vector<Status> & results, Session * session = NULL );
+	Status read( const string & fileName, uint32_t startPos, uint32_t numBytes, const ReadOutput & output, Session * session = NULL );
+	Status read( const string & fileName, uint32_t numBytes, const ReadOutput & output, Session * session = NULL );
+	Status write( const string & fileName, uint32_t startPos, const string & data, Session * session = NULL );
+	Status write( const string & fileName, const string & data, Session * session = NULL );
+	Status append( const string & fileName, const string & data, Session * session = NULL );
+	Status rm( const string & fileName, bool safe = false, Session * session = NULL );
+	Status mkdir( const string & directoryName, Session * session = NULL );
+	Status mkdir( const vector<string> & directoryNames, vector<Status> & results, Session * session = NULL );
+	Status rmdir( const string & directoryName, Session * session = NULL );
+	Status rmTree( const string & directoryName, Session * session = NULL );
+	Status du( const string & path, UsageTotals & totals, Session * session = NULL );
+	Status find( const string & path, const string & pattern, const FindOutput & output, Session * session = NULL );
+	Status prealloc( const string & fileName, uint32_t numBytes, bool keepSize, Reservation & reservation, Session * session = NULL );
+	Status defrag( const string & entryName, uint32_t budget, DefragReport & report, Session * session = NULL );
+	Status check( bool repair, CheckReport & report );
+	Status sync();
+	void trim( bool enable );
+	void jobs( vector<JobInfo> & jobs );
+	Status cancel( uint32_t id, JobInfo & job );
+	Status workers( uint32_t count );
 
 };
 
@@ -1,6 +1,7 @@
 #include "fat32.h"
 #include "limitsfix.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdlib>
 #include <iostream>
@@ -16,21 +17,34 @@ using namespace std;
  * Forward Declarations
  */
 
+const string describeProblem( const FAT_FS::CheckProblem & problem );
+void printCheckReport( const FAT_FS::CheckReport & checkReport );
+void printDefragReport( const FAT_FS::DefragReport & defragReport );
 void printPrompt( const string & currentPath );
+vector<string> readNames();
+bool report( FAT_FS::Status status, const string & name, const string & kind = "file" );
+void reportEach( FAT_FS::Status status, const vector<string> & names, const vector<FAT_FS::Status> & results, const string & kind, const string & directory );
 bool stringTouint32( const string & asString, const string & name, uint32_t & out );
 vector<string> tokenize( const string & input );
+void writeOutput( const uint8_t * data, uint32_t length, bool raw );
 
 int main( int argc, char * argv[] ) {
 
-	string input, image;
+	string input, image, sidecar;
 	fstream fatImage;
 
 	if ( argc == 2 )
 		image = argv[1];
 
-	else {
+	// Mount-acceleration cache kept next to the image
+	else if ( argc == 3 && string( argv[2] ).compare( "--sidecar" ) == 0 ) {
 
-		cout << "usage: fmod <FAT32 Image>" << endl;
+		image = argv[1];
+		sidecar = image + ".sidecar";
+
+	} else {
+
+		cout << "usage: fmod <FAT32 Image> [--sidecar]" << endl;
 		exit( EXIT_SUCCESS );
 	}
 
@@ -44,7 +58,7 @@ int main( int argc, char * argv[] ) {
 	}
 
 	// Setup FAT32
-	FAT_FS::FAT32 fat( fatImage );
+	FAT_FS::FAT32 fat( fatImage, image, sidecar );
 
 	printPrompt( fat.getCurrentPath() );
 
@@ -62,50 +76,82 @@ int main( int argc, char * argv[] ) {
 
 			else if ( tokens[0].compare( "fsinfo" ) == 0 ) {
 
-				fat.fsinfo();
+				FAT_FS::FileSystemInfo info;
+				fat.fsinfo( info );
+
+				// + used to promote type to a printable number
+				cout << "Bytes per sector: " << info.bytesPerSector
+					 << "\nSectors per cluster: " << +info.sectorsPerCluster
+					 << "\nTotal sectors: " << info.totalSectors
+					 << "\nNumber of FATs: " << +info.numFATs
+					 << "\nSectors per FAT: " << info.sectorsPerFAT
+					 << "\nNumber of free sectors: " << info.freeSectors
+					 << "\nCache hits: " << info.cacheHits
+					 << "\nCache misses: " << info.cacheMisses
+					 << "\nCached clusters: " << info.cachedClusters << " (" << info.dirtyClusters << " dirty)"
+					 << "\nI/O engine: " << info.engine
+					 << "\nI/O workers: " << info.workers
+					 << "\n";
 
 			} else if ( tokens[0].compare( "open" ) == 0 ) {
 
-				if ( tokens.size() == 3 )
-					fat.open( tokens[1], tokens[2] );
+				uint32_t handle;
+				uint8_t mode = tokens.size() == 3 ? fat.isValidOpenMode( tokens[2] ) : 0;
 
-				else
+				if ( tokens.size() != 3 )
 					cout << "error: usage: open <file name> <mode>\n";
 
+				else if ( report( fat.openFile( tokens[1], mode, handle ), tokens[1] ) )
+					cout << tokens[1] << " has been opened with " << fat.modeToString( mode ) << " permission (handle #" << handle << ").\n";
+
 			} else if ( tokens[0].compare( "close" ) == 0 ) {
 
-				if ( tokens.size() == 2 )
-					fat.close( tokens[1] );
+				if ( tokens.size() == 2 ) {
 
-				else
-					cout << "error: usage: close <file name>\n";
+					FAT_FS::Status status = fat.closeFile( tokens[1] );
+
+					// Writes that didn't make it out are reported but the handle is still closed
+					if ( report( status, tokens[1] ) || status == FAT_FS::STATUS_WRITES_LOST || status == FAT_FS::STATUS_IO_ERROR )
+						cout << tokens[1] << " is now closed.\n";
+
+				} else
+					cout << "error: usage: close <file name|#handle>\n";
 
 			} else if ( tokens[0].compare( "create" ) == 0 ) {
 
-				if ( tokens.size() == 2 )
-					fat.create( tokens[1] );
+				vector<string> names;
+				vector<FAT_FS::Status> results;
 
-				else
-					cout << "error: usage: create <file name>\n";
+				// A lone - reads names from the following lines instead
+				if ( tokens.size() == 2 && tokens[1].compare( "-" ) == 0 )
+					names = readNames();
+
+				else if ( tokens.size() >= 2 )
+					names.assign( tokens.begin() + 1, tokens.end() );
+
+				if ( tokens.size() >= 2 ) {
+
+					FAT_FS::Status status = fat.create( names, results );
+					reportEach( status, names, results, "file", fat.getCurrentPath() );
+
+				} else
+					cout << "error: usage: create <file name> [file name ...] | create -\n";
 				
 			} else if ( tokens[0].compare( "read" ) == 0 ) {
 
-				if ( tokens.size() == 4 ) {
+				// Optional trailing raw flag sends bytes straight to fd 1
+				bool raw = tokens.size() >= 4 && tokens.back().compare( "raw" ) == 0;
 
-					// Check if numbers are actually numbers
-					bool validNumber = true;
-					string startPosStr = tokens[2], numBytesStr = tokens[3];
-					for ( uint32_t i = 0; i < startPosStr.length(); i++ )
-						if ( !isdigit( startPosStr[i] ) ) {
+				if ( raw )
+					tokens.pop_back();
 
-							validNumber = false;
-							break;
-						}
+				if ( tokens.size() == 3 || tokens.size() == 4 ) {
 
-					// Possibly check numBytesStr as well
-					if ( validNumber )
-						for ( uint32_t i = 0; i < numBytesStr.length(); i++ )
-							if ( !isdigit( numBytesStr[i] ) ) {
+					// Check if numbers are actually numbers
+					bool validNumber = true;
+					for ( uint32_t j = 2; j < tokens.size(); j++ )
+						for ( uint32_t i = 0; i < tokens[j].length(); i++ )
+							if ( !isdigit( tokens[j][i] ) ) {
 
 								validNumber = false;
 								break;
@@ -114,22 +160,45 @@ int main( int argc, char * argv[] ) {
 					if ( validNumber ) {
 
 						uint32_t startPos, numBytes;
+						FAT_FS::ReadOutput output = [raw]( const uint8_t * data, uint32_t length ) { writeOutput( data, length, raw ); };
+
+						// Anything already sitting in cout has to go out before raw output bypasses it
+						if ( raw )
+							cout.flush();
+
+						// Read from the handle's position when no start pos is given
+						if ( tokens.size() == 3 ) {
+
+							if ( stringTouint32( tokens[2], "num bytes", numBytes ) )
+								report( fat.read( tokens[1], numBytes, output ), tokens[1] );
+						}
 
 						// Try to convert arguments
-						if ( stringTouint32( startPosStr, "start pos", startPos ) && stringTouint32( numBytesStr, "num bytes", numBytes ) )
-							fat.read( tokens[1], startPos, numBytes );
+						else if ( stringTouint32( tokens[2], "start pos", startPos ) && stringTouint32( tokens[3], "num bytes", numBytes ) )
+							report( fat.read( tokens[1], startPos, numBytes, output ), tokens[1] );
+
+						if ( !raw )
+							cout.flush();
 
 					} else
-						cout << "error: usage: read <file name> <start pos> <num bytes>\n";
+						cout << "error: usage: read <file name|#handle> [start pos] <num bytes> [raw]\n";
 					
 				}
 
 				else
-					cout << "error: usage: read <file name> <start pos> <num bytes>\n";
+					cout << "error: usage: read <file name|#handle> [start pos] <num bytes> [raw]\n";
 
 			} else if ( tokens[0].compare( "write" ) == 0 ) {
 
-				if ( tokens.size() == 4 ) {
+				// Write at the handle's position when no start pos is given
+				if ( tokens.size() == 3 )
+					report( fat.write( tokens[1], tokens[2] ), tokens[1] );
+
+				// Or at the end of the file
+				else if ( tokens.size() == 4 && tokens[2].compare( "append" ) == 0 )
+					report( fat.append( tokens[1], tokens[3] ), tokens[1] );
+
+				else if ( tokens.size() == 4 ) {
 
 					// Check if numbers are actually numbers
 					bool validNumber = true;
@@ -147,77 +216,277 @@ int main( int argc, char * argv[] ) {
 
 						// Try to convert arguments
 						if ( stringTouint32( startPosStr, "start pos", startPos ) )
-							fat.write( tokens[1], startPos, tokens[3] );
+							report( fat.write( tokens[1], startPos, tokens[3] ), tokens[1] );
 					
 					} else
-						cout << "error: usage: write <file name> <start pos> <quoted data>\n";
+						cout << "error: usage: write <file name|#handle> [start pos|append] <quoted data>\n";
 					
 				}
 
 				else
-					cout << "error: usage: write <file name> <start pos> <quoted data>\n";
+					cout << "error: usage: write <file name|#handle> [start pos|append] <quoted data>\n";
 
 			} else if ( tokens[0].compare( "rm" ) == 0 ) {
 
 				if ( tokens.size() == 2 )
-					fat.rm( tokens[1] );
+					report( fat.rm( tokens[1] ), tokens[1] );
+
+				// Recursive removal of a whole directory
+				else if ( tokens.size() == 3 && tokens[1].compare( "-r" ) == 0 )
+					report( fat.rmTree( tokens[2] ), tokens[2], "directory" );
 
 				else
-					cout << "error: usage: rm <file name>\n";
+					cout << "error: usage: rm [-r] <file name|dir name>\n";
 
 			} else if ( tokens[0].compare( "cd" ) == 0 ) {
 
 				if ( tokens.size() == 2 )
-					fat.cd( tokens[1] );
+					report( fat.changeDirectory( tokens[1] ), tokens[1], "directory" );
 
 				else
 					cout << "error: usage: cd <dir name>\n";
 				
 			} else if ( tokens[0].compare( "ls" ) == 0 ) {
 
-				// List current directory
-				if ( tokens.size() == 1 )
-					fat.ls( "" );
-				
-				// Otherwise list specified directory
-				else if ( tokens.size() == 2 )
-					fat.ls( tokens[1] );
+				vector<FAT_FS::EntryInfo> entries;
 
-				else
+				if ( tokens.size() > 2 )
 					cout << "error: usage: ls [dir name]\n";
 
+				// List the given directory, otherwise the current one
+				else if ( report( fat.list( tokens.size() == 2 ? tokens[1] : "", entries ), tokens.back(), "directory" ) ) {
+
+					for ( uint32_t i = 0; i < entries.size(); i++ )
+						cout << entries[i].name << " ";
+
+					cout << "\n";
+				}
+
 			} else if ( tokens[0].compare( "mkdir" ) == 0 ) {
 
-				if ( tokens.size() == 2 )
-					fat.mkdir( tokens[1] );
+				vector<string> names;
+				vector<FAT_FS::Status> results;
 
-				else
-					cout << "error: usage: mkdir <dir name>\n";
+				// A lone - reads names from the following lines instead
+				if ( tokens.size() == 2 && tokens[1].compare( "-" ) == 0 )
+					names = readNames();
+
+				else if ( tokens.size() >= 2 )
+					names.assign( tokens.begin() + 1, tokens.end() );
+
+				if ( tokens.size() >= 2 ) {
+
+					FAT_FS::Status status = fat.mkdir( names, results );
+					reportEach( status, names, results, "directory", fat.getCurrentPath() );
+
+				} else
+					cout << "error: usage: mkdir <dir name> [dir name ...] | mkdir -\n";
 				
 			} else if ( tokens[0].compare( "rmdir" ) == 0 ) {
 
 				if ( tokens.size() == 2 )
-					fat.rmdir( tokens[1] );
+					report( fat.rmdir( tokens[1] ), tokens[1], "directory" );
 
 				else
 					cout << "error: usage: rmdir <dir name>\n";
 
 			} else if ( tokens[0].compare( "size" ) == 0 ) {
 
-				if ( tokens.size() == 2 )
-					fat.size( tokens[1] );
+				uint32_t bytes;
 
-				else
+				if ( tokens.size() != 2 )
 					cout << "error: usage: size <file name>\n";
+
+				else if ( report( fat.fileSize( tokens[1], bytes ), tokens[1] ) )
+					cout << bytes << " bytes.\n";
 				
 			} else if ( tokens[0].compare( "srm" ) == 0 ) {
 
 				if ( tokens.size() == 2 )
-					fat.rm( tokens[1], true );
+					report( fat.rm( tokens[1], true ), tokens[1] );
 
 				else
 					cout << "error: usage: srm <file name>\n";
 
+			} else if ( tokens[0].compare( "prealloc" ) == 0 ) {
+
+				// Optional trailing keep flag leaves the file size alone
+				bool keepSize = tokens.size() == 4 && tokens[3].compare( "keep" ) == 0;
+
+				if ( tokens.size() == 3 || keepSize ) {
+
+					// Check if number is actually a number
+					bool validNumber = true;
+					string numBytesStr = tokens[2];
+					for ( uint32_t i = 0; i < numBytesStr.length(); i++ )
+						if ( !isdigit( numBytesStr[i] ) ) {
+
+							validNumber = false;
+							break;
+						}
+
+					if ( validNumber ) {
+
+						uint32_t numBytes;
+
+						// Try to convert argument
+						if ( stringTouint32( numBytesStr, "num bytes", numBytes ) ) {
+
+							FAT_FS::Reservation reservation;
+							FAT_FS::Status status = fat.prealloc( tokens[1], numBytes, keepSize, reservation );
+
+							// Open files' buffered writes go out first, a failure there names no one file
+							if ( report( status, status == FAT_FS::STATUS_WRITES_LOST ? "open files" : tokens[1] ) && reservation.clusters > 0 )
+								cout << "Reserved " << reservation.clusters << " clusters in " << reservation.runs << " run(s).\n";
+						}
+
+					} else
+						cout << "error: usage: prealloc <file name> <num bytes> [keep]\n";
+				}
+
+				else
+					cout << "error: usage: prealloc <file name> <num bytes> [keep]\n";
+
+			} else if ( tokens[0].compare( "defrag" ) == 0 ) {
+
+				// Defragment current directory, otherwise the given entry, optionally within a byte budget
+				string entryName = tokens.size() >= 2 ? tokens[1] : "";
+				uint32_t budget = 0;
+				bool valid = tokens.size() <= 3;
+
+				if ( tokens.size() == 3 ) {
+
+					// Check if number is actually a number
+					string budgetStr = tokens[2];
+					for ( uint32_t i = 0; i < budgetStr.length(); i++ )
+						if ( !isdigit( budgetStr[i] ) ) {
+
+							valid = false;
+							break;
+						}
+				}
+
+				if ( !valid )
+					cout << "error: usage: defrag [entry name] [byte budget]\n";
+
+				// Try to convert argument
+				else if ( tokens.size() < 3 || stringTouint32( tokens[2], "byte budget", budget ) ) {
+
+					FAT_FS::DefragReport defragReport;
+					FAT_FS::Status status = fat.defrag( entryName, budget, defragReport );
+
+					// Open files' buffered writes go out first, a failure there names no one file
+					if ( report( status, status == FAT_FS::STATUS_WRITES_LOST ? "open files" : entryName, "entry" ) )
+						printDefragReport( defragReport );
+				}
+
+			} else if ( tokens[0].compare( "check" ) == 0 ) {
+
+				if ( tokens.size() > 2 || ( tokens.size() == 2 && tokens[1].compare( "--repair" ) != 0 ) )
+					cout << "error: usage: check [--repair]\n";
+
+				else {
+
+					FAT_FS::CheckReport checkReport;
+					FAT_FS::Status status = fat.check( tokens.size() == 2, checkReport );
+
+					if ( report( status, status == FAT_FS::STATUS_WRITES_LOST ? "open files" : "the image" ) )
+						printCheckReport( checkReport );
+				}
+
+			} else if ( tokens[0].compare( "du" ) == 0 ) {
+
+				FAT_FS::UsageTotals totals;
+
+				// Current directory unless a path is given
+				if ( tokens.size() > 2 )
+					cout << "error: usage: du [path]\n";
+
+				else if ( report( fat.du( tokens.size() == 2 ? tokens[1] : "", totals ), tokens.size() == 2 ? tokens[1] : ".", "directory" ) )
+					cout << totals.bytes << " bytes in " << totals.files << " files and " << totals.directories << " directories ("
+						 << totals.allocatedBytes << " bytes allocated) under " << totals.path << "\n";
+
+			} else if ( tokens[0].compare( "find" ) == 0 ) {
+
+				// Paths come in as soon as their directory is read
+				FAT_FS::FindOutput output = []( const string & path ) { cout << path << "\n" << flush; };
+
+				if ( tokens.size() == 3 && tokens[1].compare( "-name" ) == 0 )
+					report( fat.find( "", tokens[2], output ), ".", "directory" );
+
+				else if ( tokens.size() == 4 && tokens[2].compare( "-name" ) == 0 )
+					report( fat.find( tokens[1], tokens[3], output ), tokens[1], "directory" );
+
+				else
+					cout << "error: usage: find [path] -name <glob>\n";
+
+			} else if ( tokens[0].compare( "jobs" ) == 0 ) {
+
+				vector<FAT_FS::JobInfo> jobs;
+				fat.jobs( jobs );
+
+				if ( jobs.empty() )
+					cout << "No background deletes.\n";
+
+				for ( uint32_t i = 0; i < jobs.size(); i++ ) {
+
+					cout << "#" << jobs[i].id << " " << ( jobs[i].safe ? "srm " : "rm " ) << jobs[i].name << ": " 
+						 << jobs[i].reclaimedClusters << "/" << jobs[i].totalClusters << " clusters reclaimed ("
+						 << static_cast<uint64_t>( jobs[i].reclaimedClusters ) * 100 / jobs[i].totalClusters << "%)"
+						 << ( jobs[i].cancelled ? ", cancelled" : "" ) << "\n";
+				}
+
+			} else if ( tokens[0].compare( "cancel" ) == 0 ) {
+
+				// Job ids may be given with or without the leading #
+				string idStr = ( tokens.size() == 2 && tokens[1][0] == '#' ) ? tokens[1].substr( 1 ) : ( tokens.size() == 2 ? tokens[1] : "" );
+
+				bool validNumber = !idStr.empty();
+				for ( uint32_t i = 0; i < idStr.length(); i++ )
+					if ( !isdigit( idStr[i] ) ) {
+
+						validNumber = false;
+						break;
+					}
+
+				uint32_t id;
+				FAT_FS::JobInfo job;
+
+				if ( !validNumber )
+					cout << "error: usage: cancel <#job>\n";
+
+				// Try to convert argument
+				else if ( stringTouint32( idStr, "job", id ) && report( fat.cancel( id, job ), "#" + idStr ) )
+					cout << "Job #" << id << " cancelled, " << job.totalClusters - job.reclaimedClusters 
+						 << " clusters are " << ( job.safe ? "wiped and " : "" ) << "freed without being trimmed.\n";
+
+			} else if ( tokens[0].compare( "trim" ) == 0 ) {
+
+				if ( tokens.size() == 2 && ( tokens[1].compare( "on" ) == 0 || tokens[1].compare( "off" ) == 0 ) ) {
+
+					fat.trim( tokens[1].compare( "on" ) == 0 );
+					cout << "Trim on delete is " << tokens[1] << ".\n";
+
+				} else
+					cout << "error: usage: trim <on|off>\n";
+
+			} else if ( tokens[0].compare( "workers" ) == 0 ) {
+
+				// Check if number is actually a number
+				bool validNumber = tokens.size() == 2;
+				for ( uint32_t i = 0; validNumber && i < tokens[1].length(); i++ )
+					if ( !isdigit( tokens[1][i] ) )
+						validNumber = false;
+
+				uint32_t count;
+
+				if ( !validNumber )
+					cout << "error: usage: workers <count>\n";
+
+				// Try to convert argument
+				else if ( stringTouint32( tokens[1], "count", count ) && report( fat.workers( count ), tokens[1] ) )
+					cout << "Using " << count << " I/O worker" << ( count == 1 ? "" : "s" ) << ".\n";
+
 			// Invalid command
 			} else {
 
@@ -231,13 +500,93 @@ int main( int argc, char * argv[] ) {
 		tokens = tokenize( input );
 	}
 
-	// Cleanup
+	// Cleanup, buffered writes go out before the image is closed
+	report( fat.sync(), "open files" );
 	fatImage.close();
 
 	cout << "\nClosing fmod." << endl;
 	return 0;
 }
 
+/**
+ * Describe Problem
+ * Description: Turns a problem check found into the line it prints.
+ */
+const string describeProblem( const FAT_FS::CheckProblem & problem ) {
+
+	stringstream line;
+
+	switch ( problem.kind ) {
+
+		case FAT_FS::PROBLEM_INVALID_LINK: line << problem.path << ": chain links to invalid cluster " << problem.value; break;
+		case FAT_FS::PROBLEM_LOOP: line << problem.path << ": chain loops back to cluster " << problem.value; break;
+		case FAT_FS::PROBLEM_CROSS_LINK: line << problem.path << ": cross-linked at cluster " << problem.value; break;
+		case FAT_FS::PROBLEM_FREE_LINK: line << problem.path << ": chain runs into a free cluster after " << problem.value; break;
+		case FAT_FS::PROBLEM_DOTDOT: line << problem.path << ": .. points to cluster " << problem.value << ", should be " << problem.other; break;
+		case FAT_FS::PROBLEM_SIZE: line << problem.path << ": size " << problem.value << " is larger than its " << problem.other << " byte chain"; break;
+		case FAT_FS::PROBLEM_LOST: line << problem.value << " lost clusters in " << problem.other << " chains"; break;
+		case FAT_FS::PROBLEM_FREE_COUNT: line << "FSInfo free count is " << problem.value << ", should be " << problem.other; break;
+	}
+
+	return line.str();
+}
+
+/**
+ * Print Check Report
+ * Description: Prints every problem check found in order, then what it
+ *				did about them.
+ */
+void printCheckReport( const FAT_FS::CheckReport & checkReport ) {
+
+	vector<string> problems;
+	for ( uint32_t i = 0; i < checkReport.problems.size(); i++ )
+		problems.push_back( describeProblem( checkReport.problems[i] ) );
+
+	sort( problems.begin(), problems.end() );
+
+	for ( uint32_t i = 0; i < problems.size(); i++ )
+		cout << problems[i] << "\n";
+
+	if ( checkReport.repaired )
+		cout << "Repaired. Cross-linked chains are reported only and need manual attention.\n";
+
+	cout << "Checked " << checkReport.chains << " chains with " << checkReport.threads << " threads, " 
+		 << checkReport.problems.size() << " problems found.\n";
+}
+
+/**
+ * Print Defrag Report
+ * Description: Prints what defrag did with every fragmented chain, then
+ *				the totals.
+ */
+void printDefragReport( const FAT_FS::DefragReport & defragReport ) {
+
+	for ( uint32_t i = 0; i < defragReport.chains.size(); i++ ) {
+
+		const FAT_FS::DefragChain & chain = defragReport.chains[i];
+
+		cout << chain.path << ": " << chain.clusters << " clusters in " << chain.fragments << " fragments, ";
+
+		if ( chain.outcome == FAT_FS::DEFRAG_MOVED )
+			cout << "moved into " << chain.runs << " (" << chain.bytesMovedSoFar << " bytes moved so far).\n";
+
+		else if ( chain.outcome == FAT_FS::DEFRAG_OVER_BUDGET )
+			cout << "skipped (over budget).\n";
+
+		else if ( chain.outcome == FAT_FS::DEFRAG_NO_SPACE )
+			cout << "skipped (no space).\n";
+
+		else if ( chain.outcome == FAT_FS::DEFRAG_IO_ERROR )
+			cout << "skipped (could not be copied).\n";
+
+		else
+			cout << "skipped (no larger free run).\n";
+	}
+
+	cout << "Checked " << defragReport.chainsChecked << " chains, " << defragReport.chainsFragmented << " fragmented, "
+		 << defragReport.chainsMoved << " moved (" << defragReport.bytesMoved << " bytes), " << defragReport.chainsSkipped << " skipped.\n";
+}
+
 /**
  * Primpt Prompt
  * Description: Prints command prompt in form username[fs-image-name]> .
@@ -251,6 +600,48 @@ void printPrompt( const string & currentPath ) {
 	cout << login << "[" << currentPath << "]" << "> "; 
 }
 
+/**
+ * Read Names
+ * Description: Reads one name per line from standard input until an empty
+ *				line or the end of input.
+ */
+vector<string> readNames() {
+
+	vector<string> names;
+	string name;
+
+	while ( getline( cin, name, '\n' ) && !name.empty() )
+		names.push_back( name );
+
+	return names;
+}
+
+/**
+ * Report Status
+ * Description: Prints the error for a failed library call on name. Returns
+ *				whether or not the call succeeded.
+ */
+bool report( FAT_FS::Status status, const string & name, const string & kind ) {
+
+	if ( status != FAT_FS::STATUS_OK )
+		cout << "error: " << FAT_FS::describe( status, name, kind ) << "\n";
+
+	return status == FAT_FS::STATUS_OK;
+}
+
+/**
+ * Report Each
+ * Description: Prints why each name create or mkdir skipped was skipped,
+ *				then the error for the call as a whole if it failed.
+ */
+void reportEach( FAT_FS::Status status, const vector<string> & names, const vector<FAT_FS::Status> & results, const string & kind, const string & directory ) {
+
+	for ( uint32_t i = 0; i < results.size(); i++ )
+		report( results[i], names[i], kind );
+
+	report( status, directory, "directory" );
+}
+
 /**
  * String to uint32_t
  * Description: Attempts to convert a string to a uint32_t. Returns whether
@@ -290,7 +681,8 @@ vector<string> tokenize( const string & input ) {
 	// spaces just like cin >>
 	while ( stringStream ) {
 
-		if ( isWrite && i == 3 ) {
+		// Quoted data may follow the file name directly or a start pos
+		if ( isWrite && i >= 2 && ( stringStream >> ws ).peek() == '"' ) {
 
 			getline( stringStream, temp );
 
@@ -302,7 +694,7 @@ vector<string> tokenize( const string & input ) {
 			// Per the specification we assume quoted_data will always
 			// be surrounded by quotes so we don't need to do any
 			// validation so remove quotes
-			temp = temp.substr( temp.find_first_of( "\"" ) + 1, temp.find_last_of( "\"" ) - 2 );
+			temp = temp.substr( temp.find_first_of( "\"" ) + 1, temp.find_last_of( "\"" ) - temp.find_first_of( "\"" ) - 1 );
 
 		} else 
 			stringStream >> temp;
@@ -318,3 +710,34 @@ vector<string> tokenize( const string & input ) {
 
 	return result;
 }
+
+/**
+ * Write Output
+ * Description: Sends a block of file data to standard out. Raw output
+ *				goes directly to fd 1 with no stream formatting involved.
+ */
+void writeOutput( const uint8_t * data, uint32_t length, bool raw ) {
+
+	if ( !raw ) {
+
+		cout.write( reinterpret_cast<const char *>( data ), length );
+		return;
+	}
+
+	// write may be partial or interrupted so keep going until it all goes out
+	while ( length > 0 ) {
+
+		ssize_t written = ::write( STDOUT_FILENO, data, length );
+
+		if ( written < 0 ) {
+
+			if ( errno == EINTR )
+				continue;
+
+			return;
+		}
+
+		data += written;
+		length -= written;
+	}
+}
@@ -0,0 +1,100 @@
+#include "image.h"
+
+#include <sstream>
+
+/**
+ * Append mode
+ * Description: Handles opened with a or ra write every piece at the end of
+ *				the file, whatever start pos they are given, and append does
+ *				the same for any writable handle. Many small appends across
+ *				cluster boundaries add up to exactly what was written.
+ */
+
+const char * IMAGE = "append_mode.img";
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+	string expected;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		passed &= expect( fat.isValidOpenMode( "a" ) == ( WRITE | APPEND ), "a is write and append" );
+		passed &= expect( fat.isValidOpenMode( "ra" ) == ( READWRITE | APPEND ), "ra reads too" );
+		passed &= expect( fat.isValidOpenMode( "ab" ) == ( WRITE | APPEND | BUFFERED ), "ab is buffered" );
+
+		uint32_t handle;
+		passed &= expect( fat.create( "log", &session ) == STATUS_OK, "create log" );
+		passed &= expect( fat.openFile( "log", READ | APPEND, handle, &session ) == STATUS_INVALID_MODE, "append needs write" );
+		passed &= expect( fat.openFile( "log", WRITE | APPEND, handle, &session ) == STATUS_OK, "open log with a" );
+
+		// Lines of uneven length so they straddle cluster boundaries
+		for ( uint32_t i = 0; i < 200; i++ ) {
+
+			stringstream line;
+			line << "line " << i << string( i % 7, '.' ) << "\n";
+
+			Status status = i % 2 == 0 ? fat.write( "log", line.str(), &session ) : fat.write( "log", 0, line.str(), &session );
+			passed &= expect( status == STATUS_OK, "append " + line.str() );
+			expected += line.str();
+		}
+
+		passed &= expect( fat.closeFile( "log", &session ) == STATUS_OK, "close log" );
+
+		uint32_t bytes;
+		passed &= expect( fat.fileSize( "log", bytes, &session ) == STATUS_OK && bytes == expected.size(), "log holds every line" );
+
+		// append reaches the end through a plain handle too, and ra reads back
+		passed &= expect( fat.openFile( "log", WRITE, handle, &session ) == STATUS_OK, "open log with w" );
+		passed &= expect( fat.append( "log", "tail\n", &session ) == STATUS_OK, "append through w" );
+		passed &= expect( fat.write( "log", 0, "L", &session ) == STATUS_OK, "w still writes in place" );
+		passed &= expect( fat.closeFile( "log", &session ) == STATUS_OK, "close log again" );
+		expected = "L" + expected.substr( 1 ) + "tail\n";
+
+		string contents;
+		ReadOutput output = [&contents]( const uint8_t * data, uint32_t length ) { contents.append( reinterpret_cast<const char *>( data ), length ); };
+
+		passed &= expect( fat.openFile( "log", READWRITE | APPEND, handle, &session ) == STATUS_OK, "open log with ra" );
+		passed &= expect( fat.write( "log", 1, "end\n", &session ) == STATUS_OK, "ra appends" );
+		expected += "end\n";
+		passed &= expect( fat.read( "log", 0, expected.size() + 1, output, &session ) == STATUS_OK && contents == expected, "read back through ra" );
+		passed &= expect( fat.closeFile( "log", &session ) == STATUS_OK, "close ra" );
+
+		passed &= expect( fat.openFile( "log", READ, handle, &session ) == STATUS_OK, "open log with r" );
+		passed &= expect( fat.append( "log", "no", &session ) == STATUS_NOT_WRITABLE, "append needs a writable handle" );
+		passed &= expect( fat.closeFile( "log", &session ) == STATUS_OK, "close r" );
+
+		passed &= expectClean( fat );
+	}
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		string contents;
+		ReadOutput output = [&contents]( const uint8_t * data, uint32_t length ) { contents.append( reinterpret_cast<const char *>( data ), length ); };
+
+		uint32_t handle;
+		passed &= expect( fat.openFile( "log", READ, handle, &session ) == STATUS_OK, "open log after remount" );
+		passed &= expect( fat.read( "log", 0, expected.size(), output, &session ) == STATUS_OK && contents == expected, "log survives a remount" );
+		passed &= expect( fat.closeFile( "log", &session ) == STATUS_OK, "close log after remount" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": append mode always writes at the end\n";
+
+	return passed ? 0 : 1;
+}
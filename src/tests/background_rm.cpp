@@ -0,0 +1,129 @@
+#include "image.h"
+
+#include <chrono>
+#include <thread>
+
+/**
+ * Background rm
+ * Description: rm takes the entry away at once and leaves freeing its chain
+ *				to a background job. Jobs are listed until their clusters are
+ *				back in the free count, and cancelling one only frees the rest
+ *				sooner, it never loses clusters.
+ */
+
+const char * IMAGE = "background_rm.img";
+const uint32_t TOTAL_SECTORS = 65536,
+			   FILE_CLUSTERS = 6000;
+
+uint32_t freeSectors( FAT32 & fat ) {
+
+	FileSystemInfo info;
+	fat.fsinfo( info );
+
+	return info.freeSectors;
+}
+
+/**
+ * Wait For Jobs
+ * Description: Polls the job list until it is empty, giving up after a while.
+ */
+bool waitForJobs( FAT32 & fat ) {
+
+	vector<JobInfo> jobs;
+
+	for ( uint32_t i = 0; i < 1000; i++ ) {
+
+		fat.jobs( jobs );
+
+		if ( jobs.empty() )
+			return true;
+
+		this_thread::sleep_for( chrono::milliseconds( 10 ) );
+	}
+
+	return false;
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE, TOTAL_SECTORS ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+	uint32_t freed = 0;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		vector<string> names = { "one", "two", "three", "empty" };
+		vector<Status> results;
+		Reservation reservation;
+
+		passed &= expect( fat.create( names, results, &session ) == STATUS_OK, "create files" );
+
+		for ( uint32_t i = 0; i < 3; i++ )
+			passed &= expect( fat.prealloc( names[i], FILE_CLUSTERS * BYTES_PER_SECTOR, false, reservation, &session ) == STATUS_OK, "prealloc " + names[i] );
+
+		uint32_t before = freeSectors( fat );
+
+		// Empty files have nothing to free and never become a job
+		vector<JobInfo> jobs;
+		passed &= expect( fat.rm( "empty", false, &session ) == STATUS_OK, "rm empty" );
+		fat.jobs( jobs );
+		passed &= expect( jobs.empty(), "rm of an empty file is no job" );
+
+		passed &= expect( fat.rm( "one", false, &session ) == STATUS_OK, "rm one" );
+		passed &= expect( fat.rm( "two", true, &session ) == STATUS_OK, "srm two" );
+		passed &= expect( fat.rm( "three", false, &session ) == STATUS_OK, "rm three" );
+
+		// Entries go right away, names can be used again
+		EntryInfo info;
+		passed &= expect( fat.stat( "one", info, &session ) == STATUS_NOT_FOUND, "one is gone at once" );
+		passed &= expect( fat.create( "one", &session ) == STATUS_OK, "one's name is free again" );
+
+		fat.jobs( jobs );
+
+		uint32_t lastId = 0;
+		for ( const JobInfo & job : jobs ) {
+
+			passed &= expect( job.id > lastId, "jobs are listed in order" );
+			passed &= expect( job.totalClusters == FILE_CLUSTERS && job.reclaimedClusters <= job.totalClusters, "job " + job.name + " counts its clusters" );
+			passed &= expect( job.safe == ( job.name == "two" ), "job " + job.name + " knows if it is safe" );
+			lastId = job.id;
+		}
+
+		// The last job may be done already, either way its clusters come back
+		JobInfo cancelled;
+		Status status = fat.cancel( lastId, cancelled );
+		passed &= expect( status == STATUS_NO_SUCH_JOB || ( status == STATUS_OK && cancelled.cancelled && cancelled.name == "three" ), "cancel three" );
+		passed &= expect( fat.cancel( lastId + 100, cancelled ) == STATUS_NO_SUCH_JOB, "cancel a job never started" );
+
+		passed &= expect( waitForJobs( fat ), "jobs finish" );
+		passed &= expect( fat.cancel( lastId, cancelled ) == STATUS_NO_SUCH_JOB, "finished jobs can't be cancelled" );
+		freed = freeSectors( fat );
+		passed &= expect( freed == before + 3 * FILE_CLUSTERS, "every cluster is free again" );
+
+		passed &= expectClean( fat );
+	}
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+
+		// Without a sidecar the free count comes from the FAT itself
+		passed &= expect( freeSectors( fat ) == freed, "freed clusters are free on disk" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": rm frees chains in the background, jobs can be listed and cancelled\n";
+
+	return passed ? 0 : 1;
+}
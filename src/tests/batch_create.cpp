@@ -0,0 +1,93 @@
+#include "image.h"
+
+/**
+ * Batch create and mkdir
+ * Description: One call adds many entries to a directory. Every name gets
+ *				its own result, names taken before or earlier in the same
+ *				batch are skipped, and the rest all land, directories with a
+ *				working . and .. of their own.
+ */
+
+const char * IMAGE = "batch_create.img";
+
+uint32_t freeSectors( FAT32 & fat ) {
+
+	FileSystemInfo info;
+	fat.fsinfo( info );
+
+	return info.freeSectors;
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		passed &= expect( fat.mkdir( "parent" ) == STATUS_OK && fat.changeDirectory( "parent", &session ) == STATUS_OK, "cd parent" );
+		passed &= expect( fat.create( "taken", &session ) == STATUS_OK, "create taken" );
+
+		// Long names sharing a prefix need distinct short names
+		vector<string> files = { "plain", "taken", "plain", "bad/name", "a long file name one", "a long file name two" };
+		vector<Status> results;
+		vector<Status> expected = { STATUS_OK, STATUS_EXISTS, STATUS_EXISTS, STATUS_INVALID_NAME, STATUS_OK, STATUS_OK };
+
+		passed &= expect( fat.create( files, results, &session ) == STATUS_OK, "create batch" );
+		passed &= expect( results == expected, "create reports each name" );
+
+		EntryInfo info;
+		passed &= expect( fat.stat( "a long file name one", info, &session ) == STATUS_OK && !info.directory, "long name one is a file" );
+		passed &= expect( fat.stat( "a long file name two", info, &session ) == STATUS_OK && !info.directory, "long name two is a file" );
+
+		vector<string> directories = { "d1", "plain", "d2", "d1", "a long directory name", "" };
+		expected = { STATUS_OK, STATUS_NOT_A_DIRECTORY, STATUS_OK, STATUS_EXISTS, STATUS_OK, STATUS_INVALID_NAME };
+
+		uint32_t before = freeSectors( fat );
+		passed &= expect( fat.mkdir( directories, results, &session ) == STATUS_OK, "mkdir batch" );
+
+		passed &= expect( results == expected, "mkdir reports each name" );
+		passed &= expect( freeSectors( fat ) <= before - 3, "each new directory takes a cluster" );
+
+		vector<EntryInfo> entries;
+		passed &= expect( fat.list( ".", entries, &session ) == STATUS_OK && entries.size() == 2 + 4 + 3, "every new entry is listed" );
+
+		// Each new directory works on its own
+		for ( const char * name : { "d1", "d2", "a long directory name" } ) {
+
+			Session inside;
+			entries.clear();
+
+			passed &= expect( fat.changeDirectory( "parent", &inside ) == STATUS_OK && fat.changeDirectory( name, &inside ) == STATUS_OK, "cd " + string( name ) );
+			passed &= expect( fat.list( ".", entries, &inside ) == STATUS_OK && entries.size() == 2, string( name ) + " holds only . and .." );
+			passed &= expect( fat.create( "inner", &inside ) == STATUS_OK, "create in " + string( name ) );
+			passed &= expect( fat.changeDirectory( "..", &inside ) == STATUS_OK && fat.getCurrentPath( &inside ) == "/parent/", ".. of " + string( name ) );
+		}
+
+		// A batch of directories too big for the free space makes none of them
+		Reservation reservation;
+		passed &= expect( fat.create( "filler", &session ) == STATUS_OK, "create filler" );
+		passed &= expect( fat.prealloc( "filler", ( freeSectors( fat ) - 1 ) * BYTES_PER_SECTOR, true, reservation, &session ) == STATUS_OK, "fill the image" );
+
+		vector<string> tooMany = { "e1", "e2" };
+		entries.clear();
+		passed &= expect( fat.mkdir( tooMany, results, &session ) == STATUS_NO_SPACE, "mkdir past the free space" );
+		passed &= expect( fat.list( ".", entries, &session ) == STATUS_OK && entries.size() == 2 + 4 + 3 + 1, "no directory was made" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": batch create and mkdir report every name\n";
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+#include "image.h"
+#include "../volume.h"
+
+/**
+ * 2Q block cache
+ * Description: Drives a small cache over a scratch file. A block asked for
+ *				again after falling out of the recent queue must outlast a
+ *				long scan, and writes to cached blocks must reach the file on
+ *				flush or eviction, never before. Through the library, no
+ *				command leaves dirty blocks behind.
+ */
+
+const char * IMAGE = "block_cache.img";
+const char * SCRATCH = "block_cache.scratch";
+const uint32_t BLOCKS = 64,
+			   CAPACITY = 8;
+
+/**
+ * Block On Disk
+ * Description: Reads the first byte of a block straight from the file.
+ */
+uint8_t blockOnDisk( int descriptor, uint64_t block ) {
+
+	uint8_t value = 0xFF;
+
+	if ( pread( descriptor, &value, 1, block * BYTES_PER_SECTOR ) != 1 )
+		return 0xFF;
+
+	return value;
+}
+
+/**
+ * Read Block
+ * Description: Reads a block through the cache, returning its first byte.
+ */
+uint8_t readBlock( BlockCache & cache, uint64_t block ) {
+
+	uint8_t data[ BYTES_PER_SECTOR ];
+
+	if ( !cache.read( block * BYTES_PER_SECTOR, data, sizeof( data ) ) )
+		return 0xFF;
+
+	return data[0];
+}
+
+bool writeBlock( BlockCache & cache, uint64_t block, uint8_t value ) {
+
+	uint8_t data[ BYTES_PER_SECTOR ];
+	memset( data, value, sizeof( data ) );
+
+	return cache.write( block * BYTES_PER_SECTOR, data, sizeof( data ) );
+}
+
+int main() {
+
+	bool passed = true;
+
+	{
+		int descriptor = open( SCRATCH, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+		passed &= expect( descriptor >= 0, "open scratch file" );
+
+		// Block i holds i
+		for ( uint32_t i = 0; i < BLOCKS && descriptor >= 0; i++ ) {
+
+			uint8_t data[ BYTES_PER_SECTOR ];
+			memset( data, i, sizeof( data ) );
+			passed &= expect( pwrite( descriptor, data, sizeof( data ), i * BYTES_PER_SECTOR ) == sizeof( data ), "fill scratch file" );
+		}
+
+		BlockCache cache;
+		cache.configure( descriptor, 0, BYTES_PER_SECTOR, CAPACITY * BYTES_PER_SECTOR );
+
+		CacheStatistics before = cache.statistics();
+		passed &= expect( readBlock( cache, 0 ) == 0 && readBlock( cache, 0 ) == 0, "read block 0 twice" );
+		CacheStatistics after = cache.statistics();
+		passed &= expect( after.misses == before.misses + 1 && after.hits == before.hits + 1, "second read hits" );
+
+		// Push 0 out of the recent queue, asking for it again makes it frequent
+		for ( uint32_t i = 1; i <= CAPACITY; i++ )
+			passed &= expect( readBlock( cache, i ) == i, "fill the recent queue" );
+
+		before = cache.statistics();
+		passed &= expect( readBlock( cache, 0 ) == 0 && cache.statistics().misses == before.misses + 1, "0 fell out of the cache" );
+
+		// A scan much longer than the cache only cycles the recent queue
+		for ( uint32_t i = 16; i < BLOCKS; i++ )
+			passed &= expect( readBlock( cache, i ) == i, "scan" );
+
+		before = cache.statistics();
+		passed &= expect( readBlock( cache, 0 ) == 0 && cache.statistics().hits == before.hits + 1, "frequent block outlasts the scan" );
+		passed &= expect( cache.statistics().blocks <= CAPACITY, "cache keeps to its capacity" );
+
+		// Cached writes wait for a flush
+		passed &= expect( writeBlock( cache, 0, 0xA0 ), "write cached block 0" );
+		passed &= expect( cache.statistics().dirtyBlocks == 1 && blockOnDisk( descriptor, 0 ) == 0, "write stays in the cache" );
+		passed &= expect( readBlock( cache, 0 ) == 0xA0, "reads see the cached write" );
+
+		before = cache.statistics();
+		passed &= expect( cache.flush(), "flush" );
+		after = cache.statistics();
+		passed &= expect( after.dirtyBlocks == 0 && after.writeBacks == before.writeBacks + 1 && blockOnDisk( descriptor, 0 ) == 0xA0, "flush writes block 0 back" );
+
+		// Uncached writes go straight through
+		passed &= expect( writeBlock( cache, 10, 0xB0 ), "write uncached block 10" );
+		passed &= expect( cache.statistics().dirtyBlocks == 0 && blockOnDisk( descriptor, 10 ) == 0xB0, "uncached write reaches the file" );
+
+		// A dirty block pushed out is written back on its way
+		passed &= expect( writeBlock( cache, BLOCKS - 1, 0xC0 ) && cache.statistics().dirtyBlocks == 1, "write cached block at the end" );
+
+		for ( uint32_t i = 16; i < 16 + CAPACITY; i++ )
+			passed &= expect( readBlock( cache, i ) == i, "scan again" );
+
+		after = cache.statistics();
+		passed &= expect( after.dirtyBlocks == 0 && blockOnDisk( descriptor, BLOCKS - 1 ) == 0xC0, "eviction writes the dirty block back" );
+
+		if ( descriptor >= 0 )
+			close( descriptor );
+
+		remove( SCRATCH );
+	}
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	string data( 3 * BYTES_PER_SECTOR + 5, 'd' );
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		uint32_t handle;
+		FileSystemInfo info;
+		passed &= expect( fat.create( "data", &session ) == STATUS_OK, "create data" );
+		passed &= expect( fat.openFile( "data", READWRITE, handle, &session ) == STATUS_OK, "open data" );
+		passed &= expect( fat.write( "data", 0, data, &session ) == STATUS_OK, "write data" );
+		fat.fsinfo( info );
+		passed &= expect( info.dirtyClusters == 0, "write leaves nothing dirty" );
+
+		string contents;
+		ReadOutput output = [&contents]( const uint8_t * bytes, uint32_t length ) { contents.append( reinterpret_cast<const char *>( bytes ), length ); };
+
+		// New clusters were written around the cache, the first read brings them in
+		passed &= expect( fat.read( "data", 0, data.size(), output, &session ) == STATUS_OK && contents == data, "read data" );
+		fat.fsinfo( info );
+
+		uint64_t hits = info.cacheHits;
+		contents.clear();
+		passed &= expect( fat.read( "data", 0, data.size(), output, &session ) == STATUS_OK && contents == data, "read data again" );
+		fat.fsinfo( info );
+		passed &= expect( info.cacheHits >= hits + 4, "reading again hits every cluster" );
+
+		passed &= expect( fat.write( "data", 0, "D", &session ) == STATUS_OK, "write a cached cluster" );
+		fat.fsinfo( info );
+		passed &= expect( info.dirtyClusters == 0, "cached write is written back with its command" );
+		data[0] = 'D';
+
+		passed &= expect( fat.closeFile( "data", &session ) == STATUS_OK, "close data" );
+
+		passed &= expectClean( fat );
+	}
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		uint32_t handle;
+		string contents;
+		ReadOutput output = [&contents]( const uint8_t * bytes, uint32_t length ) { contents.append( reinterpret_cast<const char *>( bytes ), length ); };
+
+		passed &= expect( fat.openFile( "data", READ, handle, &session ) == STATUS_OK, "open data after remount" );
+		passed &= expect( fat.read( "data", 0, data.size(), output, &session ) == STATUS_OK && contents == data, "data reached the image" );
+		passed &= expect( fat.closeFile( "data", &session ) == STATUS_OK, "close data after remount" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": the 2Q cache keeps hot blocks and writes dirty ones back\n";
+
+	return passed ? 0 : 1;
+}
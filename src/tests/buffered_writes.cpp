@@ -0,0 +1,78 @@
+#include "image.h"
+
+#include <chrono>
+#include <thread>
+
+/**
+ * Buffered writes
+ * Description: A buffered handle's writes show up once they've sat long
+ *				enough, without another write or a close to push them out.
+ *				Two buffered handles can't both count on the last free
+ *				clusters, the second is refused up front instead of losing
+ *				its writes at flush time.
+ */
+
+const char * IMAGE = "buffered_writes.img";
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session writer, reader;
+
+		uint32_t handle, bytes = 0;
+		passed &= expect( fat.create( "log", &writer ) == STATUS_OK, "create log" );
+		passed &= expect( fat.openFile( "log", fat.isValidOpenMode( "wb" ), handle, &writer ) == STATUS_OK, "open log buffered" );
+		passed &= expect( fat.write( "log", 0, "hello", &writer ) == STATUS_OK, "write log" );
+		passed &= expect( fat.fileSize( "log", bytes, &reader ) == STATUS_OK && bytes == 0, "write stays buffered" );
+
+		// Nothing else touches the handle, the flush thread has to
+		this_thread::sleep_for( chrono::seconds( 7 ) );
+		passed &= expect( fat.fileSize( "log", bytes, &reader ) == STATUS_OK && bytes == 5, "old buffered write flushed on its own" );
+		passed &= expect( fat.append( "log", " world", &writer ) == STATUS_OK, "append to log" );
+		passed &= expect( fat.closeFile( "log", &writer ) == STATUS_OK, "close log" );
+
+		string contents;
+		ReadOutput output = [&contents]( const uint8_t * data, uint32_t length ) { contents.append( reinterpret_cast<const char *>( data ), length ); };
+
+		passed &= expect( fat.openFile( "log", READ, handle, &reader ) == STATUS_OK, "open log" );
+		passed &= expect( fat.read( "log", 0, 100, output, &reader ) == STATUS_OK && contents == "hello world", "log holds both writes" );
+		passed &= expect( fat.closeFile( "log", &reader ) == STATUS_OK, "close log again" );
+
+		// Leave four free clusters for two buffered handles to want
+		FileSystemInfo info;
+		Reservation reservation;
+		fat.fsinfo( info );
+
+		passed &= expect( fat.create( "filler", &writer ) == STATUS_OK, "create filler" );
+		passed &= expect( fat.prealloc( "filler", ( info.freeSectors - 4 ) * BYTES_PER_SECTOR, true, reservation, &writer ) == STATUS_OK, "fill the image" );
+
+		passed &= expect( fat.create( "first", &writer ) == STATUS_OK, "create first" );
+		passed &= expect( fat.create( "second", &writer ) == STATUS_OK, "create second" );
+		passed &= expect( fat.openFile( "first", fat.isValidOpenMode( "wb" ), handle, &writer ) == STATUS_OK, "open first buffered" );
+		passed &= expect( fat.openFile( "second", fat.isValidOpenMode( "wb" ), handle, &writer ) == STATUS_OK, "open second buffered" );
+
+		passed &= expect( fat.write( "first", 0, string( 4 * BYTES_PER_SECTOR, 'f' ), &writer ) == STATUS_OK, "first takes the last clusters" );
+		passed &= expect( fat.write( "second", 0, "s", &writer ) == STATUS_NO_SPACE, "second is refused up front" );
+		passed &= expect( fat.closeFile( "first", &writer ) == STATUS_OK, "close first" );
+		passed &= expect( fat.closeFile( "second", &writer ) == STATUS_OK, "close second" );
+		passed &= expect( fat.fileSize( "first", bytes, &writer ) == STATUS_OK && bytes == 4 * BYTES_PER_SECTOR, "first holds its writes" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": buffered writes age out and never count on the same space\n";
+
+	return passed ? 0 : 1;
+}
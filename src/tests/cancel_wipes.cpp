@@ -0,0 +1,78 @@
+#include "image.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * Cancelled safe rm
+ * Description: Cancels a safe rm still waiting behind another one. The rest
+ *				of its chain is freed at once, but not a byte of it may be
+ *				left on the image unwiped.
+ */
+
+const char * IMAGE = "cancel_wipes.img";
+const uint32_t TOTAL_SECTORS = 81920,
+			   BIG_BYTES = 24 * 1024 * 1024,
+			   SECRET_BYTES = 64 * 1024;
+
+int main() {
+
+	if ( !formatImage( IMAGE, TOTAL_SECTORS ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		const string names[] = { "big", "secret" };
+		const uint32_t sizes[] = { BIG_BYTES, SECRET_BYTES };
+		const char fills[] = { 'b', 'S' };
+
+		for ( uint32_t i = 0; i < 2; i++ ) {
+
+			uint32_t handle;
+			passed &= expect( fat.create( names[i], &session ) == STATUS_OK, "create " + names[i] );
+			passed &= expect( fat.openFile( names[i], WRITE, handle, &session ) == STATUS_OK, "open " + names[i] );
+			passed &= expect( fat.write( names[i], 0, string( sizes[i], fills[i] ), &session ) == STATUS_OK, "write " + names[i] );
+			passed &= expect( fat.closeFile( names[i], &session ) == STATUS_OK, "close " + names[i] );
+		}
+
+		// secret waits behind big, so it's still queued when cancelled
+		passed &= expect( fat.rm( "big", true, &session ) == STATUS_OK, "srm big" );
+		passed &= expect( fat.rm( "secret", true, &session ) == STATUS_OK, "srm secret" );
+
+		vector<JobInfo> jobs;
+		fat.jobs( jobs );
+
+		JobInfo cancelled;
+		passed &= expect( jobs.size() == 2, "both deletes are jobs" );
+		passed &= expect( !jobs.empty() && fat.cancel( jobs.back().id, cancelled ) == STATUS_OK && cancelled.name == "secret", "cancel secret" );
+
+		passed &= expectClean( fat );
+		passed &= expect( fat.sync() == STATUS_OK, "sync" );
+	}
+
+	// Nothing of secret may be left anywhere on the image
+	ifstream image( IMAGE, ios::in | ios::binary );
+	vector<char> contents( static_cast<size_t>( TOTAL_SECTORS ) * BYTES_PER_SECTOR );
+	image.read( &contents[0], contents.size() );
+
+	passed &= expect( image.gcount() == static_cast<streamsize>( contents.size() ), "read the image back" );
+	string run( 16, 'S' );
+	passed &= expect( search( contents.begin(), contents.end(), run.begin(), run.end() ) == contents.end(), "cancelled safe rm wiped everything" );
+
+	image.close();
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": a cancelled safe rm still wipes what it frees\n";
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+#include "image.h"
+
+#include <set>
+
+/**
+ * check and check --repair
+ * Description: Damages an image between mounts the ways check looks for, a
+ *				lost chain, a file larger than its chain, a wrong .. and a
+ *				wrong free count. check alone only reports them, repair
+ *				fixes every one for good.
+ */
+
+const char * IMAGE = "check_repair.img";
+
+const uint32_t FAT_SIZE = ( 8192 * 4 + BYTES_PER_SECTOR - 1 ) / BYTES_PER_SECTOR + 1,
+			   FIRST_DATA_SECTOR = RESERVED_SECTORS + NUM_FATS * FAT_SIZE,
+			   LOST_CLUSTER = 1000;
+
+/**
+ * Poke
+ * Description: Overwrites bytes of the image at the given offset.
+ */
+bool poke( uint64_t offset, const void * bytes, uint32_t length ) {
+
+	FILE * image = fopen( IMAGE, "r+b" );
+
+	if ( image == NULL )
+		return false;
+
+	bool written = fseek( image, offset, SEEK_SET ) == 0 && fwrite( bytes, 1, length, image ) == length;
+
+	return ( fclose( image ) == 0 ) && written;
+}
+
+/**
+ * Set FAT Entry
+ * Description: Sets a cluster's entry in every FAT.
+ */
+bool setFATEntry( uint32_t cluster, uint32_t value ) {
+
+	bool written = true;
+
+	for ( uint32_t i = 0; i < NUM_FATS; i++ )
+		written &= poke( static_cast<uint64_t>( RESERVED_SECTORS + i * FAT_SIZE ) * BYTES_PER_SECTOR + cluster * 4, &value, 4 );
+
+	return written;
+}
+
+uint64_t clusterOffset( uint32_t cluster ) {
+
+	return static_cast<uint64_t>( FIRST_DATA_SECTOR + cluster - 2 ) * BYTES_PER_SECTOR;
+}
+
+/**
+ * Problem Kinds
+ * Description: Runs check and sets the kinds of problems it found.
+ */
+bool problemKinds( FAT32 & fat, bool repair, set<ProblemKind> & kinds, CheckReport & report ) {
+
+	kinds.clear();
+
+	bool checked = expect( fat.check( repair, report ) == STATUS_OK, repair ? "check --repair" : "check" );
+
+	for ( const CheckProblem & problem : report.problems )
+		kinds.insert( problem.kind );
+
+	return checked;
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+	uint32_t fileCluster = 0, subCluster = 0, freeBefore = 0;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		uint32_t handle;
+		EntryInfo info;
+		passed &= expect( fat.create( "f", &session ) == STATUS_OK, "create f" );
+		passed &= expect( fat.openFile( "f", WRITE, handle, &session ) == STATUS_OK, "open f" );
+		passed &= expect( fat.write( "f", 0, string( 100, 'f' ), &session ) == STATUS_OK, "write f" );
+		passed &= expect( fat.closeFile( "f", &session ) == STATUS_OK, "close f" );
+		passed &= expect( fat.stat( "f", info, &session ) == STATUS_OK, "stat f" );
+		fileCluster = info.firstCluster;
+
+		passed &= expect( fat.mkdir( "sub", &session ) == STATUS_OK, "mkdir sub" );
+		passed &= expect( fat.stat( "sub", info, &session ) == STATUS_OK, "stat sub" );
+		subCluster = info.firstCluster;
+
+		passed &= expectClean( fat );
+	}
+
+	// Damage the image behind the library's back
+	uint8_t root[ BYTES_PER_SECTOR ];
+	FILE * image = fopen( IMAGE, "rb" );
+	passed &= expect( image != NULL && fseek( image, clusterOffset( 2 ), SEEK_SET ) == 0 && fread( root, 1, sizeof( root ), image ) == sizeof( root ), "read root" );
+
+	if ( image != NULL )
+		fclose( image );
+
+	uint32_t entry = 0;
+	while ( entry < BYTES_PER_SECTOR && memcmp( root + entry, "F          ", 11 ) != 0 )
+		entry += 32;
+
+	passed &= expect( entry < BYTES_PER_SECTOR, "find f's entry" );
+
+	uint32_t badSize = 3 * BYTES_PER_SECTOR, badParent = fileCluster, badFree = 12345;
+	passed &= expect( poke( clusterOffset( 2 ) + entry + 28, &badSize, 4 ), "grow f's size" );
+	passed &= expect( poke( clusterOffset( subCluster ) + 32 + 26, &badParent, 2 ), "point sub's .. at f" );
+	passed &= expect( setFATEntry( LOST_CLUSTER, LOST_CLUSTER + 1 ) && setFATEntry( LOST_CLUSTER + 1, 0x0FFFFFFF ), "lose a chain" );
+	passed &= expect( poke( BYTES_PER_SECTOR + 488, &badFree, 4 ), "break the free count" );
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+
+		FileSystemInfo info;
+		fat.fsinfo( info );
+		freeBefore = info.freeSectors;
+
+		CheckReport report;
+		set<ProblemKind> kinds;
+		set<ProblemKind> damage = { PROBLEM_SIZE, PROBLEM_DOTDOT, PROBLEM_LOST, PROBLEM_FREE_COUNT };
+
+		passed &= problemKinds( fat, false, kinds, report );
+		passed &= expect( kinds == damage && report.problems.size() == 4 && !report.repaired, "check reports each problem" );
+
+		for ( const CheckProblem & problem : report.problems ) {
+
+			if ( problem.kind == PROBLEM_SIZE )
+				passed &= expect( problem.path == "/f" && problem.value == badSize && problem.other == BYTES_PER_SECTOR, "size problem names f" );
+			else if ( problem.kind == PROBLEM_DOTDOT )
+				passed &= expect( problem.value == fileCluster, "dotdot problem names the wrong cluster" );
+			else if ( problem.kind == PROBLEM_LOST )
+				passed &= expect( problem.value == 2 && problem.other == 1, "one lost chain of 2 clusters" );
+			else if ( problem.kind == PROBLEM_FREE_COUNT )
+				passed &= expect( problem.value == badFree && problem.other == freeBefore, "free count problem" );
+		}
+
+		// Nothing was repaired, so a second check finds the same
+		passed &= problemKinds( fat, false, kinds, report );
+		passed &= expect( kinds == damage, "check alone leaves the problems" );
+
+		passed &= problemKinds( fat, true, kinds, report );
+		passed &= expect( kinds == damage && report.repaired, "repair reports what it fixed" );
+
+		fat.fsinfo( info );
+		passed &= expect( info.freeSectors == freeBefore + 2, "repair frees the lost chain" );
+
+		passed &= expectClean( fat );
+	}
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		uint32_t bytes;
+		passed &= expect( fat.fileSize( "f", bytes, &session ) == STATUS_OK && bytes <= BYTES_PER_SECTOR, "f fits its chain after a remount" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": check reports damage and check --repair fixes it\n";
+
+	return passed ? 0 : 1;
+}
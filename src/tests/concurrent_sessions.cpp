@@ -0,0 +1,174 @@
+#include "image.h"
+
+#include <atomic>
+#include <sstream>
+#include <thread>
+
+/**
+ * Concurrent sessions
+ * Description: Writer threads each work in a directory of their own while
+ *				reader threads list, walk and read the tree. Every writer's
+ *				files have to hold exactly what it wrote, readers never see
+ *				an error, and the tree checks clean afterwards.
+ */
+
+const char * IMAGE = "concurrent_sessions.img";
+const uint32_t WRITERS = 4,
+			   READERS = 3,
+			   ROUNDS = 40;
+
+/**
+ * Contents For
+ * Description: What a writer puts in one of its files, different for every
+ *				writer and round.
+ */
+string contentsFor( uint32_t writer, uint32_t round ) {
+
+	stringstream contents;
+	contents << "writer " << writer << " round " << round << " ";
+
+	return contents.str() + string( ( writer * 131 + round * 17 ) % 1500, static_cast<char>( 'a' + writer ) );
+}
+
+/**
+ * Writer
+ * Description: Creates, writes, reads back and removes files in its own
+ *				directory, keeping every other one.
+ */
+void writer( FAT32 & fat, uint32_t id, atomic<uint32_t> & failures ) {
+
+	Session session;
+	stringstream directory;
+	directory << "w" << id;
+
+	if ( fat.mkdir( directory.str(), &session ) != STATUS_OK || fat.changeDirectory( directory.str(), &session ) != STATUS_OK ) {
+
+		failures++;
+		return;
+	}
+
+	for ( uint32_t round = 0; round < ROUNDS; round++ ) {
+
+		stringstream name;
+		name << "file" << round;
+
+		string data = contentsFor( id, round ), contents;
+		ReadOutput output = [&contents]( const uint8_t * bytes, uint32_t length ) { contents.append( reinterpret_cast<const char *>( bytes ), length ); };
+
+		uint32_t handle;
+		bool done = fat.create( name.str(), &session ) == STATUS_OK
+					&& fat.openFile( name.str(), READWRITE, handle, &session ) == STATUS_OK
+					&& fat.write( name.str(), 0, data, &session ) == STATUS_OK
+					&& fat.read( name.str(), 0, data.size(), output, &session ) == STATUS_OK
+					&& fat.closeFile( name.str(), &session ) == STATUS_OK
+					&& contents == data;
+
+		if ( done && round % 2 == 1 )
+			done = fat.rm( name.str(), false, &session ) == STATUS_OK;
+
+		if ( !done )
+			failures++;
+	}
+}
+
+/**
+ * Reader
+ * Description: Lists the root, runs du and find over the whole tree until
+ *				the writers are done.
+ */
+void reader( FAT32 & fat, atomic<bool> & writing, atomic<uint32_t> & failures, atomic<uint32_t> & passes ) {
+
+	Session session;
+
+	while ( writing ) {
+
+		vector<EntryInfo> entries;
+		UsageTotals totals;
+		FindOutput output = []( const string & ) {};
+
+		if ( fat.list( "", entries, &session ) != STATUS_OK || fat.du( "/", totals, &session ) != STATUS_OK
+				|| fat.find( "/", "file*", output, &session ) != STATUS_OK )
+			failures++;
+
+		passes++;
+	}
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE, 32768 ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+
+		atomic<uint32_t> failures( 0 ), passes( 0 );
+		atomic<bool> writing( true );
+		vector<thread> writers, readers;
+
+		for ( uint32_t i = 0; i < READERS; i++ )
+			readers.push_back( thread( reader, ref( fat ), ref( writing ), ref( failures ), ref( passes ) ) );
+
+		for ( uint32_t i = 0; i < WRITERS; i++ )
+			writers.push_back( thread( writer, ref( fat ), i, ref( failures ) ) );
+
+		for ( uint32_t i = 0; i < WRITERS; i++ )
+			writers[i].join();
+
+		writing = false;
+
+		for ( uint32_t i = 0; i < READERS; i++ )
+			readers[i].join();
+
+		passed &= expect( failures == 0, "no call failed" );
+		passed &= expect( passes > 0, "readers ran alongside the writers" );
+
+		passed &= expectClean( fat );
+	}
+
+	{
+		// Each writer's surviving files, as seen after a remount
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+
+		for ( uint32_t id = 0; id < WRITERS; id++ ) {
+
+			Session session;
+			stringstream directory;
+			directory << "w" << id;
+
+			vector<EntryInfo> entries;
+			passed &= expect( fat.changeDirectory( directory.str(), &session ) == STATUS_OK, "cd " + directory.str() );
+			passed &= expect( fat.list( ".", entries, &session ) == STATUS_OK && entries.size() == 2 + ROUNDS / 2, directory.str() + " keeps every other file" );
+
+			for ( uint32_t round = 0; round < ROUNDS; round += 2 ) {
+
+				stringstream name;
+				name << "file" << round;
+
+				string data = contentsFor( id, round ), contents;
+				ReadOutput output = [&contents]( const uint8_t * bytes, uint32_t length ) { contents.append( reinterpret_cast<const char *>( bytes ), length ); };
+
+				uint32_t handle;
+				passed &= expect( fat.openFile( name.str(), READ, handle, &session ) == STATUS_OK
+								  && fat.read( name.str(), 0, data.size() + 1, output, &session ) == STATUS_OK
+								  && fat.closeFile( name.str(), &session ) == STATUS_OK
+								  && contents == data, directory.str() + "/" + name.str() + " holds what was written" );
+			}
+		}
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": sessions on many threads keep to their own changes\n";
+
+	return passed ? 0 : 1;
+}
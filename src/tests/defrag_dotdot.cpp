@@ -0,0 +1,117 @@
+#include "image.h"
+
+#include <sstream>
+
+/**
+ * defrag of a directory with children
+ * Description: Moves a fragmented directory holding subdirectories. Each
+ *				child's .. has to point at the directory's new first cluster,
+ *				so walking back up from a child lands in the moved directory.
+ */
+
+const char * IMAGE = "defrag_dotdot.img";
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+	uint32_t oldCluster = 0, newCluster = 0;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session inD, inE, console;
+
+		passed &= expect( fat.mkdir( "d" ) == STATUS_OK, "mkdir d" );
+		passed &= expect( fat.mkdir( "e" ) == STATUS_OK, "mkdir e" );
+		passed &= expect( fat.changeDirectory( "d", &inD ) == STATUS_OK, "cd d" );
+		passed &= expect( fat.changeDirectory( "e", &inE ) == STATUS_OK, "cd e" );
+
+		vector<string> children = { "c1", "c2" };
+		vector<Status> results;
+		passed &= expect( fat.mkdir( children, results, &inD ) == STATUS_OK, "mkdir children" );
+
+		Session inChild;
+		uint32_t handle;
+		passed &= expect( fat.changeDirectory( "d", &inChild ) == STATUS_OK && fat.changeDirectory( "c1", &inChild ) == STATUS_OK, "cd d/c1" );
+		passed &= expect( fat.create( "note", &inChild ) == STATUS_OK, "create note" );
+		passed &= expect( fat.openFile( "note", WRITE, handle, &inChild ) == STATUS_OK, "open note" );
+		passed &= expect( fat.write( "note", 0, "kept", &inChild ) == STATUS_OK, "write note" );
+		passed &= expect( fat.closeFile( "note", &inChild ) == STATUS_OK, "close note" );
+
+		// A cluster of entries at a time in turns, so d and e interleave
+		for ( uint32_t round = 0; round < 6; round++ ) {
+
+			vector<string> names;
+
+			for ( uint32_t i = 0; i < 8; i++ ) {
+
+				stringstream name;
+				name << "file" << round * 8 + i;
+				names.push_back( name.str() );
+			}
+
+			passed &= expect( fat.create( names, results, &inD ) == STATUS_OK, "create in d" );
+			passed &= expect( fat.create( names, results, &inE ) == STATUS_OK, "create in e" );
+		}
+
+		EntryInfo info;
+		passed &= expect( fat.stat( "d", info, &console ) == STATUS_OK, "stat d" );
+		oldCluster = info.firstCluster;
+
+		DefragReport report;
+		passed &= expect( fat.defrag( "d", 0, report, &console ) == STATUS_OK, "defrag d" );
+		passed &= expect( report.chainsMoved == 1, "defrag moves d" );
+
+		passed &= expect( fat.stat( "d", info, &console ) == STATUS_OK, "stat d again" );
+		newCluster = info.firstCluster;
+		passed &= expect( newCluster != oldCluster, "d has a new first cluster" );
+
+		// Climb out of each child and find d's entries again
+		for ( const string & child : children ) {
+
+			Session walker;
+			vector<EntryInfo> entries;
+
+			passed &= expect( fat.changeDirectory( "d", &walker ) == STATUS_OK && fat.changeDirectory( child, &walker ) == STATUS_OK, "cd d/" + child );
+			passed &= expect( fat.stat( "..", info, &walker ) == STATUS_OK && info.firstCluster == newCluster, child + "'s .. points at d's new cluster" );
+			passed &= expect( fat.changeDirectory( "..", &walker ) == STATUS_OK, "cd .. from " + child );
+			passed &= expect( fat.getCurrentPath( &walker ) == "/d/", "cd .. from " + child + " lands in d" );
+			passed &= expect( fat.list( ".", entries, &walker ) == STATUS_OK && entries.size() == 2 + 2 + 48, "d lists every entry from " + child );
+		}
+
+		passed &= expectClean( fat );
+	}
+
+	{
+		// The moved tree is the same after a remount
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		string contents;
+		ReadOutput output = [&contents]( const uint8_t * data, uint32_t length ) { contents.append( reinterpret_cast<const char *>( data ), length ); };
+
+		uint32_t handle;
+		passed &= expect( fat.changeDirectory( "d", &session ) == STATUS_OK && fat.changeDirectory( "c1", &session ) == STATUS_OK, "cd d/c1 after remount" );
+		passed &= expect( fat.openFile( "note", READ, handle, &session ) == STATUS_OK, "open note after remount" );
+		passed &= expect( fat.read( "note", 0, 4, output, &session ) == STATUS_OK && contents == "kept", "note keeps its data" );
+		passed &= expect( fat.closeFile( "note", &session ) == STATUS_OK, "close note after remount" );
+
+		EntryInfo info;
+		passed &= expect( fat.stat( "..", info, &session ) == STATUS_OK && info.firstCluster == newCluster, "c1's .. is on disk" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": defrag points moved children's .. at the new clusters\n";
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+#include "image.h"
+
+#include <sstream>
+
+/**
+ * defrag of a directory in use
+ * Description: Moves a fragmented directory while a file in it is open and
+ *				another session works in it. Both have to follow the
+ *				directory to its new clusters, the old ones are free again.
+ */
+
+const char * IMAGE = "defrag_handles.img";
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session inD, inE, console;
+
+		passed &= expect( fat.mkdir( "d" ) == STATUS_OK, "mkdir d" );
+		passed &= expect( fat.mkdir( "e" ) == STATUS_OK, "mkdir e" );
+		passed &= expect( fat.changeDirectory( "d", &inD ) == STATUS_OK, "cd d" );
+		passed &= expect( fat.changeDirectory( "e", &inE ) == STATUS_OK, "cd e" );
+
+		// A cluster of entries at a time in turns, so d and e interleave
+		vector<Status> results;
+		string last;
+
+		for ( uint32_t round = 0; round < 6; round++ ) {
+
+			vector<string> names;
+
+			for ( uint32_t i = 0; i < 8; i++ ) {
+
+				stringstream name;
+				name << "file" << round * 8 + i;
+				names.push_back( name.str() );
+			}
+
+			passed &= expect( fat.create( names, results, &inD ) == STATUS_OK, "create in d" );
+			passed &= expect( fat.create( names, results, &inE ) == STATUS_OK, "create in e" );
+			last = names.back();
+		}
+
+		vector<EntryInfo> before;
+		passed &= expect( fat.list( ".", before, &inD ) == STATUS_OK, "list d" );
+
+		uint32_t handle;
+		passed &= expect( fat.openFile( last, WRITE, handle, &inD ) == STATUS_OK, "open last file in d" );
+
+		DefragReport report;
+		passed &= expect( fat.defrag( "d", 0, report, &console ) == STATUS_OK, "defrag d" );
+		passed &= expect( report.chainsMoved == 1, "defrag moves d" );
+
+		// e takes the clusters d gave back
+		for ( uint32_t i = 0; i < 48; i++ ) {
+
+			stringstream name;
+			name << "more" << i;
+			passed &= expect( fat.create( name.str(), &inE ) == STATUS_OK, "grow e" );
+		}
+
+		vector<EntryInfo> after;
+		passed &= expect( fat.list( ".", after, &inD ) == STATUS_OK, "list d from its session" );
+		passed &= expect( after.size() == before.size(), "session in d sees every entry" );
+
+		stringstream byHandle;
+		byHandle << "#" << handle;
+		passed &= expect( fat.write( byHandle.str(), 0, string( 2048, 'a' ), &inD ) == STATUS_OK, "write through handle" );
+
+		uint32_t bytes = 0;
+		Session fresh;
+		passed &= expect( fat.changeDirectory( "d", &fresh ) == STATUS_OK, "cd d again" );
+		passed &= expect( fat.fileSize( last, bytes, &fresh ) == STATUS_OK && bytes == 2048, "write lands in d's entry" );
+		passed &= expect( fat.closeFile( byHandle.str(), &inD ) == STATUS_OK, "close" );
+
+		vector<EntryInfo> inEntries;
+		passed &= expect( fat.list( ".", inEntries, &inE ) == STATUS_OK && inEntries.size() == 2 + 48 + 48, "e keeps its entries" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": defrag moves handles and sessions along with a directory\n";
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+#include "image.h"
+
+#include <set>
+#include <sstream>
+
+/**
+ * du and find
+ * Description: Walk a tree wide enough to be spread over several threads.
+ *				du has to add up every file and directory under a path, and
+ *				find has to hand out every matching path exactly once.
+ */
+
+const char * IMAGE = "du_find.img";
+const uint32_t BRANCHES = 24;
+
+/**
+ * Write File
+ * Description: Creates a file holding bytes bytes.
+ */
+bool writeFile( FAT32 & fat, const string & name, uint32_t bytes, Session & session ) {
+
+	uint32_t handle;
+
+	return expect( fat.create( name, &session ) == STATUS_OK
+				   && ( bytes == 0 || ( fat.openFile( name, WRITE, handle, &session ) == STATUS_OK
+										&& fat.write( name, 0, string( bytes, 'x' ), &session ) == STATUS_OK
+										&& fat.closeFile( name, &session ) == STATUS_OK ) ), "write " + name );
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session top;
+
+		// top holds a.txt, b.log and sub, sub holds c.txt and deep, deep holds d.txt and e.log
+		passed &= expect( fat.mkdir( "top" ) == STATUS_OK && fat.changeDirectory( "top", &top ) == STATUS_OK, "cd top" );
+		passed &= writeFile( fat, "a.txt", 100, top ) & writeFile( fat, "b.log", 600, top );
+
+		Session sub, deep;
+		passed &= expect( fat.mkdir( "sub", &top ) == STATUS_OK && fat.changeDirectory( "top", &sub ) == STATUS_OK && fat.changeDirectory( "sub", &sub ) == STATUS_OK, "cd top/sub" );
+		passed &= writeFile( fat, "c.txt", 1500, sub );
+		passed &= expect( fat.mkdir( "deep", &sub ) == STATUS_OK && fat.changeDirectory( "top", &deep ) == STATUS_OK && fat.changeDirectory( "sub", &deep ) == STATUS_OK && fat.changeDirectory( "deep", &deep ) == STATUS_OK, "cd top/sub/deep" );
+		passed &= writeFile( fat, "d.txt", 0, deep ) & writeFile( fat, "e.log", 513, deep );
+
+		// Branches, each a directory holding one small file
+		for ( uint32_t i = 0; i < BRANCHES; i++ ) {
+
+			stringstream name;
+			name << "branch" << i;
+
+			Session branch;
+			passed &= expect( fat.mkdir( name.str(), &top ) == STATUS_OK && fat.changeDirectory( "top", &branch ) == STATUS_OK && fat.changeDirectory( name.str(), &branch ) == STATUS_OK, "cd " + name.str() );
+			passed &= writeFile( fat, "leaf.txt", 10, branch );
+		}
+
+		// Every file and directory takes its own clusters, the walked one's
+		// included. Each name in top takes a long and a short slot
+		UsageTotals totals;
+		uint32_t topSlots = 2 + ( 3 + BRANCHES ) * 2,
+				 topClusters = ( topSlots + BYTES_PER_SECTOR / 32 - 1 ) / ( BYTES_PER_SECTOR / 32 );
+		uint64_t clusters = topClusters + 1 + 2 + 1 + 3 + 1 + 0 + 2 + BRANCHES * 2;
+		passed &= expect( fat.du( "/top", totals ) == STATUS_OK, "du /top" );
+		passed &= expect( totals.files == 5 + BRANCHES && totals.directories == 2 + BRANCHES, "du counts every entry" );
+		passed &= expect( totals.bytes == 100 + 600 + 1500 + 513 + BRANCHES * 10, "du adds up file sizes" );
+		passed &= expect( totals.allocatedBytes == clusters * BYTES_PER_SECTOR, "du adds up clusters" );
+		passed &= expect( totals.path == "/top/", "du names the path" );
+
+		passed &= expect( fat.du( "sub/deep", totals, &top ) == STATUS_OK, "du sub/deep from top" );
+		passed &= expect( totals.files == 2 && totals.directories == 0 && totals.bytes == 513 && totals.allocatedBytes == ( 1 + 2 ) * BYTES_PER_SECTOR, "du of a relative path" );
+		passed &= expect( totals.path == "/top/sub/deep/", "du names the relative path" );
+
+		passed &= expect( fat.du( "missing", totals, &top ) == STATUS_NOT_FOUND, "du of a missing path" );
+		passed &= expect( fat.du( "a.txt", totals, &top ) == STATUS_NOT_A_DIRECTORY, "du of a file" );
+
+		// find hands every match out once
+		multiset<string> found;
+		FindOutput output = [&found]( const string & path ) { found.insert( path ); };
+
+		passed &= expect( fat.find( "/top", "*.txt", output ) == STATUS_OK, "find *.txt" );
+
+		multiset<string> expected = { "/top/a.txt", "/top/sub/c.txt", "/top/sub/deep/d.txt" };
+		for ( uint32_t i = 0; i < BRANCHES; i++ ) {
+
+			stringstream path;
+			path << "/top/branch" << i << "/leaf.txt";
+			expected.insert( path.str() );
+		}
+
+		passed &= expect( found == expected, "find matches every .txt once" );
+
+		found.clear();
+		passed &= expect( fat.find( "..", "[sd]*", output, &deep ) == STATUS_OK, "find [sd]* from deep" );
+		passed &= expect( found == multiset<string>( { "/top/sub/deep/", "/top/sub/deep/d.txt" } ), "find walks a relative path and marks directories" );
+
+		found.clear();
+		passed &= expect( fat.find( "/top", "*.LOG", output ) == STATUS_OK && found.empty(), "find is case-sensitive" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": du and find cover every entry under a path\n";
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+#include "image.h"
+
+#include <sstream>
+
+/**
+ * Open file table
+ * Description: Handles index a table shared by every session. Closed slots
+ *				are handed out again, a #handle works from anywhere, and reads
+ *				and writes without a start pos go on from the handle's cursor.
+ */
+
+const char * IMAGE = "handle_table.img";
+
+string handleName( uint32_t handle ) {
+
+	stringstream name;
+	name << "#" << handle;
+
+	return name.str();
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session, elsewhere;
+
+		vector<string> names = { "a", "b", "c" };
+		vector<Status> results;
+		passed &= expect( fat.create( names, results, &session ) == STATUS_OK, "create files" );
+		passed &= expect( fat.mkdir( "away", &elsewhere ) == STATUS_OK && fat.changeDirectory( "away", &elsewhere ) == STATUS_OK, "cd away" );
+
+		uint32_t a, b, c, again;
+		passed &= expect( fat.openFile( "a", READWRITE, a, &session ) == STATUS_OK, "open a" );
+		passed &= expect( fat.openFile( "b", READWRITE, b, &session ) == STATUS_OK, "open b" );
+		passed &= expect( fat.openFile( "c", READ, c, &session ) == STATUS_OK, "open c" );
+		passed &= expect( a == 0 && b == 1 && c == 2, "handles fill the table in order" );
+
+		passed &= expect( fat.openFile( "b", READ, again, &session ) == STATUS_ALREADY_OPEN, "open b twice" );
+		passed &= expect( fat.openFile( "a", 0, again, &session ) == STATUS_INVALID_MODE, "open without a mode" );
+
+		// A closed slot is the next one handed out
+		passed &= expect( fat.closeFile( handleName( b ), &session ) == STATUS_OK, "close b by handle" );
+		passed &= expect( fat.closeFile( handleName( b ), &session ) == STATUS_BAD_HANDLE, "close b's handle twice" );
+		passed &= expect( fat.closeFile( "b", &session ) == STATUS_NOT_OPEN, "close b by name once closed" );
+		passed &= expect( fat.openFile( "b", READWRITE, again, &session ) == STATUS_OK && again == b, "b's slot is reused" );
+		passed &= expect( fat.closeFile( "#99", &session ) == STATUS_BAD_HANDLE, "close a handle never given out" );
+
+		// Handles work from a session in another directory, where a can't be named
+		string data = "0123456789";
+		passed &= expect( fat.closeFile( "a", &elsewhere ) == STATUS_NOT_FOUND, "a isn't in away" );
+		passed &= expect( fat.write( handleName( a ), data.substr( 0, 4 ), &elsewhere ) == STATUS_OK, "write at a's cursor" );
+		passed &= expect( fat.write( handleName( a ), data.substr( 4 ), &elsewhere ) == STATUS_OK, "write on from a's cursor" );
+
+		uint32_t bytes;
+		passed &= expect( fat.fileSize( "a", bytes, &session ) == STATUS_OK && bytes == data.size(), "cursor writes follow each other" );
+
+		// Reads and writes at a start pos move the cursor past them too
+		string contents;
+		ReadOutput output = [&contents]( const uint8_t * bytes, uint32_t length ) { contents.append( reinterpret_cast<const char *>( bytes ), length ); };
+
+		passed &= expect( fat.read( handleName( a ), 1, output, &elsewhere ) == STATUS_OUT_OF_RANGE, "cursor is at the end of a" );
+		passed &= expect( fat.read( handleName( a ), 0, 3, output, &elsewhere ) == STATUS_OK && contents == "012", "read a from a start pos" );
+		passed &= expect( fat.read( handleName( a ), 1, output, &elsewhere ) == STATUS_OK && contents == "0123", "read on from a's cursor" );
+
+		passed &= expect( fat.write( handleName( a ), 2, "xy", &elsewhere ) == STATUS_OK, "write a at a start pos" );
+		passed &= expect( fat.read( handleName( a ), 3, output, &elsewhere ) == STATUS_OK && contents == "0123456", "cursor reads follow the write" );
+		passed &= expect( fat.read( handleName( a ), 2, output, &elsewhere ) == STATUS_OK && contents == "012345678", "cursor reads follow each other" );
+
+		// Modes still hold through a handle
+		passed &= expect( fat.write( handleName( c ), 0, "no", &elsewhere ) == STATUS_NOT_WRITABLE, "write a read only handle" );
+
+		passed &= expect( fat.closeFile( "a", &session ) == STATUS_OK, "close a by name" );
+		passed &= expect( fat.closeFile( handleName( again ), &elsewhere ) == STATUS_OK, "close b from away" );
+		passed &= expect( fat.closeFile( handleName( c ), &session ) == STATUS_OK, "close c" );
+		passed &= expect( fat.read( handleName( a ), 0, 1, output, &session ) == STATUS_BAD_HANDLE, "closed handles are gone" );
+
+		contents.clear();
+		passed &= expect( fat.openFile( "a", READ, a, &session ) == STATUS_OK && a == 0, "first slot is free again" );
+		passed &= expect( fat.read( "a", 10, output, &session ) == STATUS_OK && contents == "01xy456789", "a holds both writes" );
+		passed &= expect( fat.closeFile( "a", &session ) == STATUS_OK, "close a again" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": handles are reused slots with their own cursor\n";
+
+	return passed ? 0 : 1;
+}
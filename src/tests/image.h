@@ -0,0 +1,107 @@
+#pragma once
+
+#include "../fat32.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+using namespace FAT_FS;
+
+/**
+ * Test Images
+ * Description: What every test program shares, an empty image to work on and
+ *				a way to report what went wrong.
+ */
+
+const uint32_t BYTES_PER_SECTOR = 512,
+			   RESERVED_SECTORS = 32,
+			   NUM_FATS = 2;
+
+/**
+ * Format Image
+ * Description: Writes out an empty FAT32 image of totalSectors with one
+ *				sector clusters.
+ */
+inline bool formatImage( const char * path, uint32_t totalSectors = 8192 ) {
+
+	uint32_t fatSize = ( totalSectors * 4 + BYTES_PER_SECTOR - 1 ) / BYTES_PER_SECTOR + 1,
+			 firstDataSector = RESERVED_SECTORS + NUM_FATS * fatSize,
+			 clusters = totalSectors - firstDataSector;
+
+	uint8_t sector[ BYTES_PER_SECTOR ];
+	FILE * image = fopen( path, "wb" );
+
+	if ( image == NULL )
+		return false;
+
+	// Boot sector
+	memset( sector, 0, sizeof( sector ) );
+	memcpy( sector, "\xEB\x58\x90MSWIN4.1", 11 );
+	sector[11] = BYTES_PER_SECTOR & 0xFF;
+	sector[12] = BYTES_PER_SECTOR >> 8;
+	sector[13] = 1;
+	sector[14] = RESERVED_SECTORS;
+	sector[16] = NUM_FATS;
+	sector[21] = 0xF8;
+	memcpy( sector + 32, &totalSectors, 4 );
+	memcpy( sector + 36, &fatSize, 4 );
+	sector[44] = 2;
+	sector[48] = 1;
+	sector[50] = 6;
+	sector[66] = 0x29;
+	memcpy( sector + 71, "NO NAME    FAT32   ", 19 );
+	sector[510] = 0x55;
+	sector[511] = 0xAA;
+	fwrite( sector, 1, sizeof( sector ), image );
+
+	// FSInfo, the root directory takes the first cluster
+	uint32_t signatures[] = { 0x41615252, 0x61417272, clusters - 1, 3, 0xAA550000 };
+	memset( sector, 0, sizeof( sector ) );
+	memcpy( sector, &signatures[0], 4 );
+	memcpy( sector + 484, &signatures[1], 12 );
+	memcpy( sector + 508, &signatures[4], 4 );
+	fwrite( sector, 1, sizeof( sector ), image );
+
+	uint32_t reserved[] = { 0x0FFFFFF8, 0x0FFFFFFF, 0x0FFFFFFF };
+
+	for ( uint32_t i = 0; i < NUM_FATS; i++ ) {
+
+		fseek( image, ( RESERVED_SECTORS + i * fatSize ) * BYTES_PER_SECTOR, SEEK_SET );
+		fwrite( reserved, 1, sizeof( reserved ), image );
+	}
+
+	// Zeroed root directory cluster and the rest of the image
+	memset( sector, 0, sizeof( sector ) );
+	fseek( image, ( totalSectors - 1 ) * BYTES_PER_SECTOR, SEEK_SET );
+	fwrite( sector, 1, sizeof( sector ), image );
+
+	return fclose( image ) == 0;
+}
+
+/**
+ * Expect
+ * Description: Prints a failed expectation. Returns whether or not it held.
+ */
+inline bool expect( bool held, const string & what ) {
+
+	if ( !held )
+		cout << "FAIL: " << what << "\n";
+
+	return held;
+}
+
+/**
+ * Expect Clean
+ * Description: Runs check on the image, expecting it to find nothing wrong.
+ */
+inline bool expectClean( FAT32 & fat ) {
+
+	CheckReport report;
+
+	return expect( fat.check( false, report ) == STATUS_OK, "check" )
+		   & expect( report.problems.empty(), "check finds no problems" );
+}
@@ -0,0 +1,126 @@
+#include "image.h"
+
+#include <sstream>
+
+/**
+ * Incremental listing updates
+ * Description: The session making a change patches its listing in place
+ *				rather than reading the directory again. After mixed creates,
+ *				mkdirs and rms with long names, some reusing freed slots in
+ *				the middle, it has to match a listing read from disk.
+ */
+
+const char * IMAGE = "incremental_listing.img";
+
+/**
+ * Describe Listing
+ * Description: Lists a session's directory, one entry per line.
+ */
+string describeListing( FAT32 & fat, Session & session ) {
+
+	vector<EntryInfo> entries;
+	stringstream listing;
+
+	if ( fat.list( ".", entries, &session ) != STATUS_OK )
+		return "";
+
+	for ( const EntryInfo & entry : entries )
+		listing << entry.name << " " << entry.size << " " << entry.firstCluster << " " << entry.directory << "\n";
+
+	return listing.str();
+}
+
+/**
+ * Matches Disk
+ * Description: Compares a session's listing with one a fresh session reads.
+ */
+bool matchesDisk( FAT32 & fat, Session & session, const string & after ) {
+
+	Session fresh;
+	fat.changeDirectory( "work", &fresh );
+
+	return expect( describeListing( fat, session ) == describeListing( fat, fresh ), "listing matches the disk after " + after );
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+	string expected;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		passed &= expect( fat.mkdir( "work" ) == STATUS_OK && fat.changeDirectory( "work", &session ) == STATUS_OK, "cd work" );
+
+		// Names long enough to take several slots, the short ones only take one
+		for ( uint32_t i = 0; i < 12; i++ ) {
+
+			stringstream name;
+			name << ( i % 3 == 0 ? "s" : "a rather long file name number " ) << i;
+
+			Status status = i % 4 == 1 ? fat.mkdir( name.str(), &session ) : fat.create( name.str(), &session );
+			passed &= expect( status == STATUS_OK, "make " + name.str() );
+		}
+
+		passed &= matchesDisk( fat, session, "creates" );
+
+		// Free slots in the middle, then fill them with names of other lengths
+		passed &= expect( fat.rm( "a rather long file name number 2", false, &session ) == STATUS_OK, "rm a long name" );
+		passed &= expect( fat.rm( "s3", false, &session ) == STATUS_OK, "rm a short name" );
+		passed &= expect( fat.rmdir( "a rather long file name number 5", &session ) == STATUS_OK, "rmdir a long name" );
+		passed &= matchesDisk( fat, session, "rms" );
+
+		passed &= expect( fat.create( "t", &session ) == STATUS_OK, "create a short name in a hole" );
+		passed &= expect( fat.create( "a long name for a hole", &session ) == STATUS_OK, "create a long name in a hole" );
+		passed &= expect( fat.mkdir( "x", &session ) == STATUS_OK, "mkdir a short name in a hole" );
+		passed &= matchesDisk( fat, session, "refilling holes" );
+
+		uint32_t handle;
+		passed &= expect( fat.openFile( "t", WRITE, handle, &session ) == STATUS_OK, "open t" );
+		passed &= expect( fat.write( "t", 0, string( 700, 't' ), &session ) == STATUS_OK, "write t" );
+		passed &= expect( fat.closeFile( "t", &session ) == STATUS_OK, "close t" );
+		passed &= matchesDisk( fat, session, "a write" );
+
+		// Enough to grow the directory past its first clusters
+		vector<string> names;
+		vector<Status> results;
+
+		for ( uint32_t i = 0; i < 40; i++ ) {
+
+			stringstream name;
+			name << "batch entry with a long name " << i;
+			names.push_back( name.str() );
+		}
+
+		passed &= expect( fat.create( names, results, &session ) == STATUS_OK, "create a batch" );
+		passed &= matchesDisk( fat, session, "growing the directory" );
+
+		expected = describeListing( fat, session );
+		passed &= expectClean( fat );
+	}
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		passed &= expect( fat.changeDirectory( "work", &session ) == STATUS_OK, "cd work after remount" );
+		passed &= expect( describeListing( fat, session ) == expected, "listing matches after a remount" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": incremental listing updates match the directory on disk\n";
+
+	return passed ? 0 : 1;
+}
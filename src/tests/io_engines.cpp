@@ -0,0 +1,253 @@
+#include "image.h"
+#include "../volume.h"
+
+#include <random>
+
+/**
+ * I/O engines
+ * Description: Runs the same batches through the sync engine and io_uring
+ *				against two copies of one file. Results, what reads hand back
+ *				and the files themselves have to come out the same, for
+ *				batches deeper than the ring, reads past the end of the file,
+ *				bad descriptors and several threads sharing the ring. Hosts
+ *				without io_uring only run the sync engine. A volume then has
+ *				to pick the engine the host has and carry a file through it.
+ */
+
+const char * IMAGE = "io_engines.img";
+const char * SYNC_FILE = "io_engines.sync";
+const char * URING_FILE = "io_engines.uring";
+const uint32_t FILE_BYTES = 1 << 20,
+			   REQUESTS = 3 * IO_QUEUE_DEPTH + 7,
+			   THREADS = 4;
+
+/**
+ * Batch
+ * Description: Requests over slots of the file that never overlap, in a
+ *				shuffled order, every third one a write. The last read runs
+ *				past the end of the file. Buffers are filled with a pattern
+ *				for writes and garbage for reads.
+ */
+typedef struct Batch {
+
+	vector<IORequest> requests;
+	vector<vector<uint8_t> > buffers;
+
+} Batch;
+
+void buildBatch( Batch & batch, uint32_t seed ) {
+
+	mt19937 random( seed );
+	uint32_t slot = FILE_BYTES / REQUESTS;
+	vector<uint32_t> order( REQUESTS );
+
+	for ( uint32_t i = 0; i < REQUESTS; i++ )
+		order[i] = i;
+
+	shuffle( order.begin(), order.end(), random );
+
+	batch.requests.resize( REQUESTS + 1 );
+	batch.buffers.resize( REQUESTS + 1 );
+
+	for ( uint32_t i = 0; i < REQUESTS; i++ ) {
+
+		IORequest & request = batch.requests[i];
+		request.offset = static_cast<uint64_t>( order[i] ) * slot + random() % 64;
+		request.length = 1 + random() % ( slot - 64 );
+		request.write = i % 3 == 0;
+		request.result = 0;
+
+		batch.buffers[i].resize( request.length );
+
+		for ( uint32_t j = 0; j < request.length; j++ )
+			batch.buffers[i][j] = request.write ? static_cast<uint8_t>( random() ) : 0xEE;
+	}
+
+	IORequest & tail = batch.requests[ REQUESTS ];
+	tail.offset = FILE_BYTES - 100;
+	tail.length = 300;
+	tail.write = false;
+	tail.result = 0;
+	batch.buffers[ REQUESTS ].assign( tail.length, 0xEE );
+
+	for ( uint32_t i = 0; i <= REQUESTS; i++ )
+		batch.requests[i].buffer = &batch.buffers[i][0];
+}
+
+/**
+ * Same Outcome
+ * Description: Compares two batches after they ran, results and read data.
+ */
+bool sameOutcome( const Batch & left, const Batch & right ) {
+
+	for ( uint32_t i = 0; i < left.requests.size(); i++ ) {
+
+		if ( left.requests[i].result != right.requests[i].result || left.buffers[i] != right.buffers[i] )
+			return false;
+	}
+
+	return true;
+}
+
+bool fileContents( const char * path, string & contents ) {
+
+	ifstream file( path, ios::in | ios::binary );
+	contents.assign( istreambuf_iterator<char>( file ), istreambuf_iterator<char>() );
+
+	return file.good() || file.eof();
+}
+
+bool writeStartingFile( const char * path ) {
+
+	string contents( FILE_BYTES, '\0' );
+
+	for ( uint32_t i = 0; i < FILE_BYTES; i++ )
+		contents[i] = static_cast<char>( i * 7 );
+
+	ofstream file( path, ios::out | ios::binary | ios::trunc );
+	file.write( contents.data(), contents.size() );
+
+	return file.good();
+}
+
+int main() {
+
+	bool passed = true;
+
+	passed &= expect( writeStartingFile( SYNC_FILE ) && writeStartingFile( URING_FILE ), "write starting files" );
+
+	int syncDescriptor = open( SYNC_FILE, O_RDWR ),
+		uringDescriptor = open( URING_FILE, O_RDWR );
+	passed &= expect( syncDescriptor >= 0 && uringDescriptor >= 0, "open files" );
+
+	SyncEngine sync( syncDescriptor );
+
+	Batch expected;
+	buildBatch( expected, 1 );
+	sync.submit( expected.requests );
+
+	passed &= expect( expected.requests.back().result == 100, "read past the end stops at the end" );
+
+	for ( uint32_t i = 0; i < REQUESTS; i++ )
+		passed &= expect( expected.requests[i].result == static_cast<int64_t>( expected.requests[i].length ), "sync request completes" );
+
+	// A bad descriptor fails every request with its errno
+	SyncEngine broken( -1 );
+	Batch failed;
+	buildBatch( failed, 2 );
+	broken.submit( failed.requests );
+	passed &= expect( failed.requests[0].result == -EBADF && failed.requests[1].result == -EBADF, "bad descriptor reports EBADF" );
+
+#ifdef HAVE_IO_URING
+	UringEngine uring( uringDescriptor );
+
+	if ( uring.isReady() ) {
+
+		Batch ringed;
+		buildBatch( ringed, 1 );
+		uring.submit( ringed.requests );
+		passed &= expect( sameOutcome( expected, ringed ), "io_uring matches the sync engine" );
+
+		UringEngine brokenRing( -1 );
+
+		if ( brokenRing.isReady() ) {
+
+			Batch ringFailed;
+			buildBatch( ringFailed, 2 );
+			brokenRing.submit( ringFailed.requests );
+			passed &= expect( sameOutcome( failed, ringFailed ), "io_uring reports the same errors" );
+		}
+
+		// Threads sharing the ring, each batch over the same slots with its own data
+		vector<Batch> syncBatches( THREADS ), uringBatches( THREADS );
+		vector<thread> threads;
+
+		for ( uint32_t i = 0; i < THREADS; i++ ) {
+
+			buildBatch( syncBatches[i], 10 + i );
+			buildBatch( uringBatches[i], 10 + i );
+
+			// Only reads, so the threads never race on the file
+			for ( uint32_t j = 0; j <= REQUESTS; j++ )
+				syncBatches[i].requests[j].write = uringBatches[i].requests[j].write = false;
+		}
+
+		for ( uint32_t i = 0; i < THREADS; i++ )
+			threads.push_back( thread( [&uring, &uringBatches, i]() { uring.submit( uringBatches[i].requests ); } ) );
+
+		for ( uint32_t i = 0; i < THREADS; i++ ) {
+
+			threads[i].join();
+			sync.submit( syncBatches[i].requests );
+			passed &= expect( sameOutcome( syncBatches[i], uringBatches[i] ), "threads sharing the ring read the same" );
+		}
+
+	} else
+		cout << "io_uring is not available, only the sync engine ran\n";
+
+#else
+	cout << "io_uring is not built in, only the sync engine ran\n";
+#endif
+
+	string syncContents, uringContents;
+
+#ifdef HAVE_IO_URING
+	if ( UringEngine( uringDescriptor ).isReady() ) {
+
+		passed &= expect( fileContents( SYNC_FILE, syncContents ) && fileContents( URING_FILE, uringContents ), "read both files back" );
+		passed &= expect( syncContents == uringContents, "both engines wrote the same file" );
+	}
+#endif
+
+	if ( syncDescriptor >= 0 )
+		close( syncDescriptor );
+
+	if ( uringDescriptor >= 0 )
+		close( uringDescriptor );
+
+	remove( SYNC_FILE );
+	remove( URING_FILE );
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		FileSystemInfo info;
+		fat.fsinfo( info );
+
+		int descriptor = open( IMAGE, O_RDWR );
+		IOEngine * engine = IOEngine::create( descriptor );
+		passed &= expect( info.engine == engine->name(), "volume picks the host's engine" );
+		delete engine;
+		close( descriptor );
+
+		// Large enough to be split into chunks read as one batch
+		string data( 256 * BYTES_PER_SECTOR, '\0' ), contents;
+		for ( uint32_t i = 0; i < data.size(); i++ )
+			data[i] = static_cast<char>( i * 13 );
+
+		ReadOutput output = [&contents]( const uint8_t * bytes, uint32_t length ) { contents.append( reinterpret_cast<const char *>( bytes ), length ); };
+
+		uint32_t handle;
+		passed &= expect( fat.create( "data", &session ) == STATUS_OK, "create data" );
+		passed &= expect( fat.openFile( "data", READWRITE, handle, &session ) == STATUS_OK, "open data" );
+		passed &= expect( fat.write( "data", 0, data, &session ) == STATUS_OK, "write data" );
+		passed &= expect( fat.read( "data", 0, data.size(), output, &session ) == STATUS_OK && contents == data, "read data back" );
+		passed &= expect( fat.closeFile( "data", &session ) == STATUS_OK, "close data" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": io_uring and the sync engine do the same I/O\n";
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+#include "image.h"
+
+#include <sstream>
+
+/**
+ * I/O workers
+ * Description: Large reads and writes are cut into chunks the worker pool
+ *				carries out. Whatever the number of workers, including none,
+ *				a file spread over many fragments has to be written and read
+ *				back byte for byte, through read and readInto alike.
+ */
+
+const char * IMAGE = "io_workers.img";
+const uint32_t TOTAL_SECTORS = 32768,
+			   FILE_BYTES = 3 << 20,
+			   HOLES = 12,
+			   MAX_WORKERS = 256;
+
+/**
+ * Pattern
+ * Description: File contents that differ for every worker count.
+ */
+string pattern( uint32_t workers ) {
+
+	string data( FILE_BYTES, '\0' );
+
+	for ( uint32_t i = 0; i < FILE_BYTES; i++ )
+		data[i] = static_cast<char>( ( i * 131 ) ^ ( i >> 11 ) ^ workers );
+
+	return data;
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE, TOTAL_SECTORS ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+	vector<uint32_t> counts = { 0, 1, 3, 8 };
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		passed &= expect( fat.workers( MAX_WORKERS + 1 ) == STATUS_TOO_MANY_WORKERS, "worker count is bounded" );
+
+		// Holes of uneven size for the files to be spread over
+		for ( uint32_t i = 0; i < 2 * HOLES; i++ ) {
+
+			stringstream name;
+			name << "hole" << i;
+
+			uint32_t handle;
+			passed &= expect( fat.create( name.str(), &session ) == STATUS_OK
+							  && fat.openFile( name.str(), WRITE, handle, &session ) == STATUS_OK
+							  && fat.write( name.str(), 0, string( ( 1 + i % 5 ) * 7 * BYTES_PER_SECTOR, 'h' ), &session ) == STATUS_OK
+							  && fat.closeFile( name.str(), &session ) == STATUS_OK, "write " + name.str() );
+		}
+
+		for ( uint32_t i = 0; i < 2 * HOLES; i += 2 ) {
+
+			stringstream name;
+			name << "hole" << i;
+			passed &= expect( fat.rm( name.str(), false, &session ) == STATUS_OK, "rm " + name.str() );
+		}
+
+		passed &= expectClean( fat );
+
+		for ( uint32_t workers : counts ) {
+
+			stringstream name;
+			name << "with" << workers;
+
+			FileSystemInfo info;
+			passed &= expect( fat.workers( workers ) == STATUS_OK, "set workers" );
+			fat.fsinfo( info );
+			passed &= expect( info.workers == workers, "fsinfo reports the workers" );
+
+			string data = pattern( workers ), contents;
+			ReadOutput output = [&contents]( const uint8_t * bytes, uint32_t length ) { contents.append( reinterpret_cast<const char *>( bytes ), length ); };
+
+			uint32_t handle, bytesRead = 0;
+			passed &= expect( fat.create( name.str(), &session ) == STATUS_OK && fat.openFile( name.str(), READWRITE, handle, &session ) == STATUS_OK, "open " + name.str() );
+			passed &= expect( fat.write( name.str(), 0, data, &session ) == STATUS_OK, "write " + name.str() );
+			passed &= expect( fat.read( name.str(), 0, FILE_BYTES, output, &session ) == STATUS_OK && contents == data, "read " + name.str() );
+
+			vector<uint8_t> buffer( FILE_BYTES );
+			passed &= expect( fat.readInto( name.str(), 0, &buffer[0], FILE_BYTES, bytesRead, &session ) == STATUS_OK && bytesRead == FILE_BYTES
+							  && memcmp( &buffer[0], data.data(), FILE_BYTES ) == 0, "readInto " + name.str() );
+
+			// Ranges starting and ending inside clusters
+			contents.clear();
+			passed &= expect( fat.read( name.str(), 1000, FILE_BYTES - 2000, output, &session ) == STATUS_OK && contents == data.substr( 1000, FILE_BYTES - 2000 ), "read inside " + name.str() );
+			passed &= expect( fat.closeFile( name.str(), &session ) == STATUS_OK, "close " + name.str() );
+		}
+
+		passed &= expectClean( fat );
+	}
+
+	{
+		// Read back with no workers what many workers wrote and the other way round
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		for ( uint32_t i = 0; i < counts.size(); i++ ) {
+
+			stringstream name;
+			name << "with" << counts[i];
+
+			string contents;
+			ReadOutput output = [&contents]( const uint8_t * bytes, uint32_t length ) { contents.append( reinterpret_cast<const char *>( bytes ), length ); };
+
+			uint32_t handle;
+			passed &= expect( fat.workers( counts[ counts.size() - 1 - i ] ) == STATUS_OK, "set workers after remount" );
+			passed &= expect( fat.openFile( name.str(), READ, handle, &session ) == STATUS_OK
+							  && fat.read( name.str(), 0, FILE_BYTES, output, &session ) == STATUS_OK
+							  && fat.closeFile( name.str(), &session ) == STATUS_OK
+							  && contents == pattern( counts[i] ), name.str() + " reads back after a remount" );
+		}
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": any number of I/O workers moves the same bytes\n";
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+#include "image.h"
+
+#include <fcntl.h>
+#include <set>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Quiet library
+ * Description: Library calls report only through their Status and what
+ *				they fill in. A run of calls, failing ones included, has to
+ *				leave stdout and stderr untouched, and describe has a message
+ *				for every Status.
+ */
+
+const char * IMAGE = "library_quiet.img";
+const char * CAPTURE = "library_quiet.out";
+
+/**
+ * Run Calls
+ * Description: Goes through most of the library, counting the calls that
+ *				didn't return what they should.
+ */
+uint32_t runCalls( FAT32 & fat ) {
+
+	Session session;
+	uint32_t handle, bytes, failures = 0;
+	vector<Status> results;
+	vector<EntryInfo> entries;
+	EntryInfo info;
+	UsageTotals totals;
+	Reservation reservation;
+	DefragReport defragReport;
+	CheckReport checkReport;
+	FileSystemInfo fsInfo;
+	vector<JobInfo> jobs;
+	JobInfo job;
+	string contents;
+
+	ReadOutput output = [&contents]( const uint8_t * data, uint32_t length ) { contents.append( reinterpret_cast<const char *>( data ), length ); };
+	FindOutput found = [&contents]( const string & path ) { contents += path; };
+
+	failures += fat.mkdir( "dir", &session ) != STATUS_OK;
+	failures += fat.changeDirectory( "dir", &session ) != STATUS_OK;
+	failures += fat.create( vector<string>( { "a", "b", "a" } ), results, &session ) != STATUS_OK;
+	failures += fat.openFile( "a", READWRITE, handle, &session ) != STATUS_OK;
+	failures += fat.write( "a", 0, string( 5000, 'a' ), &session ) != STATUS_OK;
+	failures += fat.append( "a", "tail", &session ) != STATUS_OK;
+	failures += fat.read( "a", 0, 6000, output, &session ) != STATUS_OK;
+	failures += fat.closeFile( "a", &session ) != STATUS_OK;
+	failures += fat.prealloc( "b", 3000, false, reservation, &session ) != STATUS_OK;
+	failures += fat.fileSize( "b", bytes, &session ) != STATUS_OK;
+	failures += fat.stat( "a", info, &session ) != STATUS_OK;
+	failures += fat.list( "", entries, &session ) != STATUS_OK;
+	failures += fat.du( "/", totals, &session ) != STATUS_OK;
+	failures += fat.find( "/", "*", found, &session ) != STATUS_OK;
+	failures += fat.defrag( "", 0, defragReport, &session ) != STATUS_OK;
+	failures += fat.rm( "b", true, &session ) != STATUS_OK;
+	fat.jobs( jobs );
+	fat.fsinfo( fsInfo );
+	fat.trim( true );
+	failures += fat.rm( "a", false, &session ) != STATUS_OK;
+	failures += fat.workers( 2 ) != STATUS_OK;
+	failures += fat.sync() != STATUS_OK;
+
+	// Calls that fail say so only through their Status
+	failures += fat.openFile( "missing", READ, handle, &session ) != STATUS_NOT_FOUND;
+	failures += fat.closeFile( "#42", &session ) != STATUS_BAD_HANDLE;
+	failures += fat.read( "missing", 0, 1, output, &session ) != STATUS_NOT_FOUND;
+	failures += fat.mkdir( "bad|name", &session ) != STATUS_ILLEGAL_CHARACTER;
+	failures += fat.rmdir( "missing", &session ) != STATUS_NOT_FOUND;
+	failures += fat.changeDirectory( "missing", &session ) != STATUS_NOT_FOUND;
+	failures += fat.cancel( 999, job ) != STATUS_NO_SUCH_JOB;
+	failures += fat.workers( 100000 ) != STATUS_TOO_MANY_WORKERS;
+	failures += fat.du( "missing", totals, &session ) != STATUS_NOT_FOUND;
+
+	failures += fat.changeDirectory( "..", &session ) != STATUS_OK;
+	failures += fat.rmTree( "dir", &session ) != STATUS_OK;
+	failures += fat.check( true, checkReport ) != STATUS_OK;
+
+	return failures;
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+
+	// Everything the process prints while the library runs ends up in CAPTURE
+	cout.flush();
+	cerr.flush();
+	fflush( NULL );
+
+	int capture = open( CAPTURE, O_WRONLY | O_CREAT | O_TRUNC, 0644 ),
+		savedOut = dup( STDOUT_FILENO ),
+		savedErr = dup( STDERR_FILENO );
+
+	if ( capture < 0 || savedOut < 0 || savedErr < 0 || dup2( capture, STDOUT_FILENO ) < 0 || dup2( capture, STDERR_FILENO ) < 0 ) {
+
+		cout << "FAIL: could not capture output\n";
+		return 1;
+	}
+
+	uint32_t failures;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+
+		failures = runCalls( fat );
+	}
+
+	cout.flush();
+	cerr.flush();
+	fflush( NULL );
+
+	dup2( savedOut, STDOUT_FILENO );
+	dup2( savedErr, STDERR_FILENO );
+	close( savedOut );
+	close( savedErr );
+	close( capture );
+
+	struct stat captured;
+	passed &= expect( failures == 0, "every call returns what it should" );
+	passed &= expect( stat( CAPTURE, &captured ) == 0 && captured.st_size == 0, "the library printed nothing" );
+
+	// Every Status has a message of its own
+	set<string> messages;
+
+	for ( uint32_t status = STATUS_OK; status <= STATUS_IO_ERROR; status++ ) {
+
+		string message = describe( static_cast<Status>( status ), "x" );
+		passed &= expect( !message.empty() && message.back() == '.', "describe has a sentence for every status" );
+		messages.insert( message );
+	}
+
+	passed &= expect( messages.size() == STATUS_IO_ERROR + 1, "every status has its own message" );
+	passed &= expect( describe( STATUS_ILLEGAL_CHARACTER, "bad|name", "directory" ) == "illegal character (|) in directory name.", "describe points out the character" );
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+	remove( CAPTURE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": the library reports through Status and never prints\n";
+
+	return passed ? 0 : 1;
+}
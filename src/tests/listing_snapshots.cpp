@@ -0,0 +1,123 @@
+#include "image.h"
+#include "../volume.h"
+
+/**
+ * Copy-on-write listings
+ * Description: Copies of a listing share one snapshot until one of them
+ *				changes, which then gets its own and leaves the others alone.
+ *				Sessions in one directory each see the other's changes.
+ */
+
+const char * IMAGE = "listing_snapshots.img";
+
+ShortDirectoryEntry shortEntryFor( uint32_t location, uint32_t fileSize ) {
+
+	ShortDirectoryEntry shortEntry;
+	memset( &shortEntry, 0, sizeof( shortEntry ) );
+	memset( shortEntry.name, ' ', sizeof( shortEntry.name ) );
+	shortEntry.location = location;
+	shortEntry.fileSize = fileSize;
+
+	return shortEntry;
+}
+
+/**
+ * Names Of
+ * Description: Joins a listing's names with commas.
+ */
+string namesOf( const DirectoryListing & listing ) {
+
+	string names;
+
+	for ( uint32_t i = 0; i < listing.size(); i++ )
+		names += ( i > 0 ? "," : "" ) + listing.name(i);
+
+	return names;
+}
+
+/**
+ * Listed Names
+ * Description: Lists a session's directory and joins the names with commas.
+ */
+string listedNames( FAT32 & fat, Session & session ) {
+
+	vector<EntryInfo> entries;
+	string names;
+
+	if ( fat.list( ".", entries, &session ) != STATUS_OK )
+		return "";
+
+	for ( uint32_t i = 0; i < entries.size(); i++ )
+		names += ( i > 0 ? "," : "" ) + entries[i].name;
+
+	return names;
+}
+
+int main() {
+
+	bool passed = true;
+
+	{
+		DirectoryListing original;
+		original.append( shortEntryFor( 0, 1 ), "one", 0, 0 );
+		original.append( shortEntryFor( 64, 3 ), "three", 2, 0 );
+
+		// A copy is the same snapshot until it changes
+		DirectoryListing copy = original;
+		passed &= expect( &copy[0] == &original[0], "copies share a snapshot" );
+
+		copy.setShortEntry( 0, shortEntryFor( 0, 1 ) );
+		passed &= expect( &copy[0] == &original[0], "setting the same entry stays shared" );
+
+		copy.insert( shortEntryFor( 32, 2 ), "two", 1, 0 );
+		passed &= expect( &copy[0] != &original[0], "a changed copy gets its own snapshot" );
+		passed &= expect( namesOf( copy ) == "one,two,three" && namesOf( original ) == "one,three", "insert only shows in the copy" );
+
+		DirectoryListing second = copy;
+		second.erase( 0 );
+		second.setShortEntry( 0, shortEntryFor( 32, 20 ) );
+		passed &= expect( namesOf( second ) == "two,three" && second[0].shortEntry.fileSize == 20, "erase and set in the second copy" );
+		passed &= expect( namesOf( copy ) == "one,two,three" && copy[1].shortEntry.fileSize == 2, "the first copy keeps its entries" );
+
+		copy.clear();
+		passed &= expect( copy.size() == 0 && original.size() == 2 && second.size() == 2, "clear only empties the copy" );
+	}
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session first, second;
+
+		passed &= expect( fat.mkdir( "shared" ) == STATUS_OK, "mkdir shared" );
+		passed &= expect( fat.changeDirectory( "shared", &first ) == STATUS_OK && fat.changeDirectory( "shared", &second ) == STATUS_OK, "cd shared twice" );
+		passed &= expect( listedNames( fat, second ) == ".,..", "second sees an empty shared" );
+
+		// Changes by one session reach the other, whose listing was shared
+		passed &= expect( fat.create( "made by first", &first ) == STATUS_OK, "first creates" );
+		passed &= expect( listedNames( fat, second ) == ".,..,made by first", "second sees first's file" );
+
+		passed &= expect( fat.mkdir( "made by second", &second ) == STATUS_OK, "second makes a directory" );
+		passed &= expect( fat.rm( "made by first", false, &second ) == STATUS_OK, "second removes first's file" );
+		passed &= expect( listedNames( fat, first ) == ".,..,made by second", "first sees second's changes" );
+
+		// Copies of a session share its directory
+		Session copy = first;
+		passed &= expect( fat.changeDirectory( "made by second", &copy ) == STATUS_OK, "cd in the copy" );
+		passed &= expect( fat.getCurrentPath( &first ) == "/shared/made by second/", "the session moves with its copy" );
+		passed &= expect( fat.getCurrentPath( &second ) == "/shared/", "the other session stays" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": listings are shared until changed\n";
+
+	return passed ? 0 : 1;
+}
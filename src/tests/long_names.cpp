@@ -0,0 +1,130 @@
+#include "image.h"
+
+#include <set>
+#include <sstream>
+
+/**
+ * Long names
+ * Description: Names as long as FAT allows take more long entries than a
+ *				one sector cluster holds, so they straddle clusters. They
+ *				have to be found, listed, walked and removed like any other,
+ *				also after a remount when the directory is read from disk.
+ */
+
+const char * IMAGE = "long_names.img";
+
+/**
+ * Names Of
+ * Description: Lists a session's directory into a set of names.
+ */
+set<string> namesOf( FAT32 & fat, Session & session ) {
+
+	vector<EntryInfo> entries;
+	set<string> names;
+
+	if ( fat.list( ".", entries, &session ) == STATUS_OK )
+		for ( const EntryInfo & entry : entries )
+			names.insert( entry.name );
+
+	return names;
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+
+	// Longest allowed, exact multiples of a long entry and a shared prefix
+	string longest( 255, 'x' ), thirteen( 13, 't' ), twentySix( 26, 'u' );
+	for ( uint32_t i = 0; i < longest.size(); i++ )
+		longest[i] = 'a' + i % 26;
+
+	set<string> expected = { ".", "..", longest, thirteen, twentySix, "dots" };
+
+	for ( uint32_t i = 0; i < 12; i++ ) {
+
+		stringstream name;
+		name << "shared prefix " << i;
+		expected.insert( name.str() );
+	}
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		passed &= expect( fat.mkdir( "n" ) == STATUS_OK && fat.changeDirectory( "n", &session ) == STATUS_OK, "cd n" );
+
+		// A name that doesn't fit the first cluster's free slots
+		passed &= expect( fat.create( "filler one", &session ) == STATUS_OK, "create filler" );
+
+		for ( const string & name : expected )
+			if ( name != "." && name != ".." )
+				passed &= expect( fat.create( name == "dots" ? "dots..." : name, &session ) == STATUS_OK, "create " + name.substr( 0, 20 ) );
+
+		passed &= expect( fat.rm( "filler one", false, &session ) == STATUS_OK, "rm filler" );
+
+		passed &= expect( fat.create( longest + "z", &session ) == STATUS_NAME_TOO_LONG, "256 characters are too many" );
+		passed &= expect( fat.mkdir( "deeper", &session ) == STATUS_OK && fat.changeDirectory( "deeper", &session ) == STATUS_OK, "cd deeper" );
+		passed &= expect( fat.create( longest, &session ) == STATUS_PATH_TOO_LONG, "paths are 260 characters at most" );
+		passed &= expect( fat.changeDirectory( "..", &session ) == STATUS_OK, "cd .. from deeper" );
+		expected.insert( "deeper" );
+		passed &= expect( fat.create( "caf\xC3\xA9", &session ) == STATUS_ILLEGAL_CHARACTER, "names are plain ASCII" );
+		passed &= expect( fat.create( "what?", &session ) == STATUS_ILLEGAL_CHARACTER, "? is refused" );
+
+		passed &= expect( namesOf( fat, session ) == expected, "every long name is listed" );
+
+		uint32_t handle;
+		EntryInfo info;
+		passed &= expect( fat.openFile( longest, WRITE, handle, &session ) == STATUS_OK, "open the longest name" );
+		passed &= expect( fat.write( longest, 0, "long", &session ) == STATUS_OK, "write the longest name" );
+		passed &= expect( fat.closeFile( longest, &session ) == STATUS_OK, "close the longest name" );
+		passed &= expect( fat.stat( longest, info, &session ) == STATUS_OK && info.name == longest && info.size == 4, "stat the longest name" );
+		passed &= expect( fat.stat( longest.substr( 0, 254 ), info, &session ) == STATUS_NOT_FOUND, "a prefix is another name" );
+
+		uint32_t found = 0;
+		FindOutput output = [&found, &longest]( const string & path ) { found += path == "/n/" + longest; };
+		passed &= expect( fat.find( "/", "abc*", output ) == STATUS_OK && found == 1, "find walks the longest name" );
+
+		passed &= expectClean( fat );
+	}
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		passed &= expect( fat.changeDirectory( "n", &session ) == STATUS_OK, "cd n after remount" );
+		passed &= expect( namesOf( fat, session ) == expected, "long names read back from disk" );
+
+		// Dropping the straddling name frees slots in both clusters
+		passed &= expect( fat.rm( longest, false, &session ) == STATUS_OK, "rm the longest name" );
+		expected.erase( longest );
+		passed &= expect( fat.create( twentySix + "v", &session ) == STATUS_OK, "reuse its slots" );
+		expected.insert( twentySix + "v" );
+		passed &= expect( namesOf( fat, session ) == expected, "listing after reusing the slots" );
+
+		passed &= expectClean( fat );
+	}
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		passed &= expect( fat.changeDirectory( "n", &session ) == STATUS_OK && namesOf( fat, session ) == expected, "reused slots read back from disk" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": long names straddling clusters are found, listed and removed\n";
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+#include "image.h"
+
+/**
+ * Next-fit allocation
+ * Description: New clusters come from where the last allocation left off,
+ *				remembered in FSInfo across mounts, so clusters freed behind
+ *				that point are only handed out again once it wraps around the
+ *				end of the image.
+ */
+
+const char * IMAGE = "next_fit.img";
+
+/**
+ * Write One
+ * Description: Creates a file holding a single byte and sets the cluster it
+ *				landed on.
+ */
+bool writeOne( FAT32 & fat, const string & name, uint32_t & cluster, Session * session ) {
+
+	uint32_t handle;
+	EntryInfo info;
+
+	bool written = fat.create( name, session ) == STATUS_OK
+				   && fat.openFile( name, WRITE, handle, session ) == STATUS_OK
+				   && fat.write( name, 0, "x", session ) == STATUS_OK
+				   && fat.closeFile( name, session ) == STATUS_OK
+				   && fat.stat( name, info, session ) == STATUS_OK;
+
+	cluster = info.firstCluster;
+
+	return expect( written, "write " + name );
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+	uint32_t a, b, c, d, e, f;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		passed &= writeOne( fat, "a", a, &session ) & writeOne( fat, "b", b, &session ) & writeOne( fat, "c", c, &session );
+		passed &= expect( b == a + 1 && c == b + 1, "clusters handed out in order" );
+
+		// b's cluster sits behind the rotor now
+		passed &= expect( fat.rm( "b", false, &session ) == STATUS_OK, "rm b" );
+		passed &= expectClean( fat );
+		passed &= writeOne( fat, "d", d, &session );
+		passed &= expect( d == c + 1, "freed cluster behind the rotor is skipped" );
+	}
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		passed &= writeOne( fat, "e", e, &session );
+		passed &= expect( e == d + 1, "rotor is kept in FSInfo across mounts" );
+
+		// Take every free cluster but b's, the next one has to wrap around to it
+		FileSystemInfo info;
+		Reservation reservation;
+		fat.fsinfo( info );
+
+		passed &= expect( fat.create( "filler", &session ) == STATUS_OK, "create filler" );
+		passed &= expect( fat.prealloc( "filler", ( info.freeSectors - 1 ) * BYTES_PER_SECTOR, true, reservation, &session ) == STATUS_OK, "fill the image" );
+		passed &= writeOne( fat, "f", f, &session );
+		passed &= expect( f == b, "allocation wraps around to the freed cluster" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": clusters are allocated next-fit from FSInfo's hint\n";
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+#include "image.h"
+
+/**
+ * prealloc with and without keep
+ * Description: Reserving space takes the clusters up front, in one run when
+ *				the image has one, and only raises the file size without
+ *				keep. Writing into the reserved space later takes nothing
+ *				more from the image.
+ */
+
+const char * IMAGE = "prealloc_keep.img";
+
+uint32_t freeSectors( FAT32 & fat ) {
+
+	FileSystemInfo info;
+	fat.fsinfo( info );
+
+	return info.freeSectors;
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		Reservation reservation;
+		uint32_t handle, bytes, before;
+
+		// keep reserves clusters but leaves the size alone
+		passed &= expect( fat.create( "kept", &session ) == STATUS_OK, "create kept" );
+		before = freeSectors( fat );
+		passed &= expect( fat.prealloc( "kept", 4 * BYTES_PER_SECTOR, true, reservation, &session ) == STATUS_OK, "prealloc kept" );
+		passed &= expect( reservation.clusters == 4 && reservation.runs == 1, "kept reserves 4 clusters in one run" );
+		passed &= expect( freeSectors( fat ) == before - 4, "kept takes 4 clusters" );
+		passed &= expect( fat.fileSize( "kept", bytes, &session ) == STATUS_OK && bytes == 0, "kept keeps its size" );
+
+		before = freeSectors( fat );
+		passed &= expect( fat.openFile( "kept", WRITE, handle, &session ) == STATUS_OK, "open kept" );
+		passed &= expect( fat.write( "kept", 0, string( 4 * BYTES_PER_SECTOR, 'k' ), &session ) == STATUS_OK, "write kept" );
+		passed &= expect( fat.closeFile( "kept", &session ) == STATUS_OK, "close kept" );
+		passed &= expect( freeSectors( fat ) == before, "writing reserved space allocates nothing" );
+		passed &= expect( fat.fileSize( "kept", bytes, &session ) == STATUS_OK && bytes == 4 * BYTES_PER_SECTOR, "write raises kept's size" );
+
+		// Without keep the size covers the reservation, which reads as zeros
+		uint32_t length = 3 * BYTES_PER_SECTOR + 10;
+		passed &= expect( fat.create( "sized", &session ) == STATUS_OK, "create sized" );
+		before = freeSectors( fat );
+		passed &= expect( fat.prealloc( "sized", length, false, reservation, &session ) == STATUS_OK, "prealloc sized" );
+		passed &= expect( reservation.clusters == 4 && reservation.runs == 1, "sized reserves 4 clusters in one run" );
+		passed &= expect( freeSectors( fat ) == before - 4, "sized takes 4 clusters" );
+		passed &= expect( fat.fileSize( "sized", bytes, &session ) == STATUS_OK && bytes == length, "sized takes the requested size" );
+
+		string contents;
+		ReadOutput output = [&contents]( const uint8_t * data, uint32_t count ) { contents.append( reinterpret_cast<const char *>( data ), count ); };
+
+		passed &= expect( fat.openFile( "sized", READ, handle, &session ) == STATUS_OK, "open sized" );
+		passed &= expect( fat.read( "sized", 0, length, output, &session ) == STATUS_OK, "read sized" );
+		passed &= expect( contents == string( length, '\0' ), "sized reads as zeros" );
+		passed &= expect( fat.closeFile( "sized", &session ) == STATUS_OK, "close sized" );
+
+		// Asking for less than is already there changes nothing
+		before = freeSectors( fat );
+		passed &= expect( fat.prealloc( "sized", BYTES_PER_SECTOR, false, reservation, &session ) == STATUS_OK, "prealloc sized smaller" );
+		passed &= expect( reservation.clusters == 0 && freeSectors( fat ) == before, "smaller prealloc reserves nothing" );
+		passed &= expect( fat.fileSize( "sized", bytes, &session ) == STATUS_OK && bytes == length, "smaller prealloc keeps the size" );
+
+		passed &= expect( fat.prealloc( "sized", ( before + 5 ) * BYTES_PER_SECTOR, false, reservation, &session ) == STATUS_NO_SPACE, "prealloc past the free space fails" );
+		passed &= expect( freeSectors( fat ) == before, "failed prealloc takes nothing" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": prealloc reserves clusters and only sizes the file without keep\n";
+
+	return passed ? 0 : 1;
+}
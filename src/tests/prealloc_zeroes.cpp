@@ -0,0 +1,65 @@
+#include "image.h"
+
+/**
+ * prealloc over a reused cluster
+ * Description: Grows a file's size with prealloc while its last cluster
+ *				used to hold a deleted file. Everything past what was written
+ *				has to read back as zeros, not the deleted file's data.
+ */
+
+const char * IMAGE = "prealloc_zeroes.img";
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		uint32_t handle;
+		passed &= expect( fat.create( "old", &session ) == STATUS_OK, "create old" );
+		passed &= expect( fat.openFile( "old", WRITE, handle, &session ) == STATUS_OK, "open old" );
+		passed &= expect( fat.write( "old", 0, string( BYTES_PER_SECTOR, 'x' ), &session ) == STATUS_OK, "write old" );
+		passed &= expect( fat.closeFile( "old", &session ) == STATUS_OK, "close old" );
+		passed &= expect( fat.rm( "old", false, &session ) == STATUS_OK, "rm old" );
+
+		// Once the delete is done, fill everything but one cluster so the
+		// next allocation wraps around onto the one old gave back
+		passed &= expectClean( fat );
+
+		FileSystemInfo info;
+		fat.fsinfo( info );
+
+		Reservation reservation;
+		passed &= expect( fat.create( "filler", &session ) == STATUS_OK, "create filler" );
+		passed &= expect( fat.prealloc( "filler", ( info.freeSectors - 1 ) * BYTES_PER_SECTOR, true, reservation, &session ) == STATUS_OK, "fill the image" );
+
+		passed &= expect( fat.create( "new", &session ) == STATUS_OK, "create new" );
+		passed &= expect( fat.openFile( "new", READWRITE, handle, &session ) == STATUS_OK, "open new" );
+		passed &= expect( fat.write( "new", 0, "abc", &session ) == STATUS_OK, "write new" );
+		passed &= expect( fat.prealloc( "new", BYTES_PER_SECTOR, false, reservation, &session ) == STATUS_OK, "prealloc new" );
+
+		string contents;
+		ReadOutput output = [&contents]( const uint8_t * data, uint32_t length ) { contents.append( reinterpret_cast<const char *>( data ), length ); };
+
+		passed &= expect( fat.read( "new", 0, BYTES_PER_SECTOR, output, &session ) == STATUS_OK, "read new" );
+		passed &= expect( contents == "abc" + string( BYTES_PER_SECTOR - 3, '\0' ), "prealloc exposes only zeros" );
+		passed &= expect( fat.closeFile( "new", &session ) == STATUS_OK, "close new" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": prealloc never exposes a reused cluster's old data\n";
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+#include "image.h"
+
+/**
+ * read output
+ * Description: Reads hand file data out in whole blocks rather than a byte
+ *				at a time, exactly as stored (NULs and newlines included, as
+ *				read raw prints them), from any start pos up to the end of
+ *				the file.
+ */
+
+const char * IMAGE = "read_output.img";
+const uint32_t FILE_BYTES = 3 * BYTES_PER_SECTOR + 100;
+
+/**
+ * Read All
+ * Description: Reads numBytes from startPos, collecting the output and how
+ *				many pieces it came in.
+ */
+Status readAll( FAT32 & fat, uint32_t startPos, uint32_t numBytes, string & contents, uint32_t & pieces, Session * session ) {
+
+	contents.clear();
+	pieces = 0;
+
+	ReadOutput output = [&contents, &pieces]( const uint8_t * data, uint32_t length ) {
+
+		contents.append( reinterpret_cast<const char *>( data ), length );
+		pieces++;
+	};
+
+	return fat.read( "data", startPos, numBytes, output, session );
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		string data( FILE_BYTES, '\0' );
+		for ( uint32_t i = 0; i < FILE_BYTES; i++ )
+			data[i] = static_cast<char>( i % 251 );
+
+		uint32_t handle, pieces;
+		string contents;
+
+		passed &= expect( fat.create( "data", &session ) == STATUS_OK, "create data" );
+		passed &= expect( fat.openFile( "data", READWRITE, handle, &session ) == STATUS_OK, "open data" );
+		passed &= expect( fat.write( "data", 0, data, &session ) == STATUS_OK, "write data" );
+
+		passed &= expect( readAll( fat, 0, FILE_BYTES, contents, pieces, &session ) == STATUS_OK && contents == data, "read everything back" );
+		passed &= expect( pieces <= FILE_BYTES / BYTES_PER_SECTOR + 1, "read comes out in blocks" );
+
+		// Across cluster boundaries from the middle of one
+		passed &= expect( readAll( fat, 300, 1000, contents, pieces, &session ) == STATUS_OK && contents == data.substr( 300, 1000 ), "read from a start pos" );
+
+		// Past the end stops at the end
+		passed &= expect( readAll( fat, FILE_BYTES - 10, 100, contents, pieces, &session ) == STATUS_OK && contents == data.substr( FILE_BYTES - 10 ), "read stops at the end" );
+		passed &= expect( readAll( fat, FILE_BYTES, 1, contents, pieces, &session ) == STATUS_OUT_OF_RANGE && contents.empty(), "start pos past the end" );
+
+		passed &= expect( fat.closeFile( "data", &session ) == STATUS_OK, "close data" );
+		passed &= expect( readAll( fat, 0, 1, contents, pieces, &session ) == STATUS_NOT_OPEN, "read needs the file open" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": read hands out exactly the bytes asked for, in blocks\n";
+
+	return passed ? 0 : 1;
+}
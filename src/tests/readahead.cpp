@@ -0,0 +1,116 @@
+#include "image.h"
+
+#include <chrono>
+#include <thread>
+
+/**
+ * Readahead
+ * Description: Reads picking up where the last one stopped have the
+ *				clusters ahead of them loaded in the background, so a cold
+ *				sequential pass over a file misses far less than once per
+ *				cluster. Reads jumping around load nothing ahead and miss on
+ *				every cluster. Both hand back the right data.
+ */
+
+const char * IMAGE = "readahead.img";
+const uint32_t TOTAL_SECTORS = 16384,
+			   FILE_BYTES = 1 << 20,
+			   PIECE = 4096,
+			   PIECES = FILE_BYTES / PIECE,
+			   STRIDE = 97;
+
+uint64_t cacheMisses( FAT32 & fat ) {
+
+	FileSystemInfo info;
+	fat.fsinfo( info );
+
+	return info.cacheMisses;
+}
+
+/**
+ * Read Pieces
+ * Description: Reads a file a piece at a time in the given order, giving
+ *				readahead a moment after each piece, and collects the data.
+ */
+bool readPieces( FAT32 & fat, const string & name, const vector<uint32_t> & order, string & contents, Session & session ) {
+
+	uint32_t handle;
+	bool read = fat.openFile( name, READ, handle, &session ) == STATUS_OK;
+
+	contents.assign( FILE_BYTES, '\0' );
+
+	for ( uint32_t i = 0; i < order.size() && read; i++ ) {
+
+		uint32_t at = order[i] * PIECE;
+		ReadOutput output = [&contents, &at]( const uint8_t * data, uint32_t length ) { contents.replace( at, length, reinterpret_cast<const char *>( data ), length ); at += length; };
+
+		read = fat.read( name, order[i] * PIECE, PIECE, output, &session ) == STATUS_OK;
+		this_thread::sleep_for( chrono::milliseconds( 1 ) );
+	}
+
+	return read && fat.closeFile( name, &session ) == STATUS_OK;
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE, TOTAL_SECTORS ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+	string data( FILE_BYTES, '\0' );
+
+	for ( uint32_t i = 0; i < FILE_BYTES; i++ )
+		data[i] = static_cast<char>( ( i * 31 ) ^ ( i >> 9 ) );
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		for ( const char * name : { "sequential", "jumping" } ) {
+
+			uint32_t handle;
+			passed &= expect( fat.create( name, &session ) == STATUS_OK
+							  && fat.openFile( name, WRITE, handle, &session ) == STATUS_OK
+							  && fat.write( name, 0, data, &session ) == STATUS_OK
+							  && fat.closeFile( name, &session ) == STATUS_OK, "write " + string( name ) );
+		}
+	}
+
+	{
+		// Cold cache
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		uint32_t clusters = FILE_BYTES / BYTES_PER_SECTOR;
+		vector<uint32_t> order( PIECES );
+		string contents;
+
+		for ( uint32_t i = 0; i < PIECES; i++ )
+			order[i] = i;
+
+		uint64_t misses = cacheMisses( fat );
+		passed &= expect( readPieces( fat, "sequential", order, contents, session ) && contents == data, "read sequential" );
+		passed &= expect( cacheMisses( fat ) - misses < clusters / 4, "sequential reads are mostly read ahead" );
+
+		// Never two neighbouring pieces in a row
+		for ( uint32_t i = 0; i < PIECES; i++ )
+			order[i] = ( ( i + 1 ) * STRIDE ) % PIECES;
+
+		misses = cacheMisses( fat );
+		passed &= expect( readPieces( fat, "jumping", order, contents, session ) && contents == data, "read jumping" );
+		passed &= expect( cacheMisses( fat ) - misses >= clusters * 9 / 10, "jumping reads load nothing ahead" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": sequential reads are read ahead, jumping ones are not\n";
+
+	return passed ? 0 : 1;
+}
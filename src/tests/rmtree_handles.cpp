@@ -0,0 +1,72 @@
+#include "image.h"
+
+#include <sstream>
+
+/**
+ * rm -r while a file is open
+ * Description: Removes a directory spanning several clusters while a file
+ *				whose entry sits in a later cluster is open. The handle has to
+ *				go with the tree, writing through it afterwards would land on
+ *				clusters the directory gave back.
+ */
+
+const char * IMAGE = "rmtree_handles.img";
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+
+		vector<Status> results;
+		vector<string> names;
+
+		// Every name takes a long and a short entry, 16 entries fit a cluster
+		for ( uint32_t i = 0; i < 24; i++ ) {
+
+			stringstream name;
+			name << "file" << i;
+			names.push_back( name.str() );
+		}
+
+		passed &= expect( fat.mkdir( "tree", &session ) == STATUS_OK, "mkdir tree" );
+		passed &= expect( fat.changeDirectory( "tree", &session ) == STATUS_OK, "cd tree" );
+		passed &= expect( fat.create( names, results, &session ) == STATUS_OK, "create files" );
+
+		uint32_t handle;
+		passed &= expect( fat.openFile( names.back(), WRITE, handle, &session ) == STATUS_OK, "open last file" );
+		passed &= expect( fat.write( names.back(), 0, string( 2048, 'a' ), &session ) == STATUS_OK, "write last file" );
+
+		passed &= expect( fat.changeDirectory( "..", &session ) == STATUS_OK, "cd .." );
+		passed &= expect( fat.rmTree( "tree", &session ) == STATUS_OK, "rm -r tree" );
+
+		// Something else takes the freed clusters
+		passed &= expect( fat.create( "other", &session ) == STATUS_OK, "create other" );
+
+		uint32_t otherHandle;
+		passed &= expect( fat.openFile( "other", WRITE, otherHandle, &session ) == STATUS_OK, "open other" );
+		passed &= expect( fat.write( "other", 0, string( 8192, 'b' ), &session ) == STATUS_OK, "write other" );
+		passed &= expect( fat.closeFile( "other", &session ) == STATUS_OK, "close other" );
+
+		stringstream stale;
+		stale << "#" << handle;
+		passed &= expect( fat.write( stale.str(), 0, string( 2048, 'c' ), &session ) != STATUS_OK, "stale handle refused after rm -r" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": rm -r closes handles in every cluster of the tree\n";
+
+	return passed ? 0 : 1;
+}
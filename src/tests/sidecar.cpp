@@ -0,0 +1,158 @@
+#include "image.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Mount sidecar
+ * Description: A sidecar is only trusted against the exact image it was
+ *				written for. The FAT is changed behind its back with the
+ *				image's modification time kept, so the free count at mount
+ *				tells whether the sidecar was used or the FAT was scanned.
+ */
+
+const char * IMAGE = "sidecar.img";
+const string SIDECAR = string( IMAGE ) + ".sidecar";
+
+const uint32_t FAT_SIZE = ( 8192 * 4 + BYTES_PER_SECTOR - 1 ) / BYTES_PER_SECTOR + 1,
+			   TAKEN_CLUSTER = 1000;
+
+/**
+ * Poke
+ * Description: Overwrites bytes of a file at the given offset, keeping its
+ *				modification time unless asked not to.
+ */
+bool poke( const string & path, uint64_t offset, const void * bytes, uint32_t length, bool keepTime = true ) {
+
+	struct stat before;
+
+	if ( stat( path.c_str(), &before ) != 0 )
+		return false;
+
+	FILE * file = fopen( path.c_str(), "r+b" );
+
+	if ( file == NULL )
+		return false;
+
+	bool written = fseek( file, offset, SEEK_SET ) == 0 && fwrite( bytes, 1, length, file ) == length;
+	written &= fclose( file ) == 0;
+
+	struct timespec times[2] = { before.st_atim, before.st_mtim };
+
+	return written && ( !keepTime || utimensat( AT_FDCWD, path.c_str(), times, 0 ) == 0 );
+}
+
+/**
+ * Take Cluster
+ * Description: Marks a cluster used in every FAT without telling FSInfo.
+ */
+bool takeCluster( uint32_t cluster, bool keepTime = true ) {
+
+	uint32_t value = 0x0FFFFFFF;
+	bool written = true;
+
+	for ( uint32_t i = 0; i < NUM_FATS; i++ )
+		written &= poke( IMAGE, static_cast<uint64_t>( RESERVED_SECTORS + i * FAT_SIZE ) * BYTES_PER_SECTOR + cluster * 4, &value, 4, keepTime );
+
+	return written;
+}
+
+/**
+ * Mounted Free
+ * Description: Mounts the image with the sidecar and returns its free count.
+ */
+uint32_t mountedFree() {
+
+	fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+	FAT32 fat( fatImage, IMAGE, SIDECAR );
+
+	FileSystemInfo info;
+	fat.fsinfo( info );
+
+	return info.freeSectors;
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	remove( SIDECAR.c_str() );
+
+	bool passed = true;
+	uint32_t written = 0;
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE, SIDECAR );
+		Session session;
+
+		uint32_t handle;
+		passed &= expect( fat.create( "f", &session ) == STATUS_OK, "create f" );
+		passed &= expect( fat.openFile( "f", WRITE, handle, &session ) == STATUS_OK, "open f" );
+		passed &= expect( fat.write( "f", 0, string( 1000, 'f' ), &session ) == STATUS_OK, "write f" );
+		passed &= expect( fat.closeFile( "f", &session ) == STATUS_OK, "close f" );
+
+		FileSystemInfo info;
+		fat.fsinfo( info );
+		written = info.freeSectors;
+	}
+
+	struct stat sidecarInfo;
+	passed &= expect( stat( SIDECAR.c_str(), &sidecarInfo ) == 0, "unmount writes the sidecar" );
+
+	// Matching image, the sidecar's count wins over the changed FAT
+	passed &= expect( takeCluster( TAKEN_CLUSTER ), "take a cluster" );
+	passed &= expect( mountedFree() == written, "matching sidecar is used" );
+
+	// Nothing changed on that mount, so the sidecar was left alone
+	struct stat after;
+	passed &= expect( stat( SIDECAR.c_str(), &after ) == 0 && after.st_mtim.tv_sec == sidecarInfo.st_mtim.tv_sec
+					  && after.st_mtim.tv_nsec == sidecarInfo.st_mtim.tv_nsec, "unchanged mount keeps the sidecar" );
+	passed &= expect( mountedFree() == written, "sidecar still holds after an unchanged mount" );
+
+	// A newer image is scanned, and the new count is saved for next time
+	passed &= expect( takeCluster( TAKEN_CLUSTER + 1, false ), "take a cluster and touch the image" );
+	passed &= expect( mountedFree() == written - 2, "changed modification time rejects the sidecar" );
+	passed &= expect( mountedFree() == written - 2, "rewritten sidecar is used" );
+
+	// Same modification time but a different FSInfo
+	uint32_t nextFree = 4000;
+	passed &= expect( takeCluster( TAKEN_CLUSTER + 2 ) && poke( IMAGE, BYTES_PER_SECTOR + 492, &nextFree, 4 ), "change FSInfo" );
+	passed &= expect( mountedFree() == written - 3, "changed FSInfo rejects the sidecar" );
+
+	// A sidecar cut short
+	uint8_t garbage[4] = { 0 };
+	passed &= expect( truncate( SIDECAR.c_str(), 20 ) == 0 && poke( SIDECAR, 0, garbage, sizeof( garbage ) ), "damage the sidecar" );
+	passed &= expect( takeCluster( TAKEN_CLUSTER + 3 ), "take another cluster" );
+	passed &= expect( mountedFree() == written - 4, "damaged sidecar is rejected" );
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE, SIDECAR );
+
+		CheckReport report;
+		passed &= expect( fat.check( true, report ) == STATUS_OK && report.repaired, "repair the taken clusters" );
+		passed &= expectClean( fat );
+	}
+
+	// The generation lives in the sidecar only, FSInfo's reserved bytes stay zero
+	uint8_t fsInfo[ BYTES_PER_SECTOR ], zeros[ 480 ] = { 0 };
+	FILE * image = fopen( IMAGE, "rb" );
+	passed &= expect( image != NULL && fseek( image, BYTES_PER_SECTOR, SEEK_SET ) == 0 && fread( fsInfo, 1, sizeof( fsInfo ), image ) == sizeof( fsInfo ), "read FSInfo" );
+	passed &= expect( memcmp( fsInfo + 4, zeros, sizeof( zeros ) ) == 0 && memcmp( fsInfo + 496, zeros, 12 ) == 0, "FSInfo reserved bytes stay zero" );
+
+	if ( image != NULL )
+		fclose( image );
+
+	remove( IMAGE );
+	remove( SIDECAR.c_str() );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": sidecars are only trusted against the image they were written for\n";
+
+	return passed ? 0 : 1;
+}
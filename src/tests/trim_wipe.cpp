@@ -0,0 +1,134 @@
+#include "image.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Trim and safe rm
+ * Description: With trim on, rm gives the host back the storage behind a
+ *				freed chain, with it off the image keeps it. srm leaves none
+ *				of the file's data anywhere in the image. Hosts that can't
+ *				punch holes only have the wipe checked.
+ */
+
+const char * IMAGE = "trim_wipe.img";
+const uint32_t TOTAL_SECTORS = 16384,
+			   FILE_CLUSTERS = 4096;
+
+/**
+ * Allocated Bytes
+ * Description: Returns how much host storage the image takes.
+ */
+uint64_t allocatedBytes() {
+
+	struct stat info;
+
+	return stat( IMAGE, &info ) == 0 ? static_cast<uint64_t>( info.st_blocks ) * 512 : 0;
+}
+
+/**
+ * Can Punch
+ * Description: Checks whether the host punches holes in files next to the image.
+ */
+bool canPunch() {
+
+	const char * probe = "trim_wipe.probe";
+	int descriptor = open( probe, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+	vector<char> data( 1 << 16, 'p' );
+
+	bool punched = descriptor >= 0 && write( descriptor, &data[0], data.size() ) == static_cast<ssize_t>( data.size() )
+				   && fsync( descriptor ) == 0 && fallocate( descriptor, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, data.size() ) == 0;
+
+	if ( descriptor >= 0 )
+		close( descriptor );
+
+	remove( probe );
+
+	return punched;
+}
+
+/**
+ * Write File
+ * Description: Creates a file of FILE_CLUSTERS clusters of one byte.
+ */
+bool writeFile( FAT32 & fat, const string & name, char fill, Session & session ) {
+
+	uint32_t handle;
+
+	return expect( fat.create( name, &session ) == STATUS_OK
+				   && fat.openFile( name, WRITE, handle, &session ) == STATUS_OK
+				   && fat.write( name, 0, string( FILE_CLUSTERS * BYTES_PER_SECTOR, fill ), &session ) == STATUS_OK
+				   && fat.closeFile( name, &session ) == STATUS_OK, "write " + name );
+}
+
+bool imageHolds( const string & run ) {
+
+	ifstream image( IMAGE, ios::in | ios::binary );
+	string contents( ( istreambuf_iterator<char>( image ) ), istreambuf_iterator<char>() );
+
+	return search( contents.begin(), contents.end(), run.begin(), run.end() ) != contents.end();
+}
+
+int main() {
+
+	if ( !formatImage( IMAGE, TOTAL_SECTORS ) ) {
+
+		cout << "FAIL: could not write " << IMAGE << "\n";
+		return 1;
+	}
+
+	bool passed = true, punching = canPunch();
+	string kept( 64, 'K' ), trimmed( 64, 'T' ), secret( 64, 'S' );
+
+	if ( !punching )
+		cout << "The host can't punch holes, only the wipe is checked\n";
+
+	{
+		fstream fatImage( IMAGE, ios::in | ios::out | ios::binary );
+		FAT32 fat( fatImage, IMAGE );
+		Session session;
+		CheckReport report;
+
+		passed &= writeFile( fat, "kept", 'K', session ) & writeFile( fat, "trimmed", 'T', session ) & writeFile( fat, "secret", 'S', session );
+
+		// Without trim the storage stays, check waits for the delete
+		uint64_t before = allocatedBytes();
+		fat.trim( false );
+		passed &= expect( fat.rm( "kept", false, &session ) == STATUS_OK && fat.check( false, report ) == STATUS_OK, "rm kept" );
+		passed &= expect( allocatedBytes() >= before, "rm without trim keeps the storage" );
+		passed &= expect( imageHolds( kept ), "rm without trim leaves the data" );
+
+		before = allocatedBytes();
+		fat.trim( true );
+		passed &= expect( fat.rm( "trimmed", false, &session ) == STATUS_OK && fat.check( false, report ) == STATUS_OK, "rm trimmed" );
+
+		if ( punching ) {
+
+			passed &= expect( allocatedBytes() + ( FILE_CLUSTERS / 2 ) * BYTES_PER_SECTOR <= before, "rm with trim gives the storage back" );
+			passed &= expect( !imageHolds( trimmed ), "trimmed clusters read as zeros" );
+		}
+
+		passed &= expect( fat.rm( "secret", true, &session ) == STATUS_OK && fat.check( false, report ) == STATUS_OK, "srm secret" );
+		passed &= expect( fat.sync() == STATUS_OK, "sync" );
+		passed &= expect( !imageHolds( secret ), "srm wipes every cluster" );
+
+		// The freed clusters still read as zeros once they are used again
+		FileSystemInfo info;
+		Reservation reservation;
+		fat.fsinfo( info );
+		passed &= expect( fat.create( "again", &session ) == STATUS_OK, "create again" );
+		passed &= expect( fat.prealloc( "again", info.freeSectors * BYTES_PER_SECTOR, false, reservation, &session ) == STATUS_OK, "take every free cluster" );
+		passed &= expect( !imageHolds( kept ) && !imageHolds( trimmed ) && !imageHolds( secret ), "reused clusters hold no old data" );
+
+		passed &= expectClean( fat );
+	}
+
+	remove( IMAGE );
+
+	cout << ( passed ? "PASS" : "FAIL" ) << ": trim gives storage back and srm leaves no data behind\n";
+
+	return passed ? 0 : 1;
+}
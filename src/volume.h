@@ -0,0 +1,907 @@
+#pragma once
+
+#include "fat32.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <iomanip>
+
+// io_uring only needs the kernel's header, without it every batch goes
+// through plain positional I/O
+#if defined( __linux__ ) && __has_include( <linux/io_uring.h> )
+	#include <linux/io_uring.h>
+	#include <sys/syscall.h>
+	#define HAVE_IO_URING 1
+#endif
+
+using namespace std;
+
+namespace FAT_FS {
+
+// FAT Markers/Constants
+const uint8_t ATTR_READ_ONLY = 0x01,
+			  ATTR_HIDDEN = 0x02,
+			  ATTR_SYSTEM = 0x04,
+			  ATTR_VOLUME_ID = 0x08,
+			  ATTR_DIRECTORY = 0x10,
+			  ATTR_ARCHIVE = 0x20,
+			  ATTR_LONG_NAME = ATTR_READ_ONLY | ATTR_HIDDEN | ATTR_SYSTEM | ATTR_VOLUME_ID,
+			  ATTR_LONG_NAME_MASK = ATTR_READ_ONLY | ATTR_HIDDEN | ATTR_SYSTEM | ATTR_VOLUME_ID | ATTR_DIRECTORY | ATTR_ARCHIVE,
+			  LAST_LONG_ENTRY = 0x40,
+			  SHORT_NAME_SPACE_PAD = 0x20,
+			  DIR_FREE_ENTRY = 0xE5,
+			  DIR_LAST_FREE_ENTRY = 0x00,
+			  LONG_NAME_LENGTH = 0x0D,
+			  LONG_ENTRY_MAX = 0x14;
+
+const uint16_t LONG_NAME_TRAIL = 0xFFFF,
+			   LONG_NAME_NULL = 0x0000;
+
+const uint32_t FAT_ENTRY_SIZE = 0x04,
+			   FAT_ENTRY_MASK = 0x0FFFFFFF,
+			   FREE_CLUSTER = 0x00000000,
+			   EOC = 0x0FFFFFF8,
+			   DIR_ENTRY_SIZE = 0x20,
+			   DIR_Attr = 0x0B,
+			   DIR_Name_LENGTH = 0x0B,
+			   DIR_MAX_SIZE = 0x200000,
+			   FILE_MAX_SIZE = 0xFFFFFFFF,
+			   READ_BUFFER_SIZE = 0x100000,
+			   WRITE_BUFFER_SIZE = 0x100000,
+			   WRITE_BUFFER_SECONDS = 0x05,
+			   RECLAIM_SLICE = 0x1000,
+			   SIDECAR_VERSION = 0x03,
+			   READAHEAD_MIN = 0x20000,
+			   READAHEAD_MAX = 0x800000,
+			   BLOCK_CACHE_SIZE = 0x4000000,
+			   IO_QUEUE_DEPTH = 0x40,
+			   IO_WORKERS_MAX = 0x100;
+
+/**
+ * FAT Data Structures
+ */
+
+typedef struct BIOSParameterBlock {
+
+	uint8_t jmpBoot[3];
+	uint8_t OEMName[8];
+	uint16_t bytesPerSector;
+	uint8_t sectorsPerCluster;
+	uint16_t reservedSectorCount;
+	uint8_t numFATs;
+	uint16_t rootEntryCount;
+	uint16_t totalSectors16;
+	uint8_t media;
+	uint16_t FATSz16;
+	uint16_t sectorsPerTrack;
+	uint16_t numHeads;
+	uint32_t hiddenSectors;
+	uint32_t totalSectors32;
+	uint32_t FATSz32;
+	uint16_t extraFlags;
+	uint16_t FSVersion;
+	uint32_t rootCluster;
+	uint16_t FSInfo;
+	uint16_t backupBootSector;
+	uint8_t reserved[12];
+	uint8_t driveNumber;
+	uint8_t reserved1;
+	uint8_t bootSignature;
+	uint32_t volumeID;
+	uint8_t volumeLabel[11];
+	uint8_t fileSystemType[8];
+
+} __attribute__((packed)) BIOSParameterBlock;
+
+typedef struct FSInfo {
+
+	uint32_t leadSignature;
+	uint32_t reserved1[120];
+	uint32_t structSignature;
+	uint32_t freeCount;
+	uint32_t nextFree;
+	uint32_t reserved2[3];
+	uint32_t trailingSignature;
+
+} __attribute__((packed)) FSInfo;
+
+typedef struct SidecarHeader {
+
+	uint8_t magic[8];
+	uint32_t version;
+	uint32_t countOfClusters;
+
+	// Image state the sidecar was written against, the checksum covers the
+	// boot sector and FSInfo as they were on disk
+	uint64_t imageSize;
+	int64_t modifiedSeconds;
+	int64_t modifiedNanoseconds;
+	uint64_t checksum;
+
+	// Sidecars written for this image so far
+	uint32_t generation;
+
+	// The real count and hint, FSInfo's own may be stale and need a scan
+	uint32_t freeCount;
+	uint32_t nextFree;
+	uint32_t directoryCount;
+
+} __attribute__((packed)) SidecarHeader;
+
+typedef struct ShortDirectoryEntry {
+
+	uint8_t name[11];
+	uint8_t attributes;
+	uint8_t NTReserved;
+	uint8_t createdTimeTenth;
+	uint16_t createdTime;
+	uint16_t createdDate;
+	uint16_t lastAccessDate;
+	uint16_t firstClusterHI;
+	uint16_t writeTime;
+	uint16_t writeDate;
+	uint16_t firstClusterLO;
+	uint32_t fileSize;
+	uint32_t location;
+
+} __attribute__((packed)) ShortDirectoryEntry;
+
+typedef struct LongDirectoryEntry {
+
+	uint8_t ordinal;
+	uint16_t name1[5];
+	uint8_t attributes;
+	uint8_t type;
+	uint8_t checksum;
+	uint16_t name2[6];
+	uint16_t firstClusterLO;
+	uint16_t name3[2];
+	uint32_t location;
+
+} __attribute__((packed)) LongDirectoryEntry;
+
+typedef struct DirectoryEntry {
+
+	string name;
+	ShortDirectoryEntry shortEntry;
+	deque<LongDirectoryEntry> longEntries;
+
+} DirectoryEntry;
+
+typedef struct DirectoryRecord {
+
+	ShortDirectoryEntry shortEntry;
+	uint32_t nameOffset;
+	uint32_t firstSlot;
+	uint16_t nameLength;
+	uint8_t longEntryCount;
+
+} DirectoryRecord;
+
+typedef struct DirectoryListingData {
+
+	string names;
+	vector<DirectoryRecord> records;
+	vector<uint32_t> clusterChain;
+
+} DirectoryListingData;
+
+/**
+ * Directory Listing
+ * Description: Entries of one directory. Names live back to back in a
+ *				single arena and each record points into it, long entries
+ *				are only kept as the slot range they occupy on disk.
+ *				Copies share one reference counted snapshot, a listing only
+ *				clones it the first time it is changed while shared.
+ */
+class DirectoryListing {
+
+private:
+
+	shared_ptr<DirectoryListingData> snapshot;
+
+	void detach();
+
+public:
+
+	DirectoryListing();
+
+	void append( const ShortDirectoryEntry & shortEntry, const string & name, uint32_t firstSlot, uint8_t longEntryCount );
+	void clear();
+	void erase( uint32_t index );
+	uint32_t insert( const ShortDirectoryEntry & shortEntry, const string & name, uint32_t firstSlot, uint8_t longEntryCount );
+	const vector<uint32_t> & getClusterChain() const;
+	const string name( uint32_t index ) const;
+	bool nameEquals( uint32_t index, const string & name ) const;
+	void setClusterChain( const vector<uint32_t> & clusterChain );
+	void setShortEntry( uint32_t index, const ShortDirectoryEntry & shortEntry );
+	uint32_t size() const;
+
+	const DirectoryRecord & operator[]( uint32_t index ) const;
+
+};
+
+typedef struct IORequest {
+
+	uint64_t offset;
+	uint8_t * buffer;
+	uint64_t length;
+	bool write;
+
+	// Bytes transferred, or a negative errno
+	int64_t result;
+
+} IORequest;
+
+/**
+ * I/O Engine
+ * Description: Runs batches of positional reads and writes against the
+ *				image. Every request of a batch is complete by the time
+ *				submit returns. create picks io_uring when the host has it
+ *				and plain positional I/O otherwise.
+ */
+class IOEngine {
+
+public:
+
+	virtual ~IOEngine();
+
+	static IOEngine * create( int descriptor );
+
+	virtual const char * name() const = 0;
+	virtual void submit( vector<IORequest> & requests ) = 0;
+
+};
+
+/**
+ * Sync Engine
+ * Description: One pread or pwrite after another.
+ */
+class SyncEngine : public IOEngine {
+
+private:
+
+	int descriptor;
+
+public:
+
+	SyncEngine( int descriptor );
+
+	static void complete( int descriptor, IORequest & request );
+
+	const char * name() const;
+	void submit( vector<IORequest> & requests );
+
+};
+
+#ifdef HAVE_IO_URING
+
+/**
+ * Uring Engine
+ * Description: Queues every request of a batch on an io_uring submission
+ *				queue, IO_QUEUE_DEPTH at a time, with one system call that
+ *				also waits for all of them, then reaps the completions
+ *				together. Only one batch owns the ring at a time, others and
+ *				lone requests go through positional I/O on their own thread
+ *				instead of queueing behind it.
+ */
+class UringEngine : public IOEngine {
+
+private:
+
+	int descriptor,
+		ring;
+	bool working;
+	mutex lock;
+
+	// Shared ring memory
+	void * submissionRing,
+		 * completionRing;
+	size_t submissionRingSize,
+		   completionRingSize;
+	io_uring_sqe * entries;
+	size_t entriesSize;
+	uint32_t * submissionHead,
+			 * submissionTail,
+			 * submissionMask,
+			 * submissionArray,
+			 * completionHead,
+			 * completionTail,
+			 * completionMask;
+	io_uring_cqe * completions;
+
+public:
+
+	UringEngine( int descriptor );
+	~UringEngine();
+
+	bool isReady() const;
+	const char * name() const;
+	void submit( vector<IORequest> & requests );
+
+};
+
+#endif
+
+typedef struct CacheBlock {
+
+	bool dirty;
+	bool frequent;
+	list<uint64_t>::iterator position;
+	vector<uint8_t> data;
+
+} CacheBlock;
+
+typedef struct CacheMiss {
+
+	// Run of missing blocks, read whole and copied out afterwards
+	uint64_t block;
+	uint64_t count;
+	uint64_t within;
+	uint8_t * destination;
+	uint64_t length;
+	vector<uint8_t> data;
+
+} CacheMiss;
+
+typedef struct CacheStatistics {
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t writeBacks;
+	uint32_t blocks;
+	uint32_t dirtyBlocks;
+	string engine;
+
+} CacheStatistics;
+
+/**
+ * Block Cache
+ * Description: Cluster sized blocks of the data region kept in memory under
+ *				2Q replacement. Blocks enter a FIFO of recent blocks, and only
+ *				blocks asked for again after falling out of it move into the
+ *				LRU of frequent ones, so a long file scan never pushes hot
+ *				directories out. Writes to cached blocks stay in memory until
+ *				flushed, writes to anything else go straight to the image.
+ *				Offsets in front of the data region pass straight through.
+ *				Reads and writes of the image go out as batches handed to an
+ *				I/O engine. Safe to use from several threads.
+ */
+class BlockCache {
+
+private:
+
+	int descriptor;
+	IOEngine * engine;
+	uint64_t dataOffset;
+	uint32_t blockSize;
+	uint32_t capacity,
+			 recentCapacity;
+
+	// Everything below is guarded by lock
+	mutex lock;
+	map<uint64_t, CacheBlock> blocks;
+	list<uint64_t> recentQueue,
+				   frequentQueue,
+				   ghostQueue;
+	map<uint64_t, list<uint64_t>::iterator> ghosts;
+	set<uint64_t> dirtyBlocks;
+
+	// Bumped around every write that goes around the cache, a miss only
+	// keeps what it read if nothing was written meanwhile
+	uint64_t sequence;
+	uint32_t writesInFlight;
+
+	uint64_t hits,
+			 misses,
+			 writeBacks;
+
+	bool bypass( unique_lock<mutex> & guard, uint64_t offset, uint64_t length, int mode );
+	bool evict();
+	void insert( uint64_t block, const uint8_t * data );
+	CacheBlock * lookup( uint64_t block );
+	void remove( uint64_t block );
+
+public:
+
+	BlockCache();
+	~BlockCache();
+
+	void configure( int descriptor, uint64_t dataOffset, uint32_t blockSize, uint64_t size );
+	bool flush();
+	bool load( uint64_t offset, uint64_t length );
+	void punch( uint64_t offset, uint64_t length );
+	bool read( uint64_t offset, void * buffer, uint64_t length );
+	CacheStatistics statistics();
+	bool submit( vector<IORequest> & requests, bool demand = true );
+	bool write( uint64_t offset, const void * data, uint64_t length );
+	bool zero( uint64_t offset, uint64_t length );
+
+};
+
+typedef struct PoolTask {
+
+	function<void()> work;
+	uint32_t * remaining;
+
+} PoolTask;
+
+/**
+ * I/O Pool
+ * Description: Fixed set of threads that carry out the chunks of large
+ *				transfers. Every caller counts its chunks in a counter of its
+ *				own and waits on that, so several transfers can share the
+ *				pool at once. With no threads chunks run on the caller.
+ *				Chunks must never wait on the pool themselves.
+ */
+class IOPool {
+
+private:
+
+	// Everything below is guarded by lock
+	mutex lock;
+	condition_variable ready,
+					   finished;
+	deque<PoolTask> tasks;
+	vector<thread> workers;
+	bool stopping;
+
+	void work();
+
+public:
+
+	IOPool();
+	~IOPool();
+
+	void resize( uint32_t count );
+	void run( const function<void()> & work, uint32_t & remaining );
+	uint32_t size();
+	void wait( uint32_t & remaining );
+
+};
+
+typedef struct DirectoryCursor {
+
+	uint32_t cluster;
+	uint32_t offset;
+	vector<uint8_t> buffer;
+	uint8_t longEntries[ LONG_ENTRY_MAX * DIR_ENTRY_SIZE ];
+	uint32_t longEntryCount;
+	ShortDirectoryEntry shortEntry;
+
+	// Set when a cluster of the directory couldn't be read
+	bool failed;
+
+} DirectoryCursor;
+
+// A working directory, used by one thread at a time
+struct SessionState {
+
+	vector<string> path;
+	uint32_t directoryCluster;
+	DirectoryListing listing;
+
+	// Tree version the listing was read at
+	uint64_t version;
+
+	// Cleared when the listing couldn't be read, lookups in it fail until
+	// rereading it works
+	bool readable;
+
+};
+
+typedef struct Extent {
+
+	uint32_t start;
+	uint32_t length;
+
+} Extent;
+
+typedef struct OpenFile {
+
+	bool inUse;
+	uint8_t mode;
+	ShortDirectoryEntry shortEntry;
+	vector<Extent> extents;
+	uint32_t position;
+
+	// Write-behind state of buffered handles, pages are keyed by cluster index
+	map< uint32_t, vector<uint8_t> > dirtyPages;
+	uint32_t bufferedSize;
+	time_t dirtySince;
+
+	// Free clusters set aside so the flush is sure to have room
+	uint32_t promisedClusters;
+
+	// Readahead state, only queued prefetches of the current pool generation count
+	uint64_t lastReadEnd;
+	uint64_t readaheadEnd;
+	uint32_t readaheadWindow;
+	uint32_t readaheadGeneration;
+
+} OpenFile;
+
+typedef struct ReadChunk {
+
+	// Byte range of the file this chunk covers
+	uint64_t start;
+	uint64_t end;
+
+	vector<IORequest> requests;
+	vector<uint8_t> data;
+	uint32_t remaining;
+
+} ReadChunk;
+
+typedef struct PrefetchRequest {
+
+	uint32_t generation;
+	uint32_t start;
+	uint32_t length;
+
+} PrefetchRequest;
+
+typedef struct DefragProgress {
+
+	uint32_t budget;
+	DefragReport & report;
+
+	// Cleared when a directory couldn't be read or a moved chain's links
+	// didn't all reach the image
+	bool complete;
+
+	// Every cluster of a moved directory's old chain, to the one that took
+	// its place
+	map<uint32_t, uint32_t> moved;
+
+} DefragProgress;
+
+typedef struct CheckDirectory {
+
+	uint32_t cluster;
+	uint32_t parentCluster;
+	string path;
+
+} CheckDirectory;
+
+// Directories waiting for a worker of a parallel walk
+typedef struct DirectoryQueue {
+
+	// Everything below is guarded by lock
+	mutex lock;
+	condition_variable ready;
+	deque<CheckDirectory> pending;
+	uint32_t activeWorkers;
+
+} DirectoryQueue;
+
+// What a walk does with each directory, queueing subdirectories as it goes
+typedef function<void( const CheckDirectory & directory, DirectoryQueue & queue )> DirectoryVisitor;
+
+typedef struct CheckState {
+
+	// Chain id owning each cluster, 0 when unclaimed
+	atomic<uint32_t> * owners;
+	atomic<uint32_t> nextChainId;
+
+	// Everything below is guarded by lock
+	mutex lock;
+	vector<CheckProblem> problems;
+	vector<uint32_t> terminate;
+	vector<ShortDirectoryEntry> sizeFixes;
+	vector< pair<uint32_t, uint32_t> > dotdotFixes;
+
+	// Set when a directory couldn't be read, nothing gets repaired then
+	bool failed;
+
+} CheckState;
+
+typedef struct WalkState {
+
+	// Glob names are matched against and where matches go, empty when
+	// only totalling
+	string pattern;
+	FindOutput output;
+
+	// Everything below is guarded by lock
+	mutex lock;
+	set<uint32_t> visited;
+	uint64_t bytes;
+	uint64_t allocatedBytes;
+	uint32_t files;
+	uint32_t directories;
+
+	// Set when a directory couldn't be read
+	bool failed;
+
+} WalkState;
+
+typedef struct DeleteJob {
+
+	uint32_t id;
+	string name;
+	bool safe;
+	bool trim;
+	bool cancelled;
+
+	// Clusters not yet reclaimed, taken off the front a slice at a time
+	deque<Extent> extents;
+	uint32_t totalClusters;
+	uint32_t reclaimedClusters;
+
+} DeleteJob;
+
+/**
+ * Volume
+ * Description: Everything behind the FAT32 front, the mounted image along
+ *				with its caches, helper threads and open file table. Calls
+ *				that take a session use the commands' own one when it's NULL.
+ */
+class Volume {
+
+private:
+
+	BIOSParameterBlock bpb;
+	FSInfo fsInfo;
+	uint32_t bytesPerCluster,
+			 firstDataSector,
+			 fatLocation,
+			 countOfClusters,
+			 * fat;
+
+	// Private mapping of the image the FAT lives in, NULL when it was read
+	// in whole instead
+	void * fatMapping;
+	size_t fatMappingLength;
+
+	// Set when the image refused part of the FAT, it all goes out again
+	// with the next write of any of it. Guarded by fatLock
+	bool fatStale;
+
+	fstream & fatImage;
+	int imageDescriptor;
+	bool trimOnDelete;
+	vector<OpenFile> openFileTable;
+
+	// Working directory of the commands
+	SessionState console;
+
+	// Sessions started through the library, so they can follow a directory
+	// defrag moves. Guarded by sessionLock
+	vector< weak_ptr<SessionState> > sessions;
+	mutex sessionLock;
+
+	// Lookups, listings and library reads share the tree, everything that
+	// changes it holds it alone and bumps treeVersion once it really does.
+	// A writer waiting at treeGate holds back new readers so it can't be
+	// starved. One lock covers every directory rather than one each: the
+	// FAT, free count and open file table any change touches are shared by
+	// all of them, and rm -r, defrag and check span many at once
+	mutable shared_mutex treeLock;
+	mutable mutex treeGate;
+	uint64_t treeVersion;
+
+	// Session holding the tree alone, it keeps its own listing current
+	// through the changes it makes
+	SessionState * changingSession;
+
+	// Guards handles' positions and readahead state between readers
+	// sharing the tree
+	mutex handleLock;
+
+	// Mount-acceleration cache, disabled when sidecarPath is empty
+	string sidecarPath;
+	map<uint32_t, DirectoryListing> directoryIndex;
+	mutex indexLock;
+
+	// What the sidecar on disk was written with, it's only written again
+	// once the tree or free count moves on from the mount. sidecarLoaded is
+	// clear when there was no matching one
+	bool sidecarLoaded;
+	uint32_t sidecarGeneration;
+	uint32_t mountFreeCount;
+
+	// Every read and write of the image goes through here
+	mutable BlockCache cache;
+
+	// Runs the chunks of large reads, copies and wipes
+	mutable IOPool pool;
+
+	// Readahead requests for the cache, everything below is guarded by
+	// prefetchLock
+	mutex prefetchLock;
+	condition_variable prefetchReady;
+	deque<PrefetchRequest> prefetchQueue;
+	uint32_t prefetchGeneration;
+	thread prefetchThread;
+
+	// Ages out buffered writes nobody adds to, bufferFile only checks their
+	// age on the way in. Wakes on flushReady under flushLock
+	mutex flushLock;
+	condition_variable flushReady;
+	thread flushThread;
+
+	// Guards the in-memory FAT and FSInfo against the reclaim worker
+	mutable mutex fatLock;
+
+	// Free clusters buffered handles were promised, nothing else may take
+	// them. Guarded by fatLock
+	uint32_t promisedClusters;
+
+	// Background deletes, everything below is guarded by jobLock
+	mutex jobLock;
+	condition_variable jobReady,
+					   jobsDone;
+	deque<DeleteJob> deleteJobs;
+	thread reclaimThread;
+	uint32_t nextJobId;
+	bool stopping;
+	
+	Status addFiles( SessionState & session, vector<DirectoryEntry> & entries, vector<uint32_t> & indices, uint32_t reserved );
+	uint32_t allocateCluster( uint32_t hint );
+	Status appendFile( SessionState & session, uint32_t handle, const string & data );
+	bool appendLongName( uint16_t * units, uint32_t & unitCount, const uint8_t * entry ) const;
+	void appendUTF8( string & current, const uint16_t * units, uint32_t unitCount ) const;
+	inline uint32_t availableClusters() const;
+	inline uint32_t calculateDirectoryEntryLocation( uint32_t byte, const vector<uint32_t> & clusterChain ) const;
+	Status bufferFile( SessionState & session, uint32_t handle, uint32_t startPos, const string & data );
+	void buildExtents( const vector<uint32_t> & clusterChain, vector<Extent> & extents ) const;
+	inline uint8_t calculateChecksum( const uint8_t * shortName ) const;
+	uint64_t checksumBootSectors( const BIOSParameterBlock & bpb, const FSInfo & fsInfo ) const;
+	bool checkChain( uint32_t firstCluster, const string & path, CheckState & state, vector<uint32_t> & clusterChain ) const;
+	void checkDirectory( const CheckDirectory & directory, DirectoryQueue & queue, CheckState & state ) const;
+	uint32_t chainLength( uint32_t firstCluster ) const;
+	void chainRequests( const vector<uint32_t> & clusterChain, uint8_t * buffer, bool write, vector<IORequest> & requests ) const;
+	void convertLongNameSegment( uint16_t * nameInStruct, uint8_t length, uint8_t & charLeft, bool & nullStored, const string & name ) const;
+	const string convertShortName( uint8_t * name ) const;
+	void copyClusters( uint32_t from, uint32_t to, uint32_t count, bool & copied );
+	uint32_t countExtents( const vector<uint32_t> & clusterChain ) const;
+	Status createEntries( SessionState & session, const vector<string> & names, bool directory, vector<Status> & results );
+	const string decodeLongName( const uint8_t * longEntries, uint32_t count ) const;
+	void defragEntry( ShortDirectoryEntry entry, const string & path, DefragProgress & progress );
+	void directoryWorker( DirectoryQueue & queue, const DirectoryVisitor & visit ) const;
+	void dropPrefetched();
+	void expandExtents( const vector<Extent> & extents, vector<uint32_t> & clusterChain ) const;
+	void findFreeRuns( uint32_t count, uint32_t hint, vector<uint32_t> & runs ) const;
+	Status flushFile( SessionState & session, uint32_t handle );
+	Status flushFiles( SessionState & session );
+	Status flushOpenFile( const string & fileName, SessionState & session );
+	void flushWorker();
+	void freeChain( uint32_t firstCluster, vector<uint32_t> & freed );
+	inline uint32_t formCluster( const ShortDirectoryEntry & entry ) const;
+	const string entryName( const DirectoryCursor & cursor ) const;
+	const string generateBasisName( const string & longName, bool & lossyConversion ) const;
+	string generateNumericTail( string basisName, const set<string> & shortNames ) const;
+	uint8_t * getChainContents( const vector<uint32_t> & clusterChain ) const;
+	void getClusterChain( uint32_t initialCluster, vector<uint32_t> & clusterChain ) const;
+	bool getDirectoryListing( uint32_t cluster, DirectoryListing & listing ) const;
+	bool getIndexedDirectoryListing( uint32_t cluster, DirectoryListing & listing );
+	inline uint32_t getFATEntry( uint32_t n ) const;
+	uint8_t * getFileContents( uint32_t initialCluster, vector<uint32_t> & clusterChain ) const;
+	inline uint32_t getFirstDataSectorOfCluster( uint32_t n ) const;
+	inline bool isDirectory( const ShortDirectoryEntry & entry ) const;
+	inline bool isFile( const ShortDirectoryEntry & entry ) const;
+	inline bool isFreeCluster( uint32_t value ) const;
+	inline bool isValidEntryName( const string & entryName ) const;
+	bool loadSidecar();
+	void loadOpenFile( OpenFile & file, const ShortDirectoryEntry & shortEntry ) const;
+	Status locateDirectory( const SessionState & session, const string & directoryName, uint32_t & index ) const;
+	Status locateEntry( const SessionState & session, const string & entryName, uint32_t & index ) const;
+	Status locateFile( const SessionState & session, const string & fileName, uint32_t & index ) const;
+	Status locateOpenFile( const SessionState & session, const string & fileName, uint32_t & handle ) const;
+	unique_lock<shared_mutex> lockTree( SessionState & session );
+	Status makeFile( const SessionState & session, const string & fileName, DirectoryEntry & entry, bool directory, const set<string> & shortNames ) const;
+	bool nextDirectoryEntry( DirectoryCursor & cursor ) const;
+	void openDirectory( uint32_t cluster, DirectoryCursor & cursor ) const;
+	DirectoryListing parseDirectoryContents( const uint8_t * contents, const vector<uint32_t> & clusterChain ) const;
+	void prefetchWorker();
+	void punchExtent( uint32_t firstCluster, uint32_t count ) const;
+	void queueDirectory( DirectoryQueue & queue, const CheckDirectory & directory ) const;
+	void queueReadahead( OpenFile & file, uint64_t from, uint64_t to );
+	void reclaimWorker();
+	bool readClusters( const vector<uint32_t> & clusterChain, uint8_t * contents ) const;
+	Status readFile( shared_lock<shared_mutex> & reader, uint32_t handle, uint32_t startPos, uint32_t numBytes, const ReadOutput & output );
+	void refreshOpenFiles();
+	void refreshSession( SessionState & session );
+	void relocateDirectories( const map<uint32_t, uint32_t> & moved );
+	bool releaseEntry( SessionState & session, uint32_t index, bool safe );
+	void releasePromise( OpenFile & file );
+	bool removeEntry( SessionState & session, uint32_t index, bool safe );
+	Status resolvePath( const SessionState & session, const string & path, uint32_t & cluster, string & display ) const;
+	bool resize( uint32_t amount, vector<uint32_t> & clusterChain, uint32_t hint = 0 );
+	void saveSidecar();
+	inline void setClusterValue( uint32_t n, uint32_t newValue );
+	bool setDotEntryCluster( uint32_t directoryCluster, uint32_t slot, uint32_t cluster );
+	Status shareOpenFile( shared_lock<shared_mutex> & reader, const string & fileName, uint32_t & handle, SessionState & active );
+	shared_lock<shared_mutex> shareTree() const;
+	inline bool shortNameExists( string name, const set<string> & shortNames ) const;
+	bool storeFAT( uint32_t first, uint32_t last );
+	void treeChanged();
+	void waitForDeletes();
+	uint32_t walkDirectories( const CheckDirectory & root, const DirectoryVisitor & visit ) const;
+	void walkDirectory( const CheckDirectory & directory, DirectoryQueue & queue, WalkState & state ) const;
+	void walkTree( uint32_t cluster, const string & path, WalkState & state ) const;
+	bool writeChainBytes( const vector<uint32_t> & clusterChain, uint32_t offset, const uint8_t * data, uint32_t length );
+	bool writeDirectoryEntry( SessionState & session, const ShortDirectoryEntry & shortEntry );
+	bool writeFAT();
+	bool writeFAT( uint32_t first, uint32_t last );
+	Status writeFile( SessionState & session, uint32_t handle, uint32_t startPos, const string & data );
+	bool writeFileContents( const uint8_t * contents, const vector<uint32_t> & clusterChain );
+	void zeroExtent( uint32_t firstCluster, uint32_t count, bool & zeroed ) const;
+	bool zeroExtents( const vector<Extent> & extents ) const;
+	bool zeroOutFileContents( uint32_t initialCluster ) const;
+
+public:
+
+	Volume( fstream & fatImage, const string & imagePath, const string & sidecarPath );
+	~Volume();
+
+	SessionState & sessionOf( SessionState * session );
+	const string getCurrentPath( const SessionState * session ) const;
+
+	void startSession( SessionState & session );
+	void trackSession( const shared_ptr<SessionState> & session );
+	Status changeDirectory( const string & directoryName, SessionState & session );
+	Status stat( const string & entryName, EntryInfo & info, SessionState & session );
+	Status list( const string & directoryName, vector<EntryInfo> & entries, SessionState & session );
+	Status fileSize( const string & fileName, uint32_t & bytes, SessionState & session );
+	Status openFile( const string & fileName, uint8_t mode, uint32_t & handle, SessionState & session );
+	Status closeFile( const string & fileName, SessionState & session );
+	Status readInto( const string & fileName, uint32_t startPos, uint8_t * buffer, uint32_t length, uint32_t & bytesRead, SessionState & session );
+
+	void fsinfo( FileSystemInfo & info ) const;
+	Status create( const vector<string> & fileNames, vector<Status> & results, SessionState & session );
+	Status read( const string & fileName, uint32_t startPos, uint32_t numBytes, const ReadOutput & output, SessionState & session );
+	Status read( const string & fileName, uint32_t numBytes, const ReadOutput & output, SessionState & session );
+	Status write( const string & fileName, uint32_t startPos, const string & data, SessionState & session );
+	Status write( const string & fileName, const string & data, SessionState & session );
+	Status append( const string & fileName, const string & data, SessionState & session );
+	Status rm( const string & fileName, bool safe, SessionState & session );
+	Status mkdir( const vector<string> & directoryNames, vector<Status> & results, SessionState & session );
+	Status rmdir( const string & directoryName, SessionState & session );
+	Status rmTree( const string & directoryName, SessionState & session );
+	Status du( const string & path, UsageTotals & totals, SessionState & session );
+	Status find( const string & path, const string & pattern, const FindOutput & output, SessionState & session );
+	Status prealloc( const string & fileName, uint32_t numBytes, bool keepSize, Reservation & reservation, SessionState & session );
+	Status defrag( const string & entryName, uint32_t budget, DefragReport & report, SessionState & session );
+	Status check( bool repair, CheckReport & report );
+	Status sync();
+	void trim( bool enable );
+	void jobs( vector<JobInfo> & jobs );
+	Status cancel( uint32_t id, JobInfo & job );
+	Status workers( uint32_t count );
+
+};
+
+}